@@ -0,0 +1,339 @@
+#include "aot.hpp"
+#include <cstdio>
+#include "opcodes.hpp"
+
+/* Programs linked into the process. Generated sources register theirs during static
+   initialization, the list lives in a function so it exists before the first of them. */
+static std::vector<const StaticProgram *> &Programs()
+{
+  static std::vector<const StaticProgram *> programs;
+
+  return programs;
+}
+
+bool StaticProgram::Register(const StaticProgram &program)
+{
+  Programs().push_back(&program);
+
+  return true;
+}
+
+const StaticProgram *StaticProgram::Find(const Rom &rom)
+{
+  if (Programs().empty() || rom.GetMapper() != 0)
+    return nullptr;
+
+  u64 hash = HashPrg(rom);
+
+  for (const StaticProgram *program : Programs())
+  {
+    if (program->prgSize == rom.GetPrgRomSize() && program->prgHash == hash)
+      return program;
+  }
+
+  return nullptr;
+}
+
+// FNV-1a, enough to tell ROMs apart
+u64 StaticProgram::HashPrg(const Rom &rom)
+{
+  const u8 *prg  = rom.GetPrgRom();
+  u64       hash = 0xCBF29CE484222325ULL;
+
+  for (u32 i = 0; i < rom.GetPrgRomSize(); ++i)
+    hash = (hash ^ prg[i]) * 0x100000001B3ULL;
+
+  return hash;
+}
+
+StaticRecompiler::StaticRecompiler()
+{
+  instructions = 0;
+}
+
+const std::string &StaticRecompiler::GetError() const
+{
+  return error;
+}
+
+u32 StaticRecompiler::GetRoutineCount() const
+{
+  return (u32)routines.size();
+}
+
+u32 StaticRecompiler::GetInstructionCount() const
+{
+  return instructions;
+}
+
+bool StaticRecompiler::Fail(const std::string &message)
+{
+  error = message;
+
+  return false;
+}
+
+bool StaticRecompiler::Recompile(const std::string &romFile, const std::string &sourceFile, const std::vector<u16> &entries)
+{
+  std::shared_ptr<Rom> rom = std::make_shared<Rom>();
+
+  routines.clear();
+  instructions = 0;
+
+  if (!rom->Load(romFile))
+    return Fail(rom->GetError());
+
+  if (rom->GetMapper() != 0)
+    return Fail("mapper " + std::to_string(rom->GetMapper()) + " switches banks, only NROM can be translated");
+
+  cpu.reset(new Cpu());
+  cpu->LoadRom(rom);
+
+  std::vector<u16> pending = entries;
+
+  // NMI, reset and IRQ/BRK, low byte first
+  for (u16 vector = 0xFFFA; vector != 0; vector += 2)
+    pending.push_back(cpu->ReadMemory(vector) | (cpu->ReadMemory(vector + 1) << 8));
+
+  while (!pending.empty())
+  {
+    u16 entry = pending.back();
+
+    pending.pop_back();
+
+    if (!Translatable(entry) || routines.count(entry))
+      continue;
+
+    Routine &routine = routines[entry];
+
+    routine.entry = entry;
+
+    Explore(routine, pending);
+    FindBlocks(routine);
+
+    instructions += (u32)routine.code.size();
+  }
+
+  if (routines.empty())
+    return Fail("no vector or entry point leads into PRG ROM");
+
+  std::string name = romFile.substr(romFile.find_last_of("/\\") + 1);
+
+  return Write(sourceFile, name.substr(0, name.find('.')), *rom);
+}
+
+// Only PRG ROM is translated, RAM can be rewritten at any time
+bool StaticRecompiler::Translatable(u16 PC) const
+{
+  return PC >= 0x8000 && PC + opcodeInfo[cpu->ReadMemory(PC)].bytes <= 0x10000;
+}
+
+// Operand as the handlers take it: the value, an address, a pointer or the branch target
+static u16 Operand(const Cpu &cpu, u16 PC, const OpInfo &info)
+{
+  switch (info.bytes)
+  {
+    case 1:  return 0;
+    case 2:  return info.mode == AddressingMode::Relative ? PC + 2 + (s8)cpu.ReadMemory(PC + 1) : cpu.ReadMemory(PC + 1);
+    default: return cpu.ReadMemory(PC + 1) | (cpu.ReadMemory(PC + 2) << 8);
+  }
+}
+
+// The path not taken and the target of every branch, JMP targets and the return site of every
+// JSR belong to the routine. JSR targets are queued as routines of their own.
+void StaticRecompiler::Explore(Routine &routine, std::vector<u16> &callees)
+{
+  std::vector<u16> pending = { routine.entry };
+
+  while (!pending.empty())
+  {
+    u16 PC = pending.back();
+
+    pending.pop_back();
+
+    if (!Translatable(PC) || !routine.code.insert(PC).second)
+      continue;
+
+    const OpInfo &info    = opcodeInfo[cpu->ReadMemory(PC)];
+    u16           next    = PC + info.bytes;
+    u16           operand = Operand(*cpu, PC, info);
+
+    switch (info.operation)
+    {
+      case Operation::JMP:
+        if (info.mode == AddressingMode::Absolute)
+          pending.push_back(operand);
+        break;
+
+      case Operation::JSR:
+        callees.push_back(operand);
+        pending.push_back(next);
+        break;
+
+      case Operation::RTS:
+      case Operation::RTI:
+      case Operation::BRK:
+      case Operation::JAM:
+        break;
+
+      default:
+        if (info.mode == AddressingMode::Relative)
+          pending.push_back(operand);
+
+        pending.push_back(next);
+        break;
+    }
+  }
+}
+
+// Does the instruction go on with the one after it?
+static bool FallsThrough(const OpInfo &info)
+{
+  return info.operation != Operation::JMP && info.operation != Operation::JSR &&
+         info.operation != Operation::RTS && info.operation != Operation::RTI &&
+         info.operation != Operation::BRK && info.operation != Operation::JAM;
+}
+
+// A block starts at the entry, at jump and branch targets, after branches and JSR, and where
+// the next instruction in address order isn't the one execution goes on with.
+void StaticRecompiler::FindBlocks(Routine &routine) const
+{
+  routine.heads.insert(routine.entry);
+
+  for (auto it = routine.code.begin(); it != routine.code.end(); ++it)
+  {
+    u16           PC      = *it;
+    const OpInfo &info    = opcodeInfo[cpu->ReadMemory(PC)];
+    u16           next    = PC + info.bytes;
+    u16           operand = Operand(*cpu, PC, info);
+    auto          after   = std::next(it);
+
+    if (info.mode == AddressingMode::Relative || (info.operation == Operation::JMP && info.mode == AddressingMode::Absolute))
+    {
+      if (routine.code.count(operand))
+        routine.heads.insert(operand);
+    }
+
+    bool sequential = after != routine.code.end() && *after == next;
+
+    if ((info.mode == AddressingMode::Relative || info.operation == Operation::JSR || (FallsThrough(info) && !sequential)) &&
+        routine.code.count(next))
+      routine.heads.insert(next);
+  }
+}
+
+bool StaticRecompiler::Write(const std::string &sourceFile, const std::string &name, const Rom &rom)
+{
+  FILE *file = fopen(sourceFile.c_str(), "w");
+
+  if (!file)
+    return Fail("can't write " + sourceFile);
+
+  fprintf(file, "// Generated by 6502Aot from %s: %u routines, %u instructions. Do not edit.\n",
+          name.c_str(), GetRoutineCount(), instructions);
+  fprintf(file, "#include \"aot.hpp\"\n");
+  fprintf(file, "#include \"execute.hpp\"\n\n");
+  fprintf(file, "namespace\n{\n");
+  fprintf(file, "  typedef StaticCode::Registers Registers;\n\n");
+  fprintf(file, "  template<u8 opcode>\n");
+  fprintf(file, "  FORCEINLINE void Execute(Cpu &cpu, Registers &r, u16 operand)\n");
+  fprintf(file, "  {\n    StaticCode::Execute<opcode>(cpu, r, operand);\n  }\n");
+
+  std::map<u16, u16> owners; // Block start, routine entry. The first routine to have it runs it
+  std::set<u16>      found;  // Routines Find returns, the others are left out
+
+  for (const auto &it : routines)
+  {
+    for (u16 head : it.second.heads)
+    {
+      if (owners.insert({ head, it.first }).second)
+        found.insert(it.first);
+    }
+  }
+
+  for (const auto &it : routines)
+  {
+    const Routine &routine = it.second;
+
+    if (!found.count(routine.entry))
+      continue;
+
+    fprintf(file, "\n  void Routine_%04X(Cpu &cpu, Registers &regs, const s64 &cycleLimit)\n  {\n", routine.entry);
+    fprintf(file, "    Registers r = regs;\n\n");
+    fprintf(file, "    switch (r.PC)\n    {\n");
+
+    for (u16 head : routine.heads)
+      fprintf(file, "      case 0x%04X: goto L_%04X;\n", head, head);
+
+    fprintf(file, "      default:     goto out;\n    }\n");
+
+    for (auto op = routine.code.begin(); op != routine.code.end(); ++op)
+    {
+      u16           PC      = *op;
+      u8            opcode  = cpu->ReadMemory(PC);
+      const OpInfo &info    = opcodeInfo[opcode];
+      u16           next    = PC + info.bytes;
+      u16           operand = Operand(*cpu, PC, info);
+      auto          after   = std::next(op);
+
+      // Blocks that can't reach cycleLimit, with every page crossing and branch penalty,
+      // run without checking it again, the same test RunBlocks makes
+      if (routine.heads.count(PC))
+      {
+        u32 maxCycles = 0;
+
+        for (auto block = op; block != routine.code.end(); ++block)
+        {
+          const OpInfo &blockInfo = opcodeInfo[cpu->ReadMemory(*block)];
+          auto          blockNext = std::next(block);
+
+          maxCycles += blockInfo.cycles + blockInfo.pageCycles + (blockInfo.mode == AddressingMode::Relative ? 2 : 0);
+
+          if (!FallsThrough(blockInfo) || blockInfo.mode == AddressingMode::Relative || blockNext == routine.code.end() ||
+              *blockNext != *block + blockInfo.bytes || routine.heads.count(*blockNext))
+            break;
+        }
+
+        fprintf(file, "\n  L_%04X:\n", PC);
+        fprintf(file, "    if (r.cycleCount + %u >= cycleLimit) goto out;\n", maxCycles);
+      }
+
+      fprintf(file, "    Execute<0x%02X>(cpu, r, 0x%04X); // %04X %s\n", opcode, operand, PC, info.mnemonic);
+
+      if (info.mode == AddressingMode::Relative)
+      {
+        if (routine.code.count(operand))
+          fprintf(file, "    if (r.PC == 0x%04X) goto L_%04X;\n", operand, operand);
+        else
+          fprintf(file, "    if (r.PC == 0x%04X) goto out;\n", operand);
+      }
+
+      if (info.operation == Operation::JMP && info.mode == AddressingMode::Absolute && routine.code.count(operand))
+        fprintf(file, "    goto L_%04X;\n", operand);
+      else if (!FallsThrough(info) || !routine.code.count(next))
+        fprintf(file, "    goto out;\n");
+      else if (after == routine.code.end() || *after != next)
+        fprintf(file, "    goto L_%04X;\n", next);
+    }
+
+    fprintf(file, "\n  out:\n    regs = r;\n  }\n");
+  }
+
+  fprintf(file, "\n  StaticCode::Routine Find(u16 PC)\n  {\n    switch (PC)\n    {\n");
+
+  for (const auto &owner : owners)
+    fprintf(file, "      case 0x%04X: return &Routine_%04X;\n", owner.first, owner.second);
+
+  fprintf(file, "    }\n\n    return nullptr;\n  }\n\n");
+  fprintf(file, "  const StaticProgram program    = { \"%s\", 0x%X, 0x%016llXULL, &Find };\n",
+          name.c_str(), rom.GetPrgRomSize(), (unsigned long long)StaticProgram::HashPrg(rom));
+  fprintf(file, "  const bool          registered = StaticProgram::Register(program);\n");
+  fprintf(file, "}\n");
+
+  bool written = !ferror(file);
+
+  if (fclose(file) != 0 || !written)
+    return Fail("can't write " + sourceFile);
+
+  return true;
+}
@@ -0,0 +1,84 @@
+#ifndef __AOT_H__
+#define __AOT_H__
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "cpu.hpp"
+#include "rom.hpp"
+#include "types.hpp"
+
+/* Ahead of time recompilation. StaticRecompiler disassembles a ROM offline, recursively from
+   its vectors, and writes every routine it finds as a C++ function. The generated source is
+   built with the runner and registers a StaticProgram, which Cpu picks up when it loads a ROM
+   with the same PRG and runs under Dispatch::Static. */
+
+// What generated routines see of Cpu, they run its own instruction handlers
+class StaticCode {
+public:
+  typedef Cpu::Registers Registers;
+
+  // Runs from the block at regs.PC until the code leaves the routine or the next block could
+  // reach cycleLimit. Returns with regs.PC at the first instruction it didn't run. The limit
+  // is read at every block, bus handlers can lower it to stop the routine early.
+  typedef void (*Routine)(Cpu &cpu, Registers &regs, const s64 &cycleLimit);
+
+  template<u8 opcode>
+  static FORCEINLINE void Execute(Cpu &cpu, Registers &r, u16 operand)
+  {
+    cpu.Execute<opcode>(r, operand);
+  }
+};
+
+// A recompiled ROM, defined and registered by its generated translation unit
+struct StaticProgram {
+  const char          *name;
+  u32                  prgSize;
+  u64                  prgHash;
+  StaticCode::Routine (*find)(u16 PC); // Routine with a block at PC, null when there is none
+
+  static bool                 Register(const StaticProgram &program);
+  static const StaticProgram *Find    (const Rom &rom); // Null when no program matches its PRG
+  static u64                  HashPrg (const Rom &rom);
+};
+
+/* Offline translator. Only NROM is translated, its PRG never moves. Code is followed through
+   branches, JMP and JSR from the NMI, reset and IRQ vectors plus any extra entry point, and
+   every JSR target becomes a routine of its own. JMP (ind), RTS, RTI and BRK leave the routine,
+   Cpu looks the next PC up again and interprets whatever no routine covers. */
+class StaticRecompiler {
+public:
+  StaticRecompiler();
+
+  // Returns false and sets GetError() when romFile can't be translated or written out
+  bool Recompile(const std::string &romFile, const std::string &sourceFile, const std::vector<u16> &entries);
+
+  const std::string &GetError() const;
+
+  u32 GetRoutineCount    () const;
+  u32 GetInstructionCount() const;
+
+private:
+  struct Routine {
+    u16           entry;
+    std::set<u16> code;  // Instructions, by address
+    std::set<u16> heads; // Instructions that start a block, the only ones with a label
+  };
+
+  std::unique_ptr<Cpu> cpu; // Reads the ROM the way the interpreter sees it
+  std::map<u16, Routine> routines;
+  u32                    instructions;
+  std::string            error;
+
+  bool Translatable      (u16 PC) const;
+  void Explore           (Routine &routine, std::vector<u16> &callees);
+  void FindBlocks        (Routine &routine) const;
+  bool Write             (const std::string &sourceFile, const std::string &name, const Rom &rom);
+  bool Fail              (const std::string &message);
+};
+
+#endif //__AOT_H__
@@ -0,0 +1,33 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "aot.hpp"
+
+// Usage: 6502Aot <rom> <output.cpp> [entry...]
+// Entry points are hex addresses translated along with the ones the vectors lead to.
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    printf("Usage: 6502Aot <rom> <output.cpp> [entry...]\n");
+    return 1;
+  }
+
+  std::vector<u16> entries;
+
+  for (int arg = 3; arg < argc; ++arg)
+    entries.push_back((u16)strtoul(argv[arg], nullptr, 16));
+
+  StaticRecompiler recompiler;
+
+  if (!recompiler.Recompile(argv[1], argv[2], entries))
+  {
+    printf("Can't recompile %s: %s\n", argv[1], recompiler.GetError().c_str());
+    return 1;
+  }
+
+  printf("%s: %u routines, %u instructions\n", argv[2], recompiler.GetRoutineCount(), recompiler.GetInstructionCount());
+
+  return 0;
+}
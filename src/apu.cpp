@@ -0,0 +1,823 @@
+#include "apu.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+  // Quarter and half frame clocks of the frame counter, in CPU cycles into the sequence
+  const u32 frameSteps  [2][5] = { { 7457, 14913, 22371, 29829, 0 }, { 7457, 14913, 22371, 29829, 37281 } };
+  const u32 frameStepCount[2]  = { 4, 5 };
+  const u32 framePeriods[2]    = { 29830, 37282 };
+
+  const u32 dcShift         = 9;     // High-pass time constant, 512 samples
+  const u32 maxSampleRate   = 192000;
+  const double pi           = 3.14159265358979323846;
+}
+
+/* Band-limited steps */
+s16 BlepBuffer::kernel[BlepBuffer::phases][BlepBuffer::taps];
+
+BlepBuffer::BlepBuffer()
+{
+  static std::once_flag built;
+
+  std::call_once(built, BuildKernel);
+
+  factor = 0;
+
+  Clear();
+}
+
+// Windowed sinc impulses, cut off a little below Nyquist. Row p is the impulse p / phases of a
+// sample late, and every row adds up to exactly 1 << kernelScale so steps settle on their level.
+void BlepBuffer::BuildKernel()
+{
+  const double cutoff = 0.45; // Of the sample rate
+
+  for (u32 phase = 0; phase < phases; ++phase)
+  {
+    double row[taps];
+    double sum = 0;
+
+    for (u32 i = 0; i < taps; ++i)
+    {
+      double distance = i - (taps / 2.0 - 1) - (double)phase / phases;
+      double x        = 2 * cutoff * distance;
+      double sinc     = x == 0 ? 1 : sin(pi * x) / (pi * x);
+      double window   = 0.42 + 0.5 * cos(2 * pi * distance / taps) + 0.08 * cos(4 * pi * distance / taps);
+
+      row[i] = sinc * window;
+      sum   += row[i];
+    }
+
+    s32 total  = 0;
+    u32 center = 0;
+
+    for (u32 i = 0; i < taps; ++i)
+    {
+      kernel[phase][i] = (s16)lround(row[i] / sum * (1 << kernelScale));
+      total           += kernel[phase][i];
+
+      if (kernel[phase][i] > kernel[phase][center])
+        center = i;
+    }
+
+    kernel[phase][center] += (s16)((1 << kernelScale) - total);
+  }
+}
+
+void BlepBuffer::SetRates(u32 clockRate, u32 sampleRate)
+{
+  factor = (u64)(((double)sampleRate / clockRate) * 4294967296.0);
+
+  deltas.assign((size_t)((u64)maxTime * sampleRate / clockRate) + taps + 2, 0);
+
+  Clear();
+}
+
+void BlepBuffer::Clear()
+{
+  std::fill(deltas.begin(), deltas.end(), 0);
+
+  offset     = 0;
+  integrator = 0;
+  dcLevel    = 0;
+}
+
+void BlepBuffer::EndFrame(u32 time, std::vector<s16> &out)
+{
+  u64 end   = offset + time * factor;
+  u32 count = (u32)(end >> 32);
+
+  for (u32 i = 0; i < count; ++i)
+  {
+    integrator += deltas[i];
+
+    s32 sample = integrator >> kernelScale;
+    s32 value  = sample - (dcLevel >> dcShift);
+
+    dcLevel += value;
+
+    out.push_back((s16)(value < -32768 ? -32768 : value > 32767 ? 32767 : value));
+  }
+
+  // The impulses still in flight go to the front
+  memmove(&deltas[0], &deltas[count], taps * sizeof(s32));
+  memset(&deltas[taps], 0, count * sizeof(s32));
+
+  offset = end & 0xFFFFFFFF;
+}
+
+/* Tables, NTSC */
+const u8 Apu::lengths[32] = {
+  10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+  12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+const u8 Apu::duties[4][8] = {
+  { 0, 1, 0, 0, 0, 0, 0, 0 }, // 12.5%
+  { 0, 1, 1, 0, 0, 0, 0, 0 }, // 25%
+  { 0, 1, 1, 1, 1, 0, 0, 0 }, // 50%
+  { 1, 0, 0, 1, 1, 1, 1, 1 }  // 25% negated
+};
+
+const u8 Apu::triangleSteps[32] = {
+  15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+const u16 Apu::noisePeriods[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+const u16 Apu::dmcPeriods  [16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+Apu::Apu()
+{
+  output     = nullptr;
+  dmcRead    = nullptr;
+  dmcContext = nullptr;
+  sampleRate = 0;
+
+  SetSampleRate(defaultSampleRate);
+  Reset();
+}
+
+Apu::Apu(const Apu &other)
+{
+  output     = nullptr;
+  dmcRead    = nullptr;
+  dmcContext = nullptr;
+
+  *this = other;
+}
+
+Apu &Apu::operator=(const Apu &other)
+{
+  pulses[0]   = other.pulses[0];
+  pulses[1]   = other.pulses[1];
+  triangle    = other.triangle;
+  noise       = other.noise;
+  dmc         = other.dmc;
+  enabled     = other.enabled;
+  fiveStep    = other.fiveStep;
+  irqInhibit  = other.irqInhibit;
+  frameIrq    = other.frameIrq;
+  dmcIrq      = other.dmcIrq;
+  frameCycle  = other.frameCycle;
+  cycleCount  = other.cycleCount;
+  time        = other.time;
+  blep        = other.blep;
+  sampleCount = other.sampleCount;
+  sampleRate  = other.sampleRate;
+
+  return *this;
+}
+
+void Apu::Reset()
+{
+  memset(pulses   , 0, sizeof(pulses   ));
+  memset(&triangle, 0, sizeof(triangle));
+  memset(&noise   , 0, sizeof(noise   ));
+  memset(&dmc     , 0, sizeof(dmc     ));
+
+  for (Pulse &pulse : pulses)
+    pulse.timer = 2;
+
+  triangle.timer = 1;
+  noise.period   = noisePeriods[0];
+  noise.timer    = noise.period;
+  noise.shift    = 1;
+  dmc.period     = dmcPeriods[0];
+  dmc.timer      = dmc.period;
+  dmc.bits       = 8;
+  dmc.silence    = true;
+
+  enabled    = 0;
+  fiveStep   = false;
+  irqInhibit = false;
+  frameIrq   = false;
+  dmcIrq     = false;
+  frameCycle = 0;
+
+  cycleCount  = 0;
+  time        = 0;
+  sampleCount = 0;
+
+  blep.Clear();
+  samples.clear();
+}
+
+void Apu::Save(Snapshot &snapshot) const
+{
+  snapshot.pulses[0]  = pulses[0];
+  snapshot.pulses[1]  = pulses[1];
+  snapshot.triangle   = triangle;
+  snapshot.noise      = noise;
+  snapshot.dmc        = dmc;
+  snapshot.cycleCount = cycleCount;
+  snapshot.frameCycle = frameCycle;
+  snapshot.enabled    = enabled;
+  snapshot.fiveStep   = fiveStep;
+  snapshot.irqInhibit = irqInhibit;
+  snapshot.frameIrq   = frameIrq;
+  snapshot.dmcIrq     = dmcIrq;
+}
+
+// The output holds the levels of the channels it was given, each one steps to the restored one
+void Apu::Restore(const Snapshot &snapshot)
+{
+  u8 levels[5] = { pulses[0].level, pulses[1].level, triangle.level, noise.level, dmc.level };
+
+  pulses[0]  = snapshot.pulses[0];
+  pulses[1]  = snapshot.pulses[1];
+  triangle   = snapshot.triangle;
+  noise      = snapshot.noise;
+  dmc        = snapshot.dmc;
+  cycleCount = snapshot.cycleCount;
+  frameCycle = snapshot.frameCycle;
+  enabled    = snapshot.enabled;
+  fiveStep   = snapshot.fiveStep;
+  irqInhibit = snapshot.irqInhibit;
+  frameIrq   = snapshot.frameIrq;
+  dmcIrq     = snapshot.dmcIrq;
+
+  u8 restored[5] = { pulses[0].level, pulses[1].level, triangle.level, noise.level, dmc.level };
+
+  pulses[0].level = levels[0];
+  pulses[1].level = levels[1];
+  triangle.level  = levels[2];
+  noise.level     = levels[3];
+  dmc.level       = levels[4];
+
+  SetLevel(pulses[0].level, restored[0], pulseWeight   , time);
+  SetLevel(pulses[1].level, restored[1], pulseWeight   , time);
+  SetLevel(triangle.level , restored[2], triangleWeight, time);
+  SetLevel(noise.level    , restored[3], noiseWeight   , time);
+  SetLevel(dmc.level      , restored[4], dmcWeight     , time);
+}
+
+void Apu::SetSampleRate(u32 newSampleRate)
+{
+  sampleRate = newSampleRate < maxSampleRate ? newSampleRate : maxSampleRate;
+
+  blep.SetRates(clockRate, sampleRate);
+  time = 0;
+}
+
+void Apu::SetOutput(SampleBuffer *buffer)
+{
+  output = buffer;
+}
+
+void Apu::SetDmcReader(Bus::ReadHandler read, void *context)
+{
+  dmcRead    = read;
+  dmcContext = context;
+}
+
+bool Apu::GetIrq() const
+{
+  return frameIrq || dmcIrq;
+}
+
+u32 Apu::GetCyclesToFrameIrq() const
+{
+  if (fiveStep || irqInhibit || frameIrq)
+    return 0;
+
+  u32 irqCycle = frameSteps[0][3];
+
+  return frameCycle < irqCycle ? irqCycle - frameCycle : framePeriods[0] - frameCycle + irqCycle;
+}
+
+// The last byte is fetched when the one before it leaves the buffer for the shifter, a byte
+// takes 8 output clocks
+u32 Apu::GetCyclesToDmcIrq() const
+{
+  if (!dmc.irqEnabled || dmc.loop || dmcIrq || dmc.remaining == 0)
+    return 0;
+
+  if (!dmc.bufferFull)
+    return dmc.timer;
+
+  return dmc.timer + (dmc.bits - 1) * dmc.period + (dmc.remaining - 1) * 8 * dmc.period;
+}
+
+u64 Apu::GetCycleCount() const
+{
+  return cycleCount;
+}
+
+u64 Apu::GetSampleCount() const
+{
+  return sampleCount;
+}
+
+u32 Apu::GetSampleRate() const
+{
+  return sampleRate;
+}
+
+/* Timing. Runs from one frame counter clock to the next, the channels step their timers in
+   between, and the samples are flushed at every clock so blep never holds more than maxTime. */
+void Apu::Run(u32 cycles)
+{
+  while (cycles > 0)
+  {
+    u32 next = NextFrameEvent();
+    u32 step = cycles < next ? cycles : next;
+
+    RunChannels(step);
+
+    cycles     -= step;
+    cycleCount += step;
+    frameCycle += step;
+
+    if (step == next)
+    {
+      if (frameCycle >= framePeriods[fiveStep])
+        frameCycle -= framePeriods[fiveStep];
+
+      ClockFrame();
+      Flush();
+    }
+  }
+
+  Flush();
+}
+
+void Apu::Flush()
+{
+  blep.EndFrame(time, samples);
+  time = 0;
+
+  sampleCount += samples.size();
+
+  if (output && !samples.empty())
+    output->Push(samples.data(), (u32)samples.size());
+
+  samples.clear();
+}
+
+/* Frame counter */
+u32 Apu::NextFrameEvent() const
+{
+  const u32 *steps = frameSteps[fiveStep];
+
+  for (u32 i = 0; i < frameStepCount[fiveStep]; ++i)
+  {
+    if (steps[i] > frameCycle)
+      return steps[i] - frameCycle;
+  }
+
+  return framePeriods[fiveStep] - frameCycle + steps[0];
+}
+
+void Apu::ClockFrame()
+{
+  const u32 *steps = frameSteps[fiveStep];
+
+  if (frameCycle == steps[0] || frameCycle == steps[2])
+    ClockQuarter();
+  else
+  {
+    ClockQuarter();
+    ClockHalf();
+
+    // The interrupt comes with the last step of the 4 step sequence
+    if (!fiveStep && !irqInhibit && frameCycle == steps[3])
+      frameIrq = true;
+  }
+
+  UpdateLevels();
+}
+
+void Apu::Envelope::Clock()
+{
+  if (start)
+  {
+    start   = false;
+    decay   = 15;
+    divider = volume;
+  }
+  else if (divider == 0)
+  {
+    divider = volume;
+
+    if (decay)
+      decay--;
+    else if (loop)
+      decay = 15;
+  }
+  else
+    divider--;
+}
+
+u8 Apu::Envelope::Output() const
+{
+  return constant ? volume : decay;
+}
+
+void Apu::ClockQuarter()
+{
+  pulses[0].envelope.Clock();
+  pulses[1].envelope.Clock();
+  noise.envelope.Clock();
+
+  if (triangle.reload)
+    triangle.linear = triangle.linearReload;
+  else if (triangle.linear)
+    triangle.linear--;
+
+  if (!triangle.control)
+    triangle.reload = false;
+}
+
+void Apu::ClockHalf()
+{
+  for (u32 channel = 0; channel < 2; ++channel)
+  {
+    Pulse &pulse = pulses[channel];
+
+    if (pulse.length && !pulse.envelope.loop)
+      pulse.length--;
+
+    ClockSweep(pulse, channel);
+  }
+
+  if (triangle.length && !triangle.control)
+    triangle.length--;
+  if (noise.length && !noise.envelope.loop)
+    noise.length--;
+}
+
+// The first pulse negates with one's complement, the second with two's complement
+u16 Apu::SweepTarget(const Pulse &pulse, u32 channel) const
+{
+  s32 change = pulse.period >> pulse.sweepShift;
+
+  if (!pulse.sweepNegate)
+    return (u16)(pulse.period + change);
+
+  s32 target = pulse.period - change - (channel == 0 ? 1 : 0);
+
+  return (u16)(target < 0 ? 0 : target);
+}
+
+void Apu::ClockSweep(Pulse &pulse, u32 channel)
+{
+  u16 target = SweepTarget(pulse, channel);
+
+  if (pulse.sweepDivider == 0 && pulse.sweepEnabled && pulse.sweepShift && pulse.period >= 8 && target <= 0x7FF)
+    pulse.period = target;
+
+  if (pulse.sweepDivider == 0 || pulse.sweepReload)
+  {
+    pulse.sweepDivider = pulse.sweepPeriod;
+    pulse.sweepReload  = false;
+  }
+  else
+    pulse.sweepDivider--;
+}
+
+/* Channels. Each timer is stepped clock to clock over the cycles, the level changes go to
+   blep at the cycle they happen on. */
+FORCEINLINE void Apu::SetLevel(u8 &level, u8 newLevel, s32 weight, u32 at)
+{
+  if (newLevel == level)
+    return;
+
+  blep.AddDelta(at, (newLevel - level) * weight);
+  level = newLevel;
+}
+
+void Apu::RunChannels(u32 cycles)
+{
+  for (u32 channel = 0; channel < 2; ++channel)
+  {
+    Pulse &pulse  = pulses[channel];
+    u32    reload = (pulse.period + 1) * 2;
+    u32    at     = time;
+    u32    left   = cycles;
+
+    while (pulse.timer <= left)
+    {
+      at         += pulse.timer;
+      left       -= pulse.timer;
+      pulse.timer = reload;
+      pulse.step  = (pulse.step + 1) & 7;
+
+      SetLevel(pulse.level, PulseLevel(pulse, channel), pulseWeight, at);
+    }
+
+    pulse.timer -= left;
+  }
+
+  // The sequencer stops while either counter is 0. Periods under 2 are ultrasonic and held,
+  // the way most emulators avoid the popping they would cause.
+  if (triangle.linear && triangle.length && triangle.period >= 2)
+  {
+    u32 at   = time;
+    u32 left = cycles;
+
+    while (triangle.timer <= left)
+    {
+      at            += triangle.timer;
+      left          -= triangle.timer;
+      triangle.timer = triangle.period + 1;
+      triangle.step  = (triangle.step + 1) & 31;
+
+      SetLevel(triangle.level, TriangleLevel(), triangleWeight, at);
+    }
+
+    triangle.timer -= left;
+  }
+
+  {
+    u32 at   = time;
+    u32 left = cycles;
+
+    while (noise.timer <= left)
+    {
+      at         += noise.timer;
+      left       -= noise.timer;
+      noise.timer = noise.period;
+
+      ClockNoise();
+      SetLevel(noise.level, NoiseLevel(), noiseWeight, at);
+    }
+
+    noise.timer -= left;
+  }
+
+  {
+    u32 at   = time;
+    u32 left = cycles;
+
+    while (dmc.timer <= left)
+    {
+      at       += dmc.timer;
+      left     -= dmc.timer;
+      dmc.timer = dmc.period;
+
+      ClockDmc();
+      SetLevel(dmc.level, dmc.output, dmcWeight, at);
+    }
+
+    dmc.timer -= left;
+  }
+
+  time += cycles;
+}
+
+void Apu::ClockNoise()
+{
+  u16 feedback = (noise.shift ^ (noise.shift >> (noise.mode ? 6 : 1))) & 0x01;
+
+  noise.shift = (noise.shift >> 1) | (feedback << 14);
+}
+
+// Output unit: a bit of the shift register moves the counter by 2, then the next byte is
+// taken from the sample buffer, silence when it's empty
+void Apu::ClockDmc()
+{
+  if (!dmc.silence)
+  {
+    if (dmc.shift & 0x01)
+    {
+      if (dmc.output <= 125)
+        dmc.output += 2;
+    }
+    else if (dmc.output >= 2)
+      dmc.output -= 2;
+  }
+
+  dmc.shift >>= 1;
+
+  if (--dmc.bits != 0)
+    return;
+
+  dmc.bits    = 8;
+  dmc.silence = !dmc.bufferFull;
+
+  if (dmc.bufferFull)
+  {
+    dmc.shift      = dmc.buffer;
+    dmc.bufferFull = false;
+
+    FetchDmc();
+  }
+}
+
+// Memory reader: refills the sample buffer as soon as it's empty. The CPU stall isn't counted.
+void Apu::FetchDmc()
+{
+  if (dmc.bufferFull || dmc.remaining == 0)
+    return;
+
+  dmc.buffer     = dmcRead ? dmcRead(dmcContext, dmc.address) : 0;
+  dmc.bufferFull = true;
+  dmc.address    = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+
+  if (--dmc.remaining != 0)
+    return;
+
+  if (dmc.loop)
+    RestartDmc();
+  else if (dmc.irqEnabled)
+    dmcIrq = true;
+}
+
+void Apu::RestartDmc()
+{
+  dmc.address   = dmc.start;
+  dmc.remaining = dmc.sampleLength;
+}
+
+/* Levels */
+u8 Apu::PulseLevel(const Pulse &pulse, u32 channel) const
+{
+  if (!pulse.length || pulse.period < 8 || SweepTarget(pulse, channel) > 0x7FF || !duties[pulse.duty][pulse.step])
+    return 0;
+
+  return pulse.envelope.Output();
+}
+
+u8 Apu::TriangleLevel() const
+{
+  return triangleSteps[triangle.step];
+}
+
+u8 Apu::NoiseLevel() const
+{
+  if (!noise.length || (noise.shift & 0x01))
+    return 0;
+
+  return noise.envelope.Output();
+}
+
+// After register writes and frame counter clocks, which change levels between timer clocks
+void Apu::UpdateLevels()
+{
+  SetLevel(pulses[0].level, PulseLevel(pulses[0], 0), pulseWeight, time);
+  SetLevel(pulses[1].level, PulseLevel(pulses[1], 1), pulseWeight, time);
+  SetLevel(noise.level    , NoiseLevel()            , noiseWeight, time);
+  SetLevel(dmc.level      , dmc.output              , dmcWeight  , time);
+}
+
+/* Registers */
+u8 Apu::ReadRegister(u16 address)
+{
+  if (address != 0x4015)
+    return address >> 8; // Write only, open bus
+
+  u8 status = (pulses[0].length ? 0x01 : 0) | (pulses[1].length ? 0x02 : 0) | (triangle.length ? 0x04 : 0) |
+              (noise.length     ? 0x08 : 0) | (dmc.remaining    ? 0x10 : 0) |
+              (frameIrq         ? 0x40 : 0) | (dmcIrq           ? 0x80 : 0);
+
+  frameIrq = false;
+
+  return status;
+}
+
+void Apu::WriteRegister(u16 address, u8 value)
+{
+  switch (address)
+  {
+    case 0x4000: case 0x4004: // Duty, length halt, constant volume, volume
+    {
+      Pulse &pulse = pulses[(address >> 2) & 1];
+
+      pulse.duty              = value >> 6;
+      pulse.envelope.loop     = (value & 0x20) != 0;
+      pulse.envelope.constant = (value & 0x10) != 0;
+      pulse.envelope.volume   = value & 0x0F;
+      break;
+    }
+
+    case 0x4001: case 0x4005: // Sweep
+    {
+      Pulse &pulse = pulses[(address >> 2) & 1];
+
+      pulse.sweepEnabled = (value & 0x80) != 0;
+      pulse.sweepPeriod  = (value >> 4) & 0x07;
+      pulse.sweepNegate  = (value & 0x08) != 0;
+      pulse.sweepShift   = value & 0x07;
+      pulse.sweepReload  = true;
+      break;
+    }
+
+    case 0x4002: case 0x4006:
+      pulses[(address >> 2) & 1].period = (pulses[(address >> 2) & 1].period & 0x700) | value;
+      break;
+
+    case 0x4003: case 0x4007: // Length, period high, restarts the sequence and the envelope
+    {
+      u32    channel = (address >> 2) & 1;
+      Pulse &pulse   = pulses[channel];
+
+      pulse.period         = (pulse.period & 0xFF) | ((value & 0x07) << 8);
+      pulse.step           = 0;
+      pulse.envelope.start = true;
+
+      if (enabled & (1 << channel))
+        pulse.length = lengths[value >> 3];
+      break;
+    }
+
+    case 0x4008: // Length halt and linear counter
+      triangle.control      = (value & 0x80) != 0;
+      triangle.linearReload = value & 0x7F;
+      break;
+
+    case 0x400A:
+      triangle.period = (triangle.period & 0x700) | value;
+      break;
+
+    case 0x400B:
+      triangle.period = (triangle.period & 0xFF) | ((value & 0x07) << 8);
+      triangle.reload = true;
+
+      if (enabled & 0x04)
+        triangle.length = lengths[value >> 3];
+      break;
+
+    case 0x400C:
+      noise.envelope.loop     = (value & 0x20) != 0;
+      noise.envelope.constant = (value & 0x10) != 0;
+      noise.envelope.volume   = value & 0x0F;
+      break;
+
+    case 0x400E:
+      noise.mode   = (value & 0x80) != 0;
+      noise.period = noisePeriods[value & 0x0F];
+      break;
+
+    case 0x400F:
+      noise.envelope.start = true;
+
+      if (enabled & 0x08)
+        noise.length = lengths[value >> 3];
+      break;
+
+    case 0x4010: // IRQ enable, loop, rate
+      dmc.irqEnabled = (value & 0x80) != 0;
+      dmc.loop       = (value & 0x40) != 0;
+      dmc.period     = dmcPeriods[value & 0x0F];
+
+      if (!dmc.irqEnabled)
+        dmcIrq = false;
+      break;
+
+    case 0x4011: dmc.output       = value & 0x7F;           break;
+    case 0x4012: dmc.start        = 0xC000 | (value << 6);  break;
+    case 0x4013: dmc.sampleLength = (value << 4) | 0x0001;  break;
+
+    case 0x4015: // Channel enables, disabling clears the length counter
+      enabled = value & 0x1F;
+      dmcIrq  = false;
+
+      if (!(enabled & 0x01)) pulses[0].length = 0;
+      if (!(enabled & 0x02)) pulses[1].length = 0;
+      if (!(enabled & 0x04)) triangle.length  = 0;
+      if (!(enabled & 0x08)) noise.length     = 0;
+
+      if (!(enabled & 0x10))
+        dmc.remaining = 0;
+      else if (dmc.remaining == 0)
+      {
+        RestartDmc();
+        FetchDmc();
+      }
+      break;
+
+    case 0x4017: // Frame counter mode, a write restarts the sequence and the 5 step one clocks right away
+      fiveStep   = (value & 0x80) != 0;
+      irqInhibit = (value & 0x40) != 0;
+      frameCycle = 0;
+
+      if (irqInhibit)
+        frameIrq = false;
+
+      if (fiveStep)
+      {
+        ClockQuarter();
+        ClockHalf();
+      }
+      break;
+  }
+
+  UpdateLevels();
+}
+
+// 0x4014 (sprite DMA) and the controllers at 0x4016 and 0x4017 are the Cpu's
+u8 Apu::ReadIo(void *context, u16 address)
+{
+  return ((Apu *)context)->ReadRegister(address);
+}
+
+void Apu::WriteIo(void *context, u16 address, u8 value)
+{
+  if (address <= 0x4017)
+    ((Apu *)context)->WriteRegister(address, value);
+}
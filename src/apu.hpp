@@ -0,0 +1,253 @@
+#ifndef __APU_H__
+#define __APU_H__
+
+#pragma once
+
+#include <vector>
+#include "audio.hpp"
+#include "bus.hpp"
+#include "types.hpp"
+
+/* Band-limited step synthesis. Channel outputs are flat between the cycles they change on, so
+   instead of producing a level per CPU cycle and filtering 1.79 MHz down, every change is added
+   as a delta at its exact time: the delta times a windowed sinc impulse, picked from 32 phases
+   by the fraction of a sample the time falls on. Integrating the deltas gives the output steps
+   band-limited to the sample rate, no matter how fast a channel toggles. */
+class BlepBuffer {
+public:
+  static const u32 phaseBits = 5;
+  static const u32 phases    = 1 << phaseBits;
+  static const u32 taps      = 16;      // Impulse width, in samples
+  static const u32 maxTime   = 0x4000;  // Cycles between EndFrame calls
+
+  BlepBuffer();
+
+  void SetRates(u32 clockRate, u32 sampleRate);
+  void Clear   ();
+
+  // Level change of delta at time, in cycles since the last EndFrame
+  FORCEINLINE void AddDelta(u32 time, s32 delta);
+
+  // Appends the samples finished before time to out, time becomes 0
+  void EndFrame(u32 time, std::vector<s16> &out);
+
+private:
+  static const u32 kernelScale = 15; // Rows of the kernel add up to 1 << kernelScale
+
+  static s16 kernel[phases][taps];
+
+  std::vector<s32> deltas;
+  u64              factor;     // Samples per cycle, 32.32 fixed point
+  u64              offset;     // Fraction of a sample the buffer starts at, 32.32
+  s32              integrator; // Output level, scaled by the kernel
+  s32              dcLevel;    // Removes the DC of the unipolar channels, a high-pass filter
+
+  static void BuildKernel();
+};
+
+FORCEINLINE void BlepBuffer::AddDelta(u32 time, s32 delta)
+{
+  u64        position = offset + time * factor;
+  s32       *out      = &deltas[(size_t)(position >> 32)];
+  const s16 *impulse  = kernel[(position >> (32 - phaseBits)) & (phases - 1)];
+
+  for (u32 i = 0; i < taps; ++i)
+    out[i] += delta * impulse[i];
+}
+
+/* Audio processing unit: two pulse channels, triangle, noise and the delta modulation channel,
+   with the frame counter that clocks their envelopes, sweeps and length counters. Run clocks it
+   by CPU cycles, the channel timers are stepped from one clock to the next rather than cycle by
+   cycle, and every level change goes to a BlepBuffer. Channels are mixed linearly, which keeps
+   their deltas independent. Finished samples are pushed to the output SampleBuffer, if any. */
+class Apu {
+public:
+  static const u32 clockRate         = 1789773; // NTSC CPU clock
+  static const u32 defaultSampleRate = 48000;
+
+  Apu();
+  Apu(const Apu &other);
+
+  Apu &operator=(const Apu &other); // The output and the DMC reader aren't copied
+
+  void Reset          ();
+  void SetSampleRate  (u32 sampleRate);             // Up to 192 kHz
+  void SetOutput      (SampleBuffer *buffer);       // Null drops the samples
+  void SetDmcReader   (Bus::ReadHandler read, void *context); // Where DMC samples are fetched from
+
+  void Run            (u32 cycles);
+
+  /* CPU side, $4000-$4017 */
+  u8   ReadRegister   (u16 address);
+  void WriteRegister  (u16 address, u8 value);
+
+  // Bus handlers for the page at 0x4000, context is the Apu. The rest of the page is open bus.
+  static u8   ReadIo  (void *context, u16 address);
+  static void WriteIo (void *context, u16 address, u8 value);
+
+  bool GetIrq         () const; // Frame counter or DMC interrupt pending
+
+  // Cycles Run needs to raise each interrupt with the registers as they are, 0 when it won't
+  u32  GetCyclesToFrameIrq() const;
+  u32  GetCyclesToDmcIrq  () const;
+  u64  GetCycleCount  () const;
+  u64  GetSampleCount () const; // Samples produced, pushed or not
+  u32  GetSampleRate  () const;
+
+  /* Save state section: the channels and the frame counter, defined below the channels.
+     The output isn't in it, a restored state steps the output to its levels. */
+  struct Snapshot;
+
+  void Save           (Snapshot &snapshot) const;
+  void Restore        (const Snapshot &snapshot);
+
+private:
+  struct Envelope {
+    bool start;
+    bool loop;     // Also halts the length counter
+    bool constant;
+    u8   volume;   // Constant volume or decay period
+    u8   divider;
+    u8   decay;
+
+    void Clock ();
+    u8   Output() const;
+  };
+
+  struct Pulse {
+    Envelope envelope;
+    u8   duty;
+    u8   step;
+    u16  period;     // Timer reload, the timer clocks every (period + 1) * 2 CPU cycles
+    u32  timer;      // CPU cycles to the next clock
+    u8   length;
+    bool sweepEnabled;
+    bool sweepNegate;
+    bool sweepReload;
+    u8   sweepPeriod;
+    u8   sweepShift;
+    u8   sweepDivider;
+    u8   level;      // Output, 0-15
+  };
+
+  struct Triangle {
+    u8   step;
+    u16  period;
+    u32  timer;
+    u8   length;
+    u8   linear;
+    u8   linearReload;
+    bool control;    // Also halts the length counter
+    bool reload;
+    u8   level;
+  };
+
+  struct Noise {
+    Envelope envelope;
+    bool mode;       // Short sequence, feedback from bit 6
+    u16  period;     // In CPU cycles
+    u32  timer;
+    u16  shift;
+    u8   length;
+    u8   level;
+  };
+
+  struct Dmc {
+    bool irqEnabled;
+    bool loop;
+    u16  period;
+    u32  timer;
+    u8   output;     // 7 bit counter
+    u16  start;
+    u16  address;
+    u16  sampleLength;
+    u16  remaining;  // Bytes left to fetch
+    u8   buffer;
+    bool bufferFull;
+    u8   shift;
+    u8   bits;
+    bool silence;
+    u8   level;
+  };
+
+public:
+  struct Snapshot {
+    Pulse    pulses[2];
+    Triangle triangle;
+    Noise    noise;
+    Dmc      dmc;
+    u64      cycleCount;
+    u32      frameCycle;
+    u8       enabled;
+    bool     fiveStep;
+    bool     irqInhibit;
+    bool     frameIrq;
+    bool     dmcIrq;
+  };
+
+private:
+  static const u8  lengths[32];
+  static const u8  duties[4][8];
+  static const u8  triangleSteps[32];
+  static const u16 noisePeriods[16];
+  static const u16 dmcPeriods[16];
+
+  // Linear mixer weights per level, full scale is a little under 32767
+  static const s32 pulseWeight    = 271;
+  static const s32 triangleWeight = 306;
+  static const s32 noiseWeight    = 178;
+  static const s32 dmcWeight      = 121;
+
+  Pulse    pulses[2];
+  Triangle triangle;
+  Noise    noise;
+  Dmc      dmc;
+  u8       enabled;    // $4015 channel enables
+
+  /* Frame counter */
+  bool fiveStep;
+  bool irqInhibit;
+  bool frameIrq;
+  bool dmcIrq;
+  u32  frameCycle;     // CPU cycles into the sequence
+
+  u64  cycleCount;
+  u32  time;           // CPU cycles since the last EndFrame of blep
+
+  BlepBuffer       blep;
+  std::vector<s16> samples;      // Finished samples on their way to output
+  u64              sampleCount;
+  u32              sampleRate;
+  SampleBuffer    *output;
+
+  Bus::ReadHandler dmcRead;
+  void            *dmcContext;
+
+  /* Frame counter */
+  u32  NextFrameEvent  () const; // CPU cycles to the next quarter or half frame clock
+  void ClockFrame      ();
+  void ClockQuarter    ();
+  void ClockHalf       ();
+
+  /* Channels */
+  void RunChannels     (u32 cycles);
+  void ClockPulse      (Pulse &pulse);
+  void ClockTriangle   ();
+  void ClockNoise      ();
+  void ClockDmc        ();
+  void FetchDmc        ();
+  void RestartDmc      ();
+  u16  SweepTarget     (const Pulse &pulse, u32 channel) const;
+  void ClockSweep      (Pulse &pulse, u32 channel);
+
+  // Levels from the channel states, changes go to blep at the current time
+  u8   PulseLevel      (const Pulse &pulse, u32 channel) const;
+  u8   TriangleLevel   () const;
+  u8   NoiseLevel      () const;
+  void UpdateLevels    ();
+  FORCEINLINE void SetLevel(u8 &level, u8 newLevel, s32 weight, u32 at);
+
+  void Flush           ();
+};
+
+#endif //__APU_H__
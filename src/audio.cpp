@@ -0,0 +1,151 @@
+#include "audio.hpp"
+#include <chrono>
+
+SampleBuffer::SampleBuffer(u32 capacityLog2)
+  : samples((size_t)1 << capacityLog2), mask(((u64)1 << capacityLog2) - 1), head(0), tail(0), dropped(0)
+{
+
+}
+
+u32 SampleBuffer::Push(const s16 *data, u32 count)
+{
+  u64 position = head.load(std::memory_order_relaxed);
+  u64 room     = mask + 1 - (position - tail.load(std::memory_order_acquire));
+  u32 written  = count < room ? count : (u32)room;
+
+  for (u32 i = 0; i < written; ++i)
+    samples[(position + i) & mask] = data[i];
+
+  head.store(position + written, std::memory_order_release);
+
+  if (written != count)
+    dropped.store(dropped.load(std::memory_order_relaxed) + count - written, std::memory_order_relaxed);
+
+  return written;
+}
+
+u32 SampleBuffer::Pop(s16 *data, u32 count)
+{
+  u64 position  = tail.load(std::memory_order_relaxed);
+  u64 available = head.load(std::memory_order_acquire) - position;
+  u32 read      = count < available ? count : (u32)available;
+
+  for (u32 i = 0; i < read; ++i)
+    data[i] = samples[(position + i) & mask];
+
+  tail.store(position + read, std::memory_order_release);
+
+  return read;
+}
+
+u32 SampleBuffer::GetSize() const
+{
+  return (u32)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed));
+}
+
+u64 SampleBuffer::GetDropped() const
+{
+  return dropped.load(std::memory_order_relaxed);
+}
+
+WavWriter::WavWriter()
+  : running(false), out(nullptr), sampleRate(0), written(0)
+{
+
+}
+
+WavWriter::~WavWriter()
+{
+  Stop();
+}
+
+bool WavWriter::Start(const std::string &file, u32 newSampleRate)
+{
+  Stop();
+
+  out = fopen(file.c_str(), "wb");
+
+  if (!out)
+  {
+    printf("Can't open WAV file %s\n", file.c_str());
+    return false;
+  }
+
+  sampleRate = newSampleRate;
+  written    = 0;
+
+  WriteHeader(); // With no samples yet, Stop writes it again with the sizes
+
+  running = true;
+  thread  = std::thread([this]() { Drain(); });
+
+  return true;
+}
+
+void WavWriter::Stop()
+{
+  if (!thread.joinable())
+    return;
+
+  running = false;
+  thread.join();
+
+  WriteHeader();
+  fclose(out);
+
+  out = nullptr;
+}
+
+SampleBuffer &WavWriter::GetBuffer()
+{
+  return buffer;
+}
+
+void WavWriter::Drain()
+{
+  s16 chunk[4096];
+
+  for (;;)
+  {
+    // Read running before emptying the buffer, samples pushed before Stop are never lost
+    bool stopping = !running;
+    u32  count;
+
+    while ((count = buffer.Pop(chunk, sizeof(chunk) / sizeof(chunk[0]))) != 0)
+    {
+      fwrite(chunk, sizeof(s16), count, out);
+      written += count;
+    }
+
+    if (stopping)
+      break;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+}
+
+// RIFF header of 16 bit mono PCM, little endian
+void WavWriter::WriteHeader()
+{
+  u32 dataSize = (u32)(written * sizeof(s16));
+
+  auto put16 = [this](u16 value) { u8 bytes[2] = { (u8)value, (u8)(value >> 8) }; fwrite(bytes, 1, 2, out); };
+  auto put32 = [this](u32 value) { u8 bytes[4] = { (u8)value, (u8)(value >> 8), (u8)(value >> 16), (u8)(value >> 24) }; fwrite(bytes, 1, 4, out); };
+
+  fseek(out, 0, SEEK_SET);
+
+  fwrite("RIFF", 1, 4, out);
+  put32(36 + dataSize);
+  fwrite("WAVEfmt ", 1, 8, out);
+  put32(16);             // Format chunk size
+  put16(1);              // PCM
+  put16(1);              // Mono
+  put32(sampleRate);
+  put32(sampleRate * 2); // Bytes per second
+  put16(2);              // Bytes per frame
+  put16(16);             // Bits per sample
+  fwrite("data", 1, 4, out);
+  put32(dataSize);
+
+  fseek(out, 0, SEEK_END);
+}
@@ -0,0 +1,59 @@
+#ifndef __AUDIO_H__
+#define __AUDIO_H__
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "types.hpp"
+
+/* Single producer, single consumer lock-free ring of mono samples, the same scheme as
+   TraceBuffer. The APU pushes from the emulation thread and an output thread pops. Pushing
+   never waits: what doesn't fit is dropped and counted, audio can't stall emulation. */
+class SampleBuffer {
+public:
+  explicit SampleBuffer(u32 capacityLog2 = 15);
+
+  u32 Push(const s16 *samples, u32 count); // Samples written, the rest is dropped
+  u32 Pop (s16 *samples, u32 count);       // Samples read, up to count
+
+  u32 GetSize   () const; // Samples waiting, for the consumer
+  u64 GetDropped() const;
+
+private:
+  std::vector<s16> samples;
+  u64              mask;
+
+  // Each index is written by one side only, on its own cache line so they don't false share
+  alignas(64) std::atomic<u64> head;    // Next sample to write
+  alignas(64) std::atomic<u64> tail;    // Next sample to read
+  std::atomic<u64>             dropped; // Written by the producer only
+};
+
+/* Drains a SampleBuffer into a 16 bit mono WAV file on a background thread */
+class WavWriter {
+public:
+  WavWriter();
+  ~WavWriter();
+
+  bool Start(const std::string &file, u32 sampleRate);
+  void Stop ();  // Writes what is left in the buffer, fills in the header and closes the file
+
+  SampleBuffer &GetBuffer(); // Where the APU pushes to
+
+private:
+  SampleBuffer      buffer;
+  std::thread       thread;
+  std::atomic<bool> running;
+  FILE             *out;
+  u32               sampleRate;
+  u64               written; // Samples in the file
+
+  void Drain      ();
+  void WriteHeader();
+};
+
+#endif //__AUDIO_H__
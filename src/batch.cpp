@@ -0,0 +1,421 @@
+#include "batch.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "cpu.hpp"
+#include "movie.hpp"
+#include "savestate.hpp"
+
+namespace
+{
+  const s32 frameCycles = 29781; // NTSC
+
+  std::vector<std::string> SplitWords(const char *line)
+  {
+    std::vector<std::string> words;
+
+    for (const char *c = line; *c; )
+    {
+      while (*c && isspace((u8)*c))
+        ++c;
+
+      const char *start = c;
+
+      while (*c && !isspace((u8)*c))
+        ++c;
+
+      if (c > start)
+        words.emplace_back(start, c);
+    }
+
+    return words;
+  }
+
+  bool IsAbsolute(const std::string &path)
+  {
+    return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+  }
+
+  std::string Resolve(const std::string &directory, const std::string &path)
+  {
+    return IsAbsolute(path) ? path : directory + path;
+  }
+
+  // Raw RGBA of the last frame, black when none was drawn
+  bool WriteFrame(FILE *file, const Cpu &cpu, const Palette &palette, std::vector<u32> &rgba)
+  {
+    const u16 *frame = cpu.GetPpu().GetFrame();
+
+    if (frame)
+      palette.Convert(frame, (u32)rgba.size(), rgba.data());
+    else
+      std::fill(rgba.begin(), rgba.end(), 0xFF000000);
+
+    return fwrite(rgba.data(), sizeof(u32), rgba.size(), file) == rgba.size();
+  }
+}
+
+/* RomCache */
+std::shared_ptr<const Rom> RomCache::Get(const std::string &romFile, std::string &error)
+{
+  Entry *entry;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::unique_ptr<Entry> &slot = entries[romFile];
+
+    if (!slot)
+      slot.reset(new Entry());
+
+    entry = slot.get();
+  }
+
+  // Entries are never removed, the pointer stays good without the lock
+  std::call_once(entry->loaded, [entry, &romFile]() {
+    std::shared_ptr<Rom> rom = std::make_shared<Rom>();
+
+    if (rom->Load(romFile))
+      entry->rom = rom;
+    else
+      entry->error = "can't load " + romFile + ": " + rom->GetError();
+  });
+
+  error = entry->error;
+
+  return entry->rom;
+}
+
+u32 RomCache::GetCount() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return (u32)entries.size();
+}
+
+/* Batch */
+Batch::Batch()
+{
+  threads = 0;
+  seconds = 0;
+}
+
+bool Batch::Load(const std::string &manifestFile)
+{
+  FILE *file = fopen(manifestFile.c_str(), "r");
+
+  if (!file)
+  {
+    error = "can't open " + manifestFile;
+    return false;
+  }
+
+  size_t      slash     = manifestFile.find_last_of("/\\");
+  std::string directory = slash == std::string::npos ? "" : manifestFile.substr(0, slash + 1);
+
+  char line[4096];
+  u32  number = 0;
+
+  error.clear();
+
+  while (fgets(line, sizeof(line), file) && error.empty())
+  {
+    ++number;
+
+    if (char *comment = strchr(line, '#'))
+      *comment = '\0';
+
+    std::vector<std::string> words = SplitWords(line);
+
+    if (words.empty())
+      continue;
+
+    std::string where = manifestFile + " line " + std::to_string(number) + ": ";
+    char       *end   = nullptr;
+    BatchJob    job   = {};
+
+    if (words.size() < 3)
+    {
+      error = where + "a job is a rom, a movie and a frame count";
+      break;
+    }
+
+    job.romFile   = Resolve(directory, words[0]);
+    job.movieFile = words[1] == "-" ? "" : Resolve(directory, words[1]);
+    job.frames    = (u32)strtoul(words[2].c_str(), &end, 10);
+
+    if (*end || (job.frames == 0 && job.movieFile.empty()))
+      error = where + "the frame count " + words[2] + " isn't a number, or 0 without a movie";
+
+    for (size_t i = 3; i < words.size() && error.empty(); ++i)
+    {
+      size_t      equals = words[i].find('=');
+      std::string key    = words[i].substr(0, equals);
+      std::string value  = equals == std::string::npos ? "" : words[i].substr(equals + 1);
+
+      if (value.empty())
+        error = where + words[i] + " has no value";
+      else if (key == "frame")
+        job.frameFile = Resolve(directory, value);
+      else if (key == "capture")
+        job.captureFile = Resolve(directory, value);
+      else if (key == "state")
+        job.stateFile = Resolve(directory, value);
+      else if (key == "hash")
+      {
+        job.hash    = strtoull(value.c_str(), &end, 16);
+        job.hasHash = true;
+
+        if (*end)
+          error = where + "the hash " + value + " isn't hexadecimal";
+      }
+      else
+        error = where + "unknown output " + key;
+    }
+
+    if (error.empty())
+      jobs.push_back(job);
+  }
+
+  fclose(file);
+
+  return error.empty();
+}
+
+void Batch::Add(const BatchJob &job)
+{
+  jobs.push_back(job);
+}
+
+bool Batch::Run(u32 threadCount)
+{
+  threads = threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+
+  results.assign(jobs.size(), BatchResult());
+  queues.clear();
+
+  for (u32 worker = 0; worker < threads; ++worker)
+    queues.emplace_back(new Queue());
+
+  for (u32 job = 0; job < jobs.size(); ++job)
+    queues[job % threads]->jobs.push_back(job);
+
+  auto start = std::chrono::steady_clock::now();
+
+  // The calling thread is worker 0
+  std::vector<std::thread> workers;
+
+  for (u32 worker = 1; worker < threads; ++worker)
+    workers.emplace_back([this, worker]() { Work(worker); });
+
+  Work(0);
+
+  for (std::thread &worker : workers)
+    worker.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  seconds = elapsed.count();
+
+  for (const BatchResult &result : results)
+    if (!result.ok)
+      return false;
+
+  return true;
+}
+
+const std::vector<BatchJob> &Batch::GetJobs() const
+{
+  return jobs;
+}
+
+const std::vector<BatchResult> &Batch::GetResults() const
+{
+  return results;
+}
+
+const std::string &Batch::GetError() const
+{
+  return error;
+}
+
+u64 Batch::GetFrames() const
+{
+  u64 frames = 0;
+
+  for (const BatchResult &result : results)
+    frames += result.frames;
+
+  return frames;
+}
+
+double Batch::GetSeconds() const
+{
+  return seconds;
+}
+
+u32 Batch::GetThreads() const
+{
+  return threads;
+}
+
+// FNV-1a
+u64 Batch::GetHash(const Cpu &cpu)
+{
+  const u16 *frame = cpu.GetPpu().GetFrame();
+  u64        hash  = 14695981039346656037ULL;
+
+  auto add = [&hash](u8 value) { hash = (hash ^ value) * 1099511628211ULL; };
+
+  for (u32 pixel = 0; frame && pixel < Ppu::width * Ppu::height; ++pixel)
+  {
+    add((u8)frame[pixel]);
+    add((u8)(frame[pixel] >> 8));
+  }
+
+  for (u32 address = 0x0000; address < 0x0800; ++address)
+    add(cpu.ReadMemory(address));
+
+  for (u32 address = 0x6000; address < 0x8000; ++address)
+    add(cpu.ReadMemory(address));
+
+  return hash;
+}
+
+void Batch::Work(u32 worker)
+{
+  std::unique_ptr<Cpu> cpu(new Cpu());
+  std::vector<u32>     rgba(Ppu::width * Ppu::height);
+  u32                  job;
+
+  while (Take(worker, job))
+    RunJob(*cpu, rgba, job, worker);
+}
+
+// No job is added while they run, so once every queue is found empty there's nothing left
+bool Batch::Take(u32 worker, u32 &job)
+{
+  for (u32 i = 0; i < threads; ++i)
+  {
+    Queue &queue = *queues[(worker + i) % threads];
+
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (queue.jobs.empty())
+      continue;
+
+    if (i == 0)
+    {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+    }
+    else
+    {
+      job = queue.jobs.back();
+      queue.jobs.pop_back();
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+void Batch::RunJob(Cpu &cpu, std::vector<u32> &rgba, u32 index, u32 worker)
+{
+  const BatchJob &job    = jobs[index];
+  BatchResult    &result = results[index];
+
+  auto start = std::chrono::steady_clock::now();
+
+  result.ok      = false;
+  result.frames  = 0;
+  result.seconds = 0;
+  result.hash    = 0;
+  result.worker  = worker;
+
+  Movie                      movie;
+  std::shared_ptr<const Rom> rom = roms.Get(job.romFile, result.error);
+
+  if (!rom)
+    return;
+
+  if (!cpu.LoadRom(rom))
+  {
+    result.error = job.romFile + ": mapper " + std::to_string(rom->GetMapper()) + " isn't supported";
+    return;
+  }
+
+  if (!job.movieFile.empty() && !movie.Load(job.movieFile))
+  {
+    result.error = movie.GetError();
+    return;
+  }
+
+  FILE *capture = nullptr;
+
+  if (!job.captureFile.empty() && !(capture = fopen(job.captureFile.c_str(), "wb")))
+  {
+    result.error = "can't open " + job.captureFile;
+    return;
+  }
+
+  // ROMs recompiled into the build run their routines
+  Cpu::Dispatch dispatch  = cpu.HasStaticProgram() ? Cpu::Dispatch::Static : Cpu::defaultDispatch;
+  u32           frames    = job.frames ? job.frames : movie.GetFrameCount();
+  s32           overshoot = 0;
+  bool          written   = true;
+
+  for (u32 frame = 0; frame < frames; ++frame)
+  {
+    cpu.SetButtons(0, movie.GetButtons(frame, 0));
+    cpu.SetButtons(1, movie.GetButtons(frame, 1));
+
+    overshoot = cpu.Run(frameCycles - overshoot, dispatch);
+
+    if (capture)
+      written &= WriteFrame(capture, cpu, palette, rgba);
+  }
+
+  result.frames = frames;
+  result.hash   = GetHash(cpu);
+
+  if (capture && (fclose(capture) != 0 || !written))
+    result.error = "can't write " + job.captureFile;
+
+  if (!job.frameFile.empty() && result.error.empty())
+  {
+    FILE *file  = fopen(job.frameFile.c_str(), "wb");
+    bool  saved = file && WriteFrame(file, cpu, palette, rgba);
+
+    if (!file || fclose(file) != 0 || !saved)
+      result.error = "can't write " + job.frameFile;
+  }
+
+  if (!job.stateFile.empty() && result.error.empty())
+  {
+    std::unique_ptr<SaveState> state(new SaveState());
+
+    cpu.Save(*state);
+
+    if (!StateFile::Save(job.stateFile, *state))
+      result.error = "can't write " + job.stateFile;
+  }
+
+  if (job.hasHash && result.hash != job.hash && result.error.empty())
+  {
+    char message[64];
+
+    snprintf(message, sizeof(message), "hash %016llx, expected %016llx", (unsigned long long)result.hash, (unsigned long long)job.hash);
+    result.error = message;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  result.ok      = result.error.empty();
+  result.seconds = elapsed.count();
+}
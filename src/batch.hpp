@@ -0,0 +1,109 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "palette.hpp"
+#include "rom.hpp"
+#include "types.hpp"
+
+class Cpu;
+
+/* ROMs loaded once and shared read only between threads, see Cpu::LoadRom */
+class RomCache {
+public:
+  // The Rom of romFile, loaded by the first caller while the others wait for it. Null with
+  // error set when it can't be loaded, which is remembered as well.
+  std::shared_ptr<const Rom> Get(const std::string &romFile, std::string &error);
+
+  u32 GetCount() const; // Files asked for
+
+private:
+  struct Entry {
+    std::once_flag             loaded;
+    std::shared_ptr<const Rom> rom;
+    std::string                error;
+  };
+
+  mutable std::mutex                            mutex;   // Guards the map, not the loads
+  std::map<std::string, std::unique_ptr<Entry>> entries;
+};
+
+struct BatchJob {
+  std::string romFile;
+  std::string movieFile;   // Empty runs without input
+  u32         frames;      // 0 runs the whole movie
+  std::string frameFile;   // The last frame as raw 256x240 RGBA, empty for none
+  std::string captureFile; // Every frame, the same way
+  std::string stateFile;   // A save state after the last frame
+  u64         hash;        // Batch::GetHash expected at the end, when hasHash
+  bool        hasHash;
+};
+
+struct BatchResult {
+  bool        ok;
+  std::string error;   // Why it failed
+  u32         frames;  // Run
+  double      seconds;
+  u64         hash;    // Batch::GetHash at the end
+  u32         worker;  // Thread that ran it
+};
+
+/* Headless runs of many jobs on every core. Each worker thread has one Cpu and loads the ROM
+   of every job it takes into it. The jobs are dealt round robin to a queue per worker, which
+   takes from the front of its own and steals from the back of the others once it's empty,
+   so long jobs don't leave the other threads idle at the end. */
+class Batch {
+public:
+  Batch();
+
+  Batch(const Batch &) = delete;
+  Batch &operator=(const Batch &) = delete;
+
+  // Adds the jobs of a manifest, a line per job and # comments:
+  //   rom movie frames [frame=file] [capture=file] [state=file] [hash=hex]
+  // A movie of - runs without input. Paths are relative to the manifest and can't have spaces.
+  // Returns false and sets GetError() at the first line that isn't a job.
+  bool Load                  (const std::string &manifestFile);
+  void Add                   (const BatchJob &job);
+
+  // Runs every job, threads 0 for one per core. False when a job failed.
+  bool Run                   (u32 threads = 0);
+
+  const std::vector<BatchJob>    &GetJobs   () const;
+  const std::vector<BatchResult> &GetResults() const; // One per job, in the same order
+  const std::string              &GetError  () const;
+
+  u64    GetFrames           () const; // Run by every job in the last Run
+  double GetSeconds          () const; // Wall clock of the last Run
+  u32    GetThreads          () const;
+
+  static u64 GetHash         (const Cpu &cpu); // The last frame, internal RAM and PRG RAM
+
+private:
+  struct Queue {
+    std::mutex      mutex;
+    std::deque<u32> jobs;
+  };
+
+  std::vector<BatchJob>               jobs;
+  std::vector<BatchResult>            results;
+  std::vector<std::unique_ptr<Queue>> queues;  // One per worker
+  RomCache                            roms;
+  Palette                             palette; // For the frame outputs
+  u32                                 threads;
+  double                              seconds;
+  std::string                         error;
+
+  void Work                  (u32 worker);
+  bool Take                  (u32 worker, u32 &job); // Own queue first, then the others. False when all are empty
+  void RunJob                (Cpu &cpu, std::vector<u32> &rgba, u32 job, u32 worker);
+};
+
+#endif //__BATCH_H__
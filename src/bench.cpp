@@ -0,0 +1,964 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "apu.hpp"
+#include "audio.hpp"
+#include "batch.hpp"
+#include "cpu.hpp"
+#include "lockstep.hpp"
+#include "palette.hpp"
+#include "ppu.hpp"
+#include "rewind.hpp"
+#include "savestate.hpp"
+#include "selftest.hpp"
+#include "tiles.hpp"
+
+namespace
+{
+  const u32 nestestInstructions = 8991;     // Length of the nestest automation run
+  const u64 benchInstructions   = 50000000; // Instructions executed per measurement
+  const s32 nestestCycles       = 26500;    // Cycles taken by roughly one nestest automation run
+  const s64 benchCycles         = 200000000;
+  const u32 benchFrames         = 2000;     // PPU frames rendered per measurement
+  const u32 benchTiles          = 20000000; // CHR tiles decoded per measurement
+  const u32 benchConversions    = 5000;     // Frames converted per measurement
+  const u32 benchApuFrames      = 20000;    // APU frames run per measurement
+  const u32 benchCatchUpFrames  = 600;      // Frames of the CPU, PPU and APU run per measurement
+  const u32 frameCycles         = 29781;    // CPU cycles of an NTSC frame
+  const u32 benchStates         = 20000;    // Saves and restores per measurement
+  const u32 benchStateFiles     = 500;      // File round trips per measurement
+  const u32 benchRewindFrames   = 6000;     // Frames run and pushed per measurement
+  const u32 benchForks          = 20000;    // Forks and copies per measurement
+  const u32 benchForkChildren   = 256;      // Alive at once
+  const u32 benchBatchJobs      = 32;       // Jobs per measurement
+  const u32 benchBatchFrames    = 120;      // Frames per job
+  const u32 benchLockstepPhase  = 500;      // Instructions between the four starting points of the lanes
+  const u32 benchLockstepRun    = 7000;     // Instructions per lane and round, the rest of nestest after the last phase
+
+  // Executes benchInstructions, restarting from the loaded rom every nestest run,
+  // and returns the instructions per second. run executes one whole nestest run.
+  template<typename Run>
+  double MeasureRuns(const Cpu &loaded, Run run)
+  {
+    u64 executed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (executed < benchInstructions)
+    {
+      Cpu cpu = loaded;
+
+      run(cpu);
+
+      executed += nestestInstructions;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return executed / elapsed.count();
+  }
+
+  // Same as MeasureRuns, stepping one instruction at a time.
+  template<typename Step>
+  double MeasureInstructions(const Cpu &loaded, Step step)
+  {
+    return MeasureRuns(loaded, [step](Cpu &cpu) {
+      for (u32 i = 0; i < nestestInstructions; ++i)
+        step(cpu);
+    });
+  }
+
+  int DispatchBenchmark(const std::string &romFile)
+  {
+    Cpu *loaded = new Cpu();
+
+    if (!LoadNestest(*loaded, romFile))
+    {
+      delete loaded;
+      return 1;
+    }
+
+    double table = MeasureInstructions(*loaded, [](Cpu &cpu) { cpu.ProcessOpcode(cpu.FetchOpcode()); });
+    double sw    = MeasureInstructions(*loaded, [](Cpu &cpu) { cpu.ProcessOpcodeSwitch(cpu.FetchOpcode()); });
+
+    printf("dispatch table : %8.2f M instructions/s\n", table / 1e6);
+    printf("dispatch switch: %8.2f M instructions/s\n", sw / 1e6);
+    printf("table / switch : %8.2fx\n", table / sw);
+
+    delete loaded;
+
+    return 0;
+  }
+
+  // Compares the interpreter loops over long runs, where the cost of a shared,
+  // mispredicted dispatch branch dominates.
+  int ThreadedBenchmark(const std::string &romFile)
+  {
+    Cpu *loaded = new Cpu();
+
+    if (!LoadNestest(*loaded, romFile))
+    {
+      delete loaded;
+      return 1;
+    }
+
+    const struct { const char *name; Cpu::Dispatch dispatch; } loops[] = {
+      { "table   ", Cpu::Dispatch::Table    },
+      { "switch  ", Cpu::Dispatch::Switch   },
+      { "threaded", Cpu::Dispatch::Threaded },
+    };
+
+    double results[3];
+
+    for (int i = 0; i < 3; ++i)
+    {
+      Cpu::Dispatch dispatch = loops[i].dispatch;
+
+      results[i] = MeasureRuns(*loaded, [dispatch](Cpu &cpu) { cpu.RunInstructions(nestestInstructions, dispatch); });
+
+      printf("%s: %8.2f M instructions/s\n", loops[i].name, results[i] / 1e6);
+    }
+
+#ifndef NESEMU_THREADED_DISPATCH
+    printf("(built without NESEMU_THREADED_DISPATCH, threaded falls back to switch)\n");
+#endif
+    printf("threaded / switch: %8.2fx\n", results[2] / results[1]);
+
+    delete loaded;
+
+    return 0;
+  }
+
+  // Same as MeasureRuns on a single Cpu, which only goes back to the start of nestest
+  // between runs. Memory and anything cached from it carry over to the next run.
+  template<typename Run>
+  double MeasureWarmRuns(const Cpu &loaded, Run run)
+  {
+    Cpu *cpu      = new Cpu(loaded);
+    u64  executed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (executed < benchInstructions)
+    {
+      cpu->SetState(loaded.GetState());
+
+      run(*cpu);
+
+      executed += nestestInstructions;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    delete cpu;
+
+    return executed / elapsed.count();
+  }
+
+  // Compares the block cache, with and without native blocks, and the recompiled routines
+  // against the threaded loop. Cold runs start from a fresh copy and decode every block they
+  // reach, warm runs find the blocks of the previous run. Native blocks and routines only run
+  // under Run, RunInstructions counts instructions and keeps to the decoded ops.
+  int BlockBenchmark(const std::string &romFile)
+  {
+    Cpu *loaded = new Cpu();
+
+    if (!LoadNestest(*loaded, romFile))
+    {
+      delete loaded;
+      return 1;
+    }
+
+    const struct { const char *name; Cpu::Dispatch dispatch; } loops[] = {
+      { "threaded", Cpu::Dispatch::Threaded },
+      { "block   ", Cpu::Dispatch::Block    },
+      { "jit     ", Cpu::Dispatch::Jit      },
+      { "static  ", Cpu::Dispatch::Static   },
+    };
+
+    double cold[4];
+    double warm[4];
+    double frame[4];
+
+    for (int i = 0; i < 4; ++i)
+    {
+      Cpu::Dispatch dispatch = loops[i].dispatch;
+      auto          run      = [dispatch](Cpu &cpu) { cpu.RunInstructions(nestestInstructions, dispatch); };
+
+      cold [i] = MeasureRuns    (*loaded, run);
+      warm [i] = MeasureWarmRuns(*loaded, run);
+      frame[i] = MeasureWarmRuns(*loaded, [dispatch](Cpu &cpu) { cpu.Run(nestestCycles, dispatch); });
+
+      printf("%s: %8.2f M instructions/s cold, %8.2f warm, %8.2f warm Run per frame\n",
+             loops[i].name, cold[i] / 1e6, warm[i] / 1e6, frame[i] / 1e6);
+    }
+
+    printf("block / threaded: %8.2fx cold, %8.2fx warm, %8.2fx warm Run per frame\n",
+           cold[1] / cold[0], warm[1] / warm[0], frame[1] / frame[0]);
+    printf("jit / threaded  : %8.2fx warm Run per frame\n", frame[2] / frame[0]);
+
+    if (loaded->HasStaticProgram())
+      printf("static / threaded: %7.2fx warm Run per frame\n", frame[3] / frame[0]);
+    else
+      printf("static: %s wasn't recompiled into this build, the block cache ran instead\n", romFile.c_str());
+
+    delete loaded;
+
+    return 0;
+  }
+
+  // Runs benchCycles, restarting from the loaded rom every nestest run, and returns
+  // the emulated cycles per second. run executes one nestest run worth of cycles.
+  template<typename Run>
+  double MeasureCycles(const Cpu &loaded, Run run)
+  {
+    s64 executed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (executed < benchCycles)
+    {
+      Cpu cpu = loaded;
+
+      run(cpu);
+
+      executed += cpu.GetCycleCount() - loaded.GetCycleCount();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return executed / elapsed.count();
+  }
+
+  // Compares stepping one instruction per call against batches, like with like: CPU only,
+  // ProcessOpcode against RunInstructions, then with the PPU and APU synced, Run(1) against
+  // Run per scanline and per frame
+  int RunBatchBenchmark(const std::string &romFile)
+  {
+    const u32 scanlineInstructions = nestestInstructions * 114 / nestestCycles;
+
+    Cpu *loaded = new Cpu();
+
+    if (!LoadNestest(*loaded, romFile))
+    {
+      delete loaded;
+      return 1;
+    }
+
+    double step = MeasureCycles(*loaded, [](Cpu &cpu) {
+      while (cpu.GetCycleCount() < nestestCycles)
+        cpu.ProcessOpcode(cpu.FetchOpcode());
+    });
+
+    double instructions = MeasureCycles(*loaded, [](Cpu &cpu) {
+      while (cpu.GetCycleCount() < nestestCycles)
+        cpu.RunInstructions(scanlineInstructions);
+    });
+
+    double batch = MeasureCycles(*loaded, [](Cpu &cpu) {
+      while (cpu.GetCycleCount() < nestestCycles)
+        cpu.RunInstructions(nestestInstructions);
+    });
+
+    double synced = MeasureCycles(*loaded, [](Cpu &cpu) {
+      while (cpu.GetCycleCount() < nestestCycles)
+        cpu.Run(1);
+    });
+
+    double scanline = MeasureCycles(*loaded, [](Cpu &cpu) {
+      s32 overshoot = 0;
+      while (cpu.GetCycleCount() < nestestCycles)
+        overshoot = cpu.Run(114 - overshoot);
+    });
+
+    double frame = MeasureCycles(*loaded, [](Cpu &cpu) { cpu.Run(nestestCycles); });
+
+    printf("CPU only, step per instruction         : %8.2f M cycles/s\n", step         / 1e6);
+    printf("CPU only, RunInstructions per scanline : %8.2f M cycles/s\n", instructions / 1e6);
+    printf("CPU only, RunInstructions per frame    : %8.2f M cycles/s\n", batch        / 1e6);
+    printf("with PPU and APU, Run per instruction  : %8.2f M cycles/s\n", synced       / 1e6);
+    printf("with PPU and APU, Run per scanline     : %8.2f M cycles/s\n", scanline     / 1e6);
+    printf("with PPU and APU, Run per frame        : %8.2f M cycles/s\n", frame        / 1e6);
+    printf("frame / instruction: %5.2fx CPU only, %5.2fx with PPU and APU\n", batch / step, frame / synced);
+
+    delete loaded;
+
+    return 0;
+  }
+
+  // Renders benchFrames of the scene from a copy of loaded and returns the frames per second
+  template<Ppu::Renderer renderer>
+  double MeasureFrames(const Ppu &loaded)
+  {
+    Ppu *ppu = new Ppu(loaded);
+
+    auto start = std::chrono::steady_clock::now();
+
+    ppu->Run<renderer>(benchFrames * Ppu::dotsPerScanline * Ppu::scanlinesPerFrame);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    delete ppu;
+
+    return benchFrames / elapsed.count();
+  }
+
+  // Compares the scanline renderer against the dot one, 8x8 and 8x16 sprites
+  int PpuBenchmark(const std::string &romFile)
+  {
+    for (int tall = 0; tall < 2; ++tall)
+    {
+      Ppu *loaded = new Ppu();
+
+      if (!LoadPpuScene(*loaded, romFile, tall != 0))
+      {
+        delete loaded;
+        return 1;
+      }
+
+      double scanline = MeasureFrames<Ppu::Renderer::Scanline>(*loaded);
+      double dot      = MeasureFrames<Ppu::Renderer::Dot>     (*loaded);
+
+      printf("%-4s sprites: scanline %8.1f frames/s, dot %8.1f frames/s, scanline / dot %6.2fx\n",
+             tall ? "8x16" : "8x8", scanline, dot, scanline / dot);
+
+      delete loaded;
+    }
+
+    return 0;
+  }
+
+  // Decodes benchTiles with kernel, the 512 tiles of the pattern tables over and over, and
+  // returns the tiles per second
+  double MeasureTiles(TileCache::Kernel kernel, const u8 *chr, bool flip)
+  {
+    const u32 count = TileCache::tileCount;
+
+    std::vector<u8> pixels (count * 64);
+    std::vector<u8> flipped(count * 64);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (u32 decoded = 0; decoded < benchTiles; decoded += count)
+      TileCache::Decode(kernel, chr, count, pixels.data(), flip ? flipped.data() : nullptr);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return benchTiles / elapsed.count();
+  }
+
+  // Compares the SIMD tile decoders against the scalar one, with and without the flipped copy
+  int TileBenchmark()
+  {
+    std::vector<u8> chr(TileCache::tileCount * 16);
+
+    u32 seed = 1;
+
+    for (u8 &byte : chr)
+    {
+      seed = seed * 1103515245 + 12345;
+      byte = (u8)(seed >> 16);
+    }
+
+    double scalar = MeasureTiles(TileCache::Kernel::Scalar, chr.data(), true);
+
+    for (TileCache::Kernel kernel : { TileCache::Kernel::Scalar, TileCache::Kernel::Sse2, TileCache::Kernel::Avx2, TileCache::Kernel::Neon })
+    {
+      if (!TileCache::IsSupported(kernel))
+        continue;
+
+      double both  = kernel == TileCache::Kernel::Scalar ? scalar : MeasureTiles(kernel, chr.data(), true);
+      double plain = MeasureTiles(kernel, chr.data(), false);
+
+      printf("%-6s: %8.2f M tiles/s with the flipped copy, %8.2f without, %6.2fx scalar\n",
+             TileCache::GetKernelName(kernel), both / 1e6, plain / 1e6, both / scalar);
+    }
+
+    printf("cache uses %s\n", TileCache::GetKernelName(TileCache::GetKernel()));
+
+    return 0;
+  }
+
+  // Converts benchConversions frames with kernel and returns the frames per second
+  template<typename Color>
+  double MeasureConversions(const Palette &palette, Palette::Kernel kernel, const u16 *frame)
+  {
+    std::vector<Color> out(Ppu::width * Ppu::height);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (u32 i = 0; i < benchConversions; ++i)
+      palette.Convert(kernel, frame, (u32)out.size(), out.data());
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return benchConversions / elapsed.count();
+  }
+
+  // Converts a frame of the PPU scene to RGBA and RGB565 with every kernel
+  int PaletteBenchmark(const std::string &romFile)
+  {
+    Ppu *ppu = new Ppu();
+
+    if (!LoadPpuScene(*ppu, romFile, false))
+    {
+      delete ppu;
+      return 1;
+    }
+
+    ppu->Run(Ppu::dotsPerScanline * Ppu::scanlinesPerFrame);
+
+    Palette palette;
+    double  scalar[2] = { 0, 0 };
+
+    for (Palette::Kernel kernel : { Palette::Kernel::Scalar, Palette::Kernel::Avx2, Palette::Kernel::Neon })
+    {
+      if (!Palette::IsSupported(kernel))
+        continue;
+
+      double rgba   = MeasureConversions<u32>(palette, kernel, ppu->GetFrame());
+      double rgb565 = MeasureConversions<u16>(palette, kernel, ppu->GetFrame());
+
+      if (kernel == Palette::Kernel::Scalar)
+      {
+        scalar[0] = rgba;
+        scalar[1] = rgb565;
+      }
+
+      printf("%-6s: RGBA %8.0f frames/s (%5.2fx scalar), RGB565 %8.0f frames/s (%5.2fx scalar)\n",
+             Palette::GetKernelName(kernel), rgba, rgba / scalar[0], rgb565, rgb565 / scalar[1]);
+    }
+
+    delete ppu;
+
+    return 0;
+  }
+
+  u8 ReadDmcNoise(void *, u16 address)
+  {
+    return (u8)(address * 0x9D);
+  }
+
+  // Runs benchApuFrames with every channel playing and the samples going through the ring,
+  // and returns the frames per second
+  double MeasureApuFrames(u32 sampleRate)
+  {
+    Apu          *apu = new Apu();
+    SampleBuffer  ring;
+    s16           drained[4096];
+
+    apu->SetSampleRate(sampleRate);
+    apu->SetOutput(&ring);
+    apu->SetDmcReader(ReadDmcNoise, nullptr);
+
+    static const u8 writes[][2] = {
+      { 0x00, 0x7F }, { 0x01, 0x9A }, { 0x02, 0x40 }, { 0x03, 0x09 }, // Pulse 1, sweeping down
+      { 0x04, 0xB4 }, { 0x05, 0x00 }, { 0x06, 0x1D }, { 0x07, 0x0A }, // Pulse 2
+      { 0x08, 0xFF }, { 0x0A, 0x55 }, { 0x0B, 0x08 },                 // Triangle
+      { 0x0C, 0x3A }, { 0x0E, 0x04 }, { 0x0F, 0x08 },                 // Noise
+      { 0x10, 0x4F }, { 0x12, 0x00 }, { 0x13, 0xFF },                 // DMC, looping at the fastest rate
+      { 0x15, 0x1F }, { 0x17, 0x40 }
+    };
+
+    for (const u8 *write : writes)
+      apu->WriteRegister(0x4000 | write[0], write[1]);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (u32 i = 0; i < benchApuFrames; ++i)
+    {
+      apu->Run(frameCycles);
+
+      while (ring.Pop(drained, sizeof(drained) / sizeof(drained[0])) != 0)
+        ;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    delete apu;
+
+    return benchApuFrames / elapsed.count();
+  }
+
+  // Time the APU takes per frame, against a real time frame and against the CPU and PPU frame
+  int ApuBenchmark(const std::string &romFile)
+  {
+    Cpu *cpu = new Cpu();
+    Ppu *ppu = new Ppu();
+
+    if (!LoadNestest(*cpu, romFile) || !LoadPpuScene(*ppu, romFile, false))
+    {
+      delete cpu;
+      delete ppu;
+      return 1;
+    }
+
+    double cycles   = MeasureCycles(*cpu, [](Cpu &copy) { copy.Run(nestestCycles); });
+    double frames   = MeasureFrames<Ppu::Renderer::Scanline>(*ppu);
+    double emulated = 1e6 * frameCycles / cycles + 1e6 / frames; // CPU and PPU, us per frame
+
+    for (u32 sampleRate : { 44100u, 48000u, 96000u })
+    {
+      double apu = 1e6 / MeasureApuFrames(sampleRate);
+
+      printf("%6u Hz: %7.2f us/frame, %5.2f%% of a 60 Hz frame, %5.2f%% of the emulated frame (CPU + PPU %.2f us)\n",
+             sampleRate, apu, apu * 100 / (1e6 / 60), apu * 100 / (emulated + apu), emulated);
+    }
+
+    delete cpu;
+    delete ppu;
+
+    return 0;
+  }
+
+  // A game shaped load without a cartridge: a loop over a page of RAM, and an NMI handler
+  // that uploads 32 bytes to VRAM and sets the scroll, with rendering on. The vectors read
+  // open bus, $FFFF: its ISC $0700,X takes the operand from $0000 and goes on at $0002.
+  Cpu *LoadFrameWorkload()
+  {
+    // 0300: LDA #$80
+    // 0302: STA $2000 ; NMI on
+    // 0305: LDA #$1E
+    // 0307: STA $2001 ; Rendering on
+    // 030A: LDX #$00
+    // 030C: LDA $0200,X
+    // 030F: ADC #$01
+    // 0311: STA $0200,X
+    // 0314: INX
+    // 0315: BNE $030C
+    // 0317: JMP $030A
+    const u8 program[] = { 0xA9, 0x80, 0x8D, 0x00, 0x20, 0xA9, 0x1E, 0x8D, 0x01, 0x20, 0xA2, 0x00,
+                           0xBD, 0x00, 0x02, 0x69, 0x01, 0x9D, 0x00, 0x02, 0xE8, 0xD0, 0xF5,
+                           0x4C, 0x0A, 0x03 };
+
+    // 0000: $0700, the operand of ISC
+    // 0002: JMP $0400
+    // 0400: LDA #$20
+    // 0402: STA $2006
+    // 0405: LDA #$00
+    // 0407: STA $2006 ; VRAM at $2000
+    // 040A: LDY #$20
+    // 040C: STY $2007
+    // 040F: DEY
+    // 0410: BNE $040C
+    // 0412: STA $2005
+    // 0415: STA $2005
+    // 0418: RTI
+    const u8 vector [] = { 0x00, 0x07, 0x4C, 0x00, 0x04 };
+    const u8 handler[] = { 0xA9, 0x20, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20, 0xA0, 0x20,
+                           0x8C, 0x07, 0x20, 0x88, 0xD0, 0xFA, 0x8D, 0x05, 0x20, 0x8D, 0x05, 0x20,
+                           0x40 };
+
+    Cpu *cpu = new Cpu();
+
+    for (u32 i = 0; i < sizeof(vector); ++i)
+      cpu->WriteMemory(0x0000 + i, vector[i]);
+
+    for (u32 i = 0; i < sizeof(program); ++i)
+      cpu->WriteMemory(0x0300 + i, program[i]);
+
+    for (u32 i = 0; i < sizeof(handler); ++i)
+      cpu->WriteMemory(0x0400 + i, handler[i]);
+
+    cpu->SetState({ 0x0300, 0xFD, 0, 0, 0, 0x24, 0 });
+
+    return cpu;
+  }
+
+  // Runs benchCatchUpFrames of the workload and returns the frames per second. Lockstep
+  // runs one instruction per Run, the PPU and APU are synced after each.
+  double MeasureFrameWorkload(const Cpu &loaded, bool lockstep, u32 &catchUps, u32 &nmis)
+  {
+    Cpu *cpu       = new Cpu(loaded);
+    s32  overshoot = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (u32 frame = 0; frame < benchCatchUpFrames; ++frame)
+    {
+      s32 cycles = (s32)frameCycles - overshoot;
+
+      if (lockstep)
+      {
+        s64 end = cpu->GetCycleCount() + cycles;
+
+        while (cpu->GetCycleCount() < end)
+          cpu->Run(1);
+
+        overshoot = (s32)(cpu->GetCycleCount() - end);
+      }
+      else
+        overshoot = cpu->Run(cycles);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    catchUps = cpu->GetCatchUps();
+    nmis     = cpu->ReadMemory(0x0700);
+
+    delete cpu;
+
+    return benchCatchUpFrames / elapsed.count();
+  }
+
+  // Catching the PPU and APU up at events and register accesses, against syncing them after
+  // every instruction
+  int CatchUpBenchmark()
+  {
+    Cpu *loaded = LoadFrameWorkload();
+    u32  catchUps[2];
+    u32  nmis    [2];
+
+    double catchUp  = MeasureFrameWorkload(*loaded, false, catchUps[0], nmis[0]);
+    double lockstep = MeasureFrameWorkload(*loaded, true , catchUps[1], nmis[1]);
+
+    printf("catch-up: %8.2f us/frame, %4u catch-ups in the last frame\n", 1e6 / catchUp, catchUps[0]);
+    printf("lockstep: %8.2f us/frame\n", 1e6 / lockstep);
+    printf("catch-up / lockstep: %6.2fx\n", catchUp / lockstep);
+
+    delete loaded;
+
+    if (nmis[0] != nmis[1])
+    {
+      printf("catch-up ran %u NMIs, lockstep %u\n", nmis[0], nmis[1]);
+      return 1;
+    }
+
+    return 0;
+  }
+
+  // Seconds per call of op, over count calls
+  template<typename Op>
+  double MeasureStates(u32 count, Op op)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    for (u32 i = 0; i < count; ++i)
+      op(i);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / count;
+  }
+
+  int SaveStateBenchmark()
+  {
+    const char *stateFile = "savestate-bench.state";
+
+    Cpu *cpu = LoadFrameWorkload();
+
+    cpu->Run(frameCycles * 10 + 1234);
+
+    std::unique_ptr<SaveState> state(new SaveState());
+    bool                       restored = true;
+
+    double save    = MeasureStates(benchStates, [&](u32) { cpu->Save(*state); });
+    double restore = MeasureStates(benchStates, [&](u32) { restored &= cpu->Restore(*state); });
+
+    // Restoring over a machine that ran on since, with a frame between restores
+    double rewind = MeasureStates(benchStates / 100, [&](u32) {
+      cpu->Run(frameCycles);
+      restored &= cpu->Restore(*state);
+    }) - MeasureStates(benchStates / 100, [&](u32) { cpu->Run(frameCycles); });
+
+    StateFile file;
+
+    double files = MeasureStates(benchStateFiles, [&](u32) {
+      restored &= StateFile::Save(stateFile, *state) && file.Load(stateFile) && cpu->Restore(*file.Get());
+    });
+
+    file.Close();
+    remove(stateFile);
+
+    printf("state size         : %8u bytes\n", (u32)sizeof(SaveState));
+    printf("save               : %8.2f us\n", save * 1e6);
+    printf("restore            : %8.2f us\n", restore * 1e6);
+    printf("restore after frame: %8.2f us\n", rewind * 1e6);
+    printf("file round trip    : %8.2f us\n", files * 1e6);
+
+    delete cpu;
+
+    if (!restored)
+    {
+      printf("a state failed to restore\n");
+      return 1;
+    }
+
+    return 0;
+  }
+
+  // A point every frame, the size of 10 minutes of them and the worst push
+  int RewindBenchmark()
+  {
+    Cpu    *cpu = LoadFrameWorkload();
+    Rewind  rewind;
+    double  pushes = 0;
+    double  worst  = 0;
+
+    for (u32 frame = 0; frame < benchRewindFrames; ++frame)
+    {
+      cpu->Run(frameCycles);
+
+      auto start = std::chrono::steady_clock::now();
+
+      rewind.Push(*cpu);
+
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      pushes += elapsed.count();
+      worst   = std::max(worst, elapsed.count());
+    }
+
+    u32    points   = rewind.GetCount();
+    double perPoint = (double)rewind.GetUsed() / (points - 1);
+    double pops     = MeasureStates(points, [&](u32) { rewind.Pop(*cpu); });
+
+    printf("push             : %8.2f us, worst %.2f us\n", pushes / benchRewindFrames * 1e6, worst * 1e6);
+    printf("pop              : %8.2f us\n", pops * 1e6);
+    printf("delta            : %8.0f bytes, %u byte states\n", perPoint, (u32)sizeof(SaveState));
+    printf("10 minutes at 60 : %8.2f MB\n", perPoint * Rewind::defaultPoints / (1 << 20));
+
+    delete cpu;
+
+    if (points != benchRewindFrames || rewind.GetCount() != 0)
+    {
+      printf("kept %u points of %u, %u left after popping them\n", points, benchRewindFrames, rewind.GetCount());
+      return 1;
+    }
+
+    return 0;
+  }
+
+  // Children of a machine with its PRG RAM, CHR RAM and nametables filled, benchForkChildren
+  // alive at a time as a search keeps them: forked against copied, then with a frame run in each
+  int ForkBenchmark()
+  {
+    Cpu *cpu = LoadFrameWorkload();
+
+    cpu->Run(frameCycles * 10);
+
+    for (u32 i = 0; i < 0x2000; ++i)
+    {
+      cpu->WriteMemory(0x6000 + i, (u8)(i * 7 + 1));
+      cpu->GetPpu().WriteMemory(i, (u8)(i * 3 + 1));
+    }
+
+    for (u32 i = 0; i < 0x800; ++i)
+      cpu->GetPpu().WriteMemory(0x2000 + i, (u8)(i + 1));
+
+    std::vector<std::unique_ptr<Cpu>> children(benchForkChildren);
+
+    double copy = MeasureStates(benchForks, [&](u32 i) { children[i % benchForkChildren].reset(new Cpu(*cpu)); });
+    double fork = MeasureStates(benchForks, [&](u32 i) { children[i % benchForkChildren] = cpu->Fork(); });
+
+    double copyFrame = MeasureStates(benchForks / 10, [&](u32 i) {
+      children[i % benchForkChildren].reset(new Cpu(*cpu));
+      children[i % benchForkChildren]->Run(frameCycles);
+    });
+    double forkFrame = MeasureStates(benchForks / 10, [&](u32 i) {
+      children[i % benchForkChildren] = cpu->Fork();
+      children[i % benchForkChildren]->Run(frameCycles);
+    });
+
+    bool same = children[0]->GetCycleCount() >= cpu->GetCycleCount() + frameCycles &&
+                children[0]->ReadMemory(0x6123) == cpu->ReadMemory(0x6123);
+
+    printf("copy             : %8.2f us, %8.0f/s\n", copy * 1e6, 1 / copy);
+    printf("fork             : %8.2f us, %8.0f/s\n", fork * 1e6, 1 / fork);
+    printf("copy + frame     : %8.2f us\n", copyFrame * 1e6);
+    printf("fork + frame     : %8.2f us\n", forkFrame * 1e6);
+    printf("fork / copy      : %8.2fx\n", copy / fork);
+
+    children.clear();
+    delete cpu;
+
+    if (!same)
+    {
+      printf("a fork didn't run on from its parent\n");
+      return 1;
+    }
+
+    return 0;
+  }
+
+  // The same replays on one thread and on every core, nestest without input as the job
+  int BatchBenchmark(const std::string &romFile)
+  {
+    u32    cores = std::max(std::thread::hardware_concurrency(), 1u);
+    double fps[2];
+    u64    hash  = 0;
+    bool   same  = true;
+
+    for (u32 run = 0; run < 2; ++run)
+    {
+      Batch batch;
+
+      for (u32 job = 0; job < benchBatchJobs; ++job)
+        batch.Add({ romFile, "", benchBatchFrames });
+
+      if (!batch.Run(run == 0 ? 1 : cores))
+      {
+        printf("a job failed: %s\n", batch.GetResults()[0].error.c_str());
+        return 1;
+      }
+
+      for (const BatchResult &result : batch.GetResults())
+      {
+        same = same && (hash == 0 || result.hash == hash);
+        hash = result.hash;
+      }
+
+      fps[run] = batch.GetFrames() / batch.GetSeconds();
+    }
+
+    printf("jobs             : %8u of %u frames\n", benchBatchJobs, benchBatchFrames);
+    printf("1 thread         : %8.1f frames/s\n", fps[0]);
+    printf("%2u threads       : %8.1f frames/s\n", cores, fps[1]);
+    printf("speedup          : %8.2fx\n", fps[1] / fps[0]);
+
+    if (!same)
+    {
+      printf("the jobs ran to different hashes\n");
+      return 1;
+    }
+
+    return 0;
+  }
+
+  // 16 lanes of nestest, in four groups starting benchLockstepPhase instructions apart, as
+  // independent Cpus and as Lockstep lanes with each kernel. Only the runs are timed.
+  int LockstepBenchmark(const std::string &romFile)
+  {
+    std::unique_ptr<Cpu> loaded(new Cpu());
+
+    if (!LoadNestest(*loaded, romFile))
+      return 1;
+
+    std::vector<std::unique_ptr<Cpu>> lanes(Lockstep::maxLanes);
+    std::vector<s64>                  cycles(Lockstep::maxLanes);
+    bool                              same = true;
+
+    // Instructions per second of all lanes, run(lanes) running benchLockstepRun on each
+    auto measure = [&](auto run) {
+      std::chrono::duration<double> elapsed(0);
+      u64                           executed = 0;
+
+      while (executed < benchInstructions)
+      {
+        for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+        {
+          lanes[lane] = loaded->Fork();
+          lanes[lane]->RunInstructions((lane & 3) * benchLockstepPhase, Cpu::Dispatch::Switch);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        run();
+
+        elapsed  += std::chrono::steady_clock::now() - start;
+        executed += (u64)Lockstep::maxLanes * benchLockstepRun;
+      }
+
+      for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+      {
+        same         = same && (cycles[lane] == 0 || cycles[lane] == lanes[lane]->GetCycleCount());
+        cycles[lane] = lanes[lane]->GetCycleCount();
+      }
+
+      return executed / elapsed.count();
+    };
+
+    double sw = measure([&]() {
+      for (std::unique_ptr<Cpu> &lane : lanes)
+        lane->RunInstructions(benchLockstepRun, Cpu::Dispatch::Switch);
+    });
+    double dispatch = measure([&]() {
+      for (std::unique_ptr<Cpu> &lane : lanes)
+        lane->RunInstructions(benchLockstepRun, Cpu::defaultDispatch);
+    });
+
+    printf("16 Cpus, switch  : %8.2f M instructions/s\n", sw / 1e6);
+    printf("16 Cpus, default : %8.2f M instructions/s\n", dispatch / 1e6);
+
+    for (Lockstep::Kernel kernel : { Lockstep::Kernel::Scalar, Lockstep::Kernel::Vector, Lockstep::Kernel::Avx2, Lockstep::Kernel::Avx512 })
+    {
+      const char *name = Lockstep::GetKernelName(kernel);
+
+      if (!Lockstep::IsSupported(kernel))
+      {
+        printf("lockstep %-8s: not supported here\n", name);
+        continue;
+      }
+
+      Lockstep lockstep;
+      double   steps  = 0;
+      double   vector = 0;
+
+      double speed = measure([&]() {
+        lockstep.Clear();
+
+        for (std::unique_ptr<Cpu> &lane : lanes)
+          lockstep.Add(*lane);
+
+        lockstep.RunInstructions(kernel, benchLockstepRun);
+
+        steps  += lockstep.GetSteps();
+        vector += lockstep.GetVectorInstructions();
+      });
+
+      printf("lockstep %-8s: %8.2f M instructions/s, %5.2fx switch, %4.1f lanes per step\n",
+             name, speed / 1e6, speed / sw, steps ? vector / steps : 0);
+    }
+
+    printf("fastest here     : %s\n", Lockstep::GetKernelName(Lockstep::GetKernel()));
+
+    if (!same)
+    {
+      printf("the lanes ran to different cycle counts\n");
+      return 1;
+    }
+
+    return 0;
+  }
+}
+
+int RunBenchmark(const std::string &name, const std::string &romFile)
+{
+  if (name == "dispatch")
+    return DispatchBenchmark(romFile);
+  if (name == "threaded")
+    return ThreadedBenchmark(romFile);
+  if (name == "run")
+    return RunBatchBenchmark(romFile);
+  if (name == "block")
+    return BlockBenchmark(romFile);
+  if (name == "ppu")
+    return PpuBenchmark(romFile);
+  if (name == "tiles")
+    return TileBenchmark();
+  if (name == "palette")
+    return PaletteBenchmark(romFile);
+  if (name == "apu")
+    return ApuBenchmark(romFile);
+  if (name == "catchup")
+    return CatchUpBenchmark();
+  if (name == "savestate")
+    return SaveStateBenchmark();
+  if (name == "rewind")
+    return RewindBenchmark();
+  if (name == "fork")
+    return ForkBenchmark();
+  if (name == "batch")
+    return BatchBenchmark(romFile);
+  if (name == "lockstep")
+    return LockstepBenchmark(romFile);
+
+  printf("Unknown benchmark: %s\n", name.c_str());
+  printf("Available: dispatch, threaded, run, block, ppu, tiles, palette, apu, catchup, savestate, rewind, fork, batch, lockstep\n");
+
+  return 1;
+}
@@ -0,0 +1,12 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#pragma once
+
+#include <string>
+
+// Runs the named benchmark against the given rom and prints the results.
+// Returns the process exit code.
+int RunBenchmark(const std::string &name, const std::string &romFile);
+
+#endif //__BENCH_H__
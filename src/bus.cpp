@@ -0,0 +1,179 @@
+#include "bus.hpp"
+
+Bus::Bus()
+{
+  Unmap(0x0000, 0x10000);
+}
+
+void Bus::MapMemory(u16 address, u32 size, u8 *memory, u32 memorySize)
+{
+  MapReadOnly(address, size, memory, memorySize);
+
+  for (u32 offset = 0; offset < size; offset += pageSize)
+    writePages[(address + offset) / pageSize] = memory + offset % memorySize;
+}
+
+void Bus::MapReadOnly(u16 address, u32 size, const u8 *memory, u32 memorySize, WriteHandler write, void *context)
+{
+  for (u32 offset = 0; offset < size; offset += pageSize)
+  {
+    u32 page = (address + offset) / pageSize;
+
+    readPages [page] = memory + offset % memorySize;
+    writePages[page] = nullptr;
+    watched   [page] = false;
+    tracked   [page] = nullptr;
+    dirty     [page] = true;
+
+    // Writes to read only memory still reach the handlers, mappers listen there
+    handlers[page].read    = ReadOpenBus;
+    handlers[page].write   = write ? write : WriteIgnore;
+    handlers[page].context = context;
+  }
+}
+
+void Bus::MapHandlers(u16 address, u32 size, ReadHandler read, WriteHandler write, void *context)
+{
+  for (u32 offset = 0; offset < size; offset += pageSize)
+  {
+    u32 page = (address + offset) / pageSize;
+
+    readPages [page]       = nullptr;
+    writePages[page]       = nullptr;
+    watched   [page]       = false;
+    tracked   [page]       = nullptr;
+    dirty     [page]       = true;
+    handlers[page].read    = read;
+    handlers[page].write   = write;
+    handlers[page].context = context;
+  }
+}
+
+void Bus::Unmap(u16 address, u32 size)
+{
+  MapHandlers(address, size, ReadOpenBus, WriteIgnore, nullptr);
+}
+
+bool Bus::WatchWrites(u16 address, WriteHandler write, void *context)
+{
+  const u8 *memory  = readPages[address >> 8];
+  bool      watches = false;
+
+  // Mirrors are watched together, a page that isn't writable has none left to watch
+  if (!writePages[address >> 8] && !tracked[address >> 8])
+    return false;
+
+  for (u32 page = 0; page < pageCount; ++page)
+  {
+    if (readPages[page] != memory || (!writePages[page] && !tracked[page]))
+      continue;
+
+    writePages[page]       = nullptr;
+    tracked   [page]       = nullptr; // Watched writes flag the page themselves
+    watched   [page]       = true;
+    handlers[page].write   = write;
+    handlers[page].context = context;
+    watches                = true;
+  }
+
+  return watches;
+}
+
+void Bus::UnwatchWrites(u16 address)
+{
+  const u8 *memory = readPages[address >> 8];
+
+  for (u32 page = 0; memory && page < pageCount; ++page)
+  {
+    if (readPages[page] != memory || !watched[page])
+      continue;
+
+    // Only memory mapped writable gets watched. A page clean since TrackWrites stays tracked.
+    if (dirty[page])
+      writePages[page] = const_cast<u8 *>(memory);
+    else
+      tracked   [page] = const_cast<u8 *>(memory);
+
+    watched   [page]       = false;
+    handlers[page].write   = WriteIgnore;
+    handlers[page].context = nullptr;
+  }
+}
+
+void Bus::TrackWrites()
+{
+  for (u32 page = 0; page < pageCount; ++page)
+  {
+    if (writePages[page])
+    {
+      tracked   [page] = writePages[page];
+      writePages[page] = nullptr;
+    }
+
+    dirty[page] = false;
+  }
+}
+
+void Bus::MarkDirty()
+{
+  for (u32 page = 0; page < pageCount; ++page)
+  {
+    if (tracked[page])
+    {
+      writePages[page] = tracked[page];
+      tracked   [page] = nullptr;
+    }
+
+    dirty[page] = true;
+  }
+}
+
+const u8 *const *Bus::GetReadPages() const
+{
+  return readPages;
+}
+
+u8 *const *Bus::GetWritePages() const
+{
+  return writePages;
+}
+
+// Kept out of line so the inlined memory path stays small
+u8 Bus::ReadIo(u16 address) const
+{
+  const Handlers &io = handlers[address >> 8];
+
+  return io.read(io.context, address);
+}
+
+void Bus::WriteIo(u16 address, u8 value)
+{
+  u32 page = address >> 8;
+
+  dirty[page] = true;
+
+  // First write to a tracked page, straight to memory from now on
+  if (tracked[page])
+  {
+    writePages[page] = tracked[page];
+    tracked   [page] = nullptr;
+
+    writePages[page][address & 0xFF] = value;
+    return;
+  }
+
+  const Handlers &io = handlers[page];
+
+  io.write(io.context, address, value);
+}
+
+u8 Bus::ReadOpenBus(void *context, u16 address)
+{
+  // Nothing drives the data bus, it still holds the last byte fetched: the high byte of the address
+  return address >> 8;
+}
+
+void Bus::WriteIgnore(void *context, u16 address, u8 value)
+{
+
+}
@@ -0,0 +1,128 @@
+#ifndef __BUS_H__
+#define __BUS_H__
+
+#pragma once
+
+#include "types.hpp"
+
+/* CPU address space. The 64KB are split in 256 pages of 256 bytes; each page either points
+   straight at the memory behind it or, for I/O, at a pair of handlers. Plain reads and writes
+   cost one table lookup and one load or store, handlers are only called for I/O pages and
+   for writes to read only pages such as PRG ROM. */
+class Bus {
+public:
+  typedef u8   (*ReadHandler) (void *context, u16 address);
+  typedef void (*WriteHandler)(void *context, u16 address, u8 value);
+
+  static const u32 pageSize  = 0x100;
+  static const u32 pageCount = 0x100;
+
+  Bus();
+
+  FORCEINLINE u8   Read (u16 address) const;
+  FORCEINLINE void Write(u16 address, u8 value);
+
+  // Maps [address, address + size) to memory. memorySize bytes are repeated over the range,
+  // which is how mirrors are built. Sizes and addresses are multiples of pageSize.
+  void MapMemory   (u16 address, u32 size, u8 *memory, u32 memorySize);
+
+  // Same as MapMemory for memory that can't be written, such as ROM. Writes go to write,
+  // which is where mappers take their bank switches, and are dropped without one.
+  void MapReadOnly (u16 address, u32 size, const u8 *memory, u32 memorySize, WriteHandler write = nullptr, void *context = nullptr);
+
+  // Maps [address, address + size) to handlers, context is passed back on every call.
+  void MapHandlers (u16 address, u32 size, ReadHandler read, WriteHandler write, void *context);
+
+  // Back to open bus: reads return the high byte of the address and writes are dropped.
+  void Unmap       (u16 address, u32 size);
+
+  // Memory behind address, null for pages read through handlers. Two banks mapped at the
+  // same address give different pointers.
+  FORCEINLINE const u8 *GetMemory(u16 address) const;
+
+  // Writable memory behind address, watched pages included. False for I/O and ROM.
+  FORCEINLINE bool IsWritable(u16 address) const;
+  FORCEINLINE bool IsWatched (u16 address) const; // Between WatchWrites and UnwatchWrites
+
+  // The page tables, for generated code that does the lookups of Read and Write itself
+  const u8 *const *GetReadPages () const;
+  u8 *const       *GetWritePages() const;
+
+  // Sends writes to every writable page holding the same memory as address through write,
+  // mirrors included, until UnwatchWrites. Reads stay direct. False when nothing was writable.
+  bool WatchWrites  (u16 address, WriteHandler write, void *context);
+  void UnwatchWrites(u16 address);
+
+  // Dirty pages, for snapshots that only copy what changed. TrackWrites takes the writable
+  // pages off the direct path until their first write, which flags the page and maps it
+  // back: a page costs one handler call per snapshot and the memory path nothing. Every
+  // other write flags its page on the way to the handlers. The CPU writes zero page and
+  // the stack without the bus, those pages are never flagged.
+  void TrackWrites  (); // Clears the flags
+  void MarkDirty    (); // Flags every page, after memory changed behind the bus
+  FORCEINLINE bool IsDirty(u16 address) const; // Written since TrackWrites, or mapped since
+
+private:
+  struct Handlers {
+    ReadHandler  read;
+    WriteHandler write;
+    void        *context;
+  };
+
+  const u8 *readPages [pageCount]; // Null when the page is read through its handlers
+  u8       *writePages[pageCount]; // Null when the page is written through its handlers
+  Handlers  handlers  [pageCount];
+  bool      watched   [pageCount]; // Writable memory whose writes are sent to the handlers
+  u8       *tracked   [pageCount]; // Write page held back until its first write since TrackWrites
+  bool      dirty     [pageCount];
+
+  u8   ReadIo           (u16 address) const;
+  void WriteIo          (u16 address, u8 value);
+
+  static u8   ReadOpenBus (void *context, u16 address);
+  static void WriteIgnore (void *context, u16 address, u8 value);
+};
+
+FORCEINLINE u8 Bus::Read(u16 address) const
+{
+  const u8 *page = readPages[address >> 8];
+
+  if (page)
+    return page[address & 0xFF];
+
+  return ReadIo(address);
+}
+
+FORCEINLINE void Bus::Write(u16 address, u8 value)
+{
+  u8 *page = writePages[address >> 8];
+
+  if (page)
+    page[address & 0xFF] = value;
+  else
+    WriteIo(address, value);
+}
+
+FORCEINLINE const u8 *Bus::GetMemory(u16 address) const
+{
+  const u8 *page = readPages[address >> 8];
+
+  return page ? page + (address & 0xFF) : nullptr;
+}
+
+FORCEINLINE bool Bus::IsWritable(u16 address) const
+{
+  return writePages[address >> 8] || watched[address >> 8] || tracked[address >> 8];
+}
+
+FORCEINLINE bool Bus::IsWatched(u16 address) const
+{
+  return watched[address >> 8];
+}
+
+FORCEINLINE bool Bus::IsDirty(u16 address) const
+{
+  return dirty[address >> 8];
+}
+
+#endif //__BUS_H__
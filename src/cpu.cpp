@@ -1,2320 +1,1454 @@
-#include "cpu.hpp"
-#pragma warning(disable:4996) // Disable error when using fopen
-
-Cpu::Cpu()
-{
-  Reset();
-}
-
-Cpu::~Cpu()
-{
-
-}
-
-// ToDo Review this method, done really fast to testing test rom.
-void Cpu::LoadRom(std::string romFile)
-{
-  FILE *pRom = nullptr;
-  u16   romHeader[16]; // ToDo Move to a memory class
-  u16   ppuMemory[0x10000]; // ToDo Move to ppu class. 64KB of memory with addresses from 0x0000 to 0xFFFF]
-
-  pRom = fopen(romFile.c_str(), "rb");
-
-  fread(&romHeader[0], 1, 16, pRom);
-
-  // Load Rom Header
-  s16 prgRomBanks     = romHeader[4]; // Count of 16KB rom banks
-  s16 chrRomBanks     = romHeader[5]; // Count of 8KB chr-rom/vrom banks 
-  s16 romControlByte1 = romHeader[6]; // Bit dependant
-  s16 romControlByte2 = romHeader[7]; //
-  
-  // Get Rom Size
-  fseek(pRom, 0, SEEK_END);
-
-  u32 romSize = ftell(pRom);
-
-  rewind(pRom);
-
-  // Create Rom Memory
-  u8 *pRomMemory = new u8[romSize];
-
-  memset(pRomMemory, 0, sizeof(pRomMemory));
-  memset(ram       , 0, sizeof(ram       ));
-  memset(ppuMemory , 0, sizeof(ppuMemory ));
-
-  cycleCount = 0;
-
-  // Seek Header (16) ???
-  u16 bytesToRead = (prgRomBanks * 0x4000) + (chrRomBanks * 0x2000) + header;
-
-  // Load everything from the Rom file to Rom memory
-  size_t result   = fread(pRomMemory, 1 , bytesToRead, pRom);
-
-  // Load Program Rom
-  memcpy(&ram[0x8000], pRomMemory + header, 0x4000 * 2); // Copy 16KB * 2 banks
-  //memcpy(&ram[0xC000], pRomMemory + header, 0x4000 * 2); // Copy 16KB * 2 banks
-
-  // Load Video Rom 
-  memcpy(&ppuMemory[0x0000], pRomMemory + 0x4000 + header, 0x2000); // Copy 8KB
-  
-  // Generate initial PC value
-  u16 LL = ram[0xFFFC]; // low byte
-  u16 HH = ram[0xFFFD]; // high byte
-  HH <<= 8;
-  u16 initialPC = HH | LL;
-
-  initialPC = 0xC000; // To test nestest rom
-
-  PC = initialPC;
-}
-
-void Cpu::NextOpcode()
-{
-  SetStatus();
-
-  // ToDo Fix all this code, done really fast to testing test rom.
-  u16 opcode = ram[PC] & 0x00FF;
-
-  printf("PC -%X- Opcode: %X\n", PC, opcode);
-
-  ProcessOpcode(opcode);
-}
-
-void Cpu::ProcessOpcode(u16 opcode)
-{
-  switch (opcode)
-  {
-    /* Load/Store Operations: Load a register from memory or stores the contents of a register to memory. */
-    case 0xA9: LDA_A9(); break; 
-    case 0xAD: LDA_AD(); break; 
-    case 0xBD: LDA_BD(); break; 
-    case 0xB9: LDA_B9(); break; 
-    case 0xA5: LDA_A5(); break; 
-    case 0xB5: LDA_B5(); break; 
-    case 0xA1: LDA_A1(); break; 
-    case 0xB1: LDA_B1(); break; 
-    case 0xA2: LDX_A2(); break; 
-    case 0xAE: LDX_AE(); break; 
-    case 0xBE: LDX_BE(); break; 
-    case 0xA6: LDX_A6(); break; 
-    case 0xB6: LDX_B6(); break; 
-    case 0xA0: LDY_A0(); break; 
-    case 0xAC: LDY_AC(); break; 
-    case 0xBC: LDY_BC(); break; 
-    case 0xA4: LDY_A4(); break; 
-    case 0xB4: LDY_B4(); break; 
-    case 0x8D: STA_8D(); break; 
-    case 0x9D: STA_9D(); break; 
-    case 0x99: STA_99(); break; 
-    case 0x85: STA_85(); break; 
-    case 0x95: STA_95(); break; 
-    case 0x81: STA_81(); break; 
-    case 0x91: STA_91(); break; 
-    case 0x8E: STX_8E(); break; 
-    case 0x86: STX_86(); break; 
-    case 0x96: STX_96(); break; 
-    case 0x8C: STY_8C(); break; 
-    case 0x84: STY_84(); break; 
-    case 0x94: STY_94(); break; 
-
-    /* Register Transfer Operations: Copy contents of X or Y register to the accumulator or copy contents of accumulator to X or Y register. */
-    case 0xAA: TAX_AA(); break;
-    case 0xA8: TAY_A8(); break;
-    case 0x8A: TXA_8A(); break;
-    case 0x98: TYA_98(); break;
-
-    /* Stack Operations: Push or pull the stack or manipulate stack pointer using X register. */
-    case 0x48: PHA_48(); break;
-    case 0x08: PHP_08(); break;
-    case 0x68: PLA_68(); break;
-    case 0x28: PLP_28(); break;
-    case 0xBA: TSX_BA(); break;
-    case 0x9A: TXS_9A(); break;
-
-    /* Logical Operations: Perform logical operations on the accumulator and a value stored in memory. */
-    case 0x29: AND_29(); break;
-    case 0x2D: AND_2D(); break;
-    case 0x3D: AND_3D(); break;
-    case 0x39: AND_39(); break;
-    case 0x25: AND_25(); break;
-    case 0x35: AND_35(); break;
-    case 0x21: AND_21(); break;
-    case 0x31: AND_31(); break;
-    case 0x49: EOR_49(); break;
-    case 0x4D: EOR_4D(); break;
-    case 0x5D: EOR_5D(); break;
-    case 0x59: EOR_59(); break;
-    case 0x45: EOR_45(); break;
-    case 0x55: EOR_55(); break;
-    case 0x41: EOR_41(); break;
-    case 0x51: EOR_51(); break;
-    case 0x09: ORA_09(); break;
-    case 0x0D: ORA_0D(); break;
-    case 0x1D: ORA_1D(); break;
-    case 0x19: ORA_19(); break;
-    case 0x05: ORA_05(); break;
-    case 0x15: ORA_15(); break;
-    case 0x01: ORA_01(); break;
-    case 0x11: ORA_11(); break;
-    case 0x2C: BIT_2C(); break;
-    case 0x24: BIT_24(); break;
-
-    /* Arithmetic Operations: Perform arithmetic operations on registers and memory. */
-    case 0x2A: ROL_2A(); break;
-    case 0x2E: ROL_2E(); break;
-    case 0x3E: ROL_3E(); break;
-    case 0x26: ROL_26(); break;
-    case 0x36: ROL_36(); break;
-    case 0x6A: ROR_6A(); break;
-    case 0x6E: ROR_6E(); break;
-    case 0x7E: ROR_7E(); break;
-    case 0x66: ROR_66(); break;
-    case 0x76: ROR_76(); break;
-    case 0x69: ADC_69(); break;
-    case 0x6D: ADC_6D(); break;
-    case 0x7D: ADC_7D(); break;
-    case 0x79: ADC_79(); break;
-    case 0x65: ADC_65(); break;
-    case 0x75: ADC_75(); break;
-    case 0x61: ADC_61(); break;
-    case 0x71: ADC_71(); break;
-    case 0xC9: CMP_C9(); break;
-    case 0xCD: CMP_CD(); break;
-    case 0xDD: CMP_DD(); break;
-    case 0xD9: CMP_D9(); break;
-    case 0xC5: CMP_C5(); break;
-    case 0xD5: CMP_D5(); break;
-    case 0xC1: CMP_C1(); break;
-    case 0xD1: CMP_D1(); break;
-    case 0xE0: CPX_E0(); break;
-    case 0xEC: CPX_EC(); break;
-    case 0xE4: CPX_E4(); break;
-    case 0xC0: CPY_C0(); break;
-    case 0xCC: CPY_CC(); break;
-    case 0xC4: CPY_C4(); break;
-    case 0xE9: SBC_E9(); break;
-    case 0xED: SBC_ED(); break;
-    case 0xFD: SBC_FD(); break;
-    case 0xF9: SBC_F9(); break;
-    case 0xE5: SBC_E5(); break;   
-    case 0xF5: SBC_F5(); break;
-    case 0xE1: SBC_E1(); break;
-    case 0xF1: SBC_F1(); break;
-
-    /* Increments/Decrements: Increment or decrement the X or Y registers or a value stored in memory. */
-    case 0xCE: DEC_CE(); break;
-    case 0xDE: DEC_DE(); break;
-    case 0xC6: DEC_C6(); break;
-    case 0xD6: DEC_D6(); break;
-    case 0xCA: DEX_CA(); break;
-    case 0x88: DEY_88(); break;
-    case 0xEE: INC_EE(); break;
-    case 0xFE: INC_FE(); break;
-    case 0xE6: INC_E6(); break;
-    case 0xF6: INC_F6(); break;
-    case 0xE8: INX_E8(); break;
-    case 0xC8: INY_C8(); break;
-
-    /* Shifts: Shift the bits of either the accumulator or a memory location one bit to the left or right. */
-    case 0x0A: ASL_0A(); break;
-    case 0x0E: ASL_0E(); break;
-    case 0x1E: ASL_1E(); break;
-    case 0x06: ASL_06(); break;
-    case 0x16: ASL_16(); break;
-    case 0x4A: LSR_4A(); break;
-    case 0x4E: LSR_4E(); break;
-    case 0x5E: LSR_5E(); break;
-    case 0x46: LSR_46(); break;
-    case 0x56: LSR_56(); break;
-
-    /* Jumps/Calls: Break sequential execution sequence, resuming from a specified address. */
-    case 0x60: RTS_60(); break;
-    case 0x4C: JMP_4C(); break;
-    case 0x6C: JMP_6C(); break;
-    case 0x20: JSR_20(); break;
-
-    /* Branches: Break sequential execution sequence, resuming from a specified address, if a condition is met. The condition involves examining a specific bit in the status register.*/
-    case 0x90: BCC_90(); break;
-    case 0xB0: BCS_B0(); break;
-    case 0xF0: BEQ_F0(); break;
-    case 0x30: BMI_30(); break;
-    case 0xD0: BNE_D0(); break;
-    case 0x10: BPL_10(); break;
-    case 0x50: BVC_50(); break;
-    case 0x70: BVS_70(); break;
-
-    /* Status Register Operations: Set or clear a flag in the status register. */
-    case 0x18: CLC_18(); break;
-    case 0xD8: CLD_D8(); break;
-    case 0x58: CLI_58(); break;
-    case 0xB8: CLV_B8(); break;
-    case 0x38: SEC_38(); break;
-    case 0xF8: SED_F8(); break;
-    case 0x78: SEI_78(); break;
-
-    /* System Functions: Perform rarely used functions. */
-    case 0xEA: NOP_EA(); break;
-    case 0x40: RTI_40(); break;
-    case 0x00: BRK_00(); break;
-  }
-}
-
-void Cpu::Reset()
-{
-  /* Reset flags */
-  C = false; // Bit 0
-  Z = false; // Bit 1
-  I = false; // Bit 2
-  D = false; // Bit 3
-  B = false; // Bit 4
-  U = true;  // Bit 5
-  V = false; // Bit 6
-  N = false; // Bit 7
-
-  /* Reset registers */
-  A = 0;
-  X = 0;
-  Y = 0;
-
-  SP = 0xFD; // Initial memory for Stack Pos32er
-}
-
-void Cpu::SetStatus()
-{
-  status = 0;
-
-  if (C) status |= flagCvalue; // Bit 0
-  if (Z) status |= flagZvalue; // Bit 1
-  if (I) status |= flagIvalue; // Bit 2
-  if (D) status |= flagDvalue; // Bit 3
-  if (B) status |= flagBvalue; // Bit 4
-  if (U) status |= flagUvalue; // Bit 5
-  if (V) status |= flagVvalue; // Bit 6
-  if (N) status |= flagNvalue; // Bit 7
-}
-
-void Cpu::SetStatus(u8 newStatus)
-{
-  C = (newStatus & flagCvalue) == flagCvalue;
-  Z = (newStatus & flagZvalue) == flagZvalue;
-  I = (newStatus & flagIvalue) == flagIvalue;
-  D = (newStatus & flagDvalue) == flagDvalue;
-  B = (newStatus & flagBvalue) == flagBvalue;
-  U = (newStatus & flagUvalue) == flagUvalue;
-  V = (newStatus & flagVvalue) == flagVvalue;
-  N = (newStatus & flagNvalue) == flagNvalue;
-
-  SetStatus();
-}
-
-void Cpu::SetNMI(bool value)
-{
-  NMI = value;
-}
-
-void Cpu::SetIRQ(bool value)
-{
-  IRQ = value;
-}
-
-/* Addressing modes */
-u8 Cpu::ZeroPage(s32 cycles)
-{
-  u8 result = ram[PC + 1] + X;
-
-  cycleCount += cycles;
-  PC         += 2;
-
-  return result;
-}
-
-u8 Cpu::ZeroPageX(s32 cycles)
-{
-  u8 result = ram[PC + 1];
-
-  cycleCount += cycles;
-  PC         += 2;
-
-  return result;
-}
-
-u8 Cpu::ZeroPageY(s32 cycles)
-{
-  u8 result = ram[PC + 1] + Y;
-
-  cycleCount += cycles;
-  PC         += 2;
-
-  return result;
-}
-
-u16 Cpu::Absolute(s32 cycles)
-{
-  u16 LL = ram[PC + 1]; // low byte
-  u16 HH = ram[PC + 2]; // high byte
-  HH <<= 8;
-  u16 result = HH | LL;
-
-  cycleCount += cycles;
-  PC         += 3;
-
-  return result;
-}
-
-u16 Cpu::AbsoluteX(s32 cycles, s32 extraCycles)
-{
-  u16 LL = ram[PC + 1]; // low byte
-  u16 HH = ram[PC + 2]; // high byte
-  HH <<= 8;
-  u16 result = (HH | LL) + X;
-
-  // Check if it was page cross
-  if (extraCycles) 
-  {
-    if (LL + X <= 255)
-      extraCycles = 0;
-  }
-
-  cycleCount += cycles + extraCycles;
-  PC         += 3;
-
-  return result;
-}
-
-u16 Cpu::AbsoluteY(s32 cycles, s32 extraCycles)
-{
-  u16 LL = ram[PC + 1]; // low byte
-  u16 HH = ram[PC + 2]; // high byte
-  HH <<= 8;
-  u16 result = (HH | LL) + Y;
-
-  // Check if it is page cross
-  if (extraCycles)
-  {
-    if (LL + Y <= 255)
-      extraCycles = 0;
-  }
-
-  cycleCount += cycles + extraCycles;
-  PC         += 3;
-
-  return result;
-}
-
-u16 Cpu::Indirect(s32 cycles)
-{
-  u16 LL = ram[PC + 1]; // low byte
-  u16 HH = ram[PC + 2]; // high byte
-  HH <<= 8;
-  u16 address = (HH | LL);
-
-  u16 XX = ram[address];
-  u16 YY;
-
-  // Check if memory is out of bounds
-  if (address + 1 > 0x02FF)
-  {
-    address -= 0x00FF;
-    YY = ram[address];
-  }
-  else
-  {
-    YY = ram[address + 1];
-  }
-
-  YY <<= 8;
-
-  u16 result = (YY | XX);
-
-  cycleCount += cycles;
-  PC         += 3;
-
-  return result;
-}
-
-u16 Cpu::IndirectXPreIndexing(s32 cycles)
-{
-  u16 BB = ram[PC + 1]; // low byte
-  u16 XX = ram[BB + X];
-  u16 YY = ram[BB + X + 1];
-
-  YY <<= 8;
-
-  u16 result = (YY | XX);
-
-  cycleCount += cycles;
-  PC         += 2;
-
-  return result;
-}
-
-u16 Cpu::IndirectYPostIndexing(s32 cycles, s32 extraCycles)
-{
-  u16 BB = ram[PC + 1]; // low byte    
-  u16 XX = ram[BB];
-  u16 YY = ram[BB + 1];
-
-  YY <<= 8;
-
-  u16 result = (YY | XX) + Y;
-
-  // Check if it is page cross
-  if (extraCycles)
-  {
-    if (XX + Y <= 255)
-      extraCycles = 0;
-  }
-
-  cycleCount += cycles + extraCycles;
-  PC         += 2;
-
-  return result;
-}
-
-u16 Cpu::Immediate(s32 cycles)
-{
-  u16 result = PC + 1;
-
-  cycleCount += cycles;
-  PC         += 2;
-
-  return result;
-}
-
-/* Load/Store Operations: Load a register from memory or stores the contents of a register to memory. */
-void Cpu::LDA_A9() // Immediate, 2 cycles
-{
-  A = ram[Immediate(2)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_AD() // Absolute , 4 cycles
-{
-  A = ram[Absolute(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_BD() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{
-  A = ram[AbsoluteX(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_B9() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  A = ram[AbsoluteY(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_A5() // Zero page, 3 cycles
-{
-  A = ram[ZeroPage(3)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_B5() // Zero page X, 4 cycles
-{
-  A = ram[ZeroPageX(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_A1() // Indirect X Pre-Indexing, 6 cycles
-{
-  A = ram[IndirectXPreIndexing(6)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDA_B1() // Indirect Y Post-Indexing, 5 cycles
-{
-  A = ram[IndirectYPostIndexing(5)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::LDX_A2() // Immediate, 2 cycles
-{
-  X = ram[Immediate(2)];
-
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-}
-
-void Cpu::LDX_AE() // Absolute , 4 cycles
-{
-  X = ram[Absolute(4)];
-
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-}
-
-void Cpu::LDX_BE() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  X = ram[AbsoluteY(4, 1)];
-
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-}
-
-void Cpu::LDX_A6() // Zero page, 3 cycles
-{
-  X = ram[ZeroPage(3)];
-
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-}
-
-void Cpu::LDX_B6() // Zero page Y, 4 cycles
-{
-  X = ram[ZeroPageY(4)];
-
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-}
-
-void Cpu::LDY_A0() // Immediate, 2 cycles
-{
-  Y = ram[Immediate(2)];
-
-  // Set flags
-  Z = Y == 0;
-  N = (Y & 0x80) == 0x80;
-}
-
-void Cpu::LDY_AC() // Absolute , 4 cycles
-{
-  Y = ram[Absolute(4)];
-
-  // Set flags
-  Z = Y == 0;
-  N = (Y & 0x80) == 0x80;
-}
-
-void Cpu::LDY_BC() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  Y = ram[AbsoluteX(4, 1)];
-
-  // Set flags
-  Z = Y == 0;
-  N = (Y & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::LDY_A4() // Zero page, 3 cycles
-{
-  Y = ram[ZeroPage(3)];
-
-  // Set flags
-  Z = Y == 0;
-  N = (Y & 0x80) == 0x80;
-}
-
-void Cpu::LDY_B4() // Zero page X, 4 cycles
-{
-  Y = ram[ZeroPageX(4)];
-
-  // Set flags
-  Z = Y == 0;
-  N = (Y & 0x80) == 0x80;
-}
-
-void Cpu::STA_8D() // Absolute, 4 cycles
-{
-  u16 position = Absolute(4);
-
-  ram[position] = A;
-}
-
-void Cpu::STA_9D() // Absolute X Indexing, 5 cycles
-{
-  u16 position = AbsoluteX(5);
-
-  ram[position] = A;
-}
-
-void Cpu::STA_99() // Absolute Y Indexing, 5 cycles
-{
-  u16 position = AbsoluteY(5);
-
-  ram[position] = A;
-}
-
-void Cpu::STA_85() // Zero page, 3 cycles
-{
-  u16 position = ZeroPage(3);
-
-  ram[position] = A;
-}
-
-void Cpu::STA_95() // Zero page X, 4 cycles
-{
-  u16 position = ZeroPageX(4);
-
-  ram[position] = A;
-}
-
-void Cpu::STA_81() // Indirect X Pre-Indexing, 6 cycles
-{
-  u16 position = IndirectXPreIndexing(6);
-
-  ram[position] = A;
-}
-
-void Cpu::STA_91() // Indirect Y Post-Indexing, 6 cycles
-{
-  u16 position = IndirectYPostIndexing(6);
-
-  ram[position] = A;
-}
-
-void Cpu::STX_8E() // Absolute, 4 cycles
-{
-  u16 position = Absolute(4);
-
-  ram[position] = X;
-}
-
-void Cpu::STX_86() // Zero page, 3 cycles
-{
-  u16 position = ZeroPage(3);
-
-  ram[position] = X;
-}
-
-void Cpu::STX_96() // Zero page Y, 4 cycles
-{
-  u16 position = ZeroPageY(4);
-
-  ram[position] = X;
-}
-
-void Cpu::STY_8C() // Absolute, 4 cycles
-{
-  u16 position = Absolute(4);
-
-  ram[position] = Y;
-}
-
-void Cpu::STY_84() // Zero page, 3 cycles
-{
-  u16 position = ZeroPage(3);
-
-  ram[position] = Y;
-}
-
-void Cpu::STY_94() // Zero page X, 4 cycles
-{
-  u16 position = ZeroPageX(4);
-
-  ram[position] = Y;
-}
-
-/* Register Transfer Operations: Copy contents of X or Y register to the accumulator or copy contents of accumulator to X or Y register. */
-void Cpu::TAX_AA() // Implied, 2 cycles
-{
-  X = A;
-    
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::TAY_A8() // Implied, 2 cycles
-{
-  Y = A;
-    
-  // Set flags
-  Z = Y == 0;
-  N = (Y & 0x80) == 0x80;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::TXA_8A() // Implied, 2 cycles
-{
-  A = X;
-    
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::TYA_98() // Implied, 2 cycles
-{
-  A = Y;
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-/* Stack Operations: Push or pull the stack or manipulate stack pos32er using X register. */
-void Cpu::PHA_48() // Implied, 3 cycles
-{
-  SP--; // Decrement before pushing on
-  ram[0x101 + SP] = A;
-
-  cycleCount += 3;
-  ++PC;
-}
-
-void Cpu::PHP_08() // Implied, 3 cycles
-{
-  SP--; // Decrement before pushing on
-  ram[0x101 + SP] = status;
-
-  cycleCount += 3;
-  ++PC;
-}
-
-void Cpu::PLA_68() // Implied, 4 cycles
-{
-  A = ram[0x101 + SP];
-  SP++;  // Decrement after pulled off
-    
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  cycleCount += 4;
-  ++PC;
-}
-
-void Cpu::PLP_28() // Implied, 4 cycles
-{
-  u8 newStatus = ram[0x101 + SP];
-  SP++;  // Decrement after pulled off
-
-  SetStatus(newStatus);
-
-  cycleCount += 4;
-  ++PC;
-}
-
-void Cpu::TSX_BA()  // Implied, 2 cycles
-{
-  X = SP; 
-
-  // Set flags
-  Z = X == 0;
-  N = (X & 0x80) == 0x80;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::TXS_9A() // Implied, 2 cycles
-{
-  SP = X;
-    
-  cycleCount += 2;
-  ++PC;
-}
-
-/* Logical Operations: Perform logical operations on the accumulator and a value stored in memory. */
-void Cpu::AND_29() // Immediate, 2 cycles
-{
-  A = A & ram[Immediate(2)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::AND_2D() // Absolute, 4 cycles
-{
-  A = A & ram[Absolute(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::AND_3D() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  A = A & ram[AbsoluteX(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::AND_39() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  A = A & ram[AbsoluteY(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::AND_25() // Zero page, 3 cycles
-{
-  A = A & ram[ZeroPage(3)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::AND_35() // Zero page X, 4 cycles
-{
-  A = A & ram[ZeroPageX(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::AND_21() // Indirect X Pre-Indexing, 6 cycles
-{
-  A = A & ram[IndirectXPreIndexing(6)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::AND_31() // Indirect Y Post-Indexing, 5 cycles
-{
-  A = A & ram[IndirectYPostIndexing(5)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::EOR_49() // Immediate, 2 cycles
-{
-  A = A ^ ram[Immediate(2)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::EOR_4D() // Absolute, 4 cycles
-{
-  A = A ^ ram[Absolute(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::EOR_5D() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  A = A ^ ram[AbsoluteX(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::EOR_59() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  A = A ^ ram[AbsoluteY(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::EOR_45() // Zero page, 3 cycles
-{
-  A = A ^ ram[ZeroPage(3)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::EOR_55() // Zero page X, 4 cycles
-{
-  A = A ^ ram[ZeroPageX(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::EOR_41() // Indirect X Pre-Indexing, 6 cycles
-{
-  A = A ^ ram[IndirectXPreIndexing(6)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::EOR_51() // Indirect Y Post-Indexing, 5 cycles, + 1 if a page is crossed
-{
-  A = A ^ ram[IndirectYPostIndexing(5, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::ORA_09() // Immediate, 2 cycles
-{
-  A = A | ram[Immediate(2)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::ORA_0D() // Absolute, 4 cycles
-{
-  A = A | ram[Absolute(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::ORA_1D() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  A = A | ram[AbsoluteX(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::ORA_19() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 previousState = PC & 0xFF00;
-  A = A | ram[AbsoluteY(4, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-
-  // If page crossed, 1 more cycle
-  if (previousState != (PC & 0xFF00))
-    cycleCount++;
-}
-
-void Cpu::ORA_05() // Zero page, 3 cycles
-{
-  A = A | ram[ZeroPage(3)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::ORA_15() // Zero page X, 4 cycles
-{
-  A = A | ram[ZeroPageX(4)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::ORA_01() // Indirect X Pre-Indexing, 6 cycles
-{
-  A = A | ram[IndirectXPreIndexing(6)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::ORA_11() // Indirect Y Post-Indexing, 5 cycles, + 1 if a page is crossed
-{
-  A = A | ram[IndirectYPostIndexing(5, 1)];
-
-  // Set flags
-  Z = A == 0;
-  N = (A & 0x80) == 0x80;
-}
-
-void Cpu::BIT_2C() // Absolute, 4 cycles
-{
-  u8 ramPos = ram[Absolute(4)];
-  u8 result = A | ramPos;
-
-  // Set flags
-  Z = result == 0;
-  V = (ramPos & 0x40) == 0x40;
-  N = (ramPos & 0x80) == 0x80;
-}
-
-void Cpu::BIT_24() // Zero page, 3 cycles
-{
-  u8 ramPos = ram[ZeroPage(3)];
-  u8 result = A | ramPos;
-
-  // Set flags
-  Z = result == 0;
-  V = (ramPos & 0x40) == 0x40;
-  N = (ramPos & 0x80) == 0x80;
-}
-
-/* Arithmetic Operations: Perform arithmetic operations on registers and memory. */
-void Cpu::ROL_2A() // Accumulator, 2 cycles
-{
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x80;
-     
-  // Shift 1 bit left
-  A <<= 1;
-
-  if (previousCarry)
-    A |= 1 << 0;
-  else
-    A &= ~(1 << 0);
-
-  N = previousCarry;
-  Z = A == 0;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::ROL_2E() // Absolute, 6 cycles
-{
-  u16 position = Absolute(6);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x80;
-
-  // Shift 1 bit left
-  memValue <<= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 0;
-  else
-    memValue &= ~(1 << 0);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROL_3E() // Absolute X , 7 cycles
-{
-  u16 position = AbsoluteX(7);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x80;
-
-  // Shift 1 bit left
-  memValue <<= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 0;
-  else
-    memValue &= ~(1 << 0);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROL_26() // Zero page, 5 cycles
-{
-  u16 position = ZeroPage(5);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x80;
-
-  // Shift 1 bit left
-  memValue <<= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 0;
-  else
-    memValue &= ~(1 << 0);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROL_36() // Zero page X Indexing, 6 cycles
-{
-  u16 position = ZeroPageX(6);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x80;
-
-  // Shift 1 bit left
-  memValue <<= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 0;
-  else
-    memValue &= ~(1 << 0);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROR_6A()// Accumulator, 2 cycles
-{
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x01;
-
-  // Shift 1 bit left
-  A >>= 1;
-
-  if (previousCarry)
-    A |= 1 << 7;
-  else
-    A &= ~(1 << 7);
-
-  N = previousCarry;
-  Z = A == 0;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::ROR_6E() // Absolute, 6 cycles
-{
-  u16 position = Absolute(6);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x01;
-
-  // Shift 1 bit left
-  memValue >>= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 7;
-  else
-    memValue &= ~(1 << 7);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROR_7E() // Absolute X, 7 cycles
-{
-  u16 position = AbsoluteX(7);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x01;
-
-  // Shift 1 bit left
-  memValue >>= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 7;
-  else
-    memValue &= ~(1 << 7);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROR_66() // Zero page, 5 cycles
-{
-  u16 position = ZeroPage(5);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x01;
-
-  // Shift 1 bit left
-  memValue >>= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 7;
-  else
-    memValue &= ~(1 << 7);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ROR_76() // Zero page X Indexing, 6 cycles
-{
-  u16 position = ZeroPageX(6);
-  u8  memValue = ram[position];
-
-  // Get previous carry flag
-  bool previousCarry = C;
-
-  C = A & 0x01;
-
-  // Shift 1 bit left
-  memValue >>= 1;
-
-  if (previousCarry)
-    memValue |= 1 << 7;
-  else
-    memValue &= ~(1 << 7);
-
-  N = previousCarry;
-  Z = memValue == 0;
-
-  ram[position] = memValue;
-}
-
-
-void Cpu::ADC_69() // Immediate, 2 cycles
-{
-  u16 position  = Immediate(2);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_6D() // Absolute, 4 cycles
-{
-  u16 position  = Absolute(4);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_7D() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 position  = AbsoluteX(4, 1);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_79() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 position  = AbsoluteY(4, 1);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_65() // Zero page, 3 cycles
-{
-  u16 position  = ZeroPage(3);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_75() // Zero page X Indexing, 4 cycles
-{
-  u16 position = ZeroPageX(4);
-  u8  memValue = ram[position];
-  u8 previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_61() // Indirect X Pre-Indexing, 6 cycles
-{
-  u16 position  = IndirectXPreIndexing(6);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::ADC_71() // Indirect Y Post-Indexing, 5 cycles, + 1 if a page is crossed
-{
-  u16 position  = IndirectYPostIndexing(5, 1);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-    
-  A += memValue + C;
-
-  V = (previousA ^ A) & (memValue ^ A) & 0x80; // Overflow check
-  C = (previousA + memValue + C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-
-void Cpu::CMP_C9() // Immediate, 2 cycles
-{ 
-  u16 position  = Immediate(2);
-  u8  memValue  = ram[position];
-  u8  result    = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CMP_CD() // Absolute, 4 cycles
-{ 
-  u16 position  = Absolute(4);
-  u8  memValue  = ram[position];
-  u8  result    = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CMP_DD() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{ 
-  u16 pageBefore = PC & 0xFF00;
-  u16 position   = AbsoluteX(4);
-  u8  memValue   = ram[position];
-  u8  result     = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-
-  // Check if page was crossed
-  if ((PC & 0xFF00) != pageBefore)
-    ++cycleCount;
-}
-
-void Cpu::CMP_D9() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{
-  u16 pageBefore = PC & 0xFF00;
-  u16 position   = AbsoluteY(4);
-  u8  memValue   = ram[position];
-  u8  result     = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-
-  // Check if page was crossed
-  if ((PC & 0xFF00) != pageBefore)
-    ++cycleCount;
-}
-
-void Cpu::CMP_C5() // Zero page, 3 cycles
-{ 
-  u16 position  = ZeroPage(3);
-  u8  memValue  = ram[position];
-  u8  result    = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CMP_D5() // Zero page X Indexing, 4 cycles
-{ 
-  u16 position  = ZeroPageX(4);
-  u8  memValue  = ram[position];
-  u8  result    = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CMP_C1() // Indirect X Pre-Indexing, 6 cycles
-{  
-  u16 position  = Indirect(6);
-  u8  memValue  = ram[position];
-  u8  result    = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CMP_D1() // Indirect Y Post-Indexing, 5 cycles, + 1 if a page is crossed
-{
-  u16 pageBefore = PC & 0xFF00;
-  u16 position   = IndirectYPostIndexing(5);
-  u8  memValue   = ram[position];
-  u8  result     = A - memValue;
-
-  C = A >= memValue;
-  Z = A == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-
-  // Check if page was crossed
-  if ((PC & 0xFF00) != pageBefore)
-    ++cycleCount;
-}
-
-
-void Cpu::CPX_E0()  // Immediate, 2 cycles
-{  
-  u16 position  = Immediate(2);
-  u8  memValue  = ram[position];
-  u8  result    = X - memValue;
-
-  C = X >= memValue;
-  Z = X == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CPX_EC() // Absolute, 4 cycles
-{
-  u16 position = Absolute(4);
-  u8  memValue = ram[position];
-  u8  result   = X - memValue;
-
-  C = X >= memValue;
-  Z = X == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CPX_E4() // Zero page, 3 cycles
-{ 
-  u16 position  = ZeroPage(3);
-  u8  memValue  = ram[position];
-  u8  result    = X - memValue;
-
-  C = X >= memValue;
-  Z = X == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-
-void Cpu::CPY_C0()  // Immediate, 2 cycles
-{  
-  u16 position  = Immediate(2);
-  u8  memValue  = ram[position];
-  u8  result    = Y - memValue;
-
-  C = Y >= memValue;
-  Z = Y == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CPY_CC() // Absolute, 4 cycles
-{ 
-  u16 position = Absolute(4);
-  u8  memValue = ram[position];
-  u8  result   = Y - memValue;
-
-  C = Y >= memValue;
-  Z = Y == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-void Cpu::CPY_C4() // Zero page, 3 cycles
-{ 
-  u16 position  = ZeroPage(3);
-  u8  memValue  = ram[position];
-  u8  result    = Y - memValue;
-
-  C = Y >= memValue;
-  Z = Y == memValue;
-  N = (result & flagNvalue) == flagNvalue;
-}
-
-
-void Cpu::SBC_E9() // Immediate, 2 cycles
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = Immediate(2);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_ED() // Absolute, 4 cycles
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = Absolute(4);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_FD() // Absolute X Indexing, 4 cycles, + 1 if a page is crossed
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = AbsoluteX(4);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_F9() // Absolute Y Indexing, 4 cycles, + 1 if a page is crossed
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = AbsoluteY(4);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_E5() // Zero page, 3 cycles
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = ZeroPage(3);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_F5() // Zero page X Indexing, 4 cycles
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = ZeroPageX(4);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_E1() // Indirect X Pre-Indexing, 6 cycles
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = IndirectXPreIndexing(6);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-void Cpu::SBC_F1() // Indirect Y Post-Indexing, 5 cycles, + 1 if a page is crossed
-{ 
-  // ToDo Test if it works (unsigned A) ???
-  u16 position  = IndirectYPostIndexing(5);
-  u8  memValue  = ram[position];
-  u8  previousA = A;
-
-  A -= memValue - !C;
-
-  V = (previousA ^ A) & (~memValue ^ A) & 0x80; // Overflow check
-  C = (previousA - memValue - !C) > 255; // Carry check
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-}
-
-
-void Cpu::DEC_CE() // Absolute, 6 cycles
-{
-  u16 position  = Absolute(6);
-  u8  memValue  = ram[position] - 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::DEC_DE() // Absolute X Indexing, 7 cycles
-{
-  u16 position  = AbsoluteX(7);
-  u8  memValue  = ram[position] - 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::DEC_C6() // Zero page, 5 cycles
-{
-  u16 position  = ZeroPage(5);
-  u8  memValue  = ram[position] - 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::DEC_D6() // Zero page X Indexing, 6 cycles
-{
-  u16 position  = ZeroPageX(6);
-  u8  memValue  = ram[position] - 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::DEX_CA() // Implied, 2 cycles
-{
-  --X;
-
-  Z = X == 0;
-  N = (X & flagNvalue) == flagNvalue;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::DEY_88() // Implied, 2 cycles
-{
-  --Y;
-
-  Z = Y == 0;
-  N = (Y & flagNvalue) == flagNvalue;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::INC_EE() // Absolute, 6 cycles
-{
-  u16 position  = Absolute(6);
-  u8  memValue  = ram[position] + 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::INC_FE() // Absolute X Indexing, 7 cycles
-{
-  u16 position  = AbsoluteX(7);
-  u8  memValue  = ram[position] + 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::INC_E6() // Zero page, 5 cycles
-{
-  u16 position  = ZeroPage(5);
-  u8  memValue  = ram[position] + 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::INC_F6() // Zero page X Indexing, 6 cycles
-{
-  u16 position  = ZeroPageX(6);
-  u8  memValue  = ram[position] + 1;
-
-  ram[position] = memValue;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-}
-
-void Cpu::INX_E8() // Implied, 2 cycles
-{
-  ++X;
-
-  Z = X == 0;
-  N = (X & flagNvalue) == flagNvalue;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::INY_C8() // Implied, 2 cycles
-{
-  ++Y;
-
-  Z = X == 0;
-  N = (X & flagNvalue) == flagNvalue;
-
-  cycleCount += 2;
-  ++PC;
-} 
-
-/* Shifts: Shift the bits of either the accumulator or a memory location one bit to the left or right. */
-void Cpu::ASL_0A() // Accumulator, 2 cycles
-{
-  C = A & 0x80;
-
-  A <<= 1;
-
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-  
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::ASL_0E() // Absolute, 6 cycles
-{
-  u16 position  = Absolute(6);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue <<= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ASL_1E() // Absolute X Indexing, 7 cycles
-{
-  u16 position  = AbsoluteX(7);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue <<= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ASL_06() // Zero page, 5 cycles
-{
-  u16 position  = ZeroPage(5);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue <<= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::ASL_16() // Zero page X Indexing, 6 cycles
-{
-  u16 position  = ZeroPageX(6);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue <<= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::LSR_4A() // Accumulator, 2 cycles
-{
-  C = A & 0x01;
-
-  A >>= 1;
-
-  Z = A == 0;
-  N = (A & flagNvalue) == flagNvalue;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::LSR_4E() // Absolute, 6 cycles
-{
-  u16 position  = Absolute(6);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue >>= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::LSR_5E() // Absolute X Indexing, 7 cycles 
-{
-  u16 position  = AbsoluteX(7);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue >>= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::LSR_46() // Zero page, 5 cycles
-{
-  u16 position  = ZeroPage(5);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue >>= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-void Cpu::LSR_56() // Zero page X Indexing, 6 cycles
-{
-  u16 position  = ZeroPageX(6);
-  u8  memValue  = ram[position];
-
-  C = memValue & 0x80;
-
-  memValue >>= 1;
-
-  Z = memValue == 0;
-  N = (memValue & flagNvalue) == flagNvalue;
-
-  ram[position] = memValue;
-}
-
-/* Jumps/Calls: Break sequential execution sequence, resuming from a specified address. */
-void Cpu::RTS_60() // Implied, 6 cycles
-{
-  u16 LL = ram[0x101 + SP++]; // low byte
-  u16 HH = ram[0x101 + SP++]; // high byte
-  HH <<= 8;
-  u16 memValue = HH | LL;
-
-  PC = memValue + 1;
-
-  cycleCount += 6;
-}
-
-void Cpu::JMP_4C() // Absolute, 3 cycles
-{
-  PC = Absolute(3);
-}
-
-void Cpu::JMP_6C() // Indirect, 5 cycles
-{
-  PC = Indirect(5);
-}
-
-void Cpu::JSR_20() // Absolute, 6 cycles
-{
-  u16 position = Absolute(6);
-  u8  LL = (PC - 1) >> 8;   // low byte
-  u8  HH = (PC - 1) & 0xFF; // high byte
-
-  ram[0x101 + --SP] = LL;  
-  ram[0x101 + --SP] = HH;
-
-  PC = position;
-} 
-
-/* Branches: Break sequential execution sequence, resuming from a specified address, if a condition is met. The condition involves examining a specific bit in the status register.*/
-void Cpu::BCC_90() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-  
-  if (C == false)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BCS_B0() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-
-  if (C == true)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BEQ_F0() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-  
-  if (Z == true)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BMI_30() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-
-  if (N == true)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BNE_D0() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-
-  if (Z == false)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BPL_10() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-
-  if (N == false)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BVC_50() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-
-  if (V == false)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-}
-
-void Cpu::BVS_70() // Relative, 2 cycles, +1 if branch succeeds and +2 if a page is crossed
-{
-  cycleCount += 2;
-  PC         += 2;
-
-  if (V == true)
-  {  
-    u16 pageBefore = PC & 0xFF00;
-    u8  memValue   = ram[PC + 1];
-
-    cycleCount += 1; // Branch succeeds
-    PC         += memValue;
-
-    // Check if page was crossed
-    if ((PC & 0xFF00) != pageBefore)
-      cycleCount += 2;
-  }
-} 
-
-/* Status Register Operations: Set or clear a flag in the status register. */
-void Cpu::CLC_18() // Implied, 2 cycles
-{
-  C = false;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::CLD_D8() // Implied, 2 cycles
-{
-  D = false;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::CLI_58() // Implied, 2 cycles
-{
-  I = false;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::CLV_B8() // Implied, 2 cycles
-{
-  V = false;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::SEC_38() // Implied, 2 cycles
-{
-  C = true;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::SED_F8() // Implied, 2 cycles
-{
-  D = true;
-
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::SEI_78() // Implied, 2 cycles
-{
-  I = true;
-
-  cycleCount += 2;
-  ++PC;
-} 
-
-/* System Functions: Perform rarely used functions. */
-void Cpu::NOP_EA() // Implied, 2 cycles
-{
-  cycleCount += 2;
-  ++PC;
-}
-
-void Cpu::RTI_40() // Implied, 6 cycles
-{
-  u8 newStatus = ram[0x101 + SP++];
-
-  SetStatus(newStatus);
-
-  cycleCount += 2;
-
-  u16 LL = ram[0x101 + SP++]; // low byte
-  u16 HH = ram[0x101 + SP++]; // high byte
-  HH <<= 8;
-  u16 memValue = HH | LL;
-
-  PC = memValue;
-}
-
-void Cpu::BRK_00() // Immediate, 7 cycles
-{
-  cycleCount += 7;
-
-  system("pause");
-}
+#include "cpu.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include "aot.hpp"
+#include "execute.hpp"
+#include "jit.hpp"
+#include "savestate.hpp"
+
+// NESEMU_THREADED_DISPATCH builds the direct-threaded interpreter loop, which relies on the
+// labels as values extension of GCC and Clang. Other compilers keep the table and switch loops.
+#if defined(NESEMU_THREADED_DISPATCH) && !defined(__GNUC__)
+#error "NESEMU_THREADED_DISPATCH requires GCC or Clang"
+#endif
+
+Cpu::Cpu()
+{
+  tracer          = nullptr;
+  blockGeneration = 0;
+  staticProgram   = nullptr;
+
+  memset(ram, 0, sizeof(ram));
+
+  MapMemory();
+  Reset();
+
+  regs.cycleCount = 0;
+  ResetEvents();
+}
+
+Cpu::Cpu(const Cpu &other)
+{
+  tracer          = nullptr;
+  blockGeneration = 0;
+  staticProgram   = nullptr;
+
+  *this = other;
+}
+
+Cpu::~Cpu()
+{
+
+}
+
+// The page table points into the memory of its own Cpu, a copy gets a table of its own.
+// The tracer isn't copied, its ring buffer only takes one producer. Decoded blocks point
+// into the memory they came from and aren't copied either.
+Cpu &Cpu::operator=(const Cpu &other)
+{
+  memcpy(ram, other.ram, sizeof(ram));
+  prgRam.Copy(other.prgRam);
+
+  ppu = other.ppu;
+
+  CopyState(other);
+  MapMemory();
+
+  return *this;
+}
+
+Cpu::Cpu(Cpu &parent, Forked)
+{
+  tracer          = nullptr;
+  blockGeneration = 0;
+  staticProgram   = nullptr;
+
+  Share(parent);
+}
+
+std::unique_ptr<Cpu> Cpu::Fork()
+{
+  return std::unique_ptr<Cpu>(new Cpu(*this, Forked()));
+}
+
+// Both map the shared pages read only, the first write to one copies it
+void Cpu::Share(Cpu &other)
+{
+  memcpy(ram, other.ram, sizeof(ram));
+  prgRam.Share(other.prgRam);
+
+  ppu.Share(other.ppu);
+
+  CopyState(other);
+  MapMemory();
+
+  other.MapPrgRam();
+}
+
+void Cpu::CopyState(const Cpu &other)
+{
+  apu           = other.apu;
+  rom           = other.rom;
+  mapper        = other.mapper ? other.mapper->Clone() : nullptr;
+  staticProgram = other.staticProgram;
+  regs          = other.regs;
+  NMI           = other.NMI;
+  IRQ           = other.IRQ;
+  nmiLine       = other.nmiLine;
+  strobe        = other.strobe;
+  scheduler     = other.scheduler;
+  ppuClock      = other.ppuClock;
+  apuClock      = other.apuClock;
+  dmaPage       = other.dmaPage;
+  catchUps      = other.catchUps;
+
+  memcpy(buttons , other.buttons , sizeof(buttons ));
+  memcpy(shifters, other.shifters, sizeof(shifters));
+  frameCatchUps = other.frameCatchUps;
+}
+
+void Cpu::MapMemory()
+{
+  ClearBlocks(); // Blocks are tagged with memory pointers, which are about to change
+
+  // Every page is mapped again, those left open bus are the only ones unmapped
+  bus.Unmap(0x4100, 0x3F00);
+  bus.MapMemory(0x0000, 0x2000, ram   , sizeof(ram)   );
+  bus.MapHandlers(0x2000, 0x2000, ReadPpu, WritePpu, this); // 8 registers, mirrored
+  bus.MapHandlers(0x4000, 0x0100, ReadIo, WriteIo, this); // 0x4000-0x4017, the rest of the page is open bus
+  apu.SetDmcReader(ReadDmc, this);
+  ppu.SetScanlineHandler(ClockMapper, this);
+  MapPrgRam();
+
+  if (mapper)
+    MapBanks();
+  else
+    bus.Unmap(0x8000, 0x8000);
+}
+
+// Pages mapped as they already are are left alone, watches included. A page mapped again
+// loses the blocks decoded from it: it moved, or was shared and read only, so unwatched.
+void Cpu::MapPrgRam()
+{
+  static_assert(decltype(prgRam)::pageSize == Bus::pageSize, "PRG RAM pages are bus pages");
+
+  for (u32 page = 0; page < prgRam.pageCount; ++page)
+  {
+    u16       address = 0x6000 + page * Bus::pageSize;
+    const u8 *memory  = prgRam.GetPage(page);
+    const u8 *mapped  = bus.GetMemory(address);
+    bool      shared  = prgRam.IsShared(page);
+
+    if (mapped == memory && bus.IsWritable(address) != shared)
+      continue;
+
+    if (mapped && (prgRamCode & (1u << page)))
+      InvalidateBlocks(mapped);
+
+    if (shared)
+      bus.MapReadOnly(address, Bus::pageSize, memory, Bus::pageSize, WriteSharedRam, this);
+    else
+      bus.MapMemory(address, Bus::pageSize, prgRam.GetOwnPage(page), Bus::pageSize);
+  }
+}
+
+// First write to a PRG RAM page shared with a fork: this Cpu gets a copy of its own
+void Cpu::WriteSharedRam(void *context, u16 address, u8 value)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  cpu->prgRam.GetOwnPage((address - 0x6000) / Bus::pageSize);
+  cpu->MapPrgRam();
+  cpu->bus.Write(address, value);
+}
+
+// A switch only moves page pointers: four on the bus, and the pages of the PPU that changed
+void Cpu::MapBanks()
+{
+  const Mapper::Banks &banks   = mapper->GetBanks();
+  const u8            *prg     = rom->GetPrgRom();
+  u32                  prgSize = rom->GetPrgRomSize();
+
+  for (u32 slot = 0; slot < 4; ++slot)
+    bus.MapReadOnly(0x8000 + slot * 0x2000, 0x2000, prg + banks.prg[slot], prgSize < 0x2000 ? prgSize : 0x2000, WriteMapper, this);
+
+  for (u32 page = 0; page < 8; ++page)
+    ppu.MapChr(page, banks.chr[page]);
+
+  for (u32 page = 0; page < 4; ++page)
+    ppu.MapNametable(page, banks.nametables[page]);
+}
+
+bool Cpu::LoadRom(const std::string &romFile)
+{
+  std::shared_ptr<Rom> newRom = std::make_shared<Rom>();
+
+  if (!newRom->Load(romFile))
+  {
+    printf("Can't load %s: %s\n", romFile.c_str(), newRom->GetError().c_str());
+    return false;
+  }
+
+  if (!LoadRom(newRom))
+  {
+    printf("Can't load %s: mapper %u isn't supported\n", romFile.c_str(), newRom->GetMapper());
+    return false;
+  }
+
+  return true;
+}
+
+bool Cpu::LoadRom(const std::shared_ptr<const Rom> &newRom)
+{
+  std::unique_ptr<Mapper> newMapper = Mapper::Create(*newRom);
+
+  if (!newMapper)
+    return false;
+
+  rom           = newRom;
+  mapper        = std::move(newMapper);
+  staticProgram = StaticProgram::Find(*rom);
+
+  ppu.LoadRom(rom);
+  apu.Reset();
+
+  memset(ram, 0, sizeof(ram));
+  prgRam.Clear();
+
+  if (rom->GetTrainer())
+    prgRam.Write(0x1000, rom->GetTrainer(), 512); // Trainers load at 0x7000
+
+  MapMemory();
+  Reset();
+
+  // The reset sequence takes 7 cycles and ends jumping through the reset vector
+  u16 LL = bus.Read(0xFFFC); // low byte
+  u16 HH = bus.Read(0xFFFD); // high byte
+  HH <<= 8;
+
+  regs.cycleCount = 7;
+  regs.PC         = HH | LL;
+
+  ResetEvents();
+
+  return true;
+}
+
+void Cpu::NextOpcode()
+{
+  ProcessOpcode(bus.Read(regs.PC));
+}
+
+void Cpu::ProcessOpcode(u8 opcode)
+{
+  Trace(regs);
+  (this->*opcodeTable[opcode])(regs);
+}
+
+void Cpu::ProcessOpcodeSwitch(u8 opcode)
+{
+  Trace(regs);
+  ExecuteSwitch(regs, opcode);
+}
+
+void Cpu::SetTracer(Tracer *newTracer)
+{
+  tracer = newTracer;
+}
+
+// Compiled out entirely unless NESEMU_TRACE is defined, so untraced builds pay nothing
+FORCEINLINE void Cpu::Trace(const Registers &r)
+{
+#ifdef NESEMU_TRACE
+  if (tracer)
+  {
+    TraceRecord record = {};
+    u8          bytes  = opcodeInfo[bus.Read(r.PC)].bytes;
+
+    record.cycleCount  = r.cycleCount;
+    record.PC          = r.PC;
+    record.opcode      = bus.Read(r.PC);
+    record.operands[0] = bytes > 1 ? bus.Read(r.PC + 1) : 0; // Only the instruction's own bytes, reads can have side effects
+    record.operands[1] = bytes > 2 ? bus.Read(r.PC + 2) : 0;
+    record.A           = r.A;
+    record.X           = r.X;
+    record.Y           = r.Y;
+    record.P           = GetStatus(r);
+    record.SP          = r.SP;
+
+    tracer->Write(record);
+  }
+#else
+  (void)r;
+#endif
+}
+
+FORCEINLINE void Cpu::ExecuteSwitch(Registers &r, u8 opcode)
+{
+  switch (opcode)
+  {
+#define OPCODE(code) \
+    case code: Execute<code>(r); break;
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+  }
+}
+
+FORCEINLINE void Cpu::ExecuteSwitch(Registers &r, u8 opcode, u16 operand)
+{
+  switch (opcode)
+  {
+#define OPCODE(code) \
+    case code: Execute<code>(r, operand); break;
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+  }
+}
+
+// Batches run up to the next event or the target, whichever comes first
+s32 Cpu::Run(s32 cycles, Dispatch dispatch)
+{
+  s64 target = regs.cycleCount + cycles;
+
+  while (regs.cycleCount < target)
+  {
+    nextStop = std::min(target, scheduler.GetNextTime());
+
+    RunBatch(dispatch);
+    HandleEvents();
+  }
+
+  Sync();
+
+  return (s32)(regs.cycleCount - target);
+}
+
+// The loops read nextStop before every instruction, whatever lowers it stops them
+void Cpu::RunBatch(Dispatch dispatch)
+{
+  auto spent = [this](const Registers &r) { return r.cycleCount >= nextStop; };
+
+  switch (dispatch)
+  {
+    case Dispatch::Table:    RunTable(spent);               break;
+    case Dispatch::Switch:   RunSwitch(spent);              break;
+#ifdef NESEMU_THREADED_DISPATCH
+    case Dispatch::Threaded: RunThreaded(spent);            break;
+#else
+    case Dispatch::Threaded: RunSwitch(spent);              break;
+#endif
+    case Dispatch::Block:    RunBlocks(spent, true, false); break;
+    case Dispatch::Jit:      RunBlocks(spent, true, true);  break;
+    case Dispatch::Static:
+      if (staticProgram)
+        RunStatic(spent);
+      else
+        RunBlocks(spent, true, false);
+      break;
+  }
+}
+
+#ifdef NESEMU_THREADED_DISPATCH
+const Cpu::Dispatch Cpu::defaultDispatch = Dispatch::Threaded;
+#else
+const Cpu::Dispatch Cpu::defaultDispatch = Dispatch::Switch;
+#endif
+
+void Cpu::RunInstructions(u32 count, Dispatch dispatch)
+{
+  auto done = [count](const Registers &) mutable { return count-- == 0; };
+
+  switch (dispatch)
+  {
+    case Dispatch::Table:    RunTable(done);                 break;
+    case Dispatch::Switch:   RunSwitch(done);                break;
+#ifdef NESEMU_THREADED_DISPATCH
+    case Dispatch::Threaded: RunThreaded(done);              break;
+#else
+    case Dispatch::Threaded: RunSwitch(done);                break;
+#endif
+    case Dispatch::Block:
+    case Dispatch::Jit:
+    case Dispatch::Static:   RunBlocks(done, false, false);   break; // Native blocks and routines only stop on cycles
+  }
+}
+
+// The loops below copy the registers into a local for the whole batch and write
+// them back once at the end. A local whose address never escapes can live in host
+// registers, while the members would have to be reloaded after every store to ram.
+template<typename Stop>
+void Cpu::RunTable(Stop stop)
+{
+  Registers r = regs;
+
+  while (!stop(r))
+  {
+    Trace(r);
+    (this->*opcodeTable[bus.Read(r.PC)])(r);
+  }
+
+  regs = r;
+}
+
+template<typename Stop>
+void Cpu::RunSwitch(Stop stop)
+{
+  Registers r = regs;
+
+  while (!stop(r))
+  {
+    Trace(r);
+    ExecuteSwitch(r, bus.Read(r.PC));
+  }
+
+  regs = r;
+}
+
+#ifdef NESEMU_THREADED_DISPATCH
+template<typename Stop>
+void Cpu::RunThreaded(Stop stop)
+{
+  // One label per opcode. Every handler ends with its own indirect jump to the next
+  // opcode, so each jump site gets its own branch history instead of sharing one.
+  static void *const labels[256] = {
+#define OPCODE(code) &&opcode_##code,
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+  };
+
+  Registers r = regs;
+
+  if (stop(r))
+    goto done;
+
+  goto *labels[bus.Read(r.PC)];
+
+#define OPCODE(code)                 \
+  opcode_##code:                     \
+    Trace(r);                        \
+    Execute<code>(r);                \
+    if (stop(r))                     \
+      goto done;                     \
+    goto *labels[bus.Read(r.PC)];
+
+  CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+
+done:
+  regs = r;
+}
+#endif
+
+// Instructions that can write through the bus, the only way to drop blocks while one runs.
+// Zero page and stack writes go straight to ram, code there is never decoded.
+static constexpr bool WritesBus(const OpInfo &info)
+{
+  return info.mode != AddressingMode::Accumulator && info.mode != AddressingMode::ZeroPage &&
+         info.mode != AddressingMode::ZeroPageX   && info.mode != AddressingMode::ZeroPageY &&
+         (info.operation == Operation::STA || info.operation == Operation::STX || info.operation == Operation::STY ||
+          info.operation == Operation::INC || info.operation == Operation::DEC || info.operation == Operation::ASL ||
+          info.operation == Operation::LSR || info.operation == Operation::ROL || info.operation == Operation::ROR ||
+          info.operation == Operation::SLO || info.operation == Operation::RLA || info.operation == Operation::SRE ||
+          info.operation == Operation::RRA || info.operation == Operation::DCP || info.operation == Operation::ISC ||
+          info.operation == Operation::SAX || info.operation == Operation::SHA || info.operation == Operation::SHX ||
+          info.operation == Operation::SHY || info.operation == Operation::SHS);
+}
+
+// Blocks that can't reach nextStop, even with every page crossing and branch penalty, run
+// without calling stop. Without limited, for loops that don't stop on a cycle count, they don't.
+// Code without a block is interpreted up to the next jump or taken branch. A taken branch
+// leaves its block, so does an RTS returning elsewhere than the block went on, and a write
+// that drops blocks, the running one included.
+// With native, hot blocks that run without calling stop are compiled and run natively.
+template<typename Stop>
+void Cpu::RunBlocks(Stop stop, bool limited, bool native)
+{
+#ifdef NESEMU_THREADED_DISPATCH
+  static void *const labels[256] = {
+#define OPCODE(code) &&block_##code,
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+  };
+
+  static void *const interpreted[256] = {
+#define OPCODE(code) &&interpreted_##code,
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+  };
+
+  u16 next;
+#endif
+
+#ifdef NESEMU_TRACE
+  native = native && !tracer; // Native code has no trace hook
+#endif
+
+  Registers        r          = regs;
+  Block           *block      = nullptr;
+  const DecodedOp *op         = nullptr;
+  u32              generation = 0;
+  bool             fits       = false;
+
+  while (!stop(r))
+  {
+    block = FindBlock(r.PC);
+
+#ifdef NESEMU_THREADED_DISPATCH
+  found:
+    // Interpreted without looking up the PCs in between, they're no block start
+    if (!block)
+      goto *interpreted[bus.Read(r.PC)];
+#else
+    // Interpreted without looking up the PCs in between, they're no block start
+    while (!block)
+    {
+      u8  opcode = bus.Read(r.PC);
+      u16 next   = r.PC + opcodeInfo[opcode].bytes;
+
+      Trace(r);
+      ExecuteSwitch(r, opcode);
+
+      if (r.PC != next)
+        break;
+
+      if (stop(r))
+        goto done;
+    }
+
+    if (!block)
+      continue;
+#endif
+
+    op         = &blockOps[block->first];
+    generation = blockGeneration;
+    fits       = limited && r.cycleCount + block->maxCycles < nextStop;
+
+    if (native && fits)
+    {
+      if (block->hits < nativeThreshold && ++block->hits == nativeThreshold)
+        block->native = CompileBlock(*block, r.PC);
+
+      // Native code works on the members, the local stays out of memory everywhere else
+      if (block->native)
+      {
+        regs = r;
+        block->native(&regs);
+        r = regs;
+        continue;
+      }
+    }
+
+#ifdef NESEMU_THREADED_DISPATCH
+    goto *labels[op->opcode];
+
+// Leaving a block: the next one is looked up and entered from the handler that left, so each
+// handler's indirect jump has its own branch history as in RunThreaded. Native blocks and PCs
+// without a block go back to the top.
+#define NEXT_BLOCK()                                                                 \
+    {                                                                                \
+      if (stop(r))                                                                   \
+        goto done;                                                                   \
+      block = FindBlock(r.PC);                                                       \
+      if (!block || native)                                                          \
+        goto found;                                                                  \
+      op         = &blockOps[block->first];                                          \
+      generation = blockGeneration;                                                  \
+      fits       = limited && r.cycleCount + block->maxCycles < nextStop;            \
+      goto *labels[op->opcode];                                                      \
+    }
+
+#define OPCODE(code)                                                                 \
+  block_##code:                                                                      \
+    Trace(r);                                                                        \
+    Execute<code>(r, op->operand);                                                   \
+    if (opcodeInfo[code].mode == AddressingMode::Relative && r.PC == op->operand)    \
+      NEXT_BLOCK();                                                                  \
+    if (opcodeInfo[code].operation == Operation::RTS && r.PC != op->operand)         \
+      NEXT_BLOCK();                                                                  \
+    if ((op++)->last || (WritesBus(opcodeInfo[code]) && blockGeneration != generation)) \
+      NEXT_BLOCK();                                                                  \
+    if (!fits && stop(r))                                                            \
+      goto done;                                                                     \
+    goto *labels[op->opcode];
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+#undef NEXT_BLOCK
+
+// Code without a block, run as in RunThreaded up to the next jump or taken branch
+#define OPCODE(code)                                                                 \
+  interpreted_##code:                                                                \
+    next = r.PC + opcodeInfo[code].bytes;                                            \
+    Trace(r);                                                                        \
+    Execute<code>(r);                                                                \
+    if (stop(r))                                                                     \
+      goto done;                                                                     \
+    if (r.PC != next)                                                                \
+    {                                                                                \
+      block = FindBlock(r.PC);                                                       \
+      goto found;                                                                    \
+    }                                                                                \
+    goto *interpreted[bus.Read(r.PC)];
+
+    CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+#else
+    for (;;)
+    {
+      Trace(r);
+      ExecuteSwitch(r, op->opcode, op->operand);
+
+      if (opcodeInfo[op->opcode].mode == AddressingMode::Relative && r.PC == op->operand)
+        break;
+
+      if (opcodeInfo[op->opcode].operation == Operation::RTS && r.PC != op->operand)
+        break;
+
+      if ((op++)->last || blockGeneration != generation)
+        break;
+
+      if (!fits && stop(r))
+        goto done;
+    }
+#endif
+  }
+
+done:
+  regs = r;
+}
+
+// Routines of the recompiled ROM run as long as their blocks can't reach nextStop, they
+// return when a block might or when the code leaves them. Whatever they don't run, PCs no
+// routine covers included, is interpreted one instruction at a time.
+template<typename Stop>
+void Cpu::RunStatic(Stop stop)
+{
+  bool translated = true;
+
+#ifdef NESEMU_TRACE
+  translated = !tracer; // Routines have no trace hook
+#endif
+
+  Registers r = regs;
+
+  while (!stop(r))
+  {
+    StaticCode::Routine routine = translated ? staticProgram->find(r.PC) : nullptr;
+
+    // Routines work on the members, the local stays out of memory everywhere else
+    if (routine)
+    {
+      s64 cycles = r.cycleCount;
+
+      regs = r;
+      routine(*this, regs, nextStop);
+      r = regs;
+
+      if (r.cycleCount != cycles)
+        continue;
+    }
+
+    Trace(r);
+    ExecuteSwitch(r, bus.Read(r.PC));
+  }
+
+  regs = r;
+}
+
+// Jumps end a block, so does JAM which never moves on. Branches don't, decoding goes on
+// with the path not taken and a taken branch leaves the block when it runs.
+FORCEINLINE bool Cpu::EndsBlock(u8 opcode)
+{
+  const OpInfo &info = opcodeInfo[opcode];
+
+  return info.operation == Operation::JMP || info.operation == Operation::JSR ||
+         info.operation == Operation::RTS || info.operation == Operation::RTI ||
+         info.operation == Operation::BRK || info.operation == Operation::JAM;
+}
+
+FORCEINLINE Cpu::Block *Cpu::FindBlock(u16 PC)
+{
+  const u8 *code = bus.GetMemory(PC);
+
+  if (!blocks)
+  {
+    blocks.reset((Block *)calloc(blockSlots, sizeof(Block)));
+  }
+
+  Block &slot = blocks[PC & (blockSlots - 1)];
+
+  if (slot.code == code && slot.count)
+    return &slot;
+
+  return DecodeBlock(PC, slot);
+}
+
+Cpu::Block *Cpu::DecodeBlock(u16 PC, Block &slot)
+{
+  const u8 *code = bus.GetMemory(PC);
+
+  // Zero page and the stack are written straight to ram without going through the bus,
+  // so writes there couldn't be watched. Code running there is interpreted.
+  if (!code || (code >= ram && code < ram + 0x200))
+    return nullptr;
+
+  // Most code runs once, during start up. The first time a block is reached its slot
+  // only remembers it, the block is decoded when it's reached again.
+  if (slot.code != code)
+  {
+    slot.code  = code;
+    slot.count = 0;
+    return nullptr;
+  }
+
+  if (blockOps.size() + blockLength > blockOpsLimit)
+    ClearBlocks();
+
+  Block block;
+
+  block.code      = code;
+  block.native    = nullptr;
+  block.first     = (u16)blockOps.size();
+  block.count     = 0;
+  block.maxCycles = 0;
+  block.hits      = 0;
+
+  // RAM code stays in one page, the one that gets watched. ROM code stays in its 8KB slot,
+  // which banks switch as a whole, and follows JSR and JMP to their targets there and RTS
+  // back after the JSR it returns from.
+  bool rom     = PC >= 0x8000 && !bus.IsWritable(PC);
+  u16  region  = rom ? 0xE000 : 0xFF00;
+  u16  returns[blockLength];
+  u32  calls   = 0;
+
+  for (u16 address = PC; block.count < blockLength; )
+  {
+    u8            opcode  = bus.Read(address);
+    const OpInfo &info    = opcodeInfo[opcode];
+    u16           operand = DecodeOperand(info.mode, address);
+    u16           next    = address + info.bytes;
+    bool          follow  = false;
+
+    if ((address & region) != (PC & region) || ((u16)(next - 1) & region) != (PC & region))
+      break;
+
+    if (rom && info.mode == AddressingMode::Absolute && (info.operation == Operation::JSR || info.operation == Operation::JMP) &&
+        (operand & region) == (PC & region))
+    {
+      if (info.operation == Operation::JSR)
+        returns[calls++] = next;
+
+      next   = operand;
+      follow = true;
+    }
+    else if (info.operation == Operation::RTS && calls)
+    {
+      next    = returns[--calls];
+      operand = next; // Where RTS has to return for the block to go on, see RunBlocks
+      follow  = true;
+    }
+
+    blockOps.push_back({ operand, opcode, 0 });
+
+    block.count++;
+    block.maxCycles += info.cycles + info.pageCycles + (info.mode == AddressingMode::Relative ? 2 : 0);
+
+    if (!follow && EndsBlock(opcode))
+      break;
+
+    address = next;
+  }
+
+  if (block.count == 0)
+    return nullptr;
+
+  blockOps.back().last = 1;
+
+  // The first block decoded from a RAM page starts watching it, mirrors included.
+  // Pages already watched and ROM have no writable page left and are skipped, and so are
+  // PRG RAM pages shared with a fork, which move when written.
+  bus.WatchWrites(PC, WriteCode, this);
+
+  if (PC >= 0x6000 && PC < 0x8000)
+    prgRamCode |= 1u << ((PC - 0x6000) / Bus::pageSize);
+
+  if (PC < 0x8000 || bus.IsWritable(PC))
+    ramBlocks.push_back((u16)(&slot - blocks.get()));
+
+  slot = block;
+
+  return &slot;
+}
+
+// Can run from a write handler called by a native block, which still returns to its own
+// code: Jit::Reset leaves the bytes in place.
+void Cpu::ClearBlocks()
+{
+  for (u32 index = 0; blocks && index < blockSlots; ++index)
+    blocks[index].code = nullptr;
+
+  blockOps.clear();
+  ramBlocks.clear();
+  blockGeneration++;
+  prgRamCode = 0;
+
+  if (jit)
+    jit->Reset();
+}
+
+// Drops the blocks decoded from the 256 bytes of RAM at page. Only the slots RAM blocks were
+// decoded into are looked at, free ones leave the list.
+void Cpu::InvalidateBlocks(const u8 *page)
+{
+  u32 kept = 0;
+
+  for (u16 index : ramBlocks)
+  {
+    Block &block = blocks[index];
+
+    if (block.code >= page && block.code < page + Bus::pageSize)
+      block.code = nullptr;
+    else if (block.code)
+      ramBlocks[kept++] = index;
+  }
+
+  ramBlocks.resize(kept);
+  blockGeneration++;
+}
+
+// Restoring a state over the one it was saved from, the usual case when searching, keeps
+// every block. Mirrors are unwatched together and only compared once.
+void Cpu::InvalidateRestored(const Snapshot &snapshot)
+{
+  for (u32 address = 0; address < 0x10000; address += Bus::pageSize)
+  {
+    if (!bus.IsWatched(address))
+      continue;
+
+    const u8 *page     = bus.GetMemory(address);
+    const u8 *restored = page >= ram && page < ram + sizeof(ram)    ? snapshot.ram    + (page - ram)      :
+                         address >= 0x6000 && address < 0x8000      ? snapshot.prgRam + (address - 0x6000) : page;
+
+    if (memcmp(page, restored, Bus::pageSize) != 0)
+    {
+      InvalidateBlocks(page);
+      bus.UnwatchWrites(address);
+    }
+  }
+}
+
+// Write handler of watched pages. The first write drops the page's blocks and unwatches it,
+// further writes go straight to memory until code is decoded from it again.
+void Cpu::WriteCode(void *context, u16 address, u8 value)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  cpu->InvalidateBlocks(cpu->bus.GetMemory(address & 0xFF00));
+  cpu->bus.UnwatchWrites(address);
+  cpu->bus.Write(address, value);
+}
+
+u8 Cpu::ReadDmc(void *context, u16 address)
+{
+  return ((Cpu *)context)->bus.Read(address);
+}
+
+// The PPU draws up to the write with the old banks. Blocks are tagged with the memory they
+// were decoded from and stay valid, the running one leaves as its page may have moved. The
+// batch stops so the cartridge IRQ is predicted again.
+void Cpu::WriteMapper(void *context, u16 address, u8 value)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  cpu->CatchUpPpu();
+  cpu->mapper->Write(address, value);
+  cpu->MapBanks();
+
+  cpu->blockGeneration++;
+  cpu->nextStop = INT64_MIN;
+}
+
+void Cpu::ClockMapper(void *context)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  if (cpu->mapper)
+    cpu->mapper->ClockScanline();
+}
+
+// The PPU catches up to the access before the register sees it. Writes that move the NMI
+// line, the odd frame dot or sprite 0 stop the batch so the events are predicted again.
+u8 Cpu::ReadPpu(void *context, u16 address)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  cpu->CatchUpPpu();
+
+  return cpu->ppu.ReadRegister(address);
+}
+
+void Cpu::WritePpu(void *context, u16 address, u8 value)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  cpu->CatchUpPpu();
+  cpu->ppu.WriteRegister(address, value);
+
+  u16 reg = address & 0x0007;
+
+  if (reg == 0 || reg == 1 || reg == 4) // PPUCTRL, PPUMASK and OAMDATA
+    cpu->nextStop = INT64_MIN;
+}
+
+u8 Cpu::ReadIo(void *context, u16 address)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  if (address == 0x4016 || address == 0x4017)
+    return cpu->ReadController(address - 0x4016);
+
+  cpu->CatchUpApu();
+
+  return Apu::ReadIo(&cpu->apu, address);
+}
+
+// DMA waits for the batch to stop, right after the instruction. Writes that move the APU
+// interrupts stop it too, so they're predicted again.
+void Cpu::WriteIo(void *context, u16 address, u8 value)
+{
+  Cpu *cpu = (Cpu *)context;
+
+  if (address == 0x4014)
+  {
+    cpu->dmaPage  = value;
+    cpu->nextStop = INT64_MIN;
+    cpu->scheduler.Schedule(Scheduler::Event::Dma, cpu->regs.cycleCount);
+    return;
+  }
+
+  if (address == 0x4016)
+  {
+    cpu->WriteStrobe(value);
+    return;
+  }
+
+  cpu->CatchUpApu();
+
+  Apu::WriteIo(&cpu->apu, address, value);
+
+  if (address == 0x4010 || address == 0x4015 || address == 0x4017)
+    cpu->nextStop = INT64_MIN;
+}
+
+// A button per read, A first, then 1s once the 8 are out. The upper bits are open bus, the
+// high byte of the address.
+u8 Cpu::ReadController(u32 port)
+{
+  if (strobe)
+    shifters[port] = buttons[port];
+
+  u8 bit = shifters[port] & 0x01;
+
+  shifters[port] = 0x80 | (shifters[port] >> 1);
+
+  return 0x40 | bit;
+}
+
+// The shifters take the buttons held when the strobe goes low
+void Cpu::WriteStrobe(u8 value)
+{
+  if (strobe)
+    memcpy(shifters, buttons, sizeof(shifters));
+
+  strobe = (value & 0x01) != 0;
+}
+
+void Cpu::SetButtons(u32 port, u8 held)
+{
+  buttons[port & 1] = held;
+}
+
+u8 Cpu::GetButtons(u32 port) const
+{
+  return buttons[port & 1];
+}
+
+u8 Cpu::NativeRead(Cpu *cpu, u16 address)
+{
+  return cpu->bus.Read(address);
+}
+
+bool Cpu::NativeWrite(Cpu *cpu, u16 address, u8 value)
+{
+  u32 generation = cpu->blockGeneration;
+
+  cpu->bus.Write(address, value);
+
+  return cpu->blockGeneration != generation;
+}
+
+u8 Cpu::NativePushStatus(Cpu *cpu)
+{
+  return cpu->GetStatus(cpu->regs) | cpu->flagBvalue | cpu->flagUvalue; // B and U are always pushed set
+}
+
+void Cpu::NativePullStatus(Cpu *cpu, u8 value)
+{
+  cpu->SetStatus(cpu->regs, (value & ~cpu->flagBvalue) | cpu->flagUvalue);
+}
+
+Cpu::State Cpu::GetState() const
+{
+  State state;
+
+  state.PC         = regs.PC;
+  state.SP         = regs.SP;
+  state.A          = regs.A;
+  state.X          = regs.X;
+  state.Y          = regs.Y;
+  state.P          = GetStatus(regs);
+  state.cycleCount = regs.cycleCount;
+
+  return state;
+}
+
+void Cpu::SetState(const State &state)
+{
+  regs.PC         = state.PC;
+  regs.SP         = state.SP;
+  regs.A          = state.A;
+  regs.X          = state.X;
+  regs.Y          = state.Y;
+  regs.cycleCount = state.cycleCount;
+
+  SetStatus(regs, state.P);
+
+  // The PPU and the APU keep where they are, their clocks move with the cycle count
+  ppuClock = regs.cycleCount;
+  apuClock = regs.cycleCount;
+
+  if (scheduler.IsPending(Scheduler::Event::Dma))
+    scheduler.Schedule(Scheduler::Event::Dma, regs.cycleCount);
+
+  ScheduleEvents();
+}
+
+void Cpu::Save(SaveState &state) const
+{
+  Snapshot &snapshot = state.cpu;
+
+  memcpy(snapshot.ram   , ram   , sizeof(ram   ));
+  prgRam.Read(0, snapshot.prgRam, sizeof(snapshot.prgRam));
+
+  SaveComponents(state);
+}
+
+u64 Cpu::SaveChanges(SaveState &state)
+{
+  const u32 ramPages = sizeof(ram) / Bus::pageSize;
+
+  Snapshot &snapshot = state.cpu;
+  u64       changed  = 0x3; // Zero page and the stack are written without the bus
+
+  static_assert(snapshotPages <= 64, "one bit per page");
+
+  for (u32 page = 2; page < ramPages; ++page)
+  {
+    for (u32 mirror = page * Bus::pageSize; mirror < 0x2000; mirror += sizeof(ram))
+      if (bus.IsDirty(mirror))
+        changed |= 1ULL << page;
+  }
+
+  for (u32 page = 0; page < prgRam.pageCount; ++page)
+  {
+    if (bus.IsDirty(0x6000 + page * Bus::pageSize))
+      changed |= 1ULL << (ramPages + page);
+  }
+
+  for (u32 page = 0; page < snapshotPages; ++page)
+  {
+    if (!(changed & (1ULL << page)))
+      continue;
+
+    if (page < ramPages)
+      memcpy(snapshot.ram + page * Bus::pageSize, ram + page * Bus::pageSize, Bus::pageSize);
+    else
+      prgRam.Read((page - ramPages) * Bus::pageSize, snapshot.prgRam + (page - ramPages) * Bus::pageSize, Bus::pageSize);
+  }
+
+  bus.TrackWrites();
+  SaveComponents(state);
+
+  return changed;
+}
+
+void Cpu::SaveComponents(SaveState &state) const
+{
+  Snapshot &snapshot = state.cpu;
+
+  state.Stamp(rom.get());
+
+  snapshot.regs          = regs;
+  snapshot.ppuClock      = ppuClock;
+  snapshot.apuClock      = apuClock;
+  snapshot.catchUps      = catchUps;
+  snapshot.frameCatchUps = frameCatchUps;
+  snapshot.NMI           = NMI;
+  snapshot.IRQ           = IRQ;
+  snapshot.nmiLine       = nmiLine;
+  snapshot.dmaPending    = scheduler.IsPending(Scheduler::Event::Dma);
+  snapshot.dmaPage       = dmaPage;
+  snapshot.strobe        = strobe;
+
+  memcpy(snapshot.buttons , buttons , sizeof(buttons ));
+  memcpy(snapshot.shifters, shifters, sizeof(shifters));
+
+  ppu.Save(state.ppu);
+  apu.Save(state.apu);
+
+  if (mapper)
+    mapper->Save(state.mapper);
+  else
+    memset(&state.mapper, 0, sizeof(state.mapper));
+}
+
+// The events are predicted again from the restored components, only a pending DMA isn't
+// theirs to predict
+bool Cpu::Restore(const SaveState &state)
+{
+  const Snapshot &snapshot = state.cpu;
+
+  if (state.Check(rom.get()))
+    return false;
+
+  if (mapper && !mapper->Restore(state.mapper))
+    return false;
+
+  InvalidateRestored(snapshot);
+
+  memcpy(ram   , snapshot.ram   , sizeof(ram   ));
+  prgRam.Write(0, snapshot.prgRam, sizeof(snapshot.prgRam)); // Pages left equal stay shared
+  MapPrgRam();
+
+  regs          = snapshot.regs;
+  ppuClock      = snapshot.ppuClock;
+  apuClock      = snapshot.apuClock;
+  catchUps      = snapshot.catchUps;
+  frameCatchUps = snapshot.frameCatchUps;
+  NMI           = snapshot.NMI;
+  IRQ           = snapshot.IRQ;
+  nmiLine       = snapshot.nmiLine;
+  dmaPage       = snapshot.dmaPage;
+  strobe        = snapshot.strobe;
+
+  memcpy(buttons , snapshot.buttons , sizeof(buttons ));
+  memcpy(shifters, snapshot.shifters, sizeof(shifters));
+
+  ppu.Restore(state.ppu);
+  apu.Restore(state.apu);
+
+  if (mapper)
+    MapBanks();
+
+  scheduler.Clear();
+
+  if (snapshot.dmaPending)
+    scheduler.Schedule(Scheduler::Event::Dma, regs.cycleCount);
+
+  nextStop = regs.cycleCount;
+  ScheduleEvents();
+
+  bus.MarkDirty(); // The next SaveChanges copies the restored RAM
+
+  return true;
+}
+
+u8 Cpu::ReadMemory(u16 address) const
+{
+  return bus.Read(address);
+}
+
+void Cpu::WriteMemory(u16 address, u8 value)
+{
+  bus.Write(address, value);
+}
+
+bool Cpu::HasStaticProgram() const
+{
+  return staticProgram != nullptr;
+}
+
+u16 Cpu::GetPC() const
+{
+  return regs.PC;
+}
+
+s64 Cpu::GetCycleCount() const
+{
+  return regs.cycleCount;
+}
+
+u32 Cpu::GetCatchUps() const
+{
+  return frameCatchUps;
+}
+
+u8 Cpu::FetchOpcode() const
+{
+  return bus.Read(regs.PC);
+}
+
+Ppu &Cpu::GetPpu()
+{
+  return ppu;
+}
+
+const Ppu &Cpu::GetPpu() const
+{
+  return ppu;
+}
+
+Apu &Cpu::GetApu()
+{
+  return apu;
+}
+
+const Apu &Cpu::GetApu() const
+{
+  return apu;
+}
+
+void Cpu::Reset()
+{
+  Registers &r = regs;
+
+  /* Reset flags */
+  r.cResult  = 0; // Bit 0, clear
+  r.nzResult = 1; // Bit 1 and 7, clear
+  r.I = true;  // Bit 2
+  r.D = false; // Bit 3
+  r.B = false; // Bit 4
+  r.U = true;  // Bit 5
+  SetV(r, false); // Bit 6
+
+  /* Reset registers */
+  r.A = 0;
+  r.X = 0;
+  r.Y = 0;
+
+  r.SP = 0xFD; // Initial memory for Stack Pos32er
+
+  /* Controllers, released */
+  memset(buttons , 0, sizeof(buttons ));
+  memset(shifters, 0, sizeof(shifters));
+  strobe = false;
+}
+
+/* Events */
+void Cpu::ResetEvents()
+{
+  NMI      = false;
+  IRQ      = false;
+  nmiLine  = false;
+  dmaPage  = 0;
+  nextStop = regs.cycleCount;
+  ppuClock = regs.cycleCount;
+  apuClock = regs.cycleCount;
+
+  catchUps      = 0;
+  frameCatchUps = 0;
+
+  scheduler.Clear();
+  ScheduleEvents();
+}
+
+// Every event brings its component up to the cycle count. The predictions are made again
+// from where the components are, then the interrupt lines are looked at.
+void Cpu::HandleEvents()
+{
+  Scheduler::Event event;
+
+  while (scheduler.Pop(regs.cycleCount, event))
+  {
+    switch (event)
+    {
+      case Scheduler::Event::Vblank:
+        SyncPpu(regs.cycleCount);
+
+        frameCatchUps = catchUps;
+        catchUps      = 0;
+        break;
+
+      case Scheduler::Event::SpriteZero:
+      case Scheduler::Event::MapperIrq:
+        SyncPpu(regs.cycleCount);
+        break;
+
+      case Scheduler::Event::FrameIrq:
+      case Scheduler::Event::DmcIrq:
+        SyncApu(regs.cycleCount);
+        break;
+
+      case Scheduler::Event::Dma:
+        TransferOam();
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  ScheduleEvents();
+  PollInterrupts();
+}
+
+void Cpu::Sync()
+{
+  SyncPpu(regs.cycleCount);
+  SyncApu(regs.cycleCount);
+}
+
+// Three dots per cycle, in one batch however long the PPU waited
+void Cpu::SyncPpu(s64 cycle)
+{
+  if (cycle <= ppuClock)
+    return;
+
+  ppu.Run((u32)(3 * (cycle - ppuClock)));
+  ppuClock = cycle;
+}
+
+void Cpu::SyncApu(s64 cycle)
+{
+  if (cycle <= apuClock)
+    return;
+
+  apu.Run((u32)(cycle - apuClock));
+  apuClock = cycle;
+}
+
+// regs.cycleCount is the end of the instruction making the access, which is its last cycle
+void Cpu::CatchUpPpu()
+{
+  catchUps++;
+  SyncPpu(regs.cycleCount - 1);
+}
+
+void Cpu::CatchUpApu()
+{
+  catchUps++;
+  SyncApu(regs.cycleCount - 1);
+}
+
+// Event times are the first cycle the component gets past the point in. Sprite 0 is
+// looked at once its line is drawn, dot 256 covers both renderers.
+void Cpu::ScheduleEvents()
+{
+  u8  spriteY    = ppu.ReadOam(0);
+  u32 frameIrq   = apu.GetCyclesToFrameIrq();
+  u32 dmcIrq     = apu.GetCyclesToDmcIrq();
+  u32 mapperIrq  = mapper ? ppu.GetDotsUntilScanlines(mapper->GetClocksToIrq()) : 0;
+
+  scheduler.Schedule(Scheduler::Event::Vblank, ppuClock + (ppu.GetDotsUntil(Ppu::vblankLine, 1) + 2) / 3);
+
+  if (spriteY < Ppu::height - 1)
+    scheduler.Schedule(Scheduler::Event::SpriteZero, ppuClock + (ppu.GetDotsUntil(spriteY + 1, 256) + 2) / 3);
+  else
+    scheduler.Cancel(Scheduler::Event::SpriteZero);
+
+  if (frameIrq)
+    scheduler.Schedule(Scheduler::Event::FrameIrq, apuClock + frameIrq);
+  else
+    scheduler.Cancel(Scheduler::Event::FrameIrq);
+
+  if (dmcIrq)
+    scheduler.Schedule(Scheduler::Event::DmcIrq, apuClock + dmcIrq);
+  else
+    scheduler.Cancel(Scheduler::Event::DmcIrq);
+
+  // Counted in scanlines the PPU clocks the cartridge with, up to a frame ahead. Vblank
+  // predicts it again every frame.
+  if (mapperIrq)
+    scheduler.Schedule(Scheduler::Event::MapperIrq, ppuClock + (mapperIrq + 2) / 3);
+  else
+    scheduler.Cancel(Scheduler::Event::MapperIrq);
+}
+
+// NMI is taken on the rising edge of the PPU output and before IRQ, IRQ as long as the
+// APU or the cartridge holds its line and I allows it
+void Cpu::PollInterrupts()
+{
+  bool line = ppu.GetNmi();
+
+  if (line && !nmiLine)
+    SetNMI(true);
+
+  nmiLine = line;
+
+  SetIRQ(apu.GetIrq() || (mapper && mapper->GetIrq()));
+
+  if (NMI)
+  {
+    SetNMI(false);
+    Interrupt(regs, 0xFFFA);
+  }
+  else if (IRQ && !regs.I)
+    Interrupt(regs, 0xFFFE);
+}
+
+// The sequence of BRK without the padding byte and with B clear in the pushed status
+void Cpu::Interrupt(Registers &r, u16 vector)
+{
+  Push(r, r.PC >> 8);   // high byte
+  Push(r, r.PC & 0xFF); // low byte
+  Push(r, (GetStatus(r) & ~flagBvalue) | flagUvalue);
+
+  r.I           = true;
+  r.PC          = bus.Read(vector) | (bus.Read(vector + 1) << 8);
+  r.cycleCount += 7;
+}
+
+// 256 bytes of the page go to OAMDATA at the PPU's time, the CPU stops for 513 cycles and
+// one more when the DMA starts on an odd one
+void Cpu::TransferOam()
+{
+  SyncPpu(regs.cycleCount);
+
+  for (u32 offset = 0; offset < 0x100; ++offset)
+    ppu.WriteRegister(0x2004, bus.Read((dmaPage << 8) | offset));
+
+  regs.cycleCount += 513 + (regs.cycleCount & 1);
+}
+
+void Cpu::SetNMI(bool value)
+{
+  NMI = value;
+}
+
+void Cpu::SetIRQ(bool value)
+{
+  IRQ = value;
+}
+
+const Cpu::OpcodeHandler Cpu::opcodeTable[256] = {
+#define OPCODE(code) &Cpu::Execute<code>,
+
+  CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+};
@@ -1,268 +1,404 @@
-#ifndef __CPU_H__
-#define __CPU_H__
-
-#pragma once
-
-#include <string>
-#include "types.hpp"
-
-class Cpu {
-private:
-  /* Constants */
-  const u8 flagCvalue = 0x01;
-  const u8 flagZvalue = 0x02;
-  const u8 flagIvalue = 0x04;
-  const u8 flagDvalue = 0x08;
-  const u8 flagBvalue = 0x10;
-  const u8 flagUvalue = 0x20;
-  const u8 flagVvalue = 0x40;
-  const u8 flagNvalue = 0x80;
-
-  const u8 header     = 16;
-
-  /* Memory */
-  u8 ram[0x10000];    // 64KB of memory with addresses from 0x0000 to 0xFFFF
-
-  /* Registers */
-  s32 cycleCount; // Clock cycles
-  u16 PC;         // Program counter
-  u8  SP;         // Stack pointer
-  u8  A;          // Accumulator
-  u8  X;          // Index register X
-  u8  Y;          // Index register Y
-
-  /* Processor status S */
-  u8 status;
-  bool C;         // Carry flag        - bit 0
-  bool Z;         // Zero flag         - bit 1
-  bool I;         // Interrupt disable - bit 2
-  bool D;         // Decimal mode      - bit 3
-  bool B;         // Break command     - bit 4
-  bool U;         // Unused flag       - bit 5
-  bool V;         // Overflow flag     - bit 6
-  bool N;         // Negative flag     - bit 7
-
-  /* Interrupts */
-  bool NMI;       // Non-Maskable interrupt
-  bool IRQ;       // Maskable interrupt
-
-public:
-  Cpu();
-  ~Cpu();
-
-  void LoadRom             (std::string romFile = "DEFAULT_FILE");
-
-  void NextOpcode          ();
-  void ProcessOpcode       (u16 opcode);
-
-private:
-  void Reset               ();
-
-  void SetStatus           ();
-  void SetStatus           (u8 newStatus);
-  void SetNMI              (bool value);
-  void SetIRQ              (bool value);
-
-  /* Addressing modes */
-  u8  ZeroPage             (s32 cycles);
-  u8  ZeroPageX            (s32 cycles);
-  u8  ZeroPageY            (s32 cycles);
-  u16 Absolute             (s32 cycles);
-  u16 AbsoluteX            (s32 cycles, s32 extraCyclesForCrossedPage = 0);
-  u16 AbsoluteY            (s32 cycles, s32 extraCyclesForCrossedPage = 0);
-  u16 Indirect             (s32 cycles);
-  u16 IndirectXPreIndexing (s32 cycles);
-  u16 IndirectYPostIndexing(s32 cycles, s32 extraCyclesForCrossedPage = 0);
-  u16 Immediate            (s32 cycles);
-
-  /* Control Instructions -> From excel. Format: Mnemonic_Opcode */ 
-  /* Load/Store Operations: Load a register from memory or stores the contents of a register to memory. */
-  void LDA_A9(); /* Load Accumulator with Memory */
-  void LDA_AD(); /* Load Accumulator with Memory */
-  void LDA_BD(); /* Load Accumulator with Memory */
-  void LDA_B9(); /* Load Accumulator with Memory */
-  void LDA_A5(); /* Load Accumulator with Memory */
-  void LDA_B5(); /* Load Accumulator with Memory */
-  void LDA_A1(); /* Load Accumulator with Memory */
-  void LDA_B1(); /* Load Accumulator with Memory */
-  void LDX_A2(); /* Load Index X with Memory */
-  void LDX_AE(); /* Load Index X with Memory */
-  void LDX_BE(); /* Load Index X with Memory */
-  void LDX_A6(); /* Load Index X with Memory */
-  void LDX_B6(); /* Load Index X with Memory */
-  void LDY_A0(); /* Load Index Y with Memory */
-  void LDY_AC(); /* Load Index Y with Memory */
-  void LDY_BC(); /* Load Index Y with Memory */
-  void LDY_A4(); /* Load Index Y with Memory */
-  void LDY_B4(); /* Load Index Y with Memory */
-  void STA_8D(); /* Store Accumulator in Memory */
-  void STA_9D(); /* Store Accumulator in Memory */
-  void STA_99(); /* Store Accumulator in Memory */
-  void STA_85(); /* Store Accumulator in Memory */
-  void STA_95(); /* Store Accumulator in Memory */
-  void STA_81(); /* Store Accumulator in Memory */
-  void STA_91(); /* Store Accumulator in Memory */
-  void STX_8E(); /* Store Index X in Memory */
-  void STX_86(); /* Store Index X in Memory */
-  void STX_96(); /* Store Index X in Memory */
-  void STY_8C(); /* Store Index Y in Memory */
-  void STY_84(); /* Store Index Y in Memory */
-  void STY_94(); /* Store Index Y in Memory */
-    
-  /* Register Transfer Operations: Copy contents of X or Y register to the accumulator or copy contents of accumulator to X or Y register. */
-  void TAX_AA(); /* Transfer Accumulator to Index X */
-  void TAY_A8(); /* Transfer Accumulator to Index Y */
-  void TXA_8A(); /* Transfer Index X to Accumulator */
-  void TYA_98(); /* Transfer Index Y to Accumulator */
-
-  /* Stack Operations: Push or pull the stack or manipulate stack pointer using X register. */
-  void PHA_48(); /* Push Accumulator on Stack */
-  void PHP_08(); /* Push Processor Status on Stack */
-  void PLA_68(); /* Pull Accumulator from Stack */
-  void PLP_28(); /* Pull Processor Status from Stack */
-  void TSX_BA(); /* Transfer Stack Pointer to Index X */
-  void TXS_9A(); /* Transfer Index X to Stack Pointer */
-
-  /* Logical Operations: Perform logical operations on the accumulator and a value stored in memory. */
-  void AND_29(); /* AND Memory with Accumulator */
-  void AND_2D(); /* AND Memory with Accumulator */
-  void AND_3D(); /* AND Memory with Accumulator */
-  void AND_39(); /* AND Memory with Accumulator */
-  void AND_25(); /* AND Memory with Accumulator */
-  void AND_35(); /* AND Memory with Accumulator */
-  void AND_21(); /* AND Memory with Accumulator */
-  void AND_31(); /* AND Memory with Accumulator */
-  void EOR_49(); /* Exclusive Or Memory with Accumulator */
-  void EOR_4D(); /* Exclusive Or Memory with Accumulator */
-  void EOR_5D(); /* Exclusive Or Memory with Accumulator */
-  void EOR_59(); /* Exclusive Or Memory with Accumulator */
-  void EOR_45(); /* Exclusive Or Memory with Accumulator */
-  void EOR_55(); /* Exclusive Or Memory with Accumulator */
-  void EOR_41(); /* Exclusive Or Memory with Accumulator */
-  void EOR_51(); /* Exclusive Or Memory with Accumulator */
-  void ORA_09(); /* OR Memory with Accumulator */
-  void ORA_0D(); /* OR Memory with Accumulator */
-  void ORA_1D(); /* OR Memory with Accumulator */
-  void ORA_19(); /* OR Memory with Accumulator */
-  void ORA_05(); /* OR Memory with Accumulator */
-  void ORA_15(); /* OR Memory with Accumulator */
-  void ORA_01(); /* OR Memory with Accumulator */
-  void ORA_11(); /* OR Memory with Accumulator */    
-  void BIT_2C(); /* Test Bits in Memory with Accumulator */
-  void BIT_24(); /* Test Bits in Memory with Accumulator */
-
-  /* Arithmetic Operations: Perform arithmetic operations on registers and memory. */
-  void ROL_2A(); /* Rotate One Bit Left (Memory or Accumulator) */
-  void ROL_2E(); /* Rotate One Bit Left (Memory or Accumulator) */
-  void ROL_3E(); /* Rotate One Bit Left (Memory or Accumulator) */
-  void ROL_26(); /* Rotate One Bit Left (Memory or Accumulator) */
-  void ROL_36(); /* Rotate One Bit Left (Memory or Accumulator) */
-  void ROR_6A(); /* Rotate One Bit Right (Memory or Accumulator) */
-  void ROR_6E(); /* Rotate One Bit Right (Memory or Accumulator) */
-  void ROR_7E(); /* Rotate One Bit Right (Memory or Accumulator) */
-  void ROR_66(); /* Rotate One Bit Right (Memory or Accumulator) */
-  void ROR_76(); /* Rotate One Bit Right (Memory or Accumulator) */
-  void ADC_69(); /* Add Memory to Accumulator with Carry */
-  void ADC_6D(); /* Add Memory to Accumulator with Carry */
-  void ADC_7D(); /* Add Memory to Accumulator with Carry */
-  void ADC_79(); /* Add Memory to Accumulator with Carry */
-  void ADC_65(); /* Add Memory to Accumulator with Carry */
-  void ADC_75(); /* Add Memory to Accumulator with Carry */
-  void ADC_61(); /* Add Memory to Accumulator with Carry */
-  void ADC_71(); /* Add Memory to Accumulator with Carry */
-  void CMP_C9(); /* Compare Memory and Accumulator */
-  void CMP_CD(); /* Compare Memory and Accumulator */
-  void CMP_DD(); /* Compare Memory and Accumulator */
-  void CMP_D9(); /* Compare Memory and Accumulator */
-  void CMP_C5(); /* Compare Memory and Accumulator */
-  void CMP_D5(); /* Compare Memory and Accumulator */
-  void CMP_C1(); /* Compare Memory and Accumulator */
-  void CMP_D1(); /* Compare Memory and Accumulator */
-  void CPX_E0(); /* Compare Memory and Index X */
-  void CPX_EC(); /* Compare Memory and Index X */
-  void CPX_E4(); /* Compare Memory and Index X */
-  void CPY_C0(); /* Compare Memory and Index Y */
-  void CPY_CC(); /* Compare Memory and Index Y */
-  void CPY_C4(); /* Compare Memory and Index Y */
-  void SBC_E9(); /* Substract Memory from Accumulator with Borrow */
-  void SBC_ED(); /* Substract Memory from Accumulator with Borrow */
-  void SBC_FD(); /* Substract Memory from Accumulator with Borrow */
-  void SBC_F9(); /* Substract Memory from Accumulator with Borrow */
-  void SBC_E5(); /* Substract Memory from Accumulator with Borrow */    
-  void SBC_F5(); /* Substract Memory from Accumulator with Borrow */
-  void SBC_E1(); /* Substract Memory from Accumulator with Borrow */
-  void SBC_F1(); /* Substract Memory from Accumulator with Borrow */
-
-  /* Increments/Decrements: Increment or decrement the X or Y registers or a value stored in memory. */
-  void DEC_CE(); /* Decrement Memory by One */
-  void DEC_DE(); /* Decrement Memory by One */
-  void DEC_C6(); /* Decrement Memory by One */
-  void DEC_D6(); /* Decrement Memory by One */ 
-  void DEX_CA(); /* Decrement Index X by One */
-  void DEY_88(); /* Decrement Index Y by One */
-  void INC_EE(); /* Increment Memory by One */
-  void INC_FE(); /* Increment Memory by One */
-  void INC_E6(); /* Increment Memory by One */
-  void INC_F6(); /* Increment Memory by One */
-  void INX_E8(); /* Increment Index X by One */
-  void INY_C8(); /* Increment Index Y by One */
-
-  /* Shifts: Shift the bits of either the accumulator or a memory location one bit to the left or right. */
-  void ASL_0A(); /* Shift One Bit Left (Memory or Accummulator) */
-  void ASL_0E(); /* Shift One Bit Left (Memory or Accummulator) */
-  void ASL_1E(); /* Shift One Bit Left (Memory or Accummulator) */
-  void ASL_06(); /* Shift One Bit Left (Memory or Accummulator) */
-  void ASL_16(); /* Shift One Bit Left (Memory or Accummulator) */
-  void LSR_4A(); /* Shift One Bit Right (Memory or Accumulator) */
-  void LSR_4E(); /* Shift One Bit Right (Memory or Accumulator) */
-  void LSR_5E(); /* Shift One Bit Right (Memory or Accumulator) */
-  void LSR_46(); /* Shift One Bit Right (Memory or Accumulator) */
-  void LSR_56(); /* Shift One Bit Right (Memory or Accumulator) */
-
-  /* Jumps/Calls: Break sequential execution sequence, resuming from a specified address. */
-  void RTS_60(); /* Return from  Subroutine */
-  void JMP_4C(); /* Jump to New Location */
-  void JMP_6C(); /* Jump to New Location */
-  void JSR_20(); /* Jump to New Location Saving Return Address */
-
-  /* Branches: Break sequential execution sequence, resuming from a specified address, if a condition is met. The condition involves examining a specific bit in the status register.*/
-  void BCC_90(); /* Branch on Carry Clear */
-  void BCS_B0(); /* Branch on Carry Set */
-  void BEQ_F0(); /* Branch on Result Zero*/
-  void BMI_30(); /* Branch on Result Minus*/
-  void BNE_D0(); /* Branch on Result not Zero*/
-  void BPL_10(); /* Branch on Result Plus */
-  void BVC_50(); /* Branch on Overflow Clear*/
-  void BVS_70(); /* Branch on Overflow Set */
-
-  /* Status Register Operations: Set or clear a flag in the status register. */
-  void CLC_18(); /* Clear Carry Flag */
-  void CLD_D8(); /* Clear Decimal Mode */
-  void CLI_58(); /* Clear interrupt Disable Bit */
-  void CLV_B8(); /* Clear Overflow Flag */
-  void SEC_38(); /* Set Carry Flag */
-  void SED_F8(); /* Set Decimal Mode */
-  void SEI_78(); /* Set interrupt Disable Bit*/
-
-  /* System Functions: Perform rarely used functions. */
-  void NOP_EA(); /* No Operation */
-  void RTI_40(); /* Return from interrupt */
-  void BRK_00(); /* Force Break */
-
-
-  /* Imp: Implied */
-  /* Acc: Accumulator */
-  /* Imm: Immediate */
-  /* Abs: Absolute */
-  /* AbsX: Absolute with X Indexing */
-  /* AbsY: Absolute with Y Indexing */
-  /* JmpInd: Indirect Absolute */
-  /* DP: Zero/Direct/Base Page */    
-  /* DPX: Zero/Direct/Base Page with X Indexing */
-  /* DPY: Zero/Direct/Base Page with Y Indexing */
-  /* DPIndX: Zero/Direct/Base Page Indirect with X Pre-Indexing */
-  /* DPIndY: Zero/Direct/Base Page Indirect with X Post-Indexing */
-  /* Rel: Relative */
-};
-
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "apu.hpp"
+#include "bus.hpp"
+#include "mapper.hpp"
+#include "opcodes.hpp"
+#include "ppu.hpp"
+#include "rom.hpp"
+#include "scheduler.hpp"
+#include "tracer.hpp"
+#include "types.hpp"
+
+class Jit;
+class StaticCode;
+struct SaveState;
+struct StaticProgram;
+
+class Cpu {
+  friend class Lockstep;   // Runs Registers of many Cpus as vectors and their instruction handlers
+  friend class Recompiler; // Generates native blocks against Registers and the memory layout
+  friend class StaticCode; // Lets statically recompiled routines run the instruction handlers
+
+private:
+  /* Constants */
+  static const u8 flagCvalue = 0x01;
+  static const u8 flagZvalue = 0x02;
+  static const u8 flagIvalue = 0x04;
+  static const u8 flagDvalue = 0x08;
+  static const u8 flagBvalue = 0x10;
+  static const u8 flagUvalue = 0x20;
+  static const u8 flagVvalue = 0x40;
+  static const u8 flagNvalue = 0x80;
+
+  /* Memory */
+  u8                         ram   [0x800];  // 2KB of internal memory, mirrored up to 0x1FFF. Holds zero page and stack
+  PagedMemory<0x100, 32>     prgRam;         // 8KB of cartridge work memory at 0x6000, in bus pages shared with forks
+  std::shared_ptr<const Rom> rom;            // Program ROM banks are mapped straight from the rom file
+  std::unique_ptr<Mapper>    mapper;         // Picks the banks of the rom, null without one
+  Bus                        bus;            // 64KB address space with addresses from 0x0000 to 0xFFFF
+  Ppu                        ppu;            // Registers at 0x2000, runs behind the Cpu and catches up at events and register accesses
+  Apu                        apu;            // Registers at 0x4000, the same way
+
+  /* Registers */
+  struct Registers {
+    s64 cycleCount; // Clock cycles, the master clock
+    u16 PC;         // Program counter
+    u8  SP;         // Stack pointer
+    u8  A;          // Accumulator
+    u8  X;          // Index register X
+    u8  Y;          // Index register Y
+
+    /* Processor status S. Carry, zero, overflow and negative are evaluated lazily:
+       instructions store the values the flags derive from, see GetC/GetZ/GetV/GetN */
+    u16  cResult;   // Carry flag        - bit 0, bit 8 of the last carry producing result
+    u16  nzResult;  // Zero flag         - bit 1, low byte of the last result is zero
+                    // Negative flag     - bit 7, bit 7 or 8 of the last result is set
+    u8   vOperandA; // Overflow flag     - bit 6, operands and result of the last ADC/SBC
+    u8   vOperandM;
+    u8   vResult;
+    bool I;         // Interrupt disable - bit 2
+    bool D;         // Decimal mode      - bit 3
+    bool B;         // Break command     - bit 4
+    bool U;         // Unused flag       - bit 5
+  };
+
+  Registers regs;
+
+  /* Interrupts */
+  bool NMI;       // Non-Maskable interrupt, latched on the rising edge of the PPU output
+  bool IRQ;       // Maskable interrupt, the level of the APU and cartridge outputs
+  bool nmiLine;   // PPU output at the last poll
+
+  /* Standard controllers at 0x4016 and 0x4017 */
+  u8   buttons [2]; // Held, set by the host
+  u8   shifters[2]; // Bits left to read, the next one in bit 0
+  bool strobe;      // Bit 0 of the last 0x4016 write, the shifters reload from buttons while it's set
+
+  /* Events. Run stops the interpreter loops at the next scheduled event, the components it
+     concerns catch up to it and the interrupt lines are only polled there. */
+  Scheduler scheduler;
+  s64       nextStop; // Cycle count the running batch stops at, lowered to stop it sooner
+  s64       ppuClock; // Cycle count the PPU has run to
+  s64       apuClock;
+  u8        dmaPage;  // Source page of the pending OAM DMA
+
+  u32       catchUps;      // Register accesses that caught a component up, since vblank
+  u32       frameCatchUps; // The same over the last whole frame
+
+  Tracer *tracer; // Receives a record per instruction when built with NESEMU_TRACE
+
+  /* Decoded blocks. A block is a run of instructions up to the first jump or the page end,
+     decoded once with its operands resolved. Branches stay inside, a taken one leaves the
+     block. In ROM a block goes on through JSR and JMP within the 8KB bank and through RTS
+     back to the JSR's caller, up to the first jump elsewhere or the bank's end. Blocks are
+     looked up by PC and tagged with the memory the code was read from, which tells apart
+     banks mapped at the same PC. Decoding from RAM watches its page, the first write to
+     it drops its blocks. */
+  struct DecodedOp {
+    u16 operand; // Immediate value, address, pointer or branch target, see DecodeOperand
+    u8  opcode;  // Selects the handler, Execute<opcode>
+    u8  last;    // Set on the last op of a block, saves keeping its end around
+  };
+
+  // Native code of a block, runs it on the registers and returns with PC at the next one
+  typedef void (*NativeBlock)(Registers *r);
+
+  struct Block {
+    const u8   *code;      // Memory of the first opcode, null for a free slot
+    NativeBlock native;    // Compiled once the block is hot, see Dispatch::Jit
+    u16         first;     // First op in blockOps
+    u16         maxCycles; // Base cycles of every op plus the worst page crossing and branch penalties
+    u8          count;     // 0 until the block is reached a second time and decoded
+    u8          hits;      // Runs counted towards nativeThreshold
+  };
+
+  static const u32 blockSlots    = 0x4000;  // Direct mapped on PC
+  static const u32 blockLength   = 32;      // Longest block, in instructions
+  static const u32 blockOpsLimit = 0x10000; // Decoded ops kept before every block is dropped
+  static const u8  nativeThreshold = 16;    // Runs of a block before it's compiled
+
+  // Slots are allocated zeroed, pages of them code never reaches aren't touched
+  struct FreeSlots { void operator()(Block *slots) const { free(slots); } };
+
+  std::unique_ptr<Block[], FreeSlots> blocks; // blockSlots, allocated on first use, copies start empty
+  std::vector<DecodedOp> blockOps;
+  std::vector<u16>       ramBlocks;       // Slots of the blocks decoded from RAM, the only ones dropped by page
+  u32                    blockGeneration; // Bumped whenever blocks are dropped or banks switched
+  u32                    prgRamCode;      // PRG RAM pages blocks were decoded from, dropped when the page is mapped again
+  std::unique_ptr<Jit>   jit;             // Executable memory of the native blocks, created on first use
+
+  const StaticProgram   *staticProgram;   // Recompiled routines of the loaded ROM, null when none was linked in
+
+public:
+  Cpu();
+  Cpu(const Cpu &other);
+  ~Cpu();
+
+  Cpu &operator=(const Cpu &other);
+
+  // A copy sharing memory with this Cpu: the ROM, and the pages of PRG RAM, VRAM and CHR RAM
+  // until either writes to them (see PagedMemory). The 2KB of internal RAM are copied, zero
+  // page and the stack are written without the bus. Forks run on any thread.
+  std::unique_ptr<Cpu> Fork();
+
+  bool LoadRom             (const std::string &romFile);
+  bool LoadRom             (const std::shared_ptr<const Rom> &newRom); // Instances can share one Rom. False when its mapper isn't supported
+
+  void NextOpcode          ();
+  void ProcessOpcode       (u8 opcode);
+  void ProcessOpcodeSwitch (u8 opcode); // Reference switch dispatch, kept to benchmark the table against
+
+  /* Interpreter loops, run a batch of instructions without returning to the caller */
+  enum class Dispatch : u8 {
+    Table,    // Indirect call through opcodeTable
+    Switch,   // Switch with every handler inlined
+    Threaded, // Direct-threaded, every handler jumps straight to the next one (GCC/Clang only)
+    Block,    // Pre-decoded blocks, see Block
+    Jit,      // Pre-decoded blocks, hot ones compiled to native code (x86-64 only, Block elsewhere)
+    Static    // Routines recompiled ahead of time for the loaded ROM (see aot.hpp), Block when there are none
+  };
+
+  static const Dispatch defaultDispatch;
+
+  // Runs until the cycle budget is spent and returns the cycles overshot. Events and interrupts
+  // are handled on the way, the PPU and APU have caught up when it returns.
+  s32  Run                 (s32 cycles, Dispatch dispatch = defaultDispatch);
+
+  // Only the CPU, without events or interrupts. The PPU and APU catch up on the next Run.
+  void RunInstructions     (u32 count,  Dispatch dispatch = defaultDispatch);
+
+  void SetTracer           (Tracer *newTracer); // Null stops tracing, native blocks don't run while tracing
+
+  u32  GetNativeBlockCount () const;           // Blocks compiled to native code, for tests and benchmarks
+  bool HasStaticProgram    () const;           // Routines of the loaded ROM were recompiled ahead of time
+
+  /* Architectural view of the registers, for debuggers, tracers and tests */
+  struct State {
+    u16 PC;
+    u8  SP;
+    u8  A;
+    u8  X;
+    u8  Y;
+    u8  P;          // Packed processor status
+    s64 cycleCount;
+  };
+
+  State GetState           () const;
+  void  SetState           (const State &state);
+
+  /* Save state section, see savestate.hpp. The PPU and APU clocks keep how far behind they run. */
+  struct Snapshot {
+    Registers regs;
+    s64       ppuClock;
+    s64       apuClock;
+    u32       catchUps;
+    u32       frameCatchUps;
+    u8        ram   [0x800];
+    u8        prgRam[0x2000];
+    bool      NMI;
+    bool      IRQ;
+    bool      nmiLine;
+    bool      dmaPending;
+    u8        dmaPage;
+    u8        buttons [2];
+    u8        shifters[2];
+    bool      strobe;
+  };
+
+  // Copies of the whole machine, microseconds either way. Restore keeps the decoded blocks
+  // of code the state doesn't change, and refuses states saved with another cartridge.
+  void  Save               (SaveState &state) const;
+  bool  Restore            (const SaveState &state);
+
+  // RAM pages of a Snapshot, ram then prgRam
+  static const u32 snapshotPages = (sizeof(Snapshot::ram) + sizeof(Snapshot::prgRam)) / Bus::pageSize;
+
+  // Save over a state holding the last SaveChanges, copying only the RAM pages the bus saw
+  // written since. Returns the pages copied, bit n for page n of the snapshot. Restores,
+  // copies and the first call copy them all.
+  u64   SaveChanges        (SaveState &state);
+
+  u8   ReadMemory          (u16 address) const;
+  void WriteMemory         (u16 address, u8 value);
+
+  u16  GetPC               () const;
+  s64  GetCycleCount       () const;
+  u8   FetchOpcode         () const;
+
+  u32  GetCatchUps         () const; // Register accesses that caught the PPU or APU up in the last frame
+
+  // Run clocks both, three PPU dots and one APU clock per cycle. They lag behind the Cpu
+  // and catch up in one go at events and when their registers are accessed.
+  Ppu       &GetPpu        ();
+  const Ppu &GetPpu        () const;
+  Apu       &GetApu        ();
+  const Apu &GetApu        () const;
+
+  /* Controller buttons, in the order a strobe reads them out from bit 0 */
+  static const u8 buttonA      = 0x01;
+  static const u8 buttonB      = 0x02;
+  static const u8 buttonSelect = 0x04;
+  static const u8 buttonStart  = 0x08;
+  static const u8 buttonUp     = 0x10;
+  static const u8 buttonDown   = 0x20;
+  static const u8 buttonLeft   = 0x40;
+  static const u8 buttonRight  = 0x80;
+
+  void SetButtons          (u32 port, u8 held); // Port 0 or 1, games see them at their next strobe
+  u8   GetButtons          (u32 port) const;
+
+private:
+  typedef void (Cpu::*OpcodeHandler)(Registers &r);
+
+  static const OpcodeHandler opcodeTable[256]; // Built at compile time, every opcode has a handler
+
+  void Reset               ();
+  void MapMemory           ();
+  void MapBanks            (); // Where the mapper has the banks now
+  void ResetEvents         (); // The components start at the current cycle count
+
+  /* Events, see Scheduler */
+  void RunBatch            (Dispatch dispatch); // Up to nextStop
+  void HandleEvents        ();
+  void Sync                (); // Runs the PPU and APU up to the cycle count
+  void SyncPpu             (s64 cycle);
+  void SyncApu             (s64 cycle);
+  void CatchUpPpu          (); // Up to a register access
+  void CatchUpApu          ();
+  void ScheduleEvents      (); // Predicts the component events from their current state
+  void PollInterrupts      ();
+  void Interrupt           (Registers &r, u16 vector);
+  void TransferOam         ();
+
+  FORCEINLINE void CheckIrq(const Registers &r); // After I is cleared
+
+  /* Interpreter loops, Stop is called with the registers before every instruction */
+  template<typename Stop> void RunTable   (Stop stop);
+  template<typename Stop> void RunSwitch  (Stop stop);
+#ifdef NESEMU_THREADED_DISPATCH
+  template<typename Stop> void RunThreaded(Stop stop);
+#endif
+  template<typename Stop> void RunBlocks  (Stop stop, bool limited, bool native); // limited: Stop is nextStop
+  template<typename Stop> void RunStatic  (Stop stop);
+
+  /* Block cache */
+  FORCEINLINE Block      *FindBlock(u16 PC);
+  FORCEINLINE static bool EndsBlock(u8 opcode);
+  Block *DecodeBlock       (u16 PC, Block &slot);
+  void ClearBlocks         ();
+  void InvalidateBlocks    (const u8 *page);
+  void InvalidateRestored  (const Snapshot &snapshot); // Blocks of RAM code the snapshot overwrites
+  void SaveComponents      (SaveState &state) const;  // Everything but the RAM
+
+  /* Forks */
+  struct Forked {};
+
+  Cpu                      (Cpu &parent, Forked); // Skips the reset of a new Cpu, Share sets everything
+
+  void CopyState           (const Cpu &other); // All but the memory
+  void Share               (Cpu &other);
+  void MapPrgRam           ();                 // Own pages written straight, shared ones through WriteSharedRam
+
+  static void WriteSharedRam(void *context, u16 address, u8 value);
+
+  static void WriteCode    (void *context, u16 address, u8 value);
+  static u8   ReadDmc      (void *context, u16 address); // DMC sample fetches, through the bus
+
+  // Cartridge handlers: bank switches at 0x8000-0xFFFF and the scanline clock of the PPU
+  static void WriteMapper  (void *context, u16 address, u8 value);
+  static void ClockMapper  (void *context);
+
+  // Handlers of the PPU registers
+  static u8   ReadPpu      (void *context, u16 address);
+  static void WritePpu     (void *context, u16 address, u8 value);
+
+  // Handlers of the page at 0x4000: the APU, OAM DMA at 0x4014 and the controllers
+  static u8   ReadIo       (void *context, u16 address);
+  static void WriteIo      (void *context, u16 address, u8 value);
+
+  u8   ReadController      (u32 port);
+  void WriteStrobe         (u8 value);
+
+  /* Native blocks, see jit.cpp */
+  NativeBlock CompileBlock (const Block &block, u16 PC);
+  void DropNativeCode      ();
+
+  // Called from native code while it runs on regs
+  static u8   NativeRead       (Cpu *cpu, u16 address);
+  static bool NativeWrite      (Cpu *cpu, u16 address, u8 value); // True when the write dropped blocks
+  static u8   NativePushStatus (Cpu *cpu);
+  static void NativePullStatus (Cpu *cpu, u8 value);
+
+  void ExecuteSwitch       (Registers &r, u8 opcode);
+  void ExecuteSwitch       (Registers &r, u8 opcode, u16 operand);
+
+  FORCEINLINE void Trace   (const Registers &r);
+
+  void SetStatus           (Registers &r, u8 newStatus);
+  void SetNMI              (bool value);
+  void SetIRQ              (bool value);
+
+  /* Lazy flag evaluation and the arithmetic setting the flags, templates on the registers: R is
+     Registers, or the lanes of Lockstep, vectors with the same fields. A flag is 0 or 1. */
+  template<typename R>               static auto GetStatus  (const R &r);
+  template<typename R>               static auto GetC       (const R &r);
+  template<typename R>               static auto GetZ       (const R &r);
+  template<typename R>               static auto GetV       (const R &r);
+  template<typename R>               static auto GetN       (const R &r);
+  template<Operation op, typename R> static auto BranchTaken(const R &r); // The condition of a branch
+  template<typename R, typename T>   static void SetV       (R &r, const T &value);
+  template<typename R, typename T>   static void SetZN      (R &r, const T &value);
+
+  /* Stack */
+  void Push                (Registers &r, u8 value);
+  u8   Pull                (Registers &r);
+
+  /* Addressing modes. Return the effective address from the decoded operand and advance PC past it */
+  u16 Implied              (Registers &r, u16 operand, s32 cycles);
+  u16 ZeroPage             (Registers &r, u16 operand, s32 cycles);
+  u16 ZeroPageX            (Registers &r, u16 operand, s32 cycles);
+  u16 ZeroPageY            (Registers &r, u16 operand, s32 cycles);
+  u16 Absolute             (Registers &r, u16 operand, s32 cycles);
+  u16 AbsoluteX            (Registers &r, u16 operand, s32 cycles, s32 extraCyclesForCrossedPage = 0);
+  u16 AbsoluteY            (Registers &r, u16 operand, s32 cycles, s32 extraCyclesForCrossedPage = 0);
+  u16 Indirect             (Registers &r, u16 operand, s32 cycles);
+  u16 IndirectXPreIndexing (Registers &r, u16 operand, s32 cycles);
+  u16 IndirectYPostIndexing(Registers &r, u16 operand, s32 cycles, s32 extraCyclesForCrossedPage = 0);
+  u16 Immediate            (Registers &r, u16 operand, s32 cycles);
+  u16 Relative             (Registers &r, u16 operand, s32 cycles);
+
+  FORCEINLINE u16 DecodeOperand(AddressingMode mode, u16 PC) const;
+
+  template<AddressingMode mode> FORCEINLINE u16  EffectiveAddress(Registers &r, u16 operand, s32 cycles, s32 extraCyclesForCrossedPage);
+  template<AddressingMode mode> FORCEINLINE u8   ReadOperand     (const Registers &r, u16 address);
+  template<AddressingMode mode> FORCEINLINE void WriteOperand    (Registers &r, u16 address, u8 value);
+
+  // Operand accesses outside zero page. Handlers see the cycle count of the instruction in regs.
+  FORCEINLINE u8   ReadBus         (const Registers &r, u16 address);
+  FORCEINLINE void WriteBus        (const Registers &r, u16 address, u8 value);
+
+  void Branch              (Registers &r, bool condition, u16 target);
+
+  /* Arithmetic shared by the official and the unofficial read-modify-write instructions, and by Lockstep */
+  template<typename R, typename T>               static void AddWithCarry(R &r, const T &value);
+  template<typename R, typename T, typename M>   static void Compare     (R &r, const T &reg, const M &value);
+  template<typename R, typename T>               static void BitTest     (R &r, const T &value);
+  template<Operation op, typename R, typename T> static auto Shift       (R &r, const T &value);
+
+  template<AddressingMode mode> FORCEINLINE void StoreHigh(Registers &r, u16 address, u8 index, u8 value);
+
+  /* Instruction handler, specialized from opcodeInfo[opcode] once per opcode in the dispatch table.
+     The first one reads its operand at PC, the second one gets it from a decoded block. */
+  template<u8 opcode> FORCEINLINE void Execute(Registers &r);
+  template<u8 opcode> FORCEINLINE void Execute(Registers &r, u16 operand);
+};
+
 #endif //__CPU_H__
\ No newline at end of file
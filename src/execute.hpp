@@ -0,0 +1,667 @@
+#ifndef __EXECUTE_H__
+#define __EXECUTE_H__
+
+#pragma once
+
+#include "cpu.hpp"
+
+/* Instruction handlers of Cpu and everything they inline: flags, stack, addressing modes and
+   operand access. Shared by the interpreter loops in cpu.cpp and by statically recompiled
+   ROMs (see aot.hpp), which run the very same handlers on their own control flow. */
+
+/* Flags and the arithmetic setting them are written once for Registers and for the lanes of
+   Lockstep, which keep every field as a vector of u32 with a lane per Cpu. Results are masked
+   to the bits Registers keeps and flags are 0 or 1, so the same expressions fit both. */
+template<typename R>
+FORCEINLINE auto Cpu::GetStatus(const R &r)
+{
+  return GetC(r)      | // Bit 0
+         GetZ(r) << 1 | // Bit 1
+         r.I     << 2 | // Bit 2
+         r.D     << 3 | // Bit 3
+         r.B     << 4 | // Bit 4
+         r.U     << 5 | // Bit 5
+         GetV(r) << 6 | // Bit 6
+         GetN(r) << 7;  // Bit 7
+}
+
+// An IRQ held back by I is taken as soon as I clears, the batch stops after this instruction
+FORCEINLINE void Cpu::CheckIrq(const Registers &r)
+{
+  if (IRQ && !r.I)
+    nextStop = INT64_MIN;
+}
+
+FORCEINLINE void Cpu::SetStatus(Registers &r, u8 newStatus)
+{
+  bool Z = (newStatus & flagZvalue) == flagZvalue;
+  bool N = (newStatus & flagNvalue) == flagNvalue;
+
+  r.cResult  = (newStatus & flagCvalue) << 8;
+  r.nzResult = (Z ? 0x000 : 0x001) | (N ? 0x100 : 0x000); // Bit 8 gives N without clearing Z
+  r.I = (newStatus & flagIvalue) == flagIvalue;
+  r.D = (newStatus & flagDvalue) == flagDvalue;
+  r.B = (newStatus & flagBvalue) == flagBvalue;
+  r.U = (newStatus & flagUvalue) == flagUvalue;
+
+  SetV(r, (newStatus & flagVvalue) == flagVvalue);
+  CheckIrq(r);
+}
+
+template<typename R, typename T>
+FORCEINLINE void Cpu::SetZN(R &r, const T &value)
+{
+  r.nzResult = value;
+}
+
+template<typename R>
+FORCEINLINE auto Cpu::GetC(const R &r)
+{
+  return (r.cResult >> 8) & 1;
+}
+
+template<typename R>
+FORCEINLINE auto Cpu::GetZ(const R &r)
+{
+  return ((r.nzResult & 0xFF) == 0) & 1;
+}
+
+template<typename R>
+FORCEINLINE auto Cpu::GetV(const R &r)
+{
+  // Signed overflow: both operands have the same sign and the result has the other one
+  return (((r.vOperandA ^ r.vResult) & (r.vOperandM ^ r.vResult)) >> 7) & 1;
+}
+
+template<typename R>
+FORCEINLINE auto Cpu::GetN(const R &r)
+{
+  return ((r.nzResult & 0x180) != 0) & 1;
+}
+
+template<Operation op, typename R>
+FORCEINLINE auto Cpu::BranchTaken(const R &r)
+{
+  return op == Operation::BCC ? GetC(r) ^ 1 : op == Operation::BCS ? GetC(r) :
+         op == Operation::BNE ? GetZ(r) ^ 1 : op == Operation::BEQ ? GetZ(r) :
+         op == Operation::BPL ? GetN(r) ^ 1 : op == Operation::BMI ? GetN(r) :
+         op == Operation::BVC ? GetV(r) ^ 1 : GetV(r);
+}
+
+template<typename R, typename T>
+FORCEINLINE void Cpu::SetV(R &r, const T &value)
+{
+  r.vOperandA = 0;
+  r.vOperandM = 0;
+  r.vResult   = value << 7;
+}
+
+/* Stack */
+FORCEINLINE void Cpu::Push(Registers &r, u8 value)
+{
+  ram[0x100 + r.SP] = value;
+  r.SP--; // Decrement after pushing on
+}
+
+FORCEINLINE u8 Cpu::Pull(Registers &r)
+{
+  r.SP++; // Increment before pulling off
+  return ram[0x100 + r.SP];
+}
+
+/* Addressing modes */
+FORCEINLINE u16 Cpu::Implied(Registers &r, u16 operand, s32 cycles)
+{
+  r.cycleCount += cycles;
+  r.PC         += 1;
+
+  return 0;
+}
+
+FORCEINLINE u16 Cpu::ZeroPage(Registers &r, u16 operand, s32 cycles)
+{
+  u16 result = operand;
+
+  r.cycleCount += cycles;
+  r.PC         += 2;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::ZeroPageX(Registers &r, u16 operand, s32 cycles)
+{
+  u16 result = (operand + r.X) & 0xFF; // Zero page wraps around
+
+  r.cycleCount += cycles;
+  r.PC         += 2;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::ZeroPageY(Registers &r, u16 operand, s32 cycles)
+{
+  u16 result = (operand + r.Y) & 0xFF; // Zero page wraps around
+
+  r.cycleCount += cycles;
+  r.PC         += 2;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::Absolute(Registers &r, u16 operand, s32 cycles)
+{
+  u16 result = operand;
+
+  r.cycleCount += cycles;
+  r.PC         += 3;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::AbsoluteX(Registers &r, u16 operand, s32 cycles, s32 extraCycles)
+{
+  u16 LL     = operand & 0xFF; // low byte
+  u16 result = operand + r.X;
+
+  // Check if it was page cross
+  if (extraCycles) 
+  {
+    if (LL + r.X <= 255)
+      extraCycles = 0;
+  }
+
+  r.cycleCount += cycles + extraCycles;
+  r.PC         += 3;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::AbsoluteY(Registers &r, u16 operand, s32 cycles, s32 extraCycles)
+{
+  u16 LL     = operand & 0xFF; // low byte
+  u16 result = operand + r.Y;
+
+  // Check if it is page cross
+  if (extraCycles)
+  {
+    if (LL + r.Y <= 255)
+      extraCycles = 0;
+  }
+
+  r.cycleCount += cycles + extraCycles;
+  r.PC         += 3;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::Indirect(Registers &r, u16 operand, s32 cycles)
+{
+  u16 address = operand;
+
+  u16 XX = bus.Read(address);
+  u16 YY = bus.Read((address & 0xFF00) | ((address + 1) & 0x00FF)); // The high byte never crosses the page
+
+  YY <<= 8;
+
+  u16 result = (YY | XX);
+
+  r.cycleCount += cycles;
+  r.PC         += 3;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::IndirectXPreIndexing(Registers &r, u16 operand, s32 cycles)
+{
+  u8  BB = operand + r.X; // Zero page wraps around
+  u16 XX = ram[BB];
+  u16 YY = ram[(u8)(BB + 1)];
+
+  YY <<= 8;
+
+  u16 result = (YY | XX);
+
+  r.cycleCount += cycles;
+  r.PC         += 2;
+
+  return result;
+}
+
+FORCEINLINE u16 Cpu::IndirectYPostIndexing(Registers &r, u16 operand, s32 cycles, s32 extraCycles)
+{
+  u8  BB = (u8)operand; // low byte
+  u16 XX = ram[BB];
+  u16 YY = ram[(u8)(BB + 1)];
+
+  YY <<= 8;
+
+  u16 result = (YY | XX) + r.Y;
+
+  // Check if it is page cross
+  if (extraCycles)
+  {
+    if (XX + r.Y <= 255)
+      extraCycles = 0;
+  }
+
+  r.cycleCount += cycles + extraCycles;
+  r.PC         += 2;
+
+  return result;
+}
+
+// The operand is the value itself, see ReadOperand
+FORCEINLINE u16 Cpu::Immediate(Registers &r, u16 operand, s32 cycles)
+{
+  r.cycleCount += cycles;
+  r.PC         += 2;
+
+  return operand;
+}
+
+// The operand is the branch target, already resolved
+FORCEINLINE u16 Cpu::Relative(Registers &r, u16 operand, s32 cycles)
+{
+  r.cycleCount += cycles;
+  r.PC         += 2;
+
+  return operand;
+}
+
+// Reads the operand bytes of the instruction at PC. Immediate gives the value and Relative
+// the branch target, every other mode gives its bytes as they are.
+FORCEINLINE u16 Cpu::DecodeOperand(AddressingMode mode, u16 PC) const
+{
+  switch (mode)
+  {
+    case AddressingMode::Implied:
+    case AddressingMode::Accumulator: return 0;
+    case AddressingMode::Immediate:
+    case AddressingMode::ZeroPage:
+    case AddressingMode::ZeroPageX:
+    case AddressingMode::ZeroPageY:
+    case AddressingMode::IndirectX:
+    case AddressingMode::IndirectY:   return bus.Read(PC + 1);
+    case AddressingMode::Relative:    return PC + 2 + (s8)bus.Read(PC + 1);
+    case AddressingMode::Absolute:
+    case AddressingMode::AbsoluteX:
+    case AddressingMode::AbsoluteY:
+    case AddressingMode::Indirect:    return bus.Read(PC + 1) | (bus.Read(PC + 2) << 8); // low byte first
+  }
+
+  return 0;
+}
+
+template<AddressingMode mode>
+FORCEINLINE u16 Cpu::EffectiveAddress(Registers &r, u16 operand, s32 cycles, s32 extraCycles)
+{
+  switch (mode)
+  {
+    case AddressingMode::Implied:
+    case AddressingMode::Accumulator: return Implied(r, operand, cycles);
+    case AddressingMode::Immediate:   return Immediate(r, operand, cycles);
+    case AddressingMode::ZeroPage:    return ZeroPage(r, operand, cycles);
+    case AddressingMode::ZeroPageX:   return ZeroPageX(r, operand, cycles);
+    case AddressingMode::ZeroPageY:   return ZeroPageY(r, operand, cycles);
+    case AddressingMode::Absolute:    return Absolute(r, operand, cycles);
+    case AddressingMode::AbsoluteX:   return AbsoluteX(r, operand, cycles, extraCycles);
+    case AddressingMode::AbsoluteY:   return AbsoluteY(r, operand, cycles, extraCycles);
+    case AddressingMode::Indirect:    return Indirect(r, operand, cycles);
+    case AddressingMode::IndirectX:   return IndirectXPreIndexing(r, operand, cycles);
+    case AddressingMode::IndirectY:   return IndirectYPostIndexing(r, operand, cycles, extraCycles);
+    case AddressingMode::Relative:    return Relative(r, operand, cycles);
+  }
+
+  return 0;
+}
+
+template<AddressingMode mode>
+FORCEINLINE u8 Cpu::ReadOperand(const Registers &r, u16 address)
+{
+  // Zero page is always internal memory and skips the page table
+  switch (mode)
+  {
+    case AddressingMode::Accumulator: return r.A;
+    case AddressingMode::Immediate:   return (u8)address; // The operand is the value
+    case AddressingMode::ZeroPage:
+    case AddressingMode::ZeroPageX:
+    case AddressingMode::ZeroPageY:   return ram[address];
+    default:                          return ReadBus(r, address);
+  }
+}
+
+template<AddressingMode mode>
+FORCEINLINE void Cpu::WriteOperand(Registers &r, u16 address, u8 value)
+{
+  switch (mode)
+  {
+    case AddressingMode::Accumulator: r.A = value; break;
+    case AddressingMode::ZeroPage:
+    case AddressingMode::ZeroPageX:
+    case AddressingMode::ZeroPageY:   ram[address] = value; break;
+    default:                          WriteBus(r, address, value); break;
+  }
+}
+
+// The loops keep the registers in a copy, the cycle count is published to regs before the
+// handlers so they can catch their component up to it. Reads of memory skip it, a store
+// costs writes less than looking the page up twice.
+FORCEINLINE u8 Cpu::ReadBus(const Registers &r, u16 address)
+{
+  const u8 *memory = bus.GetMemory(address);
+
+  if (memory)
+    return *memory;
+
+  regs.cycleCount = r.cycleCount;
+
+  return bus.Read(address);
+}
+
+FORCEINLINE void Cpu::WriteBus(const Registers &r, u16 address, u8 value)
+{
+  regs.cycleCount = r.cycleCount;
+  bus.Write(address, value);
+}
+
+FORCEINLINE void Cpu::Branch(Registers &r, bool condition, u16 target)
+{
+  if (condition)
+  {
+    r.cycleCount += 1; // Branch succeeds
+
+    // Check if page was crossed
+    if ((r.PC & 0xFF00) != (target & 0xFF00))
+      r.cycleCount += 1;
+
+    r.PC = target;
+  }
+}
+
+// SBC adds the one's complement, value is taken as a byte
+template<typename R, typename T>
+FORCEINLINE void Cpu::AddWithCarry(R &r, const T &value)
+{
+  auto M   = value & 0xFF;
+  auto sum = r.A + M + (r.cResult >> 8);
+
+  r.vOperandA = r.A;
+  r.vOperandM = M;
+  r.vResult   = sum & 0xFF;
+  r.cResult   = sum;
+  r.A         = sum & 0xFF;
+  SetZN(r, r.A);
+}
+
+template<typename R, typename T, typename M>
+FORCEINLINE void Cpu::Compare(R &r, const T &reg, const M &value)
+{
+  // reg + ~M + 1 carries out exactly when reg >= M, its low byte is reg - M
+  r.cResult = reg + (~value & 0xFF) + 1;
+  SetZN(r, r.cResult & 0xFF);
+}
+
+// Z comes from A & M while N is bit 7 of M, moved to bit 8 so it can't clear Z
+template<typename R, typename T>
+FORCEINLINE void Cpu::BitTest(R &r, const T &value)
+{
+  r.nzResult = (r.A & value) | ((value & flagNvalue) << 1);
+  SetV(r, (value & flagVvalue) >> 6);
+}
+
+template<Operation op, typename R, typename T>
+FORCEINLINE auto Cpu::Shift(R &r, const T &value)
+{
+  auto previousCarry = r.cResult >> 8;
+
+  // Bit 7 shifts out into bit 8, which is the carry
+  if (op == Operation::ASL)
+    r.cResult = value << 1;
+  else if (op == Operation::ROL)
+    r.cResult = (value << 1) | previousCarry;
+
+  if (op == Operation::ASL || op == Operation::ROL)
+    return r.cResult & 0xFF;
+
+  r.cResult = (value & 0x01) << 8;
+
+  if (op == Operation::ROR)
+    return (value >> 1) | (previousCarry << 7);
+
+  return value >> 1;
+}
+
+// SHA, SHS, SHX and SHY store value & (high byte of the base address + 1). When indexing
+// crosses a page the stored value also replaces the high byte of the address.
+template<AddressingMode mode>
+FORCEINLINE void Cpu::StoreHigh(Registers &r, u16 address, u8 index, u8 value)
+{
+  u16 base   = address - index;
+  u8  result = value & ((base >> 8) + 1);
+
+  if ((base & 0xFF00) != (address & 0xFF00))
+    address = (result << 8) | (address & 0xFF);
+
+  WriteOperand<mode>(r, address, result);
+}
+
+template<u8 opcode>
+FORCEINLINE void Cpu::Execute(Registers &r)
+{
+  Execute<opcode>(r, DecodeOperand(opcodeInfo[opcode].mode, r.PC));
+}
+
+template<u8 opcode>
+FORCEINLINE void Cpu::Execute(Registers &r, u16 operand)
+{
+  constexpr Operation      op   = opcodeInfo[opcode].operation;
+  constexpr AddressingMode mode = opcodeInfo[opcode].mode;
+
+  u16 address = EffectiveAddress<mode>(r, operand, opcodeInfo[opcode].cycles, opcodeInfo[opcode].pageCycles);
+
+  switch (op)
+  {
+    /* Load/Store Operations: Load a register from memory or stores the contents of a register to memory. */
+    case Operation::LDA: r.A = ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+    case Operation::LDX: r.X = ReadOperand<mode>(r, address); SetZN(r, r.X); break;
+    case Operation::LDY: r.Y = ReadOperand<mode>(r, address); SetZN(r, r.Y); break;
+    case Operation::STA: WriteOperand<mode>(r, address, r.A); break;
+    case Operation::STX: WriteOperand<mode>(r, address, r.X); break;
+    case Operation::STY: WriteOperand<mode>(r, address, r.Y); break;
+
+    /* Register Transfer Operations: Copy contents of X or Y register to the accumulator or copy contents of accumulator to X or Y register. */
+    case Operation::TAX: r.X = r.A; SetZN(r, r.X); break;
+    case Operation::TAY: r.Y = r.A; SetZN(r, r.Y); break;
+    case Operation::TXA: r.A = r.X; SetZN(r, r.A); break;
+    case Operation::TYA: r.A = r.Y; SetZN(r, r.A); break;
+
+    /* Stack Operations: Push or pull the stack or manipulate stack pointer using X register. */
+    case Operation::PHA: Push(r, r.A); break;
+    case Operation::PHP: Push(r, GetStatus(r) | flagBvalue | flagUvalue); break; // B and U are always pushed set
+    case Operation::PLA: r.A = Pull(r); SetZN(r, r.A); break;
+    case Operation::PLP: SetStatus(r, (Pull(r) & ~flagBvalue) | flagUvalue); break;
+    case Operation::TSX: r.X = r.SP; SetZN(r, r.X); break;
+    case Operation::TXS: r.SP = r.X; break;
+
+    /* Logical Operations: Perform logical operations on the accumulator and a value stored in memory. */
+    case Operation::AND: r.A &= ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+    case Operation::EOR: r.A ^= ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+    case Operation::ORA: r.A |= ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+    case Operation::BIT: BitTest(r, ReadOperand<mode>(r, address)); break;
+
+    /* Arithmetic Operations: Perform arithmetic operations on registers and memory. */
+    case Operation::ADC: AddWithCarry(r,  ReadOperand<mode>(r, address)); break;
+    case Operation::SBC: AddWithCarry(r, ~ReadOperand<mode>(r, address)); break; // Substraction is an addition of the one's complement
+    case Operation::CMP: Compare(r, r.A, ReadOperand<mode>(r, address)); break;
+    case Operation::CPX: Compare(r, r.X, ReadOperand<mode>(r, address)); break;
+    case Operation::CPY: Compare(r, r.Y, ReadOperand<mode>(r, address)); break;
+
+    /* Increments/Decrements: Increment or decrement the X or Y registers or a value stored in memory. */
+    case Operation::INC:
+    case Operation::DEC:
+    {
+      u8 memValue = ReadOperand<mode>(r, address) + (op == Operation::INC ? 1 : -1);
+
+      WriteOperand<mode>(r, address, memValue);
+      SetZN(r, memValue);
+      break;
+    }
+    case Operation::INX: ++r.X; SetZN(r, r.X); break;
+    case Operation::INY: ++r.Y; SetZN(r, r.Y); break;
+    case Operation::DEX: --r.X; SetZN(r, r.X); break;
+    case Operation::DEY: --r.Y; SetZN(r, r.Y); break;
+
+    /* Shifts: Shift the bits of either the accumulator or a memory location one bit to the left or right. */
+    case Operation::ASL:
+    case Operation::LSR:
+    case Operation::ROL:
+    case Operation::ROR:
+    {
+      u8 memValue = Shift<op>(r, ReadOperand<mode>(r, address));
+
+      WriteOperand<mode>(r, address, memValue);
+      SetZN(r, memValue);
+      break;
+    }
+
+    /* Jumps/Calls: Break sequential execution sequence, resuming from a specified address. */
+    case Operation::JMP: r.PC = address; break;
+    case Operation::JSR:
+    {
+      u16 returnAddress = r.PC - 1; // Last byte of the JSR instruction
+
+      Push(r, returnAddress >> 8);   // high byte
+      Push(r, returnAddress & 0xFF); // low byte
+
+      r.PC = address;
+      break;
+    }
+    case Operation::RTS:
+    {
+      u16 LL = Pull(r); // low byte
+      u16 HH = Pull(r); // high byte
+
+      r.PC = ((HH << 8) | LL) + 1;
+      break;
+    }
+
+    /* Branches: Break sequential execution sequence, resuming from a specified address, if a condition is met. The condition involves examining a specific bit in the status register.*/
+    case Operation::BCC: case Operation::BCS:
+    case Operation::BEQ: case Operation::BNE:
+    case Operation::BMI: case Operation::BPL:
+    case Operation::BVC: case Operation::BVS: Branch(r, BranchTaken<op>(r), address); break;
+
+    /* Status Register Operations: Set or clear a flag in the status register. */
+    case Operation::CLC: r.cResult = 0x000; break;
+    case Operation::CLD: r.D = false; break;
+    case Operation::CLI: r.I = false; CheckIrq(r); break;
+    case Operation::CLV: SetV(r, false); break;
+    case Operation::SEC: r.cResult = 0x100; break;
+    case Operation::SED: r.D = true;  break;
+    case Operation::SEI: r.I = true;  break;
+
+    /* System Functions: Perform rarely used functions. */
+    case Operation::NOP: break;
+    case Operation::RTI:
+    {
+      SetStatus(r, (Pull(r) & ~flagBvalue) | flagUvalue);
+
+      u16 LL = Pull(r); // low byte
+      u16 HH = Pull(r); // high byte
+
+      r.PC = (HH << 8) | LL;
+      break;
+    }
+    case Operation::BRK:
+    {
+      u16 returnAddress = r.PC + 1; // BRK skips a padding byte
+
+      Push(r, returnAddress >> 8);   // high byte
+      Push(r, returnAddress & 0xFF); // low byte
+
+      Push(r, GetStatus(r) | flagBvalue | flagUvalue);
+
+      r.I  = true;
+      r.PC = bus.Read(0xFFFE) | (bus.Read(0xFFFF) << 8); // IRQ/BRK vector
+      break;
+    }
+
+    /* Unofficial: read-modify-write followed by an ALU operation on the result. */
+    case Operation::SLO:
+    case Operation::RLA:
+    case Operation::SRE:
+    case Operation::RRA:
+    {
+      const Operation shift = op == Operation::SLO ? Operation::ASL : op == Operation::RLA ? Operation::ROL :
+                              op == Operation::SRE ? Operation::LSR : Operation::ROR;
+
+      u8 memValue = Shift<shift>(r, ReadOperand<mode>(r, address));
+
+      WriteOperand<mode>(r, address, memValue);
+
+      if (op == Operation::RRA)
+        AddWithCarry(r, memValue);
+      else
+      {
+        r.A = op == Operation::SLO ? r.A | memValue : op == Operation::RLA ? r.A & memValue : r.A ^ memValue;
+        SetZN(r, r.A);
+      }
+      break;
+    }
+    case Operation::DCP:
+    case Operation::ISC:
+    {
+      u8 memValue = ReadOperand<mode>(r, address) + (op == Operation::ISC ? 1 : -1);
+
+      WriteOperand<mode>(r, address, memValue);
+
+      if (op == Operation::DCP)
+        Compare(r, r.A, memValue);
+      else
+        AddWithCarry(r, ~memValue);
+      break;
+    }
+
+    /* Unofficial: loads, stores and immediate combinations. */
+    case Operation::LAX: r.A = r.X = ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+    case Operation::SAX: WriteOperand<mode>(r, address, r.A & r.X); break;
+    case Operation::LAS: r.A = r.X = r.SP = ReadOperand<mode>(r, address) & r.SP; SetZN(r, r.A); break;
+    case Operation::ANC:
+      r.A &= ReadOperand<mode>(r, address);
+      r.cResult = r.A << 1; // Carry is a copy of N
+      SetZN(r, r.A);
+      break;
+    case Operation::ALR:
+      r.A = Shift<Operation::LSR>(r, r.A & ReadOperand<mode>(r, address));
+      SetZN(r, r.A);
+      break;
+    case Operation::ARR:
+    {
+      r.A = ((r.A & ReadOperand<mode>(r, address)) >> 1) | ((r.cResult >> 8) << 7);
+
+      // Carry is bit 6 of the result and overflow is bit 6 xor bit 5
+      r.cResult = (r.A & 0x40) << 2;
+      SetV(r, ((r.A >> 6) ^ (r.A >> 5)) & 0x01);
+      SetZN(r, r.A);
+      break;
+    }
+    case Operation::AXS:
+      Compare(r, r.A & r.X, ReadOperand<mode>(r, address)); // X = (A & X) - M, without borrow in
+      r.X = (u8)r.cResult;
+      break;
+
+    // The magic constant of XAA and LXA differs between chips, 0xEE is the common one
+    case Operation::XAA: r.A = (r.A | 0xEE) & r.X & ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+    case Operation::LXA: r.A = r.X = (r.A | 0xEE) & ReadOperand<mode>(r, address); SetZN(r, r.A); break;
+
+    case Operation::SHA: StoreHigh<mode>(r, address, r.Y, r.A & r.X); break;
+    case Operation::SHX: StoreHigh<mode>(r, address, r.Y, r.X); break;
+    case Operation::SHY: StoreHigh<mode>(r, address, r.X, r.Y); break;
+    case Operation::SHS: r.SP = r.A & r.X; StoreHigh<mode>(r, address, r.Y, r.SP); break;
+
+    /* Unofficial: halts the processor, PC stays on the opcode until a reset */
+    case Operation::JAM: r.PC -= 1; break;
+  }
+}
+
+#endif //__EXECUTE_H__
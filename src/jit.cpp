@@ -0,0 +1,1166 @@
+#include "jit.hpp"
+#include <cstddef>
+#include <vector>
+#include "cpu.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* Host calling conventions. Windows preserves RSI and RDI too and wants 32 bytes of
+   shadow space for the callee, the frame keeps the stack 16 byte aligned for calls. */
+#ifdef _WIN32
+static const Jit::Reg savedRegs[] = { Jit::RBX, Jit::RBP, Jit::RSI, Jit::RDI, Jit::R12, Jit::R13, Jit::R14, Jit::R15 };
+static const s32      frameSize   = 40;
+static const s32      spillOffset = 32;
+
+const Jit::Reg Jit::args[3] = { Jit::RCX, Jit::RDX, Jit::R8 };
+#else
+static const Jit::Reg savedRegs[] = { Jit::RBX, Jit::RBP, Jit::R12, Jit::R13, Jit::R14, Jit::R15 };
+static const s32      frameSize   = 8;
+static const s32      spillOffset = 0;
+
+const Jit::Reg Jit::args[3] = { Jit::RDI, Jit::RSI, Jit::RDX };
+#endif
+
+static const u32 savedCount = sizeof(savedRegs) / sizeof(savedRegs[0]);
+
+Jit::Jit()
+{
+  code     = nullptr;
+  size     = 0;
+  start    = 0;
+  overflow = false;
+  writable = true;
+
+#ifdef NESEMU_JIT_X64
+#ifdef _WIN32
+  code = (u8 *)VirtualAlloc(nullptr, capacity, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  void *memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (memory != MAP_FAILED)
+    code = (u8 *)memory;
+#endif
+#endif
+}
+
+Jit::~Jit()
+{
+  if (!code)
+    return;
+
+#ifdef _WIN32
+  VirtualFree(code, 0, MEM_RELEASE);
+#else
+  munmap(code, capacity);
+#endif
+}
+
+bool Jit::Begin()
+{
+  if (!code || capacity - size < maxFunction)
+    return false;
+
+  if (!writable)
+    Protect(true);
+
+  start    = size;
+  overflow = false;
+
+  return true;
+}
+
+void *Jit::End()
+{
+  Protect(false);
+
+  if (overflow)
+  {
+    size = start;
+    return nullptr;
+  }
+
+  return code + start;
+}
+
+void Jit::Abort()
+{
+  size = start;
+
+  Protect(false);
+}
+
+void Jit::Reset()
+{
+  size  = 0;
+  start = 0;
+}
+
+u32 Jit::Offset() const
+{
+  return size - start;
+}
+
+void Jit::Protect(bool write)
+{
+#ifdef _WIN32
+  DWORD previous;
+
+  VirtualProtect(code, capacity, write ? PAGE_READWRITE : PAGE_EXECUTE_READ, &previous);
+#else
+  mprotect(code, capacity, write ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif
+
+  writable = write;
+}
+
+/* Frame */
+void Jit::Prologue()
+{
+  for (u32 i = 0; i < savedCount; ++i)
+    Push(savedRegs[i]);
+
+  AluImm(Sub, RSP, frameSize, 8);
+}
+
+void Jit::Epilogue()
+{
+  AluImm(Add, RSP, frameSize, 8);
+
+  for (u32 i = savedCount; i-- > 0; )
+    Pop(savedRegs[i]);
+
+  Ret();
+}
+
+Jit::Mem Jit::Spill() const
+{
+  return At(RSP, spillOffset);
+}
+
+/* Instructions */
+void Jit::Mov(Reg dst, Reg src, u8 size)
+{
+  Encode(size, 0x89, src, dst);
+}
+
+void Jit::MovImm(Reg dst, u32 imm)
+{
+  if (dst & 8)
+    Emit8(0x41);
+
+  Emit8(0xB8 + (dst & 7));
+  Emit32(imm);
+}
+
+void Jit::MovImm64(Reg dst, u64 imm)
+{
+  Emit8(dst & 8 ? 0x49 : 0x48);
+  Emit8(0xB8 + (dst & 7));
+  Emit64(imm);
+}
+
+void Jit::Movzx8(Reg dst, Reg src)
+{
+  Encode(1, 0x0FB6, dst, src);
+}
+
+void Jit::Load(u8 size, Reg dst, const Mem &src)
+{
+  switch (size)
+  {
+    case 1:  Encode(1, 0x0FB6, dst, src); break;
+    case 2:  Encode(4, 0x0FB7, dst, src); break;
+    default: Encode(size, 0x8B, dst, src); break;
+  }
+}
+
+void Jit::Store(u8 size, const Mem &dst, Reg src)
+{
+  Encode(size, size == 1 ? 0x88 : 0x89, src, dst);
+}
+
+void Jit::StoreImm(u8 size, const Mem &dst, u32 imm)
+{
+  Encode(size, size == 1 ? 0xC6 : 0xC7, 0, dst);
+
+  switch (size)
+  {
+    case 1:  Emit8 ((u8)imm);  break;
+    case 2:  Emit16((u16)imm); break;
+    default: Emit32(imm);      break;
+  }
+}
+
+void Jit::Lea(Reg dst, const Mem &src)
+{
+  Encode(4, 0x8D, dst, src);
+}
+
+void Jit::Alu(AluOp op, Reg dst, Reg src)
+{
+  Encode(4, op * 8 + 1, src, dst);
+}
+
+void Jit::AluImm(AluOp op, Reg dst, s32 imm, u8 size)
+{
+  if (imm >= -128 && imm <= 127)
+  {
+    Encode(size, 0x83, op, dst);
+    Emit8((u8)imm);
+  }
+  else
+  {
+    Encode(size, 0x81, op, dst);
+    Emit32((u32)imm);
+  }
+}
+
+void Jit::AluMem(AluOp op, const Mem &dst, Reg src, u8 size)
+{
+  Encode(size, op * 8 + 1, src, dst);
+}
+
+void Jit::AluMemImm(AluOp op, const Mem &dst, s32 imm, u8 size)
+{
+  if (imm >= -128 && imm <= 127)
+  {
+    Encode(size, 0x83, op, dst);
+    Emit8((u8)imm);
+  }
+  else
+  {
+    Encode(size, 0x81, op, dst);
+    Emit32((u32)imm);
+  }
+}
+
+void Jit::Shift(ShiftOp op, Reg dst, u8 count)
+{
+  Encode(4, 0xC1, op, dst);
+  Emit8(count);
+}
+
+void Jit::Test(Reg a, Reg b, u8 size)
+{
+  Encode(size, 0x85, b, a);
+}
+
+void Jit::TestImm(Reg a, u32 imm)
+{
+  Encode(4, 0xF7, 0, a);
+  Emit32(imm);
+}
+
+void Jit::Push(Reg reg)
+{
+  if (reg & 8)
+    Emit8(0x41);
+
+  Emit8(0x50 + (reg & 7));
+}
+
+void Jit::Pop(Reg reg)
+{
+  if (reg & 8)
+    Emit8(0x41);
+
+  Emit8(0x58 + (reg & 7));
+}
+
+void Jit::Call(const void *function)
+{
+  MovImm64(RAX, (u64)function);
+  Encode(4, 0xFF, 2, RAX);
+}
+
+void Jit::Ret()
+{
+  Emit8(0xC3);
+}
+
+u32 Jit::Jcc(Cond cond)
+{
+  Emit8(0x0F);
+  Emit8(0x80 | cond);
+  Emit32(0);
+
+  return size - 4;
+}
+
+u32 Jit::Jmp()
+{
+  Emit8(0xE9);
+  Emit32(0);
+
+  return size - 4;
+}
+
+void Jit::Bind(u32 jump)
+{
+  if (overflow)
+    return;
+
+  u32 offset = size - (jump + 4); // Relative to the end of the jump
+
+  code[jump + 0] = (u8)(offset      );
+  code[jump + 1] = (u8)(offset >>  8);
+  code[jump + 2] = (u8)(offset >> 16);
+  code[jump + 3] = (u8)(offset >> 24);
+}
+
+/* Encoding */
+void Jit::Emit8(u8 value)
+{
+  if (size - start >= maxFunction)
+  {
+    overflow = true;
+    return;
+  }
+
+  code[size++] = value;
+}
+
+void Jit::Emit16(u16 value)
+{
+  Emit8((u8)value);
+  Emit8((u8)(value >> 8));
+}
+
+void Jit::Emit32(u32 value)
+{
+  Emit16((u16)value);
+  Emit16((u16)(value >> 16));
+}
+
+void Jit::Emit64(u64 value)
+{
+  Emit32((u32)value);
+  Emit32((u32)(value >> 32));
+}
+
+void Jit::Prefix(u8 size, u32 opcode, u8 reg, u8 index, u8 base)
+{
+  u8 rex = 0x40;
+
+  if (size == 2)
+    Emit8(0x66);
+
+  if (size == 8)                       rex |= 0x08; // W
+  if (reg & 8)                         rex |= 0x04; // R
+  if (index != NoReg && (index & 8))   rex |= 0x02; // X
+  if (base & 8)                        rex |= 0x01; // B
+
+  if (rex != 0x40 || size == 1)
+    Emit8(rex);
+
+  if (opcode > 0xFF)
+    Emit8((u8)(opcode >> 8));
+
+  Emit8((u8)opcode);
+}
+
+void Jit::Encode(u8 size, u32 opcode, u8 reg, Reg rm)
+{
+  Prefix(size, opcode, reg, NoReg, rm);
+  Emit8(0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void Jit::Encode(u8 size, u32 opcode, u8 reg, const Mem &rm)
+{
+  Prefix(size, opcode, reg, rm.index, rm.base);
+
+  // RBP and R13 as a base always take a displacement, RSP and R12 always take a SIB byte
+  u8 mod = rm.disp == 0 && (rm.base & 7) != RBP ? 0 : rm.disp >= -128 && rm.disp <= 127 ? 1 : 2;
+
+  if (rm.index == NoReg && (rm.base & 7) != RSP)
+    Emit8(mod << 6 | (reg & 7) << 3 | (rm.base & 7));
+  else
+  {
+    Emit8(mod << 6 | (reg & 7) << 3 | RSP);
+    Emit8(rm.scale << 6 | ((rm.index == NoReg ? RSP : rm.index) & 7) << 3 | (rm.base & 7));
+  }
+
+  if (mod == 1)
+    Emit8((u8)rm.disp);
+  else if (mod == 2)
+    Emit32((u32)rm.disp);
+}
+
+/* Block recompiler. Translates the decoded ops of a block into one native function, taking
+   the registers the block runs with. The guest registers stay in host registers for the
+   whole block:
+
+     RBX  Cpu::Registers       R12  A
+     RBP  ram                  R13  X
+     RSI  effective address    R14  Y
+     RDX  operand              R15  SP
+
+   Flags stay in memory, in the same lazy form the interpreter keeps them, and every
+   instruction leaves them the way its handler does. Base cycles are added when the block
+   exits, page crossings as they happen. Memory goes through the page tables, I/O pages
+   and watched pages are reached through Cpu::NativeRead and Cpu::NativeWrite. */
+class Recompiler {
+public:
+  Recompiler(Cpu &cpu, Jit &jit);
+
+  Cpu::NativeBlock Compile(const Cpu::Block &block, u16 PC);
+
+private:
+  enum class Access : u8 {
+    Value,      // Immediate, the operand is the value
+    Ram,        // Zero page at address
+    RamIndexed, // Zero page at RSI
+    Bus,        // Through the page tables at address
+    BusIndexed  // Through the page tables at RSI
+  };
+
+  struct Operand {
+    Access access;
+    u16    address;
+  };
+
+  // A jump to code that stores PC, adds the cycles taken and returns
+  struct Exit {
+    u32 jump;
+    u16 PC;
+    s32 cycles;
+  };
+
+  static const Jit::Reg regState   = Jit::RBX;
+  static const Jit::Reg regRam     = Jit::RBP;
+  static const Jit::Reg regAddress = Jit::RSI;
+  static const Jit::Reg regValue   = Jit::RDX;
+  static const Jit::Reg regA       = Jit::R12;
+  static const Jit::Reg regX       = Jit::R13;
+  static const Jit::Reg regY       = Jit::R14;
+  static const Jit::Reg regSP      = Jit::R15;
+
+  Cpu              &cpu;
+  Jit              &jit;
+  std::vector<Exit> exits;
+  std::vector<u32>  returns; // Jumps to the epilogue
+  u16               PC;      // Instruction being compiled
+  u16               next;    // The one after it
+  s32               cycles;  // Base cycles up to the end of the instruction being compiled
+
+  bool     CanCompile   (const OpInfo &info, u16 operand) const;
+  bool     CompileOp    (const OpInfo &info, u16 operand); // True when the instruction always leaves the block
+
+  Operand  Resolve      (const OpInfo &info, u16 operand);
+  void     Read         (const Operand &operand);          // Into regValue
+  void     Write        (const Operand &operand);          // From regValue, leaves the block when blocks were dropped
+
+  void     SetNZ        (Jit::Reg reg);
+  void     AddWithCarry ();
+  void     Compare      (Jit::Reg reg);
+  void     Bit          ();
+  void     ShiftValue   (Operation op);
+  void     Branch       (Operation op, u16 target);
+
+  void     Push         (Jit::Reg reg);
+  void     PushImm      (u8 value);
+  void     Pull         (Jit::Reg reg);
+
+  void     CallHelper   (const void *helper);              // Cycles in regs are current while it runs
+  void     ExitTo       (u16 target, s32 exitCycles);
+  void     ExitIf       (Jit::Cond cond, u16 target, s32 exitCycles);
+  void     EmitExit     (u16 target, s32 exitCycles);
+
+  static Jit::Mem State (size_t offset);
+  static Jit::Mem Stack ();
+};
+
+#define REG_OFFSET(field) offsetof(Cpu::Registers, field)
+
+Recompiler::Recompiler(Cpu &cpu, Jit &jit) : cpu(cpu), jit(jit)
+{
+  PC     = 0;
+  next   = 0;
+  cycles = 0;
+}
+
+Cpu::NativeBlock Recompiler::Compile(const Cpu::Block &block, u16 blockPC)
+{
+  const Cpu::DecodedOp *ops      = &cpu.blockOps[block.first];
+  u32                   compiled = 0;
+  bool                  left     = false;
+
+  PC = blockPC;
+
+  jit.Prologue();
+  jit.Mov     (regState, Jit::args[0], 8);
+  jit.MovImm64(regRam, (u64)cpu.ram);
+  jit.Load    (1, regA , State(REG_OFFSET(A)));
+  jit.Load    (1, regX , State(REG_OFFSET(X)));
+  jit.Load    (1, regY , State(REG_OFFSET(Y)));
+  jit.Load    (1, regSP, State(REG_OFFSET(SP)));
+
+  // Stops at the first instruction that can't be compiled, the interpreter goes on from there,
+  // and after the first jump, which leaves even when the block goes on at its target
+  for (; compiled < block.count && !left; ++compiled)
+  {
+    const OpInfo &info = opcodeInfo[ops[compiled].opcode];
+
+    if (!CanCompile(info, ops[compiled].operand))
+      break;
+
+    next    = PC + info.bytes;
+    cycles += info.cycles;
+    left    = CompileOp(info, ops[compiled].operand);
+    PC      = next;
+  }
+
+  if (compiled == 0)
+  {
+    jit.Abort();
+    return nullptr;
+  }
+
+  if (!left)
+    EmitExit(PC, cycles);
+
+  for (const Exit &exit : exits)
+  {
+    jit.Bind(exit.jump);
+    EmitExit(exit.PC, exit.cycles);
+  }
+
+  for (u32 jump : returns)
+    jit.Bind(jump);
+
+  jit.Store(1, State(REG_OFFSET(A)) , regA);
+  jit.Store(1, State(REG_OFFSET(X)) , regX);
+  jit.Store(1, State(REG_OFFSET(Y)) , regY);
+  jit.Store(1, State(REG_OFFSET(SP)), regSP);
+  jit.Epilogue();
+
+  return (Cpu::NativeBlock)jit.End();
+}
+
+// Official instructions except BRK, RTI, CLI and the indirect JMP, plus the unofficial NOPs.
+// Absolute operands on I/O or ROM pages are left to the interpreter, they're register accesses.
+// CLI can let a held IRQ in, the interpreter stops the batch for it (see Cpu::CheckIrq).
+bool Recompiler::CanCompile(const OpInfo &info, u16 operand) const
+{
+  bool reads  = false;
+  bool writes = false;
+
+  switch (info.operation)
+  {
+    case Operation::LDA: case Operation::LDX: case Operation::LDY:
+    case Operation::AND: case Operation::EOR: case Operation::ORA: case Operation::BIT:
+    case Operation::ADC: case Operation::SBC:
+    case Operation::CMP: case Operation::CPX: case Operation::CPY:
+      reads = true;
+      break;
+
+    case Operation::STA: case Operation::STX: case Operation::STY:
+      writes = true;
+      break;
+
+    case Operation::INC: case Operation::DEC:
+    case Operation::ASL: case Operation::LSR: case Operation::ROL: case Operation::ROR:
+      reads  = true;
+      writes = true;
+      break;
+
+    case Operation::TAX: case Operation::TAY: case Operation::TXA: case Operation::TYA:
+    case Operation::TSX: case Operation::TXS:
+    case Operation::PHA: case Operation::PHP: case Operation::PLA: case Operation::PLP:
+    case Operation::INX: case Operation::INY: case Operation::DEX: case Operation::DEY:
+    case Operation::JSR: case Operation::RTS:
+    case Operation::BCC: case Operation::BCS: case Operation::BEQ: case Operation::BMI:
+    case Operation::BNE: case Operation::BPL: case Operation::BVC: case Operation::BVS:
+    case Operation::CLC: case Operation::CLD: case Operation::CLV:
+    case Operation::SEC: case Operation::SED: case Operation::SEI:
+    case Operation::NOP:
+      break;
+
+    case Operation::JMP:
+      return info.mode == AddressingMode::Absolute;
+
+    default:
+      return false;
+  }
+
+  if (info.mode != AddressingMode::Absolute)
+    return true;
+
+  return (!reads || cpu.bus.GetMemory(operand)) && (!writes || cpu.bus.IsWritable(operand));
+}
+
+bool Recompiler::CompileOp(const OpInfo &info, u16 operand)
+{
+  Operand address = Resolve(info, operand);
+
+  switch (info.operation)
+  {
+    /* Load/Store Operations */
+    case Operation::LDA: Read(address); jit.Mov(regA, regValue); SetNZ(regA); break;
+    case Operation::LDX: Read(address); jit.Mov(regX, regValue); SetNZ(regX); break;
+    case Operation::LDY: Read(address); jit.Mov(regY, regValue); SetNZ(regY); break;
+    case Operation::STA: jit.Mov(regValue, regA); Write(address); break;
+    case Operation::STX: jit.Mov(regValue, regX); Write(address); break;
+    case Operation::STY: jit.Mov(regValue, regY); Write(address); break;
+
+    /* Register Transfer Operations */
+    case Operation::TAX: jit.Mov(regX, regA); SetNZ(regX); break;
+    case Operation::TAY: jit.Mov(regY, regA); SetNZ(regY); break;
+    case Operation::TXA: jit.Mov(regA, regX); SetNZ(regA); break;
+    case Operation::TYA: jit.Mov(regA, regY); SetNZ(regA); break;
+
+    /* Stack Operations */
+    case Operation::PHA: Push(regA); break;
+    case Operation::PHP:
+      jit.MovImm64(Jit::args[0], (u64)&cpu);
+      CallHelper((const void *)&Cpu::NativePushStatus);
+      Push(Jit::RAX);
+      break;
+    case Operation::PLA: Pull(regA); SetNZ(regA); break;
+    case Operation::PLP:
+      Pull(regValue);
+      jit.Mov(Jit::args[1], regValue);
+      jit.MovImm64(Jit::args[0], (u64)&cpu);
+      CallHelper((const void *)&Cpu::NativePullStatus);
+      break;
+    case Operation::TSX: jit.Mov(regX, regSP); SetNZ(regX); break;
+    case Operation::TXS: jit.Mov(regSP, regX); break;
+
+    /* Logical Operations */
+    case Operation::AND: Read(address); jit.Alu(Jit::And, regA, regValue); SetNZ(regA); break;
+    case Operation::EOR: Read(address); jit.Alu(Jit::Xor, regA, regValue); SetNZ(regA); break;
+    case Operation::ORA: Read(address); jit.Alu(Jit::Or , regA, regValue); SetNZ(regA); break;
+    case Operation::BIT: Read(address); Bit(); break;
+
+    /* Arithmetic Operations */
+    case Operation::ADC: Read(address); AddWithCarry(); break;
+    case Operation::SBC: Read(address); jit.AluImm(Jit::Xor, regValue, 0xFF); AddWithCarry(); break;
+    case Operation::CMP: Read(address); Compare(regA); break;
+    case Operation::CPX: Read(address); Compare(regX); break;
+    case Operation::CPY: Read(address); Compare(regY); break;
+
+    /* Increments/Decrements */
+    case Operation::INC:
+    case Operation::DEC:
+      Read(address);
+      jit.AluImm(info.operation == Operation::INC ? Jit::Add : Jit::Sub, regValue, 1);
+      jit.Movzx8(regValue, regValue);
+      SetNZ(regValue);
+      Write(address);
+      break;
+    case Operation::INX: jit.AluImm(Jit::Add, regX, 1); jit.Movzx8(regX, regX); SetNZ(regX); break;
+    case Operation::INY: jit.AluImm(Jit::Add, regY, 1); jit.Movzx8(regY, regY); SetNZ(regY); break;
+    case Operation::DEX: jit.AluImm(Jit::Sub, regX, 1); jit.Movzx8(regX, regX); SetNZ(regX); break;
+    case Operation::DEY: jit.AluImm(Jit::Sub, regY, 1); jit.Movzx8(regY, regY); SetNZ(regY); break;
+
+    /* Shifts */
+    case Operation::ASL:
+    case Operation::LSR:
+    case Operation::ROL:
+    case Operation::ROR:
+      if (info.mode == AddressingMode::Accumulator)
+      {
+        jit.Mov(regValue, regA);
+        ShiftValue(info.operation);
+        jit.Mov(regA, regValue);
+        SetNZ(regA);
+      }
+      else
+      {
+        Read(address);
+        ShiftValue(info.operation);
+        SetNZ(regValue);
+        Write(address);
+      }
+      break;
+
+    /* Jumps/Calls */
+    case Operation::JMP:
+      ExitTo(operand, cycles);
+      return true;
+    case Operation::JSR:
+    {
+      u16 returnAddress = PC + 2; // Last byte of the JSR instruction
+
+      PushImm(returnAddress >> 8);   // high byte
+      PushImm(returnAddress & 0xFF); // low byte
+      ExitTo(operand, cycles);
+      return true;
+    }
+    case Operation::RTS:
+      Pull(Jit::RAX); // low byte
+      Pull(Jit::RCX); // high byte
+      jit.Shift (Jit::Shl, Jit::RCX, 8);
+      jit.Alu   (Jit::Or , Jit::RAX, Jit::RCX);
+      jit.AluImm(Jit::Add, Jit::RAX, 1);
+      jit.Store (2, State(REG_OFFSET(PC)), Jit::RAX);
+      jit.AluMemImm(Jit::Add, State(REG_OFFSET(cycleCount)), cycles, 8);
+      returns.push_back(jit.Jmp());
+      return true;
+
+    /* Branches */
+    case Operation::BCC: case Operation::BCS: case Operation::BEQ: case Operation::BMI:
+    case Operation::BNE: case Operation::BPL: case Operation::BVC: case Operation::BVS:
+      Branch(info.operation, operand);
+      break;
+
+    /* Status Register Operations */
+    case Operation::CLC: jit.StoreImm(2, State(REG_OFFSET(cResult)), 0x000); break;
+    case Operation::SEC: jit.StoreImm(2, State(REG_OFFSET(cResult)), 0x100); break;
+    case Operation::CLD: jit.StoreImm(1, State(REG_OFFSET(D)), 0); break;
+    case Operation::SED: jit.StoreImm(1, State(REG_OFFSET(D)), 1); break;
+    case Operation::SEI: jit.StoreImm(1, State(REG_OFFSET(I)), 1); break;
+    case Operation::CLV:
+      jit.StoreImm(1, State(REG_OFFSET(vOperandA)), 0);
+      jit.StoreImm(1, State(REG_OFFSET(vOperandM)), 0);
+      jit.StoreImm(1, State(REG_OFFSET(vResult))  , 0);
+      break;
+
+    default: // NOP, the page crossing of its address was counted by Resolve
+      break;
+  }
+
+  return false;
+}
+
+// Emits the effective address of indexed and indirect operands into regAddress and counts
+// their page crossing. Every other operand is known at compile time.
+Recompiler::Operand Recompiler::Resolve(const OpInfo &info, u16 operand)
+{
+  const Jit::Mem cycleCount = State(REG_OFFSET(cycleCount));
+
+  switch (info.mode)
+  {
+    case AddressingMode::ZeroPage:
+      return { Access::Ram, operand };
+
+    case AddressingMode::ZeroPageX:
+    case AddressingMode::ZeroPageY:
+      jit.Lea   (regAddress, Jit::At(info.mode == AddressingMode::ZeroPageX ? regX : regY, operand));
+      jit.Movzx8(regAddress, regAddress); // Zero page wraps around
+      return { Access::RamIndexed, 0 };
+
+    case AddressingMode::Absolute:
+      return { Access::Bus, operand };
+
+    case AddressingMode::AbsoluteX:
+    case AddressingMode::AbsoluteY:
+    {
+      Jit::Reg index = info.mode == AddressingMode::AbsoluteX ? regX : regY;
+
+      // Low byte + index carries into bit 8 when a page is crossed
+      if (info.pageCycles)
+      {
+        jit.Lea   (Jit::RAX, Jit::At(index, operand & 0xFF));
+        jit.Shift (Jit::Shr, Jit::RAX, 8);
+        jit.AluMem(Jit::Add, cycleCount, Jit::RAX, 8);
+      }
+
+      jit.Lea   (regAddress, Jit::At(index, operand));
+      jit.AluImm(Jit::And, regAddress, 0xFFFF);
+      return { Access::BusIndexed, 0 };
+    }
+
+    case AddressingMode::IndirectX:
+      jit.Lea   (Jit::RAX, Jit::At(regX, operand));
+      jit.Movzx8(Jit::RAX, Jit::RAX); // Zero page wraps around
+      jit.Load  (1, regAddress, Jit::At(regRam, Jit::RAX, 0));
+      jit.AluImm(Jit::Add, Jit::RAX, 1);
+      jit.Movzx8(Jit::RAX, Jit::RAX);
+      jit.Load  (1, Jit::RAX, Jit::At(regRam, Jit::RAX, 0));
+      jit.Shift (Jit::Shl, Jit::RAX, 8);
+      jit.Alu   (Jit::Or, regAddress, Jit::RAX);
+      return { Access::BusIndexed, 0 };
+
+    case AddressingMode::IndirectY:
+      jit.Load (1, regAddress, Jit::At(regRam, operand & 0xFF));
+      jit.Load (1, Jit::RAX  , Jit::At(regRam, (operand + 1) & 0xFF));
+      jit.Shift(Jit::Shl, Jit::RAX, 8);
+      jit.Alu  (Jit::Or, regAddress, Jit::RAX);
+
+      if (info.pageCycles)
+      {
+        jit.Load  (1, Jit::RCX, Jit::At(regRam, operand & 0xFF));
+        jit.Alu   (Jit::Add, Jit::RCX, regY);
+        jit.Shift (Jit::Shr, Jit::RCX, 8);
+        jit.AluMem(Jit::Add, cycleCount, Jit::RCX, 8);
+      }
+
+      jit.Alu   (Jit::Add, regAddress, regY);
+      jit.AluImm(Jit::And, regAddress, 0xFFFF);
+      return { Access::BusIndexed, 0 };
+
+    default:
+      return { Access::Value, operand };
+  }
+}
+
+void Recompiler::Read(const Operand &operand)
+{
+  switch (operand.access)
+  {
+    case Access::Value:
+      jit.MovImm(regValue, operand.address);
+      return;
+
+    case Access::Ram:
+      jit.Load(1, regValue, Jit::At(regRam, operand.address));
+      return;
+
+    case Access::RamIndexed:
+      jit.Load(1, regValue, Jit::At(regRam, regAddress, 0));
+      return;
+
+    case Access::Bus:
+      // Internal RAM and its mirrors are never read through handlers
+      if (operand.address < 0x2000)
+      {
+        jit.Load(1, regValue, Jit::At(regRam, operand.address & 0x7FF));
+        return;
+      }
+
+      jit.MovImm64(Jit::RAX, (u64)&cpu.bus.GetReadPages()[operand.address >> 8]);
+      jit.Load    (8, Jit::RAX, Jit::At(Jit::RAX));
+      break;
+
+    case Access::BusIndexed:
+      jit.Mov     (Jit::RAX, regAddress);
+      jit.Shift   (Jit::Shr, Jit::RAX, 8);
+      jit.MovImm64(Jit::RCX, (u64)cpu.bus.GetReadPages());
+      jit.Load    (8, Jit::RAX, Jit::At(Jit::RCX, Jit::RAX, 0, 3));
+      break;
+  }
+
+  jit.Test(Jit::RAX, Jit::RAX, 8);
+
+  u32 handlers = jit.Jcc(Jit::Zero);
+
+  if (operand.access == Access::Bus)
+    jit.Load(1, regValue, Jit::At(Jit::RAX, operand.address & 0xFF));
+  else
+  {
+    jit.Movzx8(Jit::RCX, regAddress);
+    jit.Load  (1, regValue, Jit::At(Jit::RAX, Jit::RCX, 0));
+  }
+
+  u32 done = jit.Jmp();
+
+  jit.Bind (handlers);
+  jit.Store(4, jit.Spill(), regAddress); // Read-modify-write instructions write back to it
+
+  if (operand.access == Access::Bus)
+    jit.MovImm(Jit::args[1], operand.address);
+  else
+    jit.Mov(Jit::args[1], regAddress);
+
+  jit.MovImm64(Jit::args[0], (u64)&cpu);
+  CallHelper((const void *)&Cpu::NativeRead);
+  jit.Movzx8(regValue, Jit::RAX);
+  jit.Load  (4, regAddress, jit.Spill());
+
+  jit.Bind(done);
+}
+
+void Recompiler::Write(const Operand &operand)
+{
+  switch (operand.access)
+  {
+    case Access::Value:
+      return;
+
+    case Access::Ram:
+      jit.Store(1, Jit::At(regRam, operand.address), regValue);
+      return;
+
+    case Access::RamIndexed:
+      jit.Store(1, Jit::At(regRam, regAddress, 0), regValue);
+      return;
+
+    // Pages of RAM holding decoded code are watched and have no write page, so even
+    // internal RAM goes through the lookup
+    case Access::Bus:
+      jit.MovImm64(Jit::RAX, (u64)&cpu.bus.GetWritePages()[operand.address >> 8]);
+      jit.Load    (8, Jit::RAX, Jit::At(Jit::RAX));
+      break;
+
+    case Access::BusIndexed:
+      jit.Mov     (Jit::RAX, regAddress);
+      jit.Shift   (Jit::Shr, Jit::RAX, 8);
+      jit.MovImm64(Jit::RCX, (u64)cpu.bus.GetWritePages());
+      jit.Load    (8, Jit::RAX, Jit::At(Jit::RCX, Jit::RAX, 0, 3));
+      break;
+  }
+
+  jit.Test(Jit::RAX, Jit::RAX, 8);
+
+  u32 handlers = jit.Jcc(Jit::Zero);
+
+  if (operand.access == Access::Bus)
+    jit.Store(1, Jit::At(Jit::RAX, operand.address & 0xFF), regValue);
+  else
+  {
+    jit.Movzx8(Jit::RCX, regAddress);
+    jit.Store (1, Jit::At(Jit::RAX, Jit::RCX, 0), regValue);
+  }
+
+  u32 done = jit.Jmp();
+
+  // The value goes first, on Windows its argument register is the address register
+  jit.Bind(handlers);
+  jit.Mov (Jit::args[2], regValue);
+
+  if (operand.access == Access::Bus)
+    jit.MovImm(Jit::args[1], operand.address);
+  else
+    jit.Mov(Jit::args[1], regAddress);
+
+  jit.MovImm64(Jit::args[0], (u64)&cpu);
+  CallHelper((const void *)&Cpu::NativeWrite);
+
+  // Same as the decoded ops, a write that dropped blocks leaves the block after the instruction
+  jit.Movzx8(Jit::RAX, Jit::RAX);
+  jit.Test  (Jit::RAX, Jit::RAX);
+  ExitIf(Jit::NotZero, next, cycles);
+
+  jit.Bind(done);
+}
+
+void Recompiler::SetNZ(Jit::Reg reg)
+{
+  jit.Store(2, State(REG_OFFSET(nzResult)), reg);
+}
+
+// Operand in regValue, see Cpu::AddWithCarry
+void Recompiler::AddWithCarry()
+{
+  jit.Load  (2, Jit::RCX, State(REG_OFFSET(cResult)));
+  jit.Shift (Jit::Shr, Jit::RCX, 8);
+  jit.Store (1, State(REG_OFFSET(vOperandA)), regA);
+  jit.Store (1, State(REG_OFFSET(vOperandM)), regValue);
+  jit.Alu   (Jit::Add, Jit::RCX, regA);
+  jit.Alu   (Jit::Add, Jit::RCX, regValue);
+  jit.Store (1, State(REG_OFFSET(vResult)), Jit::RCX);
+  jit.Store (2, State(REG_OFFSET(cResult)), Jit::RCX);
+  jit.Movzx8(regA, Jit::RCX);
+  SetNZ(regA);
+}
+
+// Operand in regValue, see Cpu::Compare
+void Recompiler::Compare(Jit::Reg reg)
+{
+  jit.Mov   (Jit::RCX, regValue);
+  jit.AluImm(Jit::Xor, Jit::RCX, 0xFF);
+  jit.Alu   (Jit::Add, Jit::RCX, reg);
+  jit.AluImm(Jit::Add, Jit::RCX, 1);
+  jit.Store (2, State(REG_OFFSET(cResult)), Jit::RCX);
+  jit.Movzx8(Jit::RCX, Jit::RCX);
+  SetNZ(Jit::RCX);
+}
+
+// Operand in regValue. Z from A & M, N from bit 7 of M moved to bit 8, V from bit 6 of M.
+void Recompiler::Bit()
+{
+  jit.Mov   (Jit::RCX, regValue);
+  jit.AluImm(Jit::And, Jit::RCX, 0x80);
+  jit.Shift (Jit::Shl, Jit::RCX, 1);
+  jit.Mov   (Jit::RAX, regValue);
+  jit.Alu   (Jit::And, Jit::RAX, regA);
+  jit.Alu   (Jit::Or , Jit::RCX, Jit::RAX);
+  SetNZ(Jit::RCX);
+
+  jit.Mov     (Jit::RCX, regValue);
+  jit.AluImm  (Jit::And, Jit::RCX, 0x40);
+  jit.Shift   (Jit::Shl, Jit::RCX, 1);
+  jit.Store   (1, State(REG_OFFSET(vResult))  , Jit::RCX);
+  jit.StoreImm(1, State(REG_OFFSET(vOperandA)), 0);
+  jit.StoreImm(1, State(REG_OFFSET(vOperandM)), 0);
+}
+
+// Shifts regValue in place, see Cpu::Shift
+void Recompiler::ShiftValue(Operation op)
+{
+  if (op == Operation::ROL || op == Operation::ROR)
+  {
+    jit.Load (2, Jit::RAX, State(REG_OFFSET(cResult)));
+    jit.Shift(Jit::Shr, Jit::RAX, 8); // Previous carry
+
+    if (op == Operation::ROR)
+      jit.Shift(Jit::Shl, Jit::RAX, 7);
+  }
+
+  jit.Mov(Jit::RCX, regValue);
+
+  if (op == Operation::ASL || op == Operation::ROL)
+  {
+    jit.Shift(Jit::Shl, Jit::RCX, 1);
+
+    if (op == Operation::ROL)
+      jit.Alu(Jit::Or, Jit::RCX, Jit::RAX);
+
+    jit.Store (2, State(REG_OFFSET(cResult)), Jit::RCX);
+    jit.Movzx8(regValue, Jit::RCX);
+    return;
+  }
+
+  jit.AluImm(Jit::And, Jit::RCX, 0x01);
+  jit.Shift (Jit::Shl, Jit::RCX, 8);
+  jit.Store (2, State(REG_OFFSET(cResult)), Jit::RCX);
+  jit.Shift (Jit::Shr, regValue, 1);
+
+  if (op == Operation::ROR)
+    jit.Alu(Jit::Or, regValue, Jit::RAX);
+}
+
+// A taken branch leaves the block with the cycles of a successful branch, see Cpu::Branch
+void Recompiler::Branch(Operation op, u16 target)
+{
+  s32       taken = cycles + 1 + ((next & 0xFF00) != (target & 0xFF00) ? 1 : 0);
+  Jit::Cond cond;
+
+  switch (op)
+  {
+    case Operation::BCC:
+    case Operation::BCS:
+      jit.Load   (2, Jit::RAX, State(REG_OFFSET(cResult)));
+      jit.TestImm(Jit::RAX, 0x100);
+      cond = op == Operation::BCS ? Jit::NotZero : Jit::Zero;
+      break;
+
+    case Operation::BEQ:
+    case Operation::BNE:
+      jit.Load(1, Jit::RAX, State(REG_OFFSET(nzResult)));
+      jit.Test(Jit::RAX, Jit::RAX);
+      cond = op == Operation::BEQ ? Jit::Zero : Jit::NotZero;
+      break;
+
+    case Operation::BMI:
+    case Operation::BPL:
+      jit.Load   (2, Jit::RAX, State(REG_OFFSET(nzResult)));
+      jit.TestImm(Jit::RAX, 0x180);
+      cond = op == Operation::BMI ? Jit::NotZero : Jit::Zero;
+      break;
+
+    default: // BVC, BVS
+      jit.Load   (1, Jit::RAX, State(REG_OFFSET(vOperandA)));
+      jit.Load   (1, Jit::RCX, State(REG_OFFSET(vOperandM)));
+      jit.Load   (1, Jit::RDX, State(REG_OFFSET(vResult)));
+      jit.Alu    (Jit::Xor, Jit::RAX, Jit::RDX);
+      jit.Alu    (Jit::Xor, Jit::RCX, Jit::RDX);
+      jit.Alu    (Jit::And, Jit::RAX, Jit::RCX);
+      jit.TestImm(Jit::RAX, 0x80);
+      cond = op == Operation::BVS ? Jit::NotZero : Jit::Zero;
+      break;
+  }
+
+  ExitIf(cond, target, taken);
+}
+
+/* Stack, page 1 of ram */
+void Recompiler::Push(Jit::Reg reg)
+{
+  jit.Store (1, Stack(), reg);
+  jit.AluImm(Jit::Sub, regSP, 1);
+  jit.Movzx8(regSP, regSP);
+}
+
+void Recompiler::PushImm(u8 value)
+{
+  jit.StoreImm(1, Stack(), value);
+  jit.AluImm  (Jit::Sub, regSP, 1);
+  jit.Movzx8  (regSP, regSP);
+}
+
+void Recompiler::Pull(Jit::Reg reg)
+{
+  jit.AluImm(Jit::Add, regSP, 1);
+  jit.Movzx8(regSP, regSP);
+  jit.Load  (1, reg, Stack());
+}
+
+// Handlers can look at the cycle count, it's brought up to date for the length of the call
+void Recompiler::CallHelper(const void *helper)
+{
+  jit.AluMemImm(Jit::Add, State(REG_OFFSET(cycleCount)), cycles, 8);
+  jit.Call(helper);
+  jit.AluMemImm(Jit::Sub, State(REG_OFFSET(cycleCount)), cycles, 8);
+}
+
+void Recompiler::ExitTo(u16 target, s32 exitCycles)
+{
+  exits.push_back({ jit.Jmp(), target, exitCycles });
+}
+
+void Recompiler::ExitIf(Jit::Cond cond, u16 target, s32 exitCycles)
+{
+  exits.push_back({ jit.Jcc(cond), target, exitCycles });
+}
+
+void Recompiler::EmitExit(u16 target, s32 exitCycles)
+{
+  jit.StoreImm (2, State(REG_OFFSET(PC)), target);
+  jit.AluMemImm(Jit::Add, State(REG_OFFSET(cycleCount)), exitCycles, 8);
+  returns.push_back(jit.Jmp());
+}
+
+Jit::Mem Recompiler::State(size_t offset)
+{
+  return Jit::At(regState, (s32)offset);
+}
+
+Jit::Mem Recompiler::Stack()
+{
+  return Jit::At(regRam, regSP, 0x100);
+}
+
+#undef REG_OFFSET
+
+// Code in writable memory stays with the decoded ops, they notice the writes that change it.
+// A full buffer drops every native block and starts over.
+Cpu::NativeBlock Cpu::CompileBlock(const Block &block, u16 PC)
+{
+  if (bus.IsWritable(PC))
+    return nullptr;
+
+  if (!jit)
+    jit.reset(new Jit());
+
+  if (!jit->Begin())
+  {
+    DropNativeCode();
+
+    if (!jit->Begin())
+      return nullptr;
+  }
+
+  return Recompiler(*this, *jit).Compile(block, PC);
+}
+
+void Cpu::DropNativeCode()
+{
+  for (u32 index = 0; blocks && index < blockSlots; ++index)
+  {
+    blocks[index].native = nullptr;
+    blocks[index].hits   = 0;
+  }
+
+  if (jit)
+    jit->Reset();
+}
+
+u32 Cpu::GetNativeBlockCount() const
+{
+  u32 count = 0;
+
+  for (u32 index = 0; blocks && index < blockSlots; ++index)
+  {
+    if (blocks[index].code && blocks[index].native)
+      count++;
+  }
+
+  return count;
+}
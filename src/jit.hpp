@@ -0,0 +1,113 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#pragma once
+
+#include "types.hpp"
+
+// Native code is only generated on x86-64 hosts, elsewhere Dispatch::Jit runs the block cache
+#if defined(__x86_64__) || defined(_M_X64)
+#define NESEMU_JIT_X64
+#endif
+
+/* Executable memory and a small x86-64 encoder, the backend of the block recompiler (see
+   Recompiler in jit.cpp). Functions are written between Begin and End. The buffer is never
+   writable and executable at the same time: Begin makes it writable, End and Abort make it
+   executable again. Reset drops every function at once, the bytes stay in place until the
+   next Begin so a function that is running while its cache is dropped can still return. */
+class Jit {
+public:
+  enum Reg : u8 {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15,
+    NoReg = 0xFF
+  };
+
+  enum AluOp   : u8 { Add = 0, Or = 1, And = 4, Sub = 5, Xor = 6, Cmp = 7 }; // ModRM reg field of the 0x81 group
+  enum ShiftOp : u8 { Shl = 4, Shr = 5 };
+  enum Cond    : u8 { Zero = 0x4, NotZero = 0x5 };                          // Low nibble of Jcc
+
+  // [base + index << scale + disp]
+  struct Mem {
+    Reg base;
+    Reg index;
+    u8  scale;
+    s32 disp;
+  };
+
+  static Mem At(Reg base, s32 disp = 0)                         { return { base, NoReg, 0, disp }; }
+  static Mem At(Reg base, Reg index, s32 disp, u8 scale = 0)    { return { base, index, scale, disp }; }
+
+  // Argument registers of the host calling convention
+  static const Reg args[3];
+
+  Jit();
+  ~Jit();
+
+  Jit(const Jit &)            = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  bool  Begin();       // False when there is no executable memory or no room for a function
+  void *End  ();       // Entry point of the function, null if it didn't fit
+  void  Abort();       // Drops the function being written
+  void  Reset();       // Drops every function
+
+  u32  Offset() const; // Position of the next byte in the current function
+
+  /* Frame. Prologue saves every register the host ABI preserves and aligns the stack
+     for calls, Spill is a scratch slot in it. */
+  void Prologue ();
+  void Epilogue ();
+  Mem  Spill    () const;
+
+  /* Instructions. 32 bit unless a size in bytes is given, 1 and 2 byte loads zero extend */
+  void Mov      (Reg dst, Reg src, u8 size = 4);
+  void MovImm   (Reg dst, u32 imm);
+  void MovImm64 (Reg dst, u64 imm);
+  void Movzx8   (Reg dst, Reg src);
+  void Load     (u8 size, Reg dst, const Mem &src);
+  void Store    (u8 size, const Mem &dst, Reg src);
+  void StoreImm (u8 size, const Mem &dst, u32 imm);
+  void Lea      (Reg dst, const Mem &src);
+  void Alu      (AluOp op, Reg dst, Reg src);
+  void AluImm   (AluOp op, Reg dst, s32 imm, u8 size = 4);
+  void AluMem   (AluOp op, const Mem &dst, Reg src, u8 size = 4);
+  void AluMemImm(AluOp op, const Mem &dst, s32 imm, u8 size = 4);
+  void Shift    (ShiftOp op, Reg dst, u8 count);
+  void Test     (Reg a, Reg b, u8 size = 4);
+  void TestImm  (Reg a, u32 imm);
+  void Push     (Reg reg);
+  void Pop      (Reg reg);
+  void Call     (const void *function); // Clobbers RAX
+  void Ret      ();
+
+  /* Forward jumps. Jcc and Jmp return the jump, Bind points it at the next instruction */
+  u32  Jcc      (Cond cond);
+  u32  Jmp      ();
+  void Bind     (u32 jump);
+
+private:
+  static const u32 capacity    = 0x100000; // 1MB of code
+  static const u32 maxFunction = 0x4000;   // Room Begin asks for, End fails past it
+
+  u8  *code;     // Null without executable memory
+  u32  size;     // Bytes in use
+  u32  start;    // First byte of the current function
+  bool overflow; // The current function ran out of room
+  bool writable;
+
+  void Protect  (bool write);
+
+  void Emit8    (u8 value);
+  void Emit16   (u16 value);
+  void Emit32   (u32 value);
+  void Emit64   (u64 value);
+
+  // Operand size prefix, REX and opcode, then ModRM for reg and a register or memory operand.
+  // Opcodes above 0xFF are two bytes. Byte operations always get a REX so SIL and DIL encode.
+  void Encode   (u8 size, u32 opcode, u8 reg, Reg rm);
+  void Encode   (u8 size, u32 opcode, u8 reg, const Mem &rm);
+  void Prefix   (u8 size, u32 opcode, u8 reg, u8 index, u8 base);
+};
+
+#endif //__JIT_H__
@@ -0,0 +1,1036 @@
+#include "lockstep.hpp"
+#include <algorithm>
+#include <cstring>
+#include "cpu.hpp"
+#include "execute.hpp"
+
+// The vector kernels are written once with the vector extensions of GCC and Clang and built
+// for each instruction set, AVX2 and AVX-512 in their own functions picked at run time. MSVC
+// runs the lanes one at a time.
+#if defined(__GNUC__) || defined(__clang__)
+#define NESEMU_LOCKSTEP_VECTORS
+
+#if defined(__x86_64__)
+#define NESEMU_LOCKSTEP_X64
+#define AVX2_FUNCTION   __attribute__((target("avx2")))
+#define AVX512_FUNCTION __attribute__((target("avx512f")))
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef NESEMU_LOCKSTEP_VECTORS
+namespace
+{
+  // A u32 per lane, in parts as wide as the vectors of the kernel. Operators go lane by lane,
+  // comparisons give ~0 in the lanes where they hold. GCC builds vector comparisons wider than
+  // the target's vectors a lane at a time, so a kernel never sees a wider vector than its own.
+  template<typename Part>
+  struct LanesOf {
+    static const u32 width = sizeof(Part) / sizeof(u32);
+    static const u32 parts = Lockstep::maxLanes / width;
+
+    Part part[parts];
+
+    FORCEINLINE u32       &operator[](u32 lane)       { return ((u32 *)part)[lane]; }
+    FORCEINLINE const u32 &operator[](u32 lane) const { return ((const u32 *)part)[lane]; }
+
+#define LANES_OPERATOR(op) \
+    friend FORCEINLINE LanesOf operator op(const LanesOf &a, const LanesOf &b) \
+    { \
+      LanesOf result; \
+      for (u32 i = 0; i < parts; ++i) \
+        result.part[i] = (Part)(a.part[i] op b.part[i]); \
+      return result; \
+    } \
+    friend FORCEINLINE LanesOf operator op(const LanesOf &a, u32 b) \
+    { \
+      LanesOf result; \
+      for (u32 i = 0; i < parts; ++i) \
+        result.part[i] = (Part)(a.part[i] op b); \
+      return result; \
+    }
+
+    LANES_OPERATOR(+)
+    LANES_OPERATOR(-)
+    LANES_OPERATOR(&)
+    LANES_OPERATOR(|)
+    LANES_OPERATOR(^)
+    LANES_OPERATOR(<<)
+    LANES_OPERATOR(>>)
+    LANES_OPERATOR(==)
+    LANES_OPERATOR(!=)
+    LANES_OPERATOR(>)
+
+#undef LANES_OPERATOR
+
+    friend FORCEINLINE LanesOf operator~(const LanesOf &a)
+    {
+      LanesOf result;
+
+      for (u32 i = 0; i < parts; ++i)
+        result.part[i] = ~a.part[i];
+
+      return result;
+    }
+
+    FORCEINLINE LanesOf &operator-=(const LanesOf &b) { return *this = *this - b; }
+    FORCEINLINE LanesOf &operator&=(const LanesOf &b) { return *this = *this & b; }
+  };
+
+  typedef u32 Part128 __attribute__((vector_size(16))); // SSE2, NEON
+  typedef u32 Part256 __attribute__((vector_size(32))); // AVX2
+  typedef u32 Part512 __attribute__((vector_size(64))); // AVX-512
+
+  template<Lockstep::Kernel kernel> struct KernelLanes                             { typedef LanesOf<Part128> Type; };
+  template<>                        struct KernelLanes<Lockstep::Kernel::Avx2>   { typedef LanesOf<Part256> Type; };
+  template<>                        struct KernelLanes<Lockstep::Kernel::Avx512> { typedef LanesOf<Part512> Type; };
+
+  const u32 laneBits[Lockstep::maxLanes] = { 0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+                                             0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000 };
+
+  // ~0 in the lanes of group
+  template<typename Lanes>
+  FORCEINLINE Lanes GroupMask(u32 group)
+  {
+    Lanes bits;
+
+    memcpy(&bits, laneBits, sizeof(bits));
+
+    return (bits & group) != 0;
+  }
+
+  template<typename Lanes>
+  FORCEINLINE void Commit(Lanes &reg, const Lanes &value, const Lanes &mask)
+  {
+    reg = (value & mask) | (reg & ~mask);
+  }
+
+  // A register of the lanes whose assignments only reach the lanes of mask, so the Cpu flag and
+  // arithmetic helpers assigning Registers fields run on the lanes of a step
+  template<typename Lanes>
+  struct MaskedLanes {
+    Lanes       &reg;
+    const Lanes &mask;
+
+    FORCEINLINE operator const Lanes &() const { return reg; }
+
+    FORCEINLINE void operator=(const Lanes &value)       { Commit(reg, value, mask); }
+    FORCEINLINE void operator=(const MaskedLanes &value) { Commit(reg, value.reg, mask); }
+    FORCEINLINE void operator=(u32 value)                { Commit(reg, Lanes{} + value, mask); }
+  };
+
+  // The fields of Registers the helpers assign
+  template<typename Lanes>
+  struct MaskedRegisters {
+    MaskedLanes<Lanes> A;
+    MaskedLanes<Lanes> cResult;
+    MaskedLanes<Lanes> nzResult;
+    MaskedLanes<Lanes> vOperandA;
+    MaskedLanes<Lanes> vOperandM;
+    MaskedLanes<Lanes> vResult;
+  };
+
+  FORCEINLINE u32 LowestLane(u32 lanes)
+  {
+    return __builtin_ctz(lanes);
+  }
+
+  // Bit n set where lane n of mask is
+  template<typename Lanes>
+  FORCEINLINE u32 MoveMask(const Lanes &mask)
+  {
+    u32 bits = 0;
+
+    for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+      bits |= (mask[lane] & 1) << lane;
+
+    return bits;
+  }
+
+  template<typename Lanes>
+  FORCEINLINE u32 ReduceMin(const Lanes &lanes)
+  {
+    u32 result = lanes[0];
+
+    for (u32 lane = 1; lane < Lockstep::maxLanes; ++lane)
+      result = std::min(result, lanes[lane]);
+
+    return result;
+  }
+
+#ifdef NESEMU_LOCKSTEP_X64
+  // SSE2 is in every x86-64 build, the vector kernel has it
+  FORCEINLINE u32 MoveMask(const LanesOf<Part128> &mask)
+  {
+    u32 bits = 0;
+
+    for (u32 i = 0; i < LanesOf<Part128>::parts; ++i)
+      bits |= _mm_movemask_ps((__m128)mask.part[i]) << (i * 4);
+
+    return bits;
+  }
+
+  // SSE2 only compares signed, flipping the top bit orders them as unsigned
+  FORCEINLINE __m128i MinSse2(__m128i a, __m128i b)
+  {
+    const __m128i top  = _mm_set1_epi32((int)0x80000000);
+    __m128i       less = _mm_cmplt_epi32(_mm_xor_si128(a, top), _mm_xor_si128(b, top));
+
+    return _mm_or_si128(_mm_and_si128(less, a), _mm_andnot_si128(less, b));
+  }
+
+  FORCEINLINE u32 ReduceMin(const LanesOf<Part128> &lanes)
+  {
+    __m128i four = MinSse2(MinSse2((__m128i)lanes.part[0], (__m128i)lanes.part[1]), MinSse2((__m128i)lanes.part[2], (__m128i)lanes.part[3]));
+    __m128i two  = MinSse2(four, _mm_shuffle_epi32(four, 0x4E));
+
+    return _mm_cvtsi128_si32(MinSse2(two, _mm_shuffle_epi32(two, 0xB1)));
+  }
+
+  // Not forced inline: the kernel body they're called from has no target of its own until
+  // it's inlined into RunAvx2 and RunAvx512
+  AVX2_FUNCTION inline u32 ReduceMin(__m256i eight)
+  {
+    __m128i four = _mm_min_epu32(_mm256_castsi256_si128(eight), _mm256_extracti128_si256(eight, 1));
+    __m128i two  = _mm_min_epu32(four, _mm_shuffle_epi32(four, 0x4E));
+
+    return _mm_cvtsi128_si32(_mm_min_epu32(two, _mm_shuffle_epi32(two, 0xB1)));
+  }
+
+  AVX2_FUNCTION inline u32 MoveMask(const LanesOf<Part256> &mask)
+  {
+    return _mm256_movemask_ps((__m256)mask.part[0]) | (_mm256_movemask_ps((__m256)mask.part[1]) << 8);
+  }
+
+  AVX2_FUNCTION inline u32 ReduceMin(const LanesOf<Part256> &lanes)
+  {
+    return ReduceMin(_mm256_min_epu32((__m256i)lanes.part[0], (__m256i)lanes.part[1]));
+  }
+
+  AVX512_FUNCTION inline u32 MoveMask(const LanesOf<Part512> &mask)
+  {
+    return _mm512_cmplt_epi32_mask((__m512i)mask.part[0], _mm512_setzero_si512()); // ~0 is negative
+  }
+
+  // The halves of a 512-bit vector go through the AVX2 reduction, the extracts of GCC 12 warn
+  AVX512_FUNCTION inline u32 ReduceMin(const LanesOf<Part512> &lanes)
+  {
+    __m256i low, high;
+
+    memcpy(&low,  &lanes, sizeof(low));
+    memcpy(&high, (const u8 *)&lanes + sizeof(low), sizeof(high));
+
+    return ReduceMin(_mm256_min_epu32(low, high));
+  }
+#endif
+
+  constexpr bool IsVectorOp(Operation op, AddressingMode mode)
+  {
+    return mode != AddressingMode::Indirect && op != Operation::BRK && op != Operation::RTI &&
+           op != Operation::PLP && op != Operation::CLI &&
+           (op <= Operation::TYA || op == Operation::LAX || op == Operation::SAX); // The official ones come first
+  }
+
+  constexpr bool IsZeroPage(AddressingMode mode)
+  {
+    return mode == AddressingMode::ZeroPage || mode == AddressingMode::ZeroPageX || mode == AddressingMode::ZeroPageY;
+  }
+}
+
+/* The registers of Cpu::Registers, a lane per Cpu, in the lanes of the kernel. The step
+   scratch is there too, for the helpers that access memory a lane at a time. */
+template<Lockstep::Kernel kernel>
+struct Lockstep::Vectors {
+  typedef typename KernelLanes<kernel>::Type Lanes;
+
+  Lanes PC;
+  Lanes SP;
+  Lanes A;
+  Lanes X;
+  Lanes Y;
+  Lanes cResult;   // Lazy flags, see Cpu::Registers
+  Lanes nzResult;
+  Lanes vOperandA;
+  Lanes vOperandM;
+  Lanes vResult;
+  Lanes I;         // 0 or 1
+  Lanes D;
+  Lanes B;
+  Lanes U;
+  Lanes cycles;    // Since the kernel was called, on top of cycleBase
+  Lanes stop;      // Cpu::nextStop on the same base, where events stop the lane, past every count without them
+  Lanes left;      // Instructions left to run, every one up to the target with events
+
+  Lanes address;   // Effective address of the step
+  Lanes value;     // Read from it, or to write there
+};
+#endif
+
+Lockstep::Lockstep()
+{
+  Clear();
+}
+
+bool Lockstep::Add(Cpu &cpu)
+{
+  if (laneCount == maxLanes)
+    return false;
+
+  overshoots[laneCount] = 0;
+  cpus      [laneCount] = &cpu;
+  laneCount++;
+
+  return true;
+}
+
+void Lockstep::Clear()
+{
+  memset(cpus,       0, sizeof(cpus));
+  memset(overshoots, 0, sizeof(overshoots));
+
+  laneCount          = 0;
+  banksChanged       = true;
+  events             = false;
+  steps              = 0;
+  vectorInstructions = 0;
+  scalarInstructions = 0;
+}
+
+u32 Lockstep::GetLaneCount() const
+{
+  return laneCount;
+}
+
+Cpu &Lockstep::GetLane(u32 lane)
+{
+  return *cpus[lane];
+}
+
+s32 Lockstep::GetOvershoot(u32 lane) const
+{
+  return overshoots[lane];
+}
+
+void Lockstep::Run(s32 cycles)
+{
+  Run(GetKernel(), cycles);
+}
+
+// Cpu::Run on every lane: the lanes run up to Cpu::nextStop and handle their events there
+void Lockstep::Run(Kernel kernel, s32 cycles)
+{
+  if (!IsSupported(kernel))
+    kernel = Kernel::Scalar;
+
+  steps              = 0;
+  vectorInstructions = 0;
+  scalarInstructions = 0;
+
+  if (kernel == Kernel::Scalar)
+  {
+    // Instructions aren't counted, Cpu::Run doesn't
+    for (u32 lane = 0; lane < laneCount; ++lane)
+      overshoots[lane] = cpus[lane]->Run(cycles - overshoots[lane], Cpu::Dispatch::Switch);
+
+    return;
+  }
+
+  finished = 0;
+
+  for (u32 lane = 0; lane < laneCount; ++lane)
+  {
+    Cpu &cpu = *cpus[lane];
+
+    targets[lane] = cpu.regs.cycleCount + cycles - overshoots[lane];
+
+    if (cpu.regs.cycleCount < targets[lane])
+      cpu.nextStop = std::min(targets[lane], cpu.scheduler.GetNextTime());
+    else
+      Finish(lane);
+  }
+
+  events = true;
+  RunKernel(kernel, ~0u);
+  events = false;
+}
+
+void Lockstep::RunInstructions(u32 count)
+{
+  RunInstructions(GetKernel(), count);
+}
+
+void Lockstep::RunInstructions(Kernel kernel, u32 count)
+{
+  // The vector kernels count cycles in 32 bits from their call, 8 cycles at most an instruction
+  const u32 maxCount = 0x10000000;
+
+  if (!IsSupported(kernel))
+    kernel = Kernel::Scalar;
+
+  steps              = 0;
+  vectorInstructions = 0;
+  scalarInstructions = 0;
+  finished           = 0;
+
+  for (u32 chunk; count; count -= chunk)
+  {
+    chunk = std::min(count, maxCount);
+
+    RunKernel(kernel, chunk);
+  }
+}
+
+u64 Lockstep::GetSteps() const
+{
+  return steps;
+}
+
+u64 Lockstep::GetVectorInstructions() const
+{
+  return vectorInstructions;
+}
+
+u64 Lockstep::GetScalarInstructions() const
+{
+  return scalarInstructions;
+}
+
+Lockstep::Kernel Lockstep::GetKernel()
+{
+  static const Kernel kernel = IsSupported(Kernel::Avx512) ? Kernel::Avx512 :
+                               IsSupported(Kernel::Avx2)   ? Kernel::Avx2   :
+                               IsSupported(Kernel::Vector) ? Kernel::Vector : Kernel::Scalar;
+
+  return kernel;
+}
+
+bool Lockstep::IsSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return true;
+
+#ifdef NESEMU_LOCKSTEP_VECTORS
+    case Kernel::Vector:
+      return true;
+#endif
+
+#ifdef NESEMU_LOCKSTEP_X64
+    case Kernel::Avx2:
+      return __builtin_cpu_supports("avx2");
+
+    case Kernel::Avx512:
+      return __builtin_cpu_supports("avx512f");
+#endif
+
+    default:
+      return false;
+  }
+}
+
+const char *Lockstep::GetKernelName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar: return "scalar";
+    case Kernel::Vector: return "vector";
+    case Kernel::Avx2:   return "avx2";
+    case Kernel::Avx512: return "avx512";
+  }
+
+  return "unknown";
+}
+
+void Lockstep::RunKernel(Kernel kernel, u32 count)
+{
+  switch (kernel)
+  {
+#ifdef NESEMU_LOCKSTEP_VECTORS
+    case Kernel::Vector: RunVector(count); break;
+#endif
+#ifdef NESEMU_LOCKSTEP_X64
+    case Kernel::Avx2:   RunAvx2  (count); break;
+    case Kernel::Avx512: RunAvx512(count); break;
+#endif
+    default:             RunScalar(count); break;
+  }
+}
+
+// The lane reached its target, as Cpu::Run returns
+void Lockstep::Finish(u32 lane)
+{
+  Cpu &cpu = *cpus[lane];
+
+  cpu.Sync();
+
+  overshoots[lane]  = (s32)(cpu.regs.cycleCount - targets[lane]);
+  finished         |= 1u << lane;
+}
+
+void Lockstep::RunScalar(u32 count)
+{
+  for (u32 lane = 0; lane < laneCount; ++lane)
+    cpus[lane]->RunInstructions(count, Cpu::Dispatch::Switch);
+
+  scalarInstructions += (u64)count * laneCount;
+}
+
+#ifdef NESEMU_LOCKSTEP_VECTORS
+void Lockstep::RunVector(u32 count)
+{
+  RunVectors<Kernel::Vector>(count);
+}
+
+#ifdef NESEMU_LOCKSTEP_X64
+AVX2_FUNCTION void Lockstep::RunAvx2(u32 count)
+{
+  RunVectors<Kernel::Avx2>(count);
+}
+
+AVX512_FUNCTION void Lockstep::RunAvx512(u32 count)
+{
+  RunVectors<Kernel::Avx512>(count);
+}
+#endif
+
+template<Lockstep::Kernel kernel>
+void Lockstep::Load(Vectors<kernel> &v, u32 lane)
+{
+  const Cpu::Registers &r = cpus[lane]->regs;
+
+  v.PC       [lane] = r.PC;
+  v.SP       [lane] = r.SP;
+  v.A        [lane] = r.A;
+  v.X        [lane] = r.X;
+  v.Y        [lane] = r.Y;
+  v.cResult  [lane] = r.cResult;
+  v.nzResult [lane] = r.nzResult;
+  v.vOperandA[lane] = r.vOperandA;
+  v.vOperandM[lane] = r.vOperandM;
+  v.vResult  [lane] = r.vResult;
+  v.I        [lane] = r.I;
+  v.D        [lane] = r.D;
+  v.B        [lane] = r.B;
+  v.U        [lane] = r.U;
+  v.cycles   [lane] = (u32)(r.cycleCount - cycleBase[lane]);
+
+  LoadStop(v, lane);
+}
+
+template<Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::LoadStop(Vectors<kernel> &v, u32 lane)
+{
+  s64 stop = cpus[lane]->nextStop; // INT64_MIN to stop right away
+
+  v.stop[lane] = !events ? ~0u : stop <= cycleBase[lane] ? 0 : (u32)std::min<s64>(stop - cycleBase[lane], ~0u);
+}
+
+template<Lockstep::Kernel kernel>
+void Lockstep::Store(const Vectors<kernel> &v, u32 lane)
+{
+  Cpu::Registers &r = cpus[lane]->regs;
+
+  r.cycleCount = cycleBase[lane] + v.cycles[lane];
+  r.PC         = v.PC       [lane];
+  r.SP         = v.SP       [lane];
+  r.A          = v.A        [lane];
+  r.X          = v.X        [lane];
+  r.Y          = v.Y        [lane];
+  r.cResult    = v.cResult  [lane];
+  r.nzResult   = v.nzResult [lane];
+  r.vOperandA  = v.vOperandA[lane];
+  r.vOperandM  = v.vOperandM[lane];
+  r.vResult    = v.vResult  [lane];
+  r.I          = v.I        [lane] != 0;
+  r.D          = v.D        [lane] != 0;
+  r.B          = v.B        [lane] != 0;
+  r.U          = v.U        [lane] != 0;
+}
+
+// Lanes run ROM code together when they have the same banks in its 8KB, compared once for
+// each group of lanes with the same memory there
+void Lockstep::CompareBanks()
+{
+  for (u32 slot = 0; slot < bankSlots; ++slot)
+  {
+    const u32 pages = 0x2000 / Bus::pageSize;
+    u32       first[maxLanes]; // Lowest lane with the same banks
+
+    for (u32 lane = 0; lane < laneCount; ++lane)
+    {
+      const u8 *const *memory = cpus[lane]->bus.GetReadPages() + 0x80 + slot * pages;
+
+      first[lane] = lane;
+
+      for (u32 other = 0; other < lane; ++other)
+      {
+        if (first[other] == other && memcmp(memory, cpus[other]->bus.GetReadPages() + 0x80 + slot * pages, pages * sizeof(*memory)) == 0)
+        {
+          first[lane] = other;
+          break;
+        }
+      }
+    }
+
+    for (u32 lane = 0; lane < laneCount; ++lane)
+    {
+      banks[slot][lane] = 0;
+
+      for (u32 other = 0; other < laneCount; ++other)
+        banks[slot][lane] |= first[other] == first[lane] ? 1u << other : 0;
+    }
+  }
+
+  for (u32 lane = 0; lane < laneCount; ++lane)
+    generations[lane] = cpus[lane]->blockGeneration;
+
+  banksChanged = false;
+}
+
+// Mapper writes bump the generation, so do writes dropping decoded blocks
+void Lockstep::CheckBanks(u32 lane)
+{
+  banksChanged |= cpus[lane]->blockGeneration != generations[lane];
+}
+
+// Code outside the ROM slots or across two, compared byte by byte. None when the leader's
+// isn't memory.
+u32 Lockstep::CompareCode(u32 group, u32 leader, u16 PC, u32 bytes) const
+{
+  const Bus &bus  = cpus[leader]->bus;
+  u32        same = 0;
+
+  for (u32 i = 0; i < bytes; ++i)
+  {
+    if (!bus.GetMemory(PC + i))
+      return 0;
+  }
+
+  for (u32 lanes = group; lanes; lanes &= lanes - 1)
+  {
+    u32  lane  = LowestLane(lanes);
+    bool equal = true;
+
+    for (u32 i = 0; i < bytes && equal; ++i)
+    {
+      const u8 *memory = cpus[lane]->bus.GetMemory(PC + i);
+
+      equal = memory && *memory == *bus.GetMemory(PC + i);
+    }
+
+    if (equal)
+      same |= 1u << lane;
+  }
+
+  return same;
+}
+
+// Reads the opcode from its own memory, as the interpreter loops do
+template<Lockstep::Kernel kernel>
+void Lockstep::RunLane(Vectors<kernel> &v, u32 lane)
+{
+  Cpu &cpu = *cpus[lane];
+
+  Store(v, lane);
+  cpu.ProcessOpcode(cpu.bus.Read(cpu.regs.PC));
+  Load(v, lane);
+  CheckBanks(lane);
+
+  ++scalarInstructions;
+}
+
+// The lane stopped for its events: handled as Cpu::Run does between batches
+template<Lockstep::Kernel kernel>
+void Lockstep::ServiceLane(Vectors<kernel> &v, u32 lane)
+{
+  Cpu &cpu = *cpus[lane];
+
+  Store(v, lane);
+  cpu.HandleEvents();
+
+  if (cpu.regs.cycleCount < targets[lane])
+    cpu.nextStop = std::min(targets[lane], cpu.scheduler.GetNextTime());
+  else
+    Finish(lane);
+
+  Load(v, lane);
+  CheckBanks(lane);
+
+  if (finished & (1u << lane))
+    v.left[lane] = 0;
+}
+
+template<Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::RunVectors(u32 count)
+{
+  typedef typename Vectors<kernel>::Lanes Lanes;
+
+  Vectors<kernel> v = {};
+
+  for (u32 lane = 0; lane < laneCount; ++lane)
+  {
+    cycleBase[lane] = cpus[lane]->regs.cycleCount;
+    v.left   [lane] = finished & (1u << lane) ? 0 : count;
+
+    Load(v, lane);
+  }
+
+  CompareBanks();
+
+  for (;;)
+  {
+    Lanes running     = v.left != 0;
+    Lanes active      = running & (v.stop > v.cycles);
+    u32   activeBits  = MoveMask(active);
+    u32   stoppedBits = MoveMask(running) & ~activeBits;
+
+    // Lanes at their stop handle their events, lanes past their target are done
+    if (stoppedBits)
+    {
+      for (u32 lanes = stoppedBits; lanes; lanes &= lanes - 1)
+        ServiceLane(v, LowestLane(lanes));
+
+      continue;
+    }
+
+    if (!activeBits)
+      break;
+
+    if (banksChanged)
+      CompareBanks();
+
+    // The lanes furthest behind go first, the ones ahead wait for them at their PC
+    u16       PC     = (u16)ReduceMin(v.PC | ~active);
+    u32       group  = MoveMask(v.PC == PC) & activeBits;
+    u32       leader = LowestLane(group);
+    const u8 *code   = cpus[leader]->bus.GetMemory(PC);
+
+    // Instructions inside an 8KB slot of ROM have the same bytes where the banks are the same
+    if (code)
+      group = PC >= 0x8000 && (PC & 0x1FFF) <= 0x1FFD ? group & banks[(PC - 0x8000) >> 13][leader] :
+                                                         CompareCode(group, leader, PC, opcodeInfo[*code].bytes);
+
+    // Code read through handlers runs alone
+    if (!code || !group)
+    {
+      RunLane(v, leader);
+      v.left[leader]--;
+      continue;
+    }
+
+    u8  opcode  = *code;
+    u16 operand = cpus[leader]->DecodeOperand(opcodeInfo[opcode].mode, PC);
+
+    switch (opcode)
+    {
+#define OPCODE(code) \
+      case code: Step<code>(v, group, operand); break;
+
+      CPU_OPCODES(OPCODE)
+
+#undef OPCODE
+    }
+
+    v.left -= GroupMask<Lanes>(group) & 1;
+  }
+
+  for (u32 lane = 0; lane < laneCount; ++lane)
+    Store(v, lane);
+}
+
+template<AddressingMode mode, Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::ReadLanes(Vectors<kernel> &v, u32 group)
+{
+  for (u32 lanes = group; lanes; lanes &= lanes - 1)
+  {
+    u32  lane = LowestLane(lanes);
+    Cpu &cpu  = *cpus[lane];
+
+    // Bus handlers catch their component up to the cycle count of the instruction
+    if (!IsZeroPage(mode))
+      cpu.regs.cycleCount = cycleBase[lane] + v.cycles[lane];
+
+    v.value[lane] = cpu.ReadOperand<mode>(cpu.regs, (u16)v.address[lane]);
+
+    if (!IsZeroPage(mode))
+      LoadStop(v, lane); // Handlers lower nextStop
+  }
+}
+
+template<AddressingMode mode, Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::WriteLanes(Vectors<kernel> &v, u32 group)
+{
+  for (u32 lanes = group; lanes; lanes &= lanes - 1)
+  {
+    u32  lane = LowestLane(lanes);
+    Cpu &cpu  = *cpus[lane];
+
+    if (!IsZeroPage(mode))
+      cpu.regs.cycleCount = cycleBase[lane] + v.cycles[lane];
+
+    cpu.WriteOperand<mode>(cpu.regs, (u16)v.address[lane], (u8)v.value[lane]);
+
+    if (!IsZeroPage(mode))
+    {
+      CheckBanks(lane);
+      LoadStop(v, lane);
+    }
+  }
+}
+
+template<Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::Push(Vectors<kernel> &v, u32 group)
+{
+  for (u32 lanes = group; lanes; lanes &= lanes - 1)
+  {
+    u32 lane = LowestLane(lanes);
+    u8  SP   = (u8)v.SP[lane];
+
+    cpus[lane]->ram[0x100 + SP] = (u8)v.value[lane];
+    v.SP[lane] = (u8)(SP - 1);
+  }
+}
+
+template<Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::Pull(Vectors<kernel> &v, u32 group)
+{
+  for (u32 lanes = group; lanes; lanes &= lanes - 1)
+  {
+    u32 lane = LowestLane(lanes);
+    u8  SP   = (u8)(v.SP[lane] + 1);
+
+    v.SP   [lane] = SP;
+    v.value[lane] = cpus[lane]->ram[0x100 + SP];
+  }
+}
+
+// Execute<opcode> over the lanes of group: what the registers become is computed in every
+// lane and only kept in the group's, memory is accessed in the group's lanes alone
+template<u8 opcode, Lockstep::Kernel kernel>
+FORCEINLINE void Lockstep::Step(Vectors<kernel> &v, u32 group, u16 operand)
+{
+  constexpr Operation      op     = opcodeInfo[opcode].operation;
+  constexpr AddressingMode mode   = opcodeInfo[opcode].mode;
+  constexpr u32            cycles = opcodeInfo[opcode].cycles;
+  constexpr u32            page   = opcodeInfo[opcode].pageCycles;
+
+  if (!IsVectorOp(op, mode))
+  {
+    for (u32 lanes = group; lanes; lanes &= lanes - 1)
+      RunLane(v, LowestLane(lanes));
+
+    return;
+  }
+
+  typedef typename Vectors<kernel>::Lanes Lanes;
+
+  Lanes mask  = GroupMask<Lanes>(group);
+  Lanes extra = {}; // Cycles of page crossings
+
+  // The flag and arithmetic helpers of Cpu assign the group's lanes through this
+  MaskedRegisters<Lanes> masked = {{v.A, mask}, {v.cResult, mask}, {v.nzResult, mask},
+                                   {v.vOperandA, mask}, {v.vOperandM, mask}, {v.vResult, mask}};
+
+  steps              += 1;
+  vectorInstructions += __builtin_popcount(group);
+
+  /* Addressing modes */
+  switch (mode)
+  {
+    case AddressingMode::Implied:
+    case AddressingMode::Accumulator:
+      break;
+
+    case AddressingMode::ZeroPageX:
+      v.address = (v.X + operand) & 0xFF; // Zero page wraps around
+      break;
+
+    case AddressingMode::ZeroPageY:
+      v.address = (v.Y + operand) & 0xFF;
+      break;
+
+    case AddressingMode::AbsoluteX:
+    case AddressingMode::AbsoluteY:
+    {
+      const Lanes &index = mode == AddressingMode::AbsoluteX ? v.X : v.Y;
+
+      v.address = (index + operand) & 0xFFFF;
+
+      if (page)
+        extra = ((index + (operand & 0xFF)) > 0xFF) & page;
+      break;
+    }
+
+    case AddressingMode::IndirectX:
+    case AddressingMode::IndirectY:
+    {
+      // The pointer is in each lane's zero page
+      for (u32 lanes = group; lanes; lanes &= lanes - 1)
+      {
+        u32 lane = LowestLane(lanes);
+        const u8 *ram = cpus[lane]->ram;
+
+        u8  BB = mode == AddressingMode::IndirectX ? (u8)(operand + v.X[lane]) : (u8)operand;
+        u16 XX = ram[BB];
+        u16 YY = ram[(u8)(BB + 1)];
+
+        v.address[lane] = (u16)(((YY << 8) | XX) + (mode == AddressingMode::IndirectY ? v.Y[lane] : 0));
+
+        if (mode == AddressingMode::IndirectY && page && XX + v.Y[lane] > 0xFF)
+          extra[lane] = page;
+      }
+      break;
+    }
+
+    default: // Immediate value, zero page or absolute address, branch target
+      v.address = Lanes{} + operand;
+      break;
+  }
+
+  Lanes PC = (v.PC + InstructionBytes(mode)) & 0xFFFF;
+
+  Commit(v.PC,     PC,                      mask);
+  Commit(v.cycles, v.cycles + cycles + extra, mask);
+
+  // The operand, where the operation reads one
+  switch (op)
+  {
+    case Operation::LDA: case Operation::LDX: case Operation::LDY: case Operation::LAX:
+    case Operation::AND: case Operation::EOR: case Operation::ORA: case Operation::BIT:
+    case Operation::ADC: case Operation::SBC:
+    case Operation::CMP: case Operation::CPX: case Operation::CPY:
+    case Operation::INC: case Operation::DEC:
+    case Operation::ASL: case Operation::LSR: case Operation::ROL: case Operation::ROR:
+      if (mode == AddressingMode::Accumulator)
+        v.value = v.A;
+      else if (mode == AddressingMode::Immediate)
+        v.value = v.address;
+      else
+        ReadLanes<mode>(v, group);
+      break;
+
+    default:
+      break;
+  }
+
+  const Lanes &value = v.value;
+
+  switch (op)
+  {
+    /* Load/Store */
+    case Operation::LDA: Commit(v.A, value, mask); Commit(v.nzResult, value, mask); break;
+    case Operation::LDX: Commit(v.X, value, mask); Commit(v.nzResult, value, mask); break;
+    case Operation::LDY: Commit(v.Y, value, mask); Commit(v.nzResult, value, mask); break;
+    case Operation::LAX: Commit(v.A, value, mask); Commit(v.X, value, mask); Commit(v.nzResult, value, mask); break;
+    case Operation::STA: v.value = v.A;       WriteLanes<mode>(v, group); break;
+    case Operation::STX: v.value = v.X;       WriteLanes<mode>(v, group); break;
+    case Operation::STY: v.value = v.Y;       WriteLanes<mode>(v, group); break;
+    case Operation::SAX: v.value = v.A & v.X; WriteLanes<mode>(v, group); break;
+
+    /* Register transfers */
+    case Operation::TAX: Commit(v.X, v.A,  mask); Commit(v.nzResult, v.A,  mask); break;
+    case Operation::TAY: Commit(v.Y, v.A,  mask); Commit(v.nzResult, v.A,  mask); break;
+    case Operation::TXA: Commit(v.A, v.X,  mask); Commit(v.nzResult, v.X,  mask); break;
+    case Operation::TYA: Commit(v.A, v.Y,  mask); Commit(v.nzResult, v.Y,  mask); break;
+    case Operation::TSX: Commit(v.X, v.SP, mask); Commit(v.nzResult, v.SP, mask); break;
+    case Operation::TXS: Commit(v.SP, v.X, mask); break;
+
+    /* Stack */
+    case Operation::PHA: v.value = v.A; Push(v, group); break;
+    case Operation::PHP: v.value = Cpu::GetStatus(v) | Cpu::flagBvalue | Cpu::flagUvalue; Push(v, group); break;
+    case Operation::PLA: Pull(v, group); Commit(v.A, value, mask); Commit(v.nzResult, value, mask); break;
+
+    /* Logical */
+    case Operation::AND: Commit(v.A, v.A & value, mask); Commit(v.nzResult, v.A, mask); break;
+    case Operation::EOR: Commit(v.A, v.A ^ value, mask); Commit(v.nzResult, v.A, mask); break;
+    case Operation::ORA: Commit(v.A, v.A | value, mask); Commit(v.nzResult, v.A, mask); break;
+    case Operation::BIT: Cpu::BitTest(masked, value); break;
+
+    /* Arithmetic */
+    case Operation::ADC: Cpu::AddWithCarry(masked, value);  break;
+    case Operation::SBC: Cpu::AddWithCarry(masked, ~value); break; // One's complement
+    case Operation::CMP: Cpu::Compare(masked, v.A, value);  break;
+    case Operation::CPX: Cpu::Compare(masked, v.X, value);  break;
+    case Operation::CPY: Cpu::Compare(masked, v.Y, value);  break;
+
+    /* Increments/Decrements */
+    case Operation::INC:
+    case Operation::DEC:
+      v.value = (value + (op == Operation::INC ? 1 : 0xFF)) & 0xFF;
+      WriteLanes<mode>(v, group);
+      Commit(v.nzResult, value, mask);
+      break;
+    case Operation::INX: Commit(v.X, (v.X + 1) & 0xFF, mask); Commit(v.nzResult, v.X, mask); break;
+    case Operation::INY: Commit(v.Y, (v.Y + 1) & 0xFF, mask); Commit(v.nzResult, v.Y, mask); break;
+    case Operation::DEX: Commit(v.X, (v.X - 1) & 0xFF, mask); Commit(v.nzResult, v.X, mask); break;
+    case Operation::DEY: Commit(v.Y, (v.Y - 1) & 0xFF, mask); Commit(v.nzResult, v.Y, mask); break;
+
+    /* Shifts */
+    case Operation::ASL:
+    case Operation::LSR:
+    case Operation::ROL:
+    case Operation::ROR:
+    {
+      v.value = Cpu::Shift<op>(masked, value);
+
+      if (mode == AddressingMode::Accumulator)
+        Commit(v.A, value, mask);
+      else
+        WriteLanes<mode>(v, group);
+
+      Commit(v.nzResult, value, mask);
+      break;
+    }
+
+    /* Jumps/Calls */
+    case Operation::JMP: Commit(v.PC, v.address, mask); break;
+    case Operation::JSR:
+    {
+      Lanes returnAddress = v.PC - 1; // Last byte of the JSR instruction
+
+      v.value = returnAddress >> 8;   // high byte
+      Push(v, group);
+      v.value = returnAddress & 0xFF; // low byte
+      Push(v, group);
+
+      Commit(v.PC, v.address, mask);
+      break;
+    }
+    case Operation::RTS:
+    {
+      Pull(v, group);
+      Lanes LL = value; // low byte
+      Pull(v, group);
+
+      Commit(v.PC, (((value << 8) | LL) + 1) & 0xFFFF, mask);
+      break;
+    }
+
+    /* Branches, see Cpu::Branch */
+    case Operation::BCC: case Operation::BCS:
+    case Operation::BEQ: case Operation::BNE:
+    case Operation::BMI: case Operation::BPL:
+    case Operation::BVC: case Operation::BVS:
+    {
+      Lanes taken   = (Cpu::BranchTaken<op>(v) != 0) & mask;
+      Lanes crossed = (((v.PC ^ v.address) & 0xFF00) != 0) & 1;
+
+      Commit(v.cycles, v.cycles + 1 + crossed, taken);
+      Commit(v.PC,     v.address,              taken);
+      break;
+    }
+
+    /* Status flags */
+    case Operation::CLC: Commit(v.cResult, Lanes{},         mask); break;
+    case Operation::SEC: Commit(v.cResult, Lanes{} + 0x100, mask); break;
+    case Operation::CLD: Commit(v.D,       Lanes{},         mask); break;
+    case Operation::SED: Commit(v.D,       Lanes{} + 1,     mask); break;
+    case Operation::SEI: Commit(v.I,       Lanes{} + 1,     mask); break;
+    case Operation::CLV: Cpu::SetV(masked, Lanes{}); break;
+
+    default: // NOP, the others aren't run here
+      break;
+  }
+}
+#endif
@@ -0,0 +1,119 @@
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+#pragma once
+
+#include "opcodes.hpp"
+#include "types.hpp"
+
+class Cpu;
+
+/* Many machines on one core, for rollouts of the same ROM. The registers of up to 16 Cpus,
+   the lanes, are kept as vectors with a lane per machine. Every step takes the lowest PC of
+   the lanes with instructions left and decodes the instruction there once: the lanes at that
+   PC reading the same code run it together in the vector kernels, and the others wait until
+   the lanes behind them reach their PC. Lanes split at branches going both ways and join
+   again wherever their PCs meet.
+
+   The vector kernels compute the registers and the lazy flags of Cpu::Registers with the
+   helpers of execute.hpp and access memory through each lane's own Cpu, one lane at a time.
+   Run stops a lane at its Cpu::nextStop to handle its events, the others go on. JMP
+   indirect, BRK, RTI, PLP, CLI and the unofficial opcodes other than NOP, LAX and SAX run on
+   the Cpu instruction handlers, one lane at a time. */
+class Lockstep {
+public:
+  static const u32 maxLanes = 16;
+
+  enum class Kernel : u8 {
+    Scalar, // Every lane alone on the Cpu handlers, Cpu::RunInstructions
+    Vector, // 16 lanes in four vectors of 4, the baseline of the host: SSE2 on x86-64, NEON on AArch64
+    Avx2,   // 16 lanes in two vectors of 8
+    Avx512  // 16 lanes in one vector
+  };
+
+  Lockstep();
+
+  Lockstep(const Lockstep &) = delete;
+  Lockstep &operator=(const Lockstep &) = delete;
+
+  // Runs cpu in the next lane, false once there are maxLanes. The Cpu must outlive the
+  // Lockstep and only runs through it while it's a lane. Forks are the usual lanes.
+  bool Add                   (Cpu &cpu);
+  void Clear                 ();
+
+  u32  GetLaneCount          () const;
+  Cpu &GetLane               (u32 lane);
+
+  // Runs every lane the same as Cpu::Run(cycles - GetOvershoot(lane), Cpu::Dispatch::Switch): each
+  // stops at its own events and interrupts and carries its overshoot into the next Run, so one
+  // Run of the cycles of a frame is a frame of every lane. With GetKernel().
+  void Run                   (s32 cycles);
+  void Run                   (Kernel kernel, s32 cycles); // Kernels the host doesn't run fall back to the scalar one
+  s32  GetOvershoot          (u32 lane) const;            // Of the last Run, 0 after Add
+
+  // Runs count instructions on every lane, the same as Cpu::RunInstructions on each: only the
+  // CPU, without events or interrupts, and without tracing
+  void RunInstructions       (u32 count);
+  void RunInstructions       (Kernel kernel, u32 count);
+
+  // Counts of the last Run or RunInstructions, none of the scalar kernel's Run
+  u64  GetSteps              () const; // Instructions decoded for the vector kernels, once per step
+  u64  GetVectorInstructions () const; // Lane instructions they ran
+  u64  GetScalarInstructions () const; // Lane instructions run on the Cpu handlers
+
+  static Kernel      GetKernel    (); // Fastest one the host runs, picked on first use
+  static bool        IsSupported  (Kernel kernel);
+  static const char *GetKernelName(Kernel kernel);
+
+private:
+  template<Kernel kernel> struct Vectors; // The lane registers, see lockstep.cpp
+
+  static const u32 bankSlots = 4; // 8KB each from 0x8000
+
+  Cpu *cpus       [maxLanes];
+  s64  cycleBase  [maxLanes];            // Cycle count of each lane when the kernel was called
+  u32  generations[maxLanes];            // Cpu::blockGeneration when the banks were compared
+  u32  banks      [bankSlots][maxLanes]; // Lanes with the same memory in the slot as each, a bit per lane
+  bool banksChanged;                     // A lane switched banks since
+  u32  laneCount;
+
+  s64  targets   [maxLanes]; // Cycle count each lane runs to, with events
+  s32  overshoots[maxLanes];
+  u32  finished;             // Lanes at their target, a bit per lane
+  bool events;               // Run rather than RunInstructions: lanes stop at Cpu::nextStop
+
+  u64  steps;
+  u64  vectorInstructions;
+  u64  scalarInstructions;
+
+  void RunKernel             (Kernel kernel, u32 count);
+  void Finish                (u32 lane); // Syncs the lane at its target
+  void RunScalar             (u32 count);
+  void RunVector             (u32 count);
+  void RunAvx2               (u32 count);
+  void RunAvx512             (u32 count);
+
+  template<Kernel kernel> FORCEINLINE void RunVectors(u32 count);
+
+  template<Kernel kernel> void Load (Vectors<kernel> &v, u32 lane); // From the Cpu registers
+  template<Kernel kernel> void Store(const Vectors<kernel> &v, u32 lane);
+  template<Kernel kernel> FORCEINLINE void LoadStop(Vectors<kernel> &v, u32 lane);
+
+  void CompareBanks          ();
+  void CheckBanks            (u32 lane);             // After the lane wrote through the bus
+  u32  CompareCode           (u32 group, u32 leader, u16 PC, u32 bytes) const; // The lanes of group with the leader's bytes at PC
+
+  template<Kernel kernel> void RunLane    (Vectors<kernel> &v, u32 lane); // One instruction on the Cpu handlers
+  template<Kernel kernel> void ServiceLane(Vectors<kernel> &v, u32 lane); // Events of a lane at its stop
+
+  /* Memory of the lanes in group, a lane at a time: Vectors::value from or to Vectors::address */
+  template<AddressingMode mode, Kernel kernel> FORCEINLINE void ReadLanes (Vectors<kernel> &v, u32 group);
+  template<AddressingMode mode, Kernel kernel> FORCEINLINE void WriteLanes(Vectors<kernel> &v, u32 group);
+
+  template<Kernel kernel> FORCEINLINE void Push(Vectors<kernel> &v, u32 group);
+  template<Kernel kernel> FORCEINLINE void Pull(Vectors<kernel> &v, u32 group);
+
+  template<u8 opcode, Kernel kernel> FORCEINLINE void Step(Vectors<kernel> &v, u32 group, u16 operand); // Execute<opcode> on the lanes of group
+};
+
+#endif //__LOCKSTEP_H__
@@ -1,16 +1,182 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "batch.hpp"
+#include "bench.hpp"
+#include "selftest.hpp"
 #include "cpu.hpp"
+#include "palette.hpp"
+#include "tracer.hpp"
 
-int main()
+const s32 cyclesPerFrame = 29781; // NTSC, 262 scanlines of 341 PPU dots at 3 dots per CPU cycle
+
+// A line per job in manifest order, then the totals. Fails when a job did.
+int RunBatch(const std::string &manifestFile, u32 threads)
 {
-  Cpu cpu;
+  Batch batch;
+
+  if (!batch.Load(manifestFile))
+  {
+    printf("%s\n", batch.GetError().c_str());
+    return 1;
+  }
+
+  bool ok     = batch.Run(threads);
+  u32  failed = 0;
+
+  const std::vector<BatchJob>    &jobs    = batch.GetJobs();
+  const std::vector<BatchResult> &results = batch.GetResults();
+
+  printf(" job  result  frames        fps  hash              rom\n");
+
+  for (size_t i = 0; i < jobs.size(); ++i)
+  {
+    const BatchResult &result = results[i];
+    double             fps    = result.seconds > 0 ? result.frames / result.seconds : 0;
+
+    printf("%4u  %-6s  %6u  %9.1f  %016llx  %s\n", (u32)i + 1, result.ok ? "ok" : "FAILED", result.frames, fps,
+           (unsigned long long)result.hash, jobs[i].romFile.c_str());
+
+    if (!result.ok)
+    {
+      printf("      %s\n", result.error.c_str());
+      failed++;
+    }
+  }
+
+  printf("%u jobs, %u failed, %llu frames in %.2f s on %u threads: %.1f frames/s\n", (u32)jobs.size(), failed,
+         (unsigned long long)batch.GetFrames(), batch.GetSeconds(), batch.GetThreads(), batch.GetFrames() / batch.GetSeconds());
+
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string romFile = "../rom/nestest.nes";
+
+  // Usage: 6502Emu [rom] | 6502Emu --bench <name> [rom] | 6502Emu --selftest <name> [rom] [reference] | 6502Emu --batch <manifest> [threads]
+  if (argc > 2 && std::string(argv[1]) == "--bench")
+  {
+    if (argc > 3)
+      romFile = argv[3];
+
+    return RunBenchmark(argv[2], romFile);
+  }
+
+  if (argc > 2 && std::string(argv[1]) == "--selftest")
+  {
+    if (argc > 3)
+      romFile = argv[3];
+
+    return RunSelfTest(argv[2], romFile, argc > 4 ? argv[4] : "");
+  }
+
+  // Usage: 6502Emu --batch <manifest> [threads], see batch.hpp for the manifest
+  if (argc > 2 && std::string(argv[1]) == "--batch")
+    return RunBatch(argv[2], argc > 3 ? (u32)strtoul(argv[3], nullptr, 10) : 0);
+
+  // Usage: 6502Emu [--trace <file>] [--frames <count>] [--palette <file.pal>] [--capture <file>] [--wav <file>] [rom]
+  // A capture is every frame as raw 256x240 RGBA, one after the other.
+  std::string traceFile;
+  std::string wavFile;
+  std::string paletteFile;
+  std::string captureFile;
+  u32         frames = 0; // 0 runs until the process is killed
+
+  int arg = 1;
 
-  bool quit = false;
+  for (; arg + 1 < argc; arg += 2)
+  {
+    std::string option = argv[arg];
+
+    if (option == "--trace")
+      traceFile = argv[arg + 1];
+    else if (option == "--frames")
+      frames = (u32)strtoul(argv[arg + 1], nullptr, 10);
+    else if (option == "--palette")
+      paletteFile = argv[arg + 1];
+    else if (option == "--capture")
+      captureFile = argv[arg + 1];
+    else if (option == "--wav")
+      wavFile = argv[arg + 1];
+    else
+      break;
+  }
+
+  if (arg < argc)
+    romFile = argv[arg];
+
+  Cpu     cpu;
+  Tracer  tracer;
+  Palette   palette;
+  WavWriter wav;
+  FILE     *capture = nullptr;
+
+  std::vector<u32> rgba(Ppu::width * Ppu::height);
+
+  bool quit      = false;
+  u32  frame     = 0;
+  s32  overshoot = 0;
   
-  cpu.LoadRom("..\\rom\\nestest.nes");
+  if (!cpu.LoadRom(romFile))
+    return 1;
+
+  // ROMs recompiled into the build run their routines
+  Cpu::Dispatch dispatch = cpu.HasStaticProgram() ? Cpu::Dispatch::Static : Cpu::defaultDispatch;
+
+  if (!traceFile.empty())
+  {
+#ifndef NESEMU_TRACE
+    printf("Built without NESEMU_TRACE, --trace is ignored\n");
+#endif
+    if (!tracer.Start(traceFile))
+      return 1;
+
+    cpu.SetTracer(&tracer);
+  }
+
+  if (!paletteFile.empty() && !palette.Load(paletteFile))
+  {
+    printf("Can't load the palette: %s\n", palette.GetError().c_str());
+    return 1;
+  }
+
+  if (!captureFile.empty() && !(capture = fopen(captureFile.c_str(), "wb")))
+  {
+    printf("Can't open %s\n", captureFile.c_str());
+    return 1;
+  }
+
+  if (!wavFile.empty())
+  {
+    if (!wav.Start(wavFile, cpu.GetApu().GetSampleRate()))
+      return 1;
+
+    cpu.GetApu().SetOutput(&wav.GetBuffer());
+  }
 
   while(!quit){
-    cpu.NextOpcode();
+    // Run a whole frame per call, the next frame is shortened by what this one overshot.
+    // Run brings the PPU and the APU up to the CPU before it returns.
+    s32 cycles = cyclesPerFrame - overshoot;
+
+    overshoot = cpu.Run(cycles, dispatch);
+
+    if (capture && cpu.GetPpu().GetFrame())
+    {
+      palette.Convert(cpu.GetPpu().GetFrame(), (u32)rgba.size(), rgba.data());
+      fwrite(rgba.data(), sizeof(u32), rgba.size(), capture);
+    }
+
+    quit = frames != 0 && ++frame == frames;
   }
 
+  tracer.Stop();
+  wav.Stop();
+
+  if (capture)
+    fclose(capture);
+
   return 0;
-}
\ No newline at end of file
+}
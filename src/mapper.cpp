@@ -0,0 +1,475 @@
+#include "mapper.hpp"
+#include <cstring>
+
+namespace
+{
+  /* NROM: 16KB mirrored or 32KB of PRG, 8KB of CHR, nothing to switch */
+  class Nrom : public Mapper {
+  public:
+    explicit Nrom(const Rom &rom) : Mapper(rom, true) { Reset(); }
+
+    std::unique_ptr<Mapper> Clone() const override { return std::unique_ptr<Mapper>(new Nrom(*this)); }
+
+    void Write(u16 address, u8 value) override {}
+  };
+
+  /* MMC1: registers are loaded a bit at a time through a 5 bit shift register. Control picks
+     the mirroring, how the 16KB PRG banks switch and whether CHR switches 8KB or 4KB. */
+  class Mmc1 : public Mapper {
+  public:
+    explicit Mmc1(const Rom &rom) : Mapper(rom, false) { Reset(); }
+
+    std::unique_ptr<Mapper> Clone() const override { return std::unique_ptr<Mapper>(new Mmc1(*this)); }
+
+    void Reset() override;
+    void Write(u16 address, u8 value) override;
+
+    void Save   (Snapshot &snapshot) const override;
+    bool Restore(const Snapshot &snapshot) override;
+
+  private:
+    u8 shift;   // Bits come in at bit 4, a set bit 0 marks the fifth write
+    u8 control;
+    u8 chr[2];
+    u8 prg;
+
+    void Update();
+  };
+
+  /* UxROM: a 16KB bank at 0x8000, the last one fixed at 0xC000 */
+  class Uxrom : public Mapper {
+  public:
+    explicit Uxrom(const Rom &rom) : Mapper(rom, false) { Reset(); }
+
+    std::unique_ptr<Mapper> Clone() const override { return std::unique_ptr<Mapper>(new Uxrom(*this)); }
+
+    void Write(u16 address, u8 value) override { SetPrg16(0, value); }
+  };
+
+  /* CNROM: NROM with an 8KB CHR bank */
+  class Cnrom : public Mapper {
+  public:
+    explicit Cnrom(const Rom &rom) : Mapper(rom, true) { Reset(); }
+
+    std::unique_ptr<Mapper> Clone() const override { return std::unique_ptr<Mapper>(new Cnrom(*this)); }
+
+    void Write(u16 address, u8 value) override { SetChr8(value); }
+  };
+
+  /* MMC3: eight bank registers behind a select register, two 8KB PRG banks and six CHR banks,
+     both layouts can swap halves. The scanline counter reloads from the latch when it is 0 or
+     a reload was asked for, otherwise it counts down, and raises IRQ when it ends up at 0. */
+  class Mmc3 : public Mapper {
+  public:
+    explicit Mmc3(const Rom &rom) : Mapper(rom, false) { Reset(); }
+
+    std::unique_ptr<Mapper> Clone() const override { return std::unique_ptr<Mapper>(new Mmc3(*this)); }
+
+    void Reset() override;
+    void Write(u16 address, u8 value) override;
+
+    void ClockScanline  () override;
+    u32  GetClocksToIrq () const override;
+    bool GetIrq         () const override;
+
+    void Save   (Snapshot &snapshot) const override;
+    bool Restore(const Snapshot &snapshot) override;
+
+  private:
+    u8   select;       // Register written next in bits 0-2, PRG layout in bit 6, CHR inversion in bit 7
+    u8   registers[8]; // R0 and R1 are 2KB CHR banks, R2-R5 1KB, R6 and R7 8KB PRG banks
+    u8   latch;
+    u8   counter;
+    bool reload;
+    bool irqEnabled;
+    bool irq;
+
+    void Update();
+  };
+}
+
+/* Mapper */
+std::unique_ptr<Mapper> Mapper::Create(const Rom &rom)
+{
+  switch (rom.GetMapper())
+  {
+    case 0:  return std::unique_ptr<Mapper>(new Nrom (rom));
+    case 1:  return std::unique_ptr<Mapper>(new Mmc1 (rom));
+    case 2:  return std::unique_ptr<Mapper>(new Uxrom(rom));
+    case 3:  return std::unique_ptr<Mapper>(new Cnrom(rom));
+    case 4:  return std::unique_ptr<Mapper>(new Mmc3 (rom));
+    default: return nullptr;
+  }
+}
+
+bool Mapper::IsSupported(u16 number)
+{
+  return number <= 4;
+}
+
+Mapper::Mapper(const Rom &rom, bool fixedPrg)
+  : fixedPrg(fixedPrg)
+{
+  number  = rom.GetMapper();
+  prgSize = rom.GetPrgRomSize();
+  chrSize = rom.GetChrRom() ? rom.GetChrRomSize() : 0x2000;
+
+  switch (rom.GetMirroring())
+  {
+    case Rom::Mirroring::Horizontal: mirroring = Mirroring::Horizontal; break;
+    case Rom::Mirroring::Vertical:   mirroring = Mirroring::Vertical;   break;
+    case Rom::Mirroring::FourScreen: mirroring = Mirroring::FourScreen; break;
+  }
+}
+
+Mapper::~Mapper()
+{
+
+}
+
+// The NROM layout: the first 32KB of PRG, a single 16KB bank at both halves, and the first 8KB of CHR
+void Mapper::Reset()
+{
+  SetPrg16(0, 0);
+  SetPrg16(1, -1);
+  SetChr8(0);
+  SetMirroring(mirroring);
+}
+
+void Mapper::ClockScanline()
+{
+
+}
+
+u32 Mapper::GetClocksToIrq() const
+{
+  return 0;
+}
+
+bool Mapper::GetIrq() const
+{
+  return false;
+}
+
+const Mapper::Banks &Mapper::GetBanks() const
+{
+  return banks;
+}
+
+bool Mapper::HasFixedPrg() const
+{
+  return fixedPrg;
+}
+
+u16 Mapper::GetNumber() const
+{
+  return number;
+}
+
+// Boards whose banks are all their state have no registers to pack
+void Mapper::Save(Snapshot &snapshot) const
+{
+  memset(&snapshot, 0, sizeof(snapshot));
+
+  snapshot.banks  = banks;
+  snapshot.number = number;
+}
+
+bool Mapper::Restore(const Snapshot &snapshot)
+{
+  if (snapshot.number != number)
+    return false;
+
+  banks = snapshot.banks;
+
+  return true;
+}
+
+void Mapper::SetPrg8(u32 slot, s32 bank)
+{
+  u32 count = prgSize / 0x2000 ? prgSize / 0x2000 : 1;
+
+  banks.prg[slot] = (u32)((bank % (s32)count + count) % count) * 0x2000 % prgSize;
+}
+
+void Mapper::SetPrg16(u32 slot, s32 bank)
+{
+  u32 count = prgSize / 0x4000 ? prgSize / 0x4000 : 1;
+  u32 first = (u32)((bank % (s32)count + count) % count) * 2;
+
+  SetPrg8(slot * 2    , first);
+  SetPrg8(slot * 2 + 1, first + 1);
+}
+
+void Mapper::SetPrg32(s32 bank)
+{
+  SetPrg16(0, bank * 2);
+  SetPrg16(1, bank * 2 + 1);
+}
+
+void Mapper::SetChr1(u32 page, s32 bank)
+{
+  u32 count = chrSize / 0x400 ? chrSize / 0x400 : 1;
+
+  banks.chr[page] = (u32)((bank % (s32)count + count) % count) * 0x400;
+}
+
+void Mapper::SetChr2(u32 page, s32 bank)
+{
+  SetChr1(page * 2    , bank * 2);
+  SetChr1(page * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::SetChr4(u32 page, s32 bank)
+{
+  SetChr2(page * 2    , bank * 2);
+  SetChr2(page * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::SetChr8(s32 bank)
+{
+  SetChr4(0, bank * 2);
+  SetChr4(1, bank * 2 + 1);
+}
+
+void Mapper::SetMirroring(Mirroring mode)
+{
+  // VRAM pages of the four nametables, in Mirroring order
+  static const u8 layouts[5][4] = {
+    { 0, 0, 1, 1 }, // Horizontal
+    { 0, 1, 0, 1 }, // Vertical
+    { 0, 0, 0, 0 }, // Single lower
+    { 1, 1, 1, 1 }, // Single upper
+    { 0, 1, 2, 3 }  // Four screen
+  };
+
+  for (u32 page = 0; page < 4; ++page)
+    banks.nametables[page] = layouts[(u32)mode][page];
+}
+
+/* MMC1 */
+void Mmc1::Reset()
+{
+  shift   = 0x10;
+  control = 0x0C; // The last bank fixed at 0xC000
+  chr[0]  = 0;
+  chr[1]  = 0;
+  prg     = 0;
+
+  Update();
+}
+
+// Bit 7 resets the shift register, the fifth bit loads the register picked by address
+void Mmc1::Write(u16 address, u8 value)
+{
+  if (value & 0x80)
+  {
+    shift    = 0x10;
+    control |= 0x0C;
+    Update();
+    return;
+  }
+
+  bool full = shift & 0x01;
+
+  shift = (shift >> 1) | ((value & 0x01) << 4);
+
+  if (!full)
+    return;
+
+  switch ((address >> 13) & 3)
+  {
+    case 0: control = shift;        break;
+    case 1: chr[0]  = shift;        break;
+    case 2: chr[1]  = shift;        break;
+    case 3: prg     = shift & 0x0F; break; // Bit 4 enables PRG RAM, which stays mapped
+  }
+
+  shift = 0x10;
+  Update();
+}
+
+void Mmc1::Save(Snapshot &snapshot) const
+{
+  Mapper::Save(snapshot);
+
+  snapshot.registers[0] = shift;
+  snapshot.registers[1] = control;
+  snapshot.registers[2] = chr[0];
+  snapshot.registers[3] = chr[1];
+  snapshot.registers[4] = prg;
+}
+
+bool Mmc1::Restore(const Snapshot &snapshot)
+{
+  if (!Mapper::Restore(snapshot))
+    return false;
+
+  shift   = snapshot.registers[0];
+  control = snapshot.registers[1];
+  chr[0]  = snapshot.registers[2];
+  chr[1]  = snapshot.registers[3];
+  prg     = snapshot.registers[4];
+
+  return true;
+}
+
+void Mmc1::Update()
+{
+  static const Mirroring modes[4] = { Mirroring::SingleLower, Mirroring::SingleUpper, Mirroring::Vertical, Mirroring::Horizontal };
+
+  if (mirroring != Mirroring::FourScreen)
+    SetMirroring(modes[control & 0x03]);
+
+  switch ((control >> 2) & 0x03)
+  {
+    case 0:
+    case 1: // 32KB, the low bit is ignored
+      SetPrg32(prg >> 1);
+      break;
+
+    case 2: // First bank fixed at 0x8000
+      SetPrg16(0, 0);
+      SetPrg16(1, prg);
+      break;
+
+    case 3: // Last bank fixed at 0xC000
+      SetPrg16(0, prg);
+      SetPrg16(1, -1);
+      break;
+  }
+
+  if (control & 0x10)
+  {
+    SetChr4(0, chr[0]);
+    SetChr4(1, chr[1]);
+  }
+  else
+    SetChr8(chr[0] >> 1);
+}
+
+/* MMC3 */
+void Mmc3::Reset()
+{
+  static const u8 initial[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+
+  for (u32 i = 0; i < 8; ++i)
+    registers[i] = initial[i];
+
+  select     = 0;
+  latch      = 0;
+  counter    = 0;
+  reload     = false;
+  irqEnabled = false;
+  irq        = false;
+
+  SetMirroring(mirroring);
+  Update();
+}
+
+// Four pairs of registers, even and odd addresses
+void Mmc3::Write(u16 address, u8 value)
+{
+  switch (address & 0xE001)
+  {
+    case 0x8000: select = value; break;
+    case 0x8001: registers[select & 0x07] = value; break;
+
+    case 0xA000:
+      if (mirroring != Mirroring::FourScreen)
+        SetMirroring(value & 0x01 ? Mirroring::Horizontal : Mirroring::Vertical);
+      break;
+
+    case 0xA001: break; // PRG RAM protection, the RAM stays writable
+
+    case 0xC000: latch  = value; break;
+    case 0xC001: reload = true; counter = 0; break;
+
+    case 0xE000: irqEnabled = false; irq = false; break; // Also acknowledges
+    case 0xE001: irqEnabled = true; break;
+  }
+
+  Update();
+}
+
+// The eight bank registers, then select, the counter and its flags
+void Mmc3::Save(Snapshot &snapshot) const
+{
+  Mapper::Save(snapshot);
+
+  memcpy(snapshot.registers, registers, sizeof(registers));
+
+  snapshot.registers[ 8] = select;
+  snapshot.registers[ 9] = latch;
+  snapshot.registers[10] = counter;
+  snapshot.registers[11] = reload;
+  snapshot.registers[12] = irqEnabled;
+  snapshot.registers[13] = irq;
+}
+
+bool Mmc3::Restore(const Snapshot &snapshot)
+{
+  if (!Mapper::Restore(snapshot))
+    return false;
+
+  memcpy(registers, snapshot.registers, sizeof(registers));
+
+  select     = snapshot.registers[ 8];
+  latch      = snapshot.registers[ 9];
+  counter    = snapshot.registers[10];
+  reload     = snapshot.registers[11] != 0;
+  irqEnabled = snapshot.registers[12] != 0;
+  irq        = snapshot.registers[13] != 0;
+
+  return true;
+}
+
+void Mmc3::Update()
+{
+  u32 swap = (select & 0x40) ? 2 : 0; // Swaps the banks at 0x8000 and 0xC000
+  u32 half = (select & 0x80) ? 4 : 0; // Swaps the 2KB and the 1KB CHR banks
+
+  SetPrg8(0 ^ swap, registers[6]);
+  SetPrg8(1       , registers[7]);
+  SetPrg8(2 ^ swap, -2);
+  SetPrg8(3       , -1);
+
+  SetChr1(0 ^ half, registers[0] & 0xFE);
+  SetChr1(1 ^ half, registers[0] | 0x01);
+  SetChr1(2 ^ half, registers[1] & 0xFE);
+  SetChr1(3 ^ half, registers[1] | 0x01);
+  SetChr1(4 ^ half, registers[2]);
+  SetChr1(5 ^ half, registers[3]);
+  SetChr1(6 ^ half, registers[4]);
+  SetChr1(7 ^ half, registers[5]);
+}
+
+void Mmc3::ClockScanline()
+{
+  if (counter == 0 || reload)
+  {
+    counter = latch;
+    reload  = false;
+  }
+  else
+    counter--;
+
+  if (counter == 0 && irqEnabled)
+    irq = true;
+}
+
+// The next clock reloads or counts down, the counter reaches 0 that many clocks later
+u32 Mmc3::GetClocksToIrq() const
+{
+  if (!irqEnabled)
+    return 0;
+
+  u32 next = counter == 0 || reload ? latch : counter - 1;
+
+  return next + 1;
+}
+
+bool Mmc3::GetIrq() const
+{
+  return irq;
+}
@@ -0,0 +1,84 @@
+#ifndef __MAPPER_H__
+#define __MAPPER_H__
+
+#pragma once
+
+#include <memory>
+#include "rom.hpp"
+#include "types.hpp"
+
+/* Cartridge board. A Mapper decodes the writes to $8000-$FFFF into banks: 8KB of PRG ROM at
+   each of 0x8000, 0xA000, 0xC000 and 0xE000, 1KB of CHR at each PPU page and the VRAM page
+   behind each nametable. Cpu maps the banks through the page tables of the bus and the PPU,
+   so a switch moves pointers and never copies memory.
+
+   Supported: NROM (0), MMC1 (1), UxROM (2), CNROM (3) and MMC3 (4). */
+class Mapper {
+public:
+  struct Banks {
+    u32 prg       [4]; // Offsets into PRG ROM
+    u32 chr       [8]; // Offsets into CHR ROM, or CHR RAM when the board has none
+    u8  nametables[4]; // 1KB pages of VRAM
+  };
+
+  // Save state section, the banks and the registers of the board packed by each one
+  struct Snapshot {
+    Banks banks;
+    u16   number;
+    u8    registers[16];
+  };
+
+  // Null when the board isn't supported
+  static std::unique_ptr<Mapper> Create(const Rom &rom);
+  static bool                    IsSupported(u16 number);
+
+  virtual ~Mapper();
+
+  virtual std::unique_ptr<Mapper> Clone() const = 0;
+
+  virtual void Reset();
+  virtual void Write(u16 address, u8 value) = 0; // $8000-$FFFF, banks may have moved after it
+
+  // Rendered lines clock the board once, at dot 260 (PPU A12 rising with sprites at 0x1000)
+  virtual void ClockScanline  ();
+  virtual u32  GetClocksToIrq () const; // Scanline clocks until the board raises IRQ, 0 when it won't
+  virtual bool GetIrq         () const; // IRQ line, held until the game acknowledges it
+
+  const Banks &GetBanks() const;
+  bool         HasFixedPrg() const; // The PRG banks never move
+  u16          GetNumber() const;   // iNES mapper number
+
+  virtual void Save   (Snapshot &snapshot) const;
+  virtual bool Restore(const Snapshot &snapshot); // False when it comes from another board
+
+protected:
+  enum class Mirroring : u8 {
+    Horizontal,
+    Vertical,
+    SingleLower, // Every nametable on the first VRAM page
+    SingleUpper,
+    FourScreen
+  };
+
+  explicit Mapper(const Rom &rom, bool fixedPrg);
+
+  Banks     banks;
+  u16       number;
+  u32       prgSize;
+  u32       chrSize;    // CHR ROM, or the 8KB of CHR RAM
+  Mirroring mirroring;  // From the header
+  bool      fixedPrg;
+
+  // Banks are counted in units of their size and wrap around the memory, negative ones count
+  // from the end
+  void SetPrg8      (u32 slot, s32 bank);
+  void SetPrg16     (u32 slot, s32 bank); // slot 0 at 0x8000, 1 at 0xC000
+  void SetPrg32     (s32 bank);
+  void SetChr1      (u32 page, s32 bank);
+  void SetChr2      (u32 page, s32 bank); // page counts 2KB
+  void SetChr4      (u32 page, s32 bank);
+  void SetChr8      (s32 bank);
+  void SetMirroring (Mirroring mode);
+};
+
+#endif //__MAPPER_H__
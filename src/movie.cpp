@@ -0,0 +1,89 @@
+#include "movie.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+bool Movie::Load(const std::string &movieFile)
+{
+  FILE *file = fopen(movieFile.c_str(), "r");
+
+  if (!file)
+    return Fail("can't open " + movieFile);
+
+  char line[1024];
+  bool versioned = false;
+  bool binary    = false;
+
+  buttons.clear();
+
+  while (fgets(line, sizeof(line), file))
+  {
+    if (line[0] != '|')
+    {
+      versioned |= strncmp(line, "version ", 8) == 0;
+      binary    |= strncmp(line, "binary 1", 8) == 0;
+      continue;
+    }
+
+    // Soft reset and power on at the first frame are where the run starts anyway
+    if (strtoul(line + 1, nullptr, 10) != 0 && !buttons.empty())
+    {
+      fclose(file);
+      return Fail(movieFile + " resets the console at frame " + std::to_string(GetFrameCount()));
+    }
+
+    const char *field = strchr(line + 1, '|');
+
+    for (u32 port = 0; port < 2; ++port)
+    {
+      const char *end  = field ? strchr(field + 1, '|') : nullptr;
+      u8          held = 0;
+
+      // Empty for no device, zappers have coordinates
+      if (end && end - field == 9)
+      {
+        for (u32 i = 0; i < 8; ++i)
+          if (field[1 + i] != '.' && field[1 + i] != ' ')
+            held |= 0x80 >> i;
+      }
+
+      buttons.push_back(held);
+      field = end;
+    }
+  }
+
+  fclose(file);
+
+  if (!versioned)
+    return Fail(movieFile + " isn't an fm2 movie");
+
+  if (binary)
+    return Fail(movieFile + " has a binary input log, only text is read");
+
+  error.clear();
+
+  return true;
+}
+
+const std::string &Movie::GetError() const
+{
+  return error;
+}
+
+u32 Movie::GetFrameCount() const
+{
+  return (u32)buttons.size() / 2;
+}
+
+u8 Movie::GetButtons(u32 frame, u32 port) const
+{
+  return frame < GetFrameCount() ? buttons[frame * 2 + (port & 1)] : 0;
+}
+
+bool Movie::Fail(const std::string &message)
+{
+  buttons.clear();
+  error = message;
+
+  return false;
+}
@@ -0,0 +1,31 @@
+#ifndef __MOVIE_H__
+#define __MOVIE_H__
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.hpp"
+
+/* Input movie in the FCEUX text format (.fm2): header lines of a key and a value, then one
+   line per frame, |commands|port 0|port 1|port 2|. A gamepad is RLDUTSBA, a character other
+   than '.' or ' ' holds the button. Only the gamepads of ports 0 and 1 are read, the header
+   is skipped, and a reset past the first frame fails the load: there's no way to replay it. */
+class Movie {
+public:
+  // Returns false and sets GetError() when movieFile can't be read or isn't a text movie
+  bool Load                  (const std::string &movieFile);
+
+  const std::string &GetError() const;
+
+  u32 GetFrameCount          () const;
+  u8  GetButtons             (u32 frame, u32 port) const; // Cpu::button bits, none held past the end
+
+private:
+  std::vector<u8> buttons; // Ports 0 and 1 of every frame
+  std::string     error;
+
+  bool Fail                  (const std::string &message);
+};
+
+#endif //__MOVIE_H__
@@ -0,0 +1,358 @@
+#ifndef __OPCODES_H__
+#define __OPCODES_H__
+
+#pragma once
+
+#include <array>
+#include "types.hpp"
+
+/* Instruction semantics, each opcode is an (operation x addressing mode) pair */
+enum class Operation : u8 {
+  /* Official */
+  ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+  CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP,
+  JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI,
+  RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+
+  /* Unofficial, the unofficial NOPs and SBC share the official operations */
+  ALR, ANC, ARR, AXS, DCP, ISC, JAM, LAS, LAX, LXA, RLA, RRA, SAX, SHA,
+  SHS, SHX, SHY, SLO, SRE, XAA
+};
+
+enum class AddressingMode : u8 {
+  Implied,     // Imp
+  Accumulator, // Acc
+  Immediate,   // Imm
+  ZeroPage,    // DP
+  ZeroPageX,   // DPX
+  ZeroPageY,   // DPY
+  Absolute,    // Abs
+  AbsoluteX,   // AbsX
+  AbsoluteY,   // AbsY
+  Indirect,    // JmpInd
+  IndirectX,   // DPIndX
+  IndirectY,   // DPIndY
+  Relative     // Rel
+};
+
+/* Static description of an opcode */
+struct OpInfo {
+  const char     *mnemonic;
+  Operation       operation;
+  AddressingMode  mode;
+  u8              bytes;      // Instruction length, opcode included
+  u8              cycles;     // Base cycles
+  u8              pageCycles; // Extra cycles when indexing crosses a page. Taken branches add their own
+  bool            official;
+};
+
+constexpr u8 InstructionBytes(AddressingMode mode)
+{
+  return mode == AddressingMode::Implied   || mode == AddressingMode::Accumulator ? 1 :
+         mode == AddressingMode::Absolute  || mode == AddressingMode::AbsoluteX   ||
+         mode == AddressingMode::AbsoluteY || mode == AddressingMode::Indirect    ? 3 : 2;
+}
+
+#define OFFICIAL(op, mode, cycles, pageCycles) \
+  OpInfo{ #op, Operation::op, AddressingMode::mode, InstructionBytes(AddressingMode::mode), cycles, pageCycles, true }
+#define UNOFFICIAL(op, mode, cycles, pageCycles) \
+  OpInfo{ #op, Operation::op, AddressingMode::mode, InstructionBytes(AddressingMode::mode), cycles, pageCycles, false }
+
+/* Opcode map shared by the interpreter, tracer and tools. Every one of the 256 opcodes is
+   listed, so lookups never need a range check. The interpreter specializes one handler per
+   entry at compile time, see Cpu::Execute. */
+constexpr std::array<OpInfo, 256> opcodeInfo = {{
+  /* 0x00 */ OFFICIAL  (BRK, Implied    , 7, 0),
+  /* 0x01 */ OFFICIAL  (ORA, IndirectX  , 6, 0),
+  /* 0x02 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x03 */ UNOFFICIAL(SLO, IndirectX  , 8, 0),
+  /* 0x04 */ UNOFFICIAL(NOP, ZeroPage   , 3, 0),
+  /* 0x05 */ OFFICIAL  (ORA, ZeroPage   , 3, 0),
+  /* 0x06 */ OFFICIAL  (ASL, ZeroPage   , 5, 0),
+  /* 0x07 */ UNOFFICIAL(SLO, ZeroPage   , 5, 0),
+  /* 0x08 */ OFFICIAL  (PHP, Implied    , 3, 0),
+  /* 0x09 */ OFFICIAL  (ORA, Immediate  , 2, 0),
+  /* 0x0A */ OFFICIAL  (ASL, Accumulator, 2, 0),
+  /* 0x0B */ UNOFFICIAL(ANC, Immediate  , 2, 0),
+  /* 0x0C */ UNOFFICIAL(NOP, Absolute   , 4, 0),
+  /* 0x0D */ OFFICIAL  (ORA, Absolute   , 4, 0),
+  /* 0x0E */ OFFICIAL  (ASL, Absolute   , 6, 0),
+  /* 0x0F */ UNOFFICIAL(SLO, Absolute   , 6, 0),
+
+  /* 0x10 */ OFFICIAL  (BPL, Relative   , 2, 0),
+  /* 0x11 */ OFFICIAL  (ORA, IndirectY  , 5, 1),
+  /* 0x12 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x13 */ UNOFFICIAL(SLO, IndirectY  , 8, 0),
+  /* 0x14 */ UNOFFICIAL(NOP, ZeroPageX  , 4, 0),
+  /* 0x15 */ OFFICIAL  (ORA, ZeroPageX  , 4, 0),
+  /* 0x16 */ OFFICIAL  (ASL, ZeroPageX  , 6, 0),
+  /* 0x17 */ UNOFFICIAL(SLO, ZeroPageX  , 6, 0),
+  /* 0x18 */ OFFICIAL  (CLC, Implied    , 2, 0),
+  /* 0x19 */ OFFICIAL  (ORA, AbsoluteY  , 4, 1),
+  /* 0x1A */ UNOFFICIAL(NOP, Implied    , 2, 0),
+  /* 0x1B */ UNOFFICIAL(SLO, AbsoluteY  , 7, 0),
+  /* 0x1C */ UNOFFICIAL(NOP, AbsoluteX  , 4, 1),
+  /* 0x1D */ OFFICIAL  (ORA, AbsoluteX  , 4, 1),
+  /* 0x1E */ OFFICIAL  (ASL, AbsoluteX  , 7, 0),
+  /* 0x1F */ UNOFFICIAL(SLO, AbsoluteX  , 7, 0),
+
+  /* 0x20 */ OFFICIAL  (JSR, Absolute   , 6, 0),
+  /* 0x21 */ OFFICIAL  (AND, IndirectX  , 6, 0),
+  /* 0x22 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x23 */ UNOFFICIAL(RLA, IndirectX  , 8, 0),
+  /* 0x24 */ OFFICIAL  (BIT, ZeroPage   , 3, 0),
+  /* 0x25 */ OFFICIAL  (AND, ZeroPage   , 3, 0),
+  /* 0x26 */ OFFICIAL  (ROL, ZeroPage   , 5, 0),
+  /* 0x27 */ UNOFFICIAL(RLA, ZeroPage   , 5, 0),
+  /* 0x28 */ OFFICIAL  (PLP, Implied    , 4, 0),
+  /* 0x29 */ OFFICIAL  (AND, Immediate  , 2, 0),
+  /* 0x2A */ OFFICIAL  (ROL, Accumulator, 2, 0),
+  /* 0x2B */ UNOFFICIAL(ANC, Immediate  , 2, 0),
+  /* 0x2C */ OFFICIAL  (BIT, Absolute   , 4, 0),
+  /* 0x2D */ OFFICIAL  (AND, Absolute   , 4, 0),
+  /* 0x2E */ OFFICIAL  (ROL, Absolute   , 6, 0),
+  /* 0x2F */ UNOFFICIAL(RLA, Absolute   , 6, 0),
+
+  /* 0x30 */ OFFICIAL  (BMI, Relative   , 2, 0),
+  /* 0x31 */ OFFICIAL  (AND, IndirectY  , 5, 1),
+  /* 0x32 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x33 */ UNOFFICIAL(RLA, IndirectY  , 8, 0),
+  /* 0x34 */ UNOFFICIAL(NOP, ZeroPageX  , 4, 0),
+  /* 0x35 */ OFFICIAL  (AND, ZeroPageX  , 4, 0),
+  /* 0x36 */ OFFICIAL  (ROL, ZeroPageX  , 6, 0),
+  /* 0x37 */ UNOFFICIAL(RLA, ZeroPageX  , 6, 0),
+  /* 0x38 */ OFFICIAL  (SEC, Implied    , 2, 0),
+  /* 0x39 */ OFFICIAL  (AND, AbsoluteY  , 4, 1),
+  /* 0x3A */ UNOFFICIAL(NOP, Implied    , 2, 0),
+  /* 0x3B */ UNOFFICIAL(RLA, AbsoluteY  , 7, 0),
+  /* 0x3C */ UNOFFICIAL(NOP, AbsoluteX  , 4, 1),
+  /* 0x3D */ OFFICIAL  (AND, AbsoluteX  , 4, 1),
+  /* 0x3E */ OFFICIAL  (ROL, AbsoluteX  , 7, 0),
+  /* 0x3F */ UNOFFICIAL(RLA, AbsoluteX  , 7, 0),
+
+  /* 0x40 */ OFFICIAL  (RTI, Implied    , 6, 0),
+  /* 0x41 */ OFFICIAL  (EOR, IndirectX  , 6, 0),
+  /* 0x42 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x43 */ UNOFFICIAL(SRE, IndirectX  , 8, 0),
+  /* 0x44 */ UNOFFICIAL(NOP, ZeroPage   , 3, 0),
+  /* 0x45 */ OFFICIAL  (EOR, ZeroPage   , 3, 0),
+  /* 0x46 */ OFFICIAL  (LSR, ZeroPage   , 5, 0),
+  /* 0x47 */ UNOFFICIAL(SRE, ZeroPage   , 5, 0),
+  /* 0x48 */ OFFICIAL  (PHA, Implied    , 3, 0),
+  /* 0x49 */ OFFICIAL  (EOR, Immediate  , 2, 0),
+  /* 0x4A */ OFFICIAL  (LSR, Accumulator, 2, 0),
+  /* 0x4B */ UNOFFICIAL(ALR, Immediate  , 2, 0),
+  /* 0x4C */ OFFICIAL  (JMP, Absolute   , 3, 0),
+  /* 0x4D */ OFFICIAL  (EOR, Absolute   , 4, 0),
+  /* 0x4E */ OFFICIAL  (LSR, Absolute   , 6, 0),
+  /* 0x4F */ UNOFFICIAL(SRE, Absolute   , 6, 0),
+
+  /* 0x50 */ OFFICIAL  (BVC, Relative   , 2, 0),
+  /* 0x51 */ OFFICIAL  (EOR, IndirectY  , 5, 1),
+  /* 0x52 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x53 */ UNOFFICIAL(SRE, IndirectY  , 8, 0),
+  /* 0x54 */ UNOFFICIAL(NOP, ZeroPageX  , 4, 0),
+  /* 0x55 */ OFFICIAL  (EOR, ZeroPageX  , 4, 0),
+  /* 0x56 */ OFFICIAL  (LSR, ZeroPageX  , 6, 0),
+  /* 0x57 */ UNOFFICIAL(SRE, ZeroPageX  , 6, 0),
+  /* 0x58 */ OFFICIAL  (CLI, Implied    , 2, 0),
+  /* 0x59 */ OFFICIAL  (EOR, AbsoluteY  , 4, 1),
+  /* 0x5A */ UNOFFICIAL(NOP, Implied    , 2, 0),
+  /* 0x5B */ UNOFFICIAL(SRE, AbsoluteY  , 7, 0),
+  /* 0x5C */ UNOFFICIAL(NOP, AbsoluteX  , 4, 1),
+  /* 0x5D */ OFFICIAL  (EOR, AbsoluteX  , 4, 1),
+  /* 0x5E */ OFFICIAL  (LSR, AbsoluteX  , 7, 0),
+  /* 0x5F */ UNOFFICIAL(SRE, AbsoluteX  , 7, 0),
+
+  /* 0x60 */ OFFICIAL  (RTS, Implied    , 6, 0),
+  /* 0x61 */ OFFICIAL  (ADC, IndirectX  , 6, 0),
+  /* 0x62 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x63 */ UNOFFICIAL(RRA, IndirectX  , 8, 0),
+  /* 0x64 */ UNOFFICIAL(NOP, ZeroPage   , 3, 0),
+  /* 0x65 */ OFFICIAL  (ADC, ZeroPage   , 3, 0),
+  /* 0x66 */ OFFICIAL  (ROR, ZeroPage   , 5, 0),
+  /* 0x67 */ UNOFFICIAL(RRA, ZeroPage   , 5, 0),
+  /* 0x68 */ OFFICIAL  (PLA, Implied    , 4, 0),
+  /* 0x69 */ OFFICIAL  (ADC, Immediate  , 2, 0),
+  /* 0x6A */ OFFICIAL  (ROR, Accumulator, 2, 0),
+  /* 0x6B */ UNOFFICIAL(ARR, Immediate  , 2, 0),
+  /* 0x6C */ OFFICIAL  (JMP, Indirect   , 5, 0),
+  /* 0x6D */ OFFICIAL  (ADC, Absolute   , 4, 0),
+  /* 0x6E */ OFFICIAL  (ROR, Absolute   , 6, 0),
+  /* 0x6F */ UNOFFICIAL(RRA, Absolute   , 6, 0),
+
+  /* 0x70 */ OFFICIAL  (BVS, Relative   , 2, 0),
+  /* 0x71 */ OFFICIAL  (ADC, IndirectY  , 5, 1),
+  /* 0x72 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x73 */ UNOFFICIAL(RRA, IndirectY  , 8, 0),
+  /* 0x74 */ UNOFFICIAL(NOP, ZeroPageX  , 4, 0),
+  /* 0x75 */ OFFICIAL  (ADC, ZeroPageX  , 4, 0),
+  /* 0x76 */ OFFICIAL  (ROR, ZeroPageX  , 6, 0),
+  /* 0x77 */ UNOFFICIAL(RRA, ZeroPageX  , 6, 0),
+  /* 0x78 */ OFFICIAL  (SEI, Implied    , 2, 0),
+  /* 0x79 */ OFFICIAL  (ADC, AbsoluteY  , 4, 1),
+  /* 0x7A */ UNOFFICIAL(NOP, Implied    , 2, 0),
+  /* 0x7B */ UNOFFICIAL(RRA, AbsoluteY  , 7, 0),
+  /* 0x7C */ UNOFFICIAL(NOP, AbsoluteX  , 4, 1),
+  /* 0x7D */ OFFICIAL  (ADC, AbsoluteX  , 4, 1),
+  /* 0x7E */ OFFICIAL  (ROR, AbsoluteX  , 7, 0),
+  /* 0x7F */ UNOFFICIAL(RRA, AbsoluteX  , 7, 0),
+
+  /* 0x80 */ UNOFFICIAL(NOP, Immediate  , 2, 0),
+  /* 0x81 */ OFFICIAL  (STA, IndirectX  , 6, 0),
+  /* 0x82 */ UNOFFICIAL(NOP, Immediate  , 2, 0),
+  /* 0x83 */ UNOFFICIAL(SAX, IndirectX  , 6, 0),
+  /* 0x84 */ OFFICIAL  (STY, ZeroPage   , 3, 0),
+  /* 0x85 */ OFFICIAL  (STA, ZeroPage   , 3, 0),
+  /* 0x86 */ OFFICIAL  (STX, ZeroPage   , 3, 0),
+  /* 0x87 */ UNOFFICIAL(SAX, ZeroPage   , 3, 0),
+  /* 0x88 */ OFFICIAL  (DEY, Implied    , 2, 0),
+  /* 0x89 */ UNOFFICIAL(NOP, Immediate  , 2, 0),
+  /* 0x8A */ OFFICIAL  (TXA, Implied    , 2, 0),
+  /* 0x8B */ UNOFFICIAL(XAA, Immediate  , 2, 0),
+  /* 0x8C */ OFFICIAL  (STY, Absolute   , 4, 0),
+  /* 0x8D */ OFFICIAL  (STA, Absolute   , 4, 0),
+  /* 0x8E */ OFFICIAL  (STX, Absolute   , 4, 0),
+  /* 0x8F */ UNOFFICIAL(SAX, Absolute   , 4, 0),
+
+  /* 0x90 */ OFFICIAL  (BCC, Relative   , 2, 0),
+  /* 0x91 */ OFFICIAL  (STA, IndirectY  , 6, 0),
+  /* 0x92 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0x93 */ UNOFFICIAL(SHA, IndirectY  , 6, 0),
+  /* 0x94 */ OFFICIAL  (STY, ZeroPageX  , 4, 0),
+  /* 0x95 */ OFFICIAL  (STA, ZeroPageX  , 4, 0),
+  /* 0x96 */ OFFICIAL  (STX, ZeroPageY  , 4, 0),
+  /* 0x97 */ UNOFFICIAL(SAX, ZeroPageY  , 4, 0),
+  /* 0x98 */ OFFICIAL  (TYA, Implied    , 2, 0),
+  /* 0x99 */ OFFICIAL  (STA, AbsoluteY  , 5, 0),
+  /* 0x9A */ OFFICIAL  (TXS, Implied    , 2, 0),
+  /* 0x9B */ UNOFFICIAL(SHS, AbsoluteY  , 5, 0),
+  /* 0x9C */ UNOFFICIAL(SHY, AbsoluteX  , 5, 0),
+  /* 0x9D */ OFFICIAL  (STA, AbsoluteX  , 5, 0),
+  /* 0x9E */ UNOFFICIAL(SHX, AbsoluteY  , 5, 0),
+  /* 0x9F */ UNOFFICIAL(SHA, AbsoluteY  , 5, 0),
+
+  /* 0xA0 */ OFFICIAL  (LDY, Immediate  , 2, 0),
+  /* 0xA1 */ OFFICIAL  (LDA, IndirectX  , 6, 0),
+  /* 0xA2 */ OFFICIAL  (LDX, Immediate  , 2, 0),
+  /* 0xA3 */ UNOFFICIAL(LAX, IndirectX  , 6, 0),
+  /* 0xA4 */ OFFICIAL  (LDY, ZeroPage   , 3, 0),
+  /* 0xA5 */ OFFICIAL  (LDA, ZeroPage   , 3, 0),
+  /* 0xA6 */ OFFICIAL  (LDX, ZeroPage   , 3, 0),
+  /* 0xA7 */ UNOFFICIAL(LAX, ZeroPage   , 3, 0),
+  /* 0xA8 */ OFFICIAL  (TAY, Implied    , 2, 0),
+  /* 0xA9 */ OFFICIAL  (LDA, Immediate  , 2, 0),
+  /* 0xAA */ OFFICIAL  (TAX, Implied    , 2, 0),
+  /* 0xAB */ UNOFFICIAL(LXA, Immediate  , 2, 0),
+  /* 0xAC */ OFFICIAL  (LDY, Absolute   , 4, 0),
+  /* 0xAD */ OFFICIAL  (LDA, Absolute   , 4, 0),
+  /* 0xAE */ OFFICIAL  (LDX, Absolute   , 4, 0),
+  /* 0xAF */ UNOFFICIAL(LAX, Absolute   , 4, 0),
+
+  /* 0xB0 */ OFFICIAL  (BCS, Relative   , 2, 0),
+  /* 0xB1 */ OFFICIAL  (LDA, IndirectY  , 5, 1),
+  /* 0xB2 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0xB3 */ UNOFFICIAL(LAX, IndirectY  , 5, 1),
+  /* 0xB4 */ OFFICIAL  (LDY, ZeroPageX  , 4, 0),
+  /* 0xB5 */ OFFICIAL  (LDA, ZeroPageX  , 4, 0),
+  /* 0xB6 */ OFFICIAL  (LDX, ZeroPageY  , 4, 0),
+  /* 0xB7 */ UNOFFICIAL(LAX, ZeroPageY  , 4, 0),
+  /* 0xB8 */ OFFICIAL  (CLV, Implied    , 2, 0),
+  /* 0xB9 */ OFFICIAL  (LDA, AbsoluteY  , 4, 1),
+  /* 0xBA */ OFFICIAL  (TSX, Implied    , 2, 0),
+  /* 0xBB */ UNOFFICIAL(LAS, AbsoluteY  , 4, 1),
+  /* 0xBC */ OFFICIAL  (LDY, AbsoluteX  , 4, 1),
+  /* 0xBD */ OFFICIAL  (LDA, AbsoluteX  , 4, 1),
+  /* 0xBE */ OFFICIAL  (LDX, AbsoluteY  , 4, 1),
+  /* 0xBF */ UNOFFICIAL(LAX, AbsoluteY  , 4, 1),
+
+  /* 0xC0 */ OFFICIAL  (CPY, Immediate  , 2, 0),
+  /* 0xC1 */ OFFICIAL  (CMP, IndirectX  , 6, 0),
+  /* 0xC2 */ UNOFFICIAL(NOP, Immediate  , 2, 0),
+  /* 0xC3 */ UNOFFICIAL(DCP, IndirectX  , 8, 0),
+  /* 0xC4 */ OFFICIAL  (CPY, ZeroPage   , 3, 0),
+  /* 0xC5 */ OFFICIAL  (CMP, ZeroPage   , 3, 0),
+  /* 0xC6 */ OFFICIAL  (DEC, ZeroPage   , 5, 0),
+  /* 0xC7 */ UNOFFICIAL(DCP, ZeroPage   , 5, 0),
+  /* 0xC8 */ OFFICIAL  (INY, Implied    , 2, 0),
+  /* 0xC9 */ OFFICIAL  (CMP, Immediate  , 2, 0),
+  /* 0xCA */ OFFICIAL  (DEX, Implied    , 2, 0),
+  /* 0xCB */ UNOFFICIAL(AXS, Immediate  , 2, 0),
+  /* 0xCC */ OFFICIAL  (CPY, Absolute   , 4, 0),
+  /* 0xCD */ OFFICIAL  (CMP, Absolute   , 4, 0),
+  /* 0xCE */ OFFICIAL  (DEC, Absolute   , 6, 0),
+  /* 0xCF */ UNOFFICIAL(DCP, Absolute   , 6, 0),
+
+  /* 0xD0 */ OFFICIAL  (BNE, Relative   , 2, 0),
+  /* 0xD1 */ OFFICIAL  (CMP, IndirectY  , 5, 1),
+  /* 0xD2 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0xD3 */ UNOFFICIAL(DCP, IndirectY  , 8, 0),
+  /* 0xD4 */ UNOFFICIAL(NOP, ZeroPageX  , 4, 0),
+  /* 0xD5 */ OFFICIAL  (CMP, ZeroPageX  , 4, 0),
+  /* 0xD6 */ OFFICIAL  (DEC, ZeroPageX  , 6, 0),
+  /* 0xD7 */ UNOFFICIAL(DCP, ZeroPageX  , 6, 0),
+  /* 0xD8 */ OFFICIAL  (CLD, Implied    , 2, 0),
+  /* 0xD9 */ OFFICIAL  (CMP, AbsoluteY  , 4, 1),
+  /* 0xDA */ UNOFFICIAL(NOP, Implied    , 2, 0),
+  /* 0xDB */ UNOFFICIAL(DCP, AbsoluteY  , 7, 0),
+  /* 0xDC */ UNOFFICIAL(NOP, AbsoluteX  , 4, 1),
+  /* 0xDD */ OFFICIAL  (CMP, AbsoluteX  , 4, 1),
+  /* 0xDE */ OFFICIAL  (DEC, AbsoluteX  , 7, 0),
+  /* 0xDF */ UNOFFICIAL(DCP, AbsoluteX  , 7, 0),
+
+  /* 0xE0 */ OFFICIAL  (CPX, Immediate  , 2, 0),
+  /* 0xE1 */ OFFICIAL  (SBC, IndirectX  , 6, 0),
+  /* 0xE2 */ UNOFFICIAL(NOP, Immediate  , 2, 0),
+  /* 0xE3 */ UNOFFICIAL(ISC, IndirectX  , 8, 0),
+  /* 0xE4 */ OFFICIAL  (CPX, ZeroPage   , 3, 0),
+  /* 0xE5 */ OFFICIAL  (SBC, ZeroPage   , 3, 0),
+  /* 0xE6 */ OFFICIAL  (INC, ZeroPage   , 5, 0),
+  /* 0xE7 */ UNOFFICIAL(ISC, ZeroPage   , 5, 0),
+  /* 0xE8 */ OFFICIAL  (INX, Implied    , 2, 0),
+  /* 0xE9 */ OFFICIAL  (SBC, Immediate  , 2, 0),
+  /* 0xEA */ OFFICIAL  (NOP, Implied    , 2, 0),
+  /* 0xEB */ UNOFFICIAL(SBC, Immediate  , 2, 0),
+  /* 0xEC */ OFFICIAL  (CPX, Absolute   , 4, 0),
+  /* 0xED */ OFFICIAL  (SBC, Absolute   , 4, 0),
+  /* 0xEE */ OFFICIAL  (INC, Absolute   , 6, 0),
+  /* 0xEF */ UNOFFICIAL(ISC, Absolute   , 6, 0),
+
+  /* 0xF0 */ OFFICIAL  (BEQ, Relative   , 2, 0),
+  /* 0xF1 */ OFFICIAL  (SBC, IndirectY  , 5, 1),
+  /* 0xF2 */ UNOFFICIAL(JAM, Implied    , 2, 0),
+  /* 0xF3 */ UNOFFICIAL(ISC, IndirectY  , 8, 0),
+  /* 0xF4 */ UNOFFICIAL(NOP, ZeroPageX  , 4, 0),
+  /* 0xF5 */ OFFICIAL  (SBC, ZeroPageX  , 4, 0),
+  /* 0xF6 */ OFFICIAL  (INC, ZeroPageX  , 6, 0),
+  /* 0xF7 */ UNOFFICIAL(ISC, ZeroPageX  , 6, 0),
+  /* 0xF8 */ OFFICIAL  (SED, Implied    , 2, 0),
+  /* 0xF9 */ OFFICIAL  (SBC, AbsoluteY  , 4, 1),
+  /* 0xFA */ UNOFFICIAL(NOP, Implied    , 2, 0),
+  /* 0xFB */ UNOFFICIAL(ISC, AbsoluteY  , 7, 0),
+  /* 0xFC */ UNOFFICIAL(NOP, AbsoluteX  , 4, 1),
+  /* 0xFD */ OFFICIAL  (SBC, AbsoluteX  , 4, 1),
+  /* 0xFE */ OFFICIAL  (INC, AbsoluteX  , 7, 0),
+  /* 0xFF */ UNOFFICIAL(ISC, AbsoluteX  , 7, 0)
+}};
+
+#undef OFFICIAL
+#undef UNOFFICIAL
+
+/* Expands OPCODE(code) for each of the 256 opcodes in order, for the dispatch switches. Everything
+   else about an opcode comes from opcodeInfo, every opcode is listed so dispatch never needs a
+   range check. */
+#define CPU_OPCODE_ROW(OPCODE, row) \
+  OPCODE(0x##row##0) OPCODE(0x##row##1) OPCODE(0x##row##2) OPCODE(0x##row##3) OPCODE(0x##row##4) OPCODE(0x##row##5) OPCODE(0x##row##6) OPCODE(0x##row##7) \
+  OPCODE(0x##row##8) OPCODE(0x##row##9) OPCODE(0x##row##A) OPCODE(0x##row##B) OPCODE(0x##row##C) OPCODE(0x##row##D) OPCODE(0x##row##E) OPCODE(0x##row##F)
+
+#define CPU_OPCODES(OPCODE) \
+  CPU_OPCODE_ROW(OPCODE, 0) CPU_OPCODE_ROW(OPCODE, 1) \
+  CPU_OPCODE_ROW(OPCODE, 2) CPU_OPCODE_ROW(OPCODE, 3) \
+  CPU_OPCODE_ROW(OPCODE, 4) CPU_OPCODE_ROW(OPCODE, 5) \
+  CPU_OPCODE_ROW(OPCODE, 6) CPU_OPCODE_ROW(OPCODE, 7) \
+  CPU_OPCODE_ROW(OPCODE, 8) CPU_OPCODE_ROW(OPCODE, 9) \
+  CPU_OPCODE_ROW(OPCODE, A) CPU_OPCODE_ROW(OPCODE, B) \
+  CPU_OPCODE_ROW(OPCODE, C) CPU_OPCODE_ROW(OPCODE, D) \
+  CPU_OPCODE_ROW(OPCODE, E) CPU_OPCODE_ROW(OPCODE, F)
+
+#endif //__OPCODES_H__
@@ -0,0 +1,211 @@
+#ifndef __PAGES_H__
+#define __PAGES_H__
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include "types.hpp"
+
+/* Memory in reference counted pages, shared between forked machines. Share takes a reference
+   on every page instead of copying it, and a write to a page someone else holds copies it
+   first, so a fork pays for the pages it writes. New memory points every page at one zero
+   page the same way. The bytes of a shared page never change, references are atomic so the
+   holders can run on other threads.
+
+   Pointers to a page change when it's copied: users write through GetOwnPage and map the
+   page again. */
+template<u32 PageSize, u32 PageCount>
+class PagedMemory {
+public:
+  static const u32 pageSize  = PageSize;
+  static const u32 pageCount = PageCount;
+  static const u32 size      = PageSize * PageCount;
+
+  PagedMemory();
+  ~PagedMemory();
+
+  PagedMemory(const PagedMemory &) = delete;
+  PagedMemory &operator=(const PagedMemory &) = delete;
+
+  void Copy                  (const PagedMemory &other); // The same bytes in pages of its own
+  void Share                 (const PagedMemory &other); // The same pages
+  void Clear                 ();                         // Zeroed
+
+  FORCEINLINE const u8 *GetPage   (u32 page) const;
+  FORCEINLINE bool      IsShared  (u32 page) const;
+  FORCEINLINE u8       *GetOwnPage(u32 page);            // Copies the page first when it's shared
+
+  void Read                  (u32 offset, u8 *bytes, u32 count) const;
+  void Write                 (u32 offset, const u8 *bytes, u32 count); // Pages it leaves equal stay shared
+
+private:
+  struct Page {
+    std::atomic<u32> references;
+    u8               bytes[PageSize];
+  };
+
+  Page *pages[PageCount];
+
+  static Page *Zero          (); // Never freed, it keeps a reference of its own
+  static void  Release       (Page *page);
+  void         Assign        (u32 index, Page *page);
+};
+
+template<u32 PageSize, u32 PageCount>
+PagedMemory<PageSize, PageCount>::PagedMemory()
+{
+  Page *zero = Zero();
+
+  zero->references.fetch_add(PageCount, std::memory_order_relaxed);
+
+  for (u32 index = 0; index < PageCount; ++index)
+    pages[index] = zero;
+}
+
+template<u32 PageSize, u32 PageCount>
+PagedMemory<PageSize, PageCount>::~PagedMemory()
+{
+  for (u32 index = 0; index < PageCount; ++index)
+    Release(pages[index]);
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Copy(const PagedMemory &other)
+{
+  for (u32 index = 0; index < PageCount; ++index)
+  {
+    Page *page = other.pages[index];
+
+    // Zero pages are shared by everyone anyway, and never written in place
+    if (page == Zero())
+      Assign(index, page);
+    else if (pages[index] != page && !IsShared(index))
+      memcpy(pages[index]->bytes, page->bytes, PageSize);
+    else
+    {
+      Page *copy = new Page;
+
+      copy->references.store(1, std::memory_order_relaxed);
+      memcpy(copy->bytes, page->bytes, PageSize);
+
+      Release(pages[index]);
+      pages[index] = copy;
+    }
+  }
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Share(const PagedMemory &other)
+{
+  for (u32 index = 0; index < PageCount; ++index)
+    Assign(index, other.pages[index]);
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Clear()
+{
+  for (u32 index = 0; index < PageCount; ++index)
+    Assign(index, Zero());
+}
+
+template<u32 PageSize, u32 PageCount>
+FORCEINLINE const u8 *PagedMemory<PageSize, PageCount>::GetPage(u32 page) const
+{
+  return pages[page]->bytes;
+}
+
+// Acquire pairs with the release of the last other holder: its reads are done before the page is written
+template<u32 PageSize, u32 PageCount>
+FORCEINLINE bool PagedMemory<PageSize, PageCount>::IsShared(u32 page) const
+{
+  return pages[page]->references.load(std::memory_order_acquire) != 1;
+}
+
+template<u32 PageSize, u32 PageCount>
+FORCEINLINE u8 *PagedMemory<PageSize, PageCount>::GetOwnPage(u32 page)
+{
+  if (IsShared(page))
+  {
+    Page *copy = new Page;
+
+    copy->references.store(1, std::memory_order_relaxed);
+    memcpy(copy->bytes, pages[page]->bytes, PageSize);
+
+    Release(pages[page]);
+    pages[page] = copy;
+  }
+
+  return pages[page]->bytes;
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Read(u32 offset, u8 *bytes, u32 count) const
+{
+  while (count > 0)
+  {
+    u32 index = offset / PageSize;
+    u32 start = offset % PageSize;
+    u32 chunk = PageSize - start < count ? PageSize - start : count;
+
+    memcpy(bytes, pages[index]->bytes + start, chunk);
+
+    offset += chunk;
+    bytes  += chunk;
+    count  -= chunk;
+  }
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Write(u32 offset, const u8 *bytes, u32 count)
+{
+  while (count > 0)
+  {
+    u32 index = offset / PageSize;
+    u32 start = offset % PageSize;
+    u32 chunk = PageSize - start < count ? PageSize - start : count;
+
+    if (memcmp(pages[index]->bytes + start, bytes, chunk) != 0)
+      memcpy(GetOwnPage(index) + start, bytes, chunk);
+
+    offset += chunk;
+    bytes  += chunk;
+    count  -= chunk;
+  }
+}
+
+template<u32 PageSize, u32 PageCount>
+typename PagedMemory<PageSize, PageCount>::Page *PagedMemory<PageSize, PageCount>::Zero()
+{
+  static Page *zero = [] {
+    Page *page = new Page;
+
+    page->references.store(1, std::memory_order_relaxed);
+    memset(page->bytes, 0, PageSize);
+
+    return page;
+  }();
+
+  return zero;
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Release(Page *page)
+{
+  if (page->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete page;
+}
+
+template<u32 PageSize, u32 PageCount>
+void PagedMemory<PageSize, PageCount>::Assign(u32 index, Page *page)
+{
+  if (pages[index] == page)
+    return;
+
+  page->references.fetch_add(1, std::memory_order_relaxed);
+
+  Release(pages[index]);
+  pages[index] = page;
+}
+
+#endif //__PAGES_H__
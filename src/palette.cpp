@@ -0,0 +1,353 @@
+#include "palette.hpp"
+#include <cstdio>
+#include <vector>
+
+#if defined(NESEMU_PALETTE_X64)
+#include <immintrin.h>
+#elif defined(NESEMU_PALETTE_NEON)
+#include <arm_neon.h>
+#endif
+
+// AVX2 is compiled for its own functions and picked at run time, the way the tile decoders do it
+#if defined(NESEMU_PALETTE_X64) && (defined(__GNUC__) || defined(__clang__))
+#define NESEMU_PALETTE_AVX2
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#elif defined(NESEMU_PALETTE_X64) && defined(__AVX2__)
+#define NESEMU_PALETTE_AVX2
+#define AVX2_FUNCTION
+#endif
+
+namespace
+{
+  // 2C02 colors, the rows are the luma levels and $xD-$xF are black
+  const u8 ntscColors[64 * 3] = {
+     84,  84,  84,    0,  30, 116,    8,  16, 144,   48,   0, 136,   68,   0, 100,   92,   0,  48,   84,   4,   0,   60,  24,   0,
+     32,  42,   0,    8,  58,   0,    0,  64,   0,    0,  60,   0,    0,  50,  60,    0,   0,   0,    0,   0,   0,    0,   0,   0,
+    152, 150, 152,    8,  76, 196,   48,  50, 236,   92,  30, 228,  136,  20, 176,  160,  20, 100,  152,  34,  32,  120,  60,   0,
+     84,  90,   0,   40, 114,   0,    8, 124,   0,    0, 118,  40,    0, 102, 120,    0,   0,   0,    0,   0,   0,    0,   0,   0,
+    236, 238, 236,   76, 154, 236,  120, 124, 236,  176,  98, 236,  228,  84, 236,  236,  88, 180,  236, 106, 100,  212, 136,  32,
+    160, 170,   0,  116, 196,   0,   76, 208,  32,   56, 204, 108,   56, 180, 204,   60,  60,  60,    0,   0,   0,    0,   0,   0,
+    236, 238, 236,  168, 204, 236,  188, 188, 236,  212, 178, 236,  236, 174, 236,  236, 174, 212,  236, 180, 176,  228, 196, 144,
+    204, 210, 120,  180, 222, 120,  168, 226, 144,  152, 226, 180,  160, 214, 228,  160, 162, 160,    0,   0,   0,    0,   0,   0
+  };
+
+  // Each emphasis bit dims the two channels it doesn't name
+  const float emphasisDim = 0.816f;
+
+  template<typename Color>
+  void ConvertScalar(const Color *table, const u16 *pixels, u32 count, Color *out)
+  {
+    for (u32 i = 0; i < count; ++i)
+      out[i] = table[pixels[i] & (Palette::colorCount - 1)];
+  }
+
+#ifdef NESEMU_PALETTE_AVX2
+  FORCEINLINE AVX2_FUNCTION __m256i LoadIndices(const u16 *pixels)
+  {
+    __m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)pixels));
+
+    return _mm256_and_si256(index, _mm256_set1_epi32(Palette::colorCount - 1));
+  }
+
+  AVX2_FUNCTION void ConvertAvx2(const u32 *table, const u16 *pixels, u32 count, u32 *out)
+  {
+    u32 i = 0;
+
+    for (; i + 8 <= count; i += 8)
+      _mm256_storeu_si256((__m256i *)(out + i), _mm256_i32gather_epi32((const int *)table, LoadIndices(pixels + i), 4));
+
+    ConvertScalar(table, pixels + i, count - i, out + i);
+  }
+
+  // 16 bit entries are gathered as 32 bits, table has one entry of padding for the last one,
+  // and packed back. The pack works per 128 bit lane, the permute puts the halves back in order.
+  AVX2_FUNCTION void ConvertAvx2(const u16 *table, const u16 *pixels, u32 count, u16 *out)
+  {
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+
+    u32 i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+      __m256i first  = _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, LoadIndices(pixels + i    ), 2), low);
+      __m256i second = _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, LoadIndices(pixels + i + 8), 2), low);
+
+      _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi32(first, second), 0xD8));
+    }
+
+    ConvertScalar(table, pixels + i, count - i, out + i);
+  }
+#endif
+
+#ifdef NESEMU_PALETTE_NEON
+  // Emphasis of 16 pixels when they all share it, -1 otherwise. Games rarely change PPUMASK
+  // mid frame, so almost every run takes the table lookup.
+  FORCEINLINE s32 CommonEmphasis(uint16x8_t first, uint16x8_t second)
+  {
+    uint16x8_t firstEmphasis  = vshrq_n_u16(first , 6);
+    uint16x8_t secondEmphasis = vshrq_n_u16(second, 6);
+    u16        max            = vmaxvq_u16(vmaxq_u16(firstEmphasis, secondEmphasis));
+    u16        min            = vminvq_u16(vminq_u16(firstEmphasis, secondEmphasis));
+
+    return max == min && max < 8 ? max : -1;
+  }
+
+  FORCEINLINE uint8x16_t ColorIndices(uint16x8_t first, uint16x8_t second)
+  {
+    return vandq_u8(vcombine_u8(vmovn_u16(first), vmovn_u16(second)), vdupq_n_u8(0x3F));
+  }
+
+  // planes hold the R, G, B and A tables of each emphasis, vst4 interleaves them into pixels
+  void ConvertNeon(const u8 (*planes)[6][64], const u32 *table, const u16 *pixels, u32 count, u32 *out)
+  {
+    u32 i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+      uint16x8_t first    = vld1q_u16(pixels + i);
+      uint16x8_t second   = vld1q_u16(pixels + i + 8);
+      s32        emphasis = CommonEmphasis(first, second);
+
+      if (emphasis < 0)
+      {
+        ConvertScalar(table, pixels + i, 16, out + i);
+        continue;
+      }
+
+      uint8x16_t   index = ColorIndices(first, second);
+      uint8x16x4_t rgba;
+
+      for (u32 channel = 0; channel < 4; ++channel)
+        rgba.val[channel] = vqtbl4q_u8(vld1q_u8_x4(planes[emphasis][channel]), index);
+
+      vst4q_u8((u8 *)(out + i), rgba);
+    }
+
+    ConvertScalar(table, pixels + i, count - i, out + i);
+  }
+
+  void ConvertNeon(const u8 (*planes)[6][64], const u16 *table, const u16 *pixels, u32 count, u16 *out)
+  {
+    u32 i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+      uint16x8_t first    = vld1q_u16(pixels + i);
+      uint16x8_t second   = vld1q_u16(pixels + i + 8);
+      s32        emphasis = CommonEmphasis(first, second);
+
+      if (emphasis < 0)
+      {
+        ConvertScalar(table, pixels + i, 16, out + i);
+        continue;
+      }
+
+      uint8x16_t   index = ColorIndices(first, second);
+      uint8x16x2_t bytes;
+
+      bytes.val[0] = vqtbl4q_u8(vld1q_u8_x4(planes[emphasis][4]), index);
+      bytes.val[1] = vqtbl4q_u8(vld1q_u8_x4(planes[emphasis][5]), index);
+
+      vst2q_u8((u8 *)(out + i), bytes);
+    }
+
+    ConvertScalar(table, pixels + i, count - i, out + i);
+  }
+#endif
+}
+
+Palette::Palette()
+{
+  SetColors(ntscColors, 64);
+}
+
+bool Palette::Load(const std::string &palFile)
+{
+  FILE *file = fopen(palFile.c_str(), "rb");
+
+  if (!file)
+  {
+    error = "can't open " + palFile;
+    return false;
+  }
+
+  std::vector<u8> rgb(colorCount * 3 + 1);
+
+  size_t size = fread(rgb.data(), 1, rgb.size(), file);
+
+  fclose(file);
+
+  if (size != 64 * 3 && size != colorCount * 3)
+  {
+    error = palFile + " isn't 64 or 512 RGB colors";
+    return false;
+  }
+
+  SetColors(rgb.data(), (u32)size / 3);
+  error.clear();
+
+  return true;
+}
+
+const std::string &Palette::GetError() const
+{
+  return error;
+}
+
+void Palette::SetColors(const u8 *rgb, u32 count)
+{
+  for (u32 pixel = 0; pixel < colorCount; ++pixel)
+  {
+    u32 emphasis = pixel >> 6;
+    u8  color[3];
+
+    for (u32 channel = 0; channel < 3; ++channel)
+    {
+      if (count == colorCount)
+      {
+        color[channel] = rgb[pixel * 3 + channel];
+        continue;
+      }
+
+      float value = rgb[(pixel & 0x3F) * 3 + channel];
+
+      for (u32 bit = 0; bit < 3; ++bit)
+      {
+        if ((emphasis & (1 << bit)) && bit != channel)
+          value *= emphasisDim;
+      }
+
+      color[channel] = (u8)(value + 0.5f);
+    }
+
+    rgba  [pixel] = color[0] | (color[1] << 8) | (color[2] << 16) | 0xFF000000u;
+    rgb565[pixel] = ((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3);
+
+    u8 *entry = &planes[emphasis][0][pixel & 0x3F];
+
+    entry[0 * 64] = color[0];
+    entry[1 * 64] = color[1];
+    entry[2 * 64] = color[2];
+    entry[3 * 64] = 0xFF;
+    entry[4 * 64] = rgb565[pixel] & 0xFF;
+    entry[5 * 64] = rgb565[pixel] >> 8;
+  }
+
+  rgb565[colorCount] = 0;
+}
+
+u32 Palette::GetRgba(u16 pixel) const
+{
+  return rgba[pixel & (colorCount - 1)];
+}
+
+u16 Palette::GetRgb565(u16 pixel) const
+{
+  return rgb565[pixel & (colorCount - 1)];
+}
+
+void Palette::Convert(const u16 *pixels, u32 count, u32 *out) const
+{
+  Convert(GetKernel(), pixels, count, out);
+}
+
+void Palette::Convert(const u16 *pixels, u32 count, u16 *out) const
+{
+  Convert(GetKernel(), pixels, count, out);
+}
+
+Palette::Kernel Palette::GetKernel()
+{
+  static const Kernel kernel = IsSupported(Kernel::Avx2) ? Kernel::Avx2 :
+                               IsSupported(Kernel::Neon) ? Kernel::Neon : Kernel::Scalar;
+
+  return kernel;
+}
+
+bool Palette::IsSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return true;
+
+#ifdef NESEMU_PALETTE_AVX2
+    case Kernel::Avx2:
+#if defined(__GNUC__) || defined(__clang__)
+      return __builtin_cpu_supports("avx2");
+#else
+      return true;
+#endif
+#endif
+
+#ifdef NESEMU_PALETTE_NEON
+    case Kernel::Neon: // Part of AArch64
+      return true;
+#endif
+
+    default:
+      return false;
+  }
+}
+
+const char *Palette::GetKernelName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar: return "scalar";
+    case Kernel::Avx2:   return "avx2";
+    case Kernel::Neon:   return "neon";
+  }
+
+  return "unknown";
+}
+
+void Palette::Convert(Kernel kernel, const u16 *pixels, u32 count, u32 *out) const
+{
+  if (!IsSupported(kernel))
+    kernel = Kernel::Scalar;
+
+  switch (kernel)
+  {
+#ifdef NESEMU_PALETTE_AVX2
+    case Kernel::Avx2:
+      ConvertAvx2(rgba, pixels, count, out);
+      return;
+#endif
+
+#ifdef NESEMU_PALETTE_NEON
+    case Kernel::Neon:
+      ConvertNeon(planes, rgba, pixels, count, out);
+      return;
+#endif
+
+    default:
+      ConvertScalar(rgba, pixels, count, out);
+      return;
+  }
+}
+
+void Palette::Convert(Kernel kernel, const u16 *pixels, u32 count, u16 *out) const
+{
+  if (!IsSupported(kernel))
+    kernel = Kernel::Scalar;
+
+  switch (kernel)
+  {
+#ifdef NESEMU_PALETTE_AVX2
+    case Kernel::Avx2:
+      ConvertAvx2(rgb565, pixels, count, out);
+      return;
+#endif
+
+#ifdef NESEMU_PALETTE_NEON
+    case Kernel::Neon:
+      ConvertNeon(planes, rgb565, pixels, count, out);
+      return;
+#endif
+
+    default:
+      ConvertScalar(rgb565, pixels, count, out);
+      return;
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+#pragma once
+
+#include <string>
+#include "types.hpp"
+
+// SIMD converters for the host, the scalar one is always there
+#if defined(__x86_64__) || defined(_M_X64)
+#define NESEMU_PALETTE_X64
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NESEMU_PALETTE_NEON
+#endif
+
+/* Output colors of the PPU. Ppu::GetFrame pixels are a palette index in bits 0-5 and the PPUMASK
+   emphasis bits (red, green, blue) in bits 6-8, so every pixel value is an entry of a 512 color
+   table. The table is built once from a palette, in both output formats, and converting a frame
+   is a table lookup per pixel that the SIMD kernels do 8 or 16 pixels at a time.
+
+   .pal files are raw RGB triplets: 64 colors, the emphasis variants are then computed, or all 512. */
+class Palette {
+public:
+  static const u32 colorCount = 512;
+
+  enum class Kernel : u8 {
+    Scalar,
+    Avx2, // 8 pixels per gather
+    Neon  // 16 pixels per table lookup, runs of pixels with the same emphasis
+  };
+
+  Palette(); // The 2C02 colors
+
+  // Returns false and sets GetError() when palFile can't be read or isn't 64 or 512 colors
+  bool Load(const std::string &palFile);
+
+  const std::string &GetError() const;
+
+  // RGBA is R, G, B and A = 0xFF in memory order. RGB565 is red in the top bits.
+  u32 GetRgba  (u16 pixel) const;
+  u16 GetRgb565(u16 pixel) const;
+
+  // Converts count pixels, with GetKernel
+  void Convert(const u16 *pixels, u32 count, u32 *rgba  ) const;
+  void Convert(const u16 *pixels, u32 count, u16 *rgb565) const;
+
+  static Kernel      GetKernel    (); // Fastest one the host runs, picked on first use
+  static bool        IsSupported  (Kernel kernel);
+  static const char *GetKernelName(Kernel kernel);
+
+  // Kernels the host doesn't run fall back to the scalar one
+  void Convert(Kernel kernel, const u16 *pixels, u32 count, u32 *rgba  ) const;
+  void Convert(Kernel kernel, const u16 *pixels, u32 count, u16 *rgb565) const;
+
+private:
+  u32 rgba  [colorCount];
+  u16 rgb565[colorCount + 1]; // The AVX2 gather reads 32 bits from the last entry
+
+  // The same tables split by emphasis and byte for the NEON lookups: R, G, B, A and the
+  // low and high bytes of RGB565, 64 entries each
+  u8 planes[8][6][64];
+
+  std::string error;
+
+  void SetColors(const u8 *rgb, u32 count); // 64 or 512 RGB triplets
+};
+
+#endif //__PALETTE_H__
@@ -0,0 +1,934 @@
+#include "ppu.hpp"
+#include <cstring>
+
+#ifdef NESEMU_PPU_DOT
+const Ppu::Renderer Ppu::defaultRenderer = Renderer::Dot;
+#else
+const Ppu::Renderer Ppu::defaultRenderer = Renderer::Scanline;
+#endif
+
+Ppu::Ppu()
+{
+  memset(palette, 0, sizeof(palette));
+  memset(oam    , 0, sizeof(oam    ));
+  memset(sprites, 0, sizeof(sprites));
+
+  scanlineHandler = nullptr;
+  scanlineContext = nullptr;
+
+  MapDefaultBanks();
+  MapMemory();
+  Reset();
+}
+
+Ppu::Ppu(const Ppu &other)
+{
+  scanlineHandler = nullptr;
+  scanlineContext = nullptr;
+
+  *this = other;
+}
+
+// The pages point into the memory of their own Ppu, a copy maps its own
+Ppu &Ppu::operator=(const Ppu &other)
+{
+  vram  .Copy(other.vram  );
+  chrRam.Copy(other.chrRam);
+
+  CopyState(other);
+  MapMemory();
+
+  return *this;
+}
+
+// other maps its pages again, they're shared now
+void Ppu::Share(Ppu &other)
+{
+  vram  .Share(other.vram  );
+  chrRam.Share(other.chrRam);
+
+  CopyState(other);
+  MapMemory();
+
+  other.MapPages();
+}
+
+void Ppu::CopyState(const Ppu &other)
+{
+  memcpy(palette, other.palette, sizeof(palette));
+  memcpy(oam    , other.oam    , sizeof(oam    ));
+  memcpy(sprites, other.sprites, sizeof(sprites));
+  memcpy(chrBanks      , other.chrBanks      , sizeof(chrBanks      ));
+  memcpy(nametableBanks, other.nametableBanks, sizeof(nametableBanks));
+
+  rom           = other.rom;
+  ctrl          = other.ctrl;
+  mask          = other.mask;
+  status        = other.status;
+  oamAddress    = other.oamAddress;
+  readBuffer    = other.readBuffer;
+  latch         = other.latch;
+  v             = other.v;
+  t             = other.t;
+  x             = other.x;
+  w             = other.w;
+  scanline      = other.scanline;
+  dot           = other.dot;
+  oddFrame      = other.oddFrame;
+  frameCount    = other.frameCount;
+  patternLow    = other.patternLow;
+  patternHigh   = other.patternHigh;
+  attributeLow  = other.attributeLow;
+  attributeHigh = other.attributeHigh;
+  nextTile      = other.nextTile;
+  nextAttribute = other.nextAttribute;
+  nextLow       = other.nextLow;
+  nextHigh      = other.nextHigh;
+}
+
+FORCEINLINE void Ppu::MapChrPage(u32 page)
+{
+  const u8 *chr  = rom ? rom->GetChrRom() : nullptr;
+  u32       bank = chrBanks[page] / chrRam.pageSize % chrRam.pageCount;
+
+  chrPages     [page] = chr ? chr + chrBanks[page] : chrRam.GetPage(bank);
+  chrWritePages[page] = chr || chrRam.IsShared(bank) ? nullptr : chrRam.GetOwnPage(bank);
+}
+
+void Ppu::MapMemory()
+{
+  MapPages();
+
+  tiles.InvalidateAll();
+}
+
+void Ppu::MapPages()
+{
+  for (u32 page = 0; page < 8; ++page)
+    MapChrPage(page);
+
+  for (u32 page = 0; page < 4; ++page)
+    MapNametable(page, nametableBanks[page]);
+}
+
+// Without a mapper the first 8KB of CHR are the pattern tables
+void Ppu::MapDefaultBanks()
+{
+  // Nametable pages in vram for each mirroring, in Rom::Mirroring order
+  static const u8 layouts[3][4] = {
+    { 0, 0, 1, 1 }, // Horizontal
+    { 0, 1, 0, 1 }, // Vertical
+    { 0, 1, 2, 3 }  // Four screen
+  };
+
+  u32            chrSize   = rom && rom->GetChrRom() ? rom->GetChrRomSize() : chrRam.size;
+  Rom::Mirroring mirroring = rom ? rom->GetMirroring() : Rom::Mirroring::Horizontal;
+
+  for (u32 page = 0; page < 8; ++page)
+    chrBanks[page] = page * 0x400 % chrSize;
+
+  for (u32 page = 0; page < 4; ++page)
+    nametableBanks[page] = layouts[(u32)mirroring][page];
+}
+
+void Ppu::LoadRom(const std::shared_ptr<const Rom> &newRom)
+{
+  rom = newRom;
+
+  vram  .Clear();
+  chrRam.Clear();
+  memset(palette, 0, sizeof(palette));
+  memset(oam    , 0, sizeof(oam    ));
+
+  MapDefaultBanks();
+  MapMemory();
+  Reset();
+}
+
+// Only a page that moves loses its decoded tiles, games switching every frame to the
+// same banks keep them
+void Ppu::MapChr(u32 page, u32 offset)
+{
+  if (chrBanks[page] == offset)
+    return;
+
+  chrBanks[page] = offset;
+
+  MapChrPage(page);
+  tiles.InvalidatePage(page);
+}
+
+void Ppu::MapNametable(u32 page, u32 bank)
+{
+  nametableBanks     [page] = (u8)bank;
+  nametablePages     [page] = vram.GetPage(bank);
+  nametableWritePages[page] = vram.IsShared(bank) ? nullptr : vram.GetOwnPage(bank);
+}
+
+void Ppu::SetScanlineHandler(ScanlineHandler handler, void *context)
+{
+  scanlineHandler = handler;
+  scanlineContext = context;
+}
+
+void Ppu::Save(Snapshot &snapshot) const
+{
+  vram  .Read(0, snapshot.vram  , sizeof(snapshot.vram  ));
+  chrRam.Read(0, snapshot.chrRam, sizeof(snapshot.chrRam));
+
+  memcpy(snapshot.palette       , palette       , sizeof(palette       ));
+  memcpy(snapshot.oam           , oam           , sizeof(oam           ));
+  memcpy(snapshot.sprites       , sprites       , sizeof(sprites       ));
+  memcpy(snapshot.chrBanks      , chrBanks      , sizeof(chrBanks      ));
+  memcpy(snapshot.nametableBanks, nametableBanks, sizeof(nametableBanks));
+
+  snapshot.frameCount    = frameCount;
+  snapshot.v             = v;
+  snapshot.t             = t;
+  snapshot.scanline      = scanline;
+  snapshot.dot           = dot;
+  snapshot.patternLow    = patternLow;
+  snapshot.patternHigh   = patternHigh;
+  snapshot.attributeLow  = attributeLow;
+  snapshot.attributeHigh = attributeHigh;
+  snapshot.ctrl          = ctrl;
+  snapshot.mask          = mask;
+  snapshot.status        = status;
+  snapshot.oamAddress    = oamAddress;
+  snapshot.readBuffer    = readBuffer;
+  snapshot.latch         = latch;
+  snapshot.x             = x;
+  snapshot.w             = w;
+  snapshot.oddFrame      = oddFrame;
+  snapshot.nextTile      = nextTile;
+  snapshot.nextAttribute = nextAttribute;
+  snapshot.nextLow       = nextLow;
+  snapshot.nextHigh      = nextHigh;
+}
+
+// Decoded tiles of CHR ROM pages that stay where they are are kept, CHR RAM may hold
+// other tiles now. Pages equal to the snapshot stay shared.
+void Ppu::Restore(const Snapshot &snapshot)
+{
+  vram  .Write(0, snapshot.vram  , sizeof(snapshot.vram  ));
+  chrRam.Write(0, snapshot.chrRam, sizeof(snapshot.chrRam));
+
+  memcpy(palette, snapshot.palette, sizeof(palette));
+  memcpy(oam    , snapshot.oam    , sizeof(oam    ));
+  memcpy(sprites, snapshot.sprites, sizeof(sprites));
+
+  for (u32 page = 0; page < 8; ++page)
+    MapChr(page, snapshot.chrBanks[page]);
+
+  for (u32 page = 0; page < 4; ++page)
+    MapNametable(page, snapshot.nametableBanks[page]);
+
+  MapPages(); // Written pages may have been copied out of a fork
+
+  if (!rom || !rom->GetChrRom())
+    tiles.InvalidateAll();
+
+  frameCount    = snapshot.frameCount;
+  v             = snapshot.v;
+  t             = snapshot.t;
+  scanline      = snapshot.scanline;
+  dot           = snapshot.dot;
+  patternLow    = snapshot.patternLow;
+  patternHigh   = snapshot.patternHigh;
+  attributeLow  = snapshot.attributeLow;
+  attributeHigh = snapshot.attributeHigh;
+  ctrl          = snapshot.ctrl;
+  mask          = snapshot.mask;
+  status        = snapshot.status;
+  oamAddress    = snapshot.oamAddress;
+  readBuffer    = snapshot.readBuffer;
+  latch         = snapshot.latch;
+  x             = snapshot.x;
+  w             = snapshot.w;
+  oddFrame      = snapshot.oddFrame;
+  nextTile      = snapshot.nextTile;
+  nextAttribute = snapshot.nextAttribute;
+  nextLow       = snapshot.nextLow;
+  nextHigh      = snapshot.nextHigh;
+}
+
+void Ppu::Reset()
+{
+  ctrl       = 0;
+  mask       = 0;
+  status     = 0;
+  oamAddress = 0;
+  readBuffer = 0;
+  latch      = 0;
+
+  v = 0;
+  t = 0;
+  x = 0;
+  w = false;
+
+  scanline   = 0;
+  dot        = 0;
+  oddFrame   = false;
+  frameCount = 0;
+
+  patternLow    = 0;
+  patternHigh   = 0;
+  attributeLow  = 0;
+  attributeHigh = 0;
+  nextTile      = 0;
+  nextAttribute = 0;
+  nextLow       = 0;
+  nextHigh      = 0;
+
+  memset(sprites, 0, sizeof(sprites));
+}
+
+/* Memory */
+FORCEINLINE u8 Ppu::PaletteIndex(u16 address)
+{
+  address &= 0x1F;
+
+  // The backdrop entries of the sprite palettes mirror the background ones
+  return (address & 0x13) == 0x10 ? address & 0x0F : address;
+}
+
+FORCEINLINE u8 Ppu::Read(u16 address) const
+{
+  address &= 0x3FFF;
+
+  if (address < 0x2000)
+    return chrPages[(address >> 10) & 7][address & 0x3FF];
+
+  if (address < 0x3F00)
+    return nametablePages[(address >> 10) & 3][address & 0x3FF];
+
+  return palette[PaletteIndex(address)];
+}
+
+FORCEINLINE void Ppu::Write(u16 address, u8 value)
+{
+  address &= 0x3FFF;
+
+  if (address < 0x2000)
+  {
+    u8 *page = chrWritePages[(address >> 10) & 7];
+
+    if (page)
+    {
+      page[address & 0x3FF] = value;
+      tiles.Invalidate(address);
+    }
+    else if (!rom || !rom->GetChrRom())
+      WriteShared(address, value);
+  }
+  else if (address < 0x3F00)
+  {
+    u8 *page = nametableWritePages[(address >> 10) & 3];
+
+    if (page)
+      page[address & 0x3FF] = value;
+    else
+      WriteShared(address, value);
+  }
+  else
+    palette[PaletteIndex(address)] = value & 0x3F;
+}
+
+// The page gets a copy of its own, and every page mapped to it the new pointer
+void Ppu::WriteShared(u16 address, u8 value)
+{
+  if (address < 0x2000)
+    chrRam.GetOwnPage(chrBanks[(address >> 10) & 7] / chrRam.pageSize % chrRam.pageCount);
+  else
+    vram.GetOwnPage(nametableBanks[(address >> 10) & 3]);
+
+  MapPages();
+  Write(address, value);
+}
+
+u8 Ppu::ReadMemory(u16 address) const
+{
+  return Read(address);
+}
+
+void Ppu::WriteMemory(u16 address, u8 value)
+{
+  Write(address, value);
+}
+
+u8 Ppu::ReadOam(u8 address) const
+{
+  return oam[address];
+}
+
+void Ppu::WriteOam(u8 address, u8 value)
+{
+  oam[address] = value;
+}
+
+/* Registers */
+u8 Ppu::ReadRegister(u16 address)
+{
+  switch (address & 7)
+  {
+    case 2: // PPUSTATUS, the low bits are whatever was last on the bus
+      latch   = (status & 0xE0) | (latch & 0x1F);
+      status &= ~statusVblank;
+      w       = false;
+      break;
+
+    case 4: // OAMDATA
+      latch = oam[oamAddress];
+      break;
+
+    case 7: // PPUDATA, buffered except for the palette, which still refills the buffer from the nametable below it
+      if ((v & 0x3FFF) < 0x3F00)
+      {
+        latch      = readBuffer;
+        readBuffer = Read(v);
+      }
+      else
+      {
+        latch      = (latch & 0xC0) | Read(v);
+        readBuffer = Read(v - 0x1000);
+      }
+
+      v = (v + (ctrl & ctrlIncrement ? 32 : 1)) & 0x7FFF;
+      break;
+
+    // The others are write only
+  }
+
+  return latch;
+}
+
+void Ppu::WriteRegister(u16 address, u8 value)
+{
+  latch = value;
+
+  switch (address & 7)
+  {
+    case 0: // PPUCTRL, the nametable bits go to t
+      ctrl = value;
+      t    = (t & 0xF3FF) | ((value & 0x03) << 10);
+      break;
+
+    case 1: mask       = value; break; // PPUMASK
+    case 3: oamAddress = value; break; // OAMADDR
+    case 4: oam[oamAddress++] = value; break; // OAMDATA
+
+    case 5: // PPUSCROLL, X then Y
+      if (!w)
+      {
+        t = (t & 0xFFE0) | (value >> 3);
+        x = value & 0x07;
+      }
+      else
+        t = (t & 0x8C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+
+      w = !w;
+      break;
+
+    case 6: // PPUADDR, high byte then low byte
+      if (!w)
+        t = (t & 0x80FF) | ((value & 0x3F) << 8);
+      else
+      {
+        t = (t & 0xFF00) | value;
+        v = t;
+      }
+
+      w = !w;
+      break;
+
+    case 7: // PPUDATA
+      Write(v, value);
+      v = (v + (ctrl & ctrlIncrement ? 32 : 1)) & 0x7FFF;
+      break;
+  }
+}
+
+u8 Ppu::ReadIo(void *context, u16 address)
+{
+  return ((Ppu *)context)->ReadRegister(address);
+}
+
+void Ppu::WriteIo(void *context, u16 address, u8 value)
+{
+  ((Ppu *)context)->WriteRegister(address, value);
+}
+
+/* Output */
+const u16 *Ppu::GetFrame() const
+{
+  return frame.get();
+}
+
+u32 Ppu::GetFrameCount() const
+{
+  return frameCount;
+}
+
+bool Ppu::GetNmi() const
+{
+  return (status & statusVblank) && (ctrl & ctrlNmi);
+}
+
+u16 Ppu::GetScanline() const
+{
+  return scanline;
+}
+
+u16 Ppu::GetDot() const
+{
+  return dot;
+}
+
+u32 Ppu::GetDotsUntil(u16 line, u16 lineDot) const
+{
+  u32 from = scanline * dotsPerScanline + dot;
+  u32 to   = line * dotsPerScanline + lineDot;
+  u32 dots = (to + frameDots - from) % frameDots + 1;
+  u32 skip = preRender * dotsPerScanline + dotsPerScanline - 2;
+
+  // Past the skipped dot this frame, the next one to cross is in a frame of the other parity
+  bool odd = from <= skip ? oddFrame : !oddFrame;
+
+  if (odd && Rendering() && (skip + frameDots - from) % frameDots < dots - 1)
+    dots--;
+
+  return dots;
+}
+
+// Rendered lines are the visible ones and pre-render
+u32 Ppu::GetDotsUntilScanlines(u32 count) const
+{
+  if (count == 0 || !Rendering())
+    return 0;
+
+  for (u32 ahead = dot <= 260 ? 0 : 1; ahead < scanlinesPerFrame; ++ahead)
+  {
+    u16 line = (scanline + ahead) % scanlinesPerFrame;
+
+    if ((line < height || line == preRender) && --count == 0)
+      return GetDotsUntil(line, 260);
+  }
+
+  return 0;
+}
+
+FORCEINLINE u16 *Ppu::FrameLine(u32 line)
+{
+  if (!frame)
+  {
+    frame.reset(new u16[width * height]());
+  }
+
+  return &frame[line * width];
+}
+
+/* Scrolling */
+FORCEINLINE bool Ppu::Rendering() const
+{
+  return (mask & maskRendering) != 0;
+}
+
+// Coarse X, wrapping into the next horizontal nametable
+FORCEINLINE void Ppu::IncrementX()
+{
+  if ((v & 0x001F) == 31)
+    v = (v & ~0x001F) ^ 0x0400;
+  else
+    v++;
+}
+
+// Fine Y, then coarse Y. Row 29 is the last one of a nametable, 30 and 31 are attributes
+// and wrap without switching nametables.
+FORCEINLINE void Ppu::IncrementY()
+{
+  if ((v & 0x7000) != 0x7000)
+  {
+    v += 0x1000;
+    return;
+  }
+
+  u16 coarseY = (v & 0x03E0) >> 5;
+
+  v &= ~0x7000;
+
+  if (coarseY == 29)
+  {
+    coarseY = 0;
+    v      ^= 0x0800;
+  }
+  else if (coarseY == 31)
+    coarseY = 0;
+  else
+    coarseY++;
+
+  v = (v & ~0x03E0) | (coarseY << 5);
+}
+
+FORCEINLINE void Ppu::CopyX()
+{
+  v = (v & ~0x041F) | (t & 0x041F);
+}
+
+FORCEINLINE void Ppu::CopyY()
+{
+  v = (v & ~0x7BE0) | (t & 0x7BE0);
+}
+
+FORCEINLINE u16 Ppu::TileAddress(u16 address) const
+{
+  return 0x2000 | (address & 0x0FFF);
+}
+
+FORCEINLINE u16 Ppu::AttributeAddress(u16 address) const
+{
+  return 0x23C0 | (address & 0x0C00) | ((address >> 4) & 0x38) | ((address >> 2) & 0x07);
+}
+
+// An attribute byte holds the palettes of four 16x16 areas, bit 1 of coarse X and Y picks one
+FORCEINLINE u8 Ppu::AttributeBits(u16 address) const
+{
+  return (Read(AttributeAddress(address)) >> (((address >> 4) & 0x04) | (address & 0x02))) & 0x03;
+}
+
+/* Sprites. Both renderers evaluate OAM at dot 257 for the next line and fetch every pattern
+   at once, sprite Y is one less than the first line a sprite shows on. The pixels of the
+   first sprite in OAM order that isn't transparent end up in sprites. */
+void Ppu::EvaluateSprites(s32 line)
+{
+  memset(sprites, 0, sizeof(sprites));
+
+  if (!Rendering() || line < 0 || line >= (s32)height - 1)
+    return;
+
+  s32 spriteHeight = ctrl & ctrlTallSprites ? 16 : 8;
+  u32 found        = 0;
+
+  for (u32 sprite = 0; sprite < 64; ++sprite)
+  {
+    const u8 *entry = &oam[sprite * 4];
+    s32       row   = line - entry[0];
+
+    if (row < 0 || row >= spriteHeight)
+      continue;
+
+    if (found++ == 8)
+    {
+      status |= statusOverflow;
+      break;
+    }
+
+    u8  tile       = entry[1];
+    u8  attributes = entry[2];
+    u32 left       = entry[3];
+    u16 address;
+
+    if (attributes & 0x80) // Vertical flip
+      row = spriteHeight - 1 - row;
+
+    if (spriteHeight == 16) // Bit 0 of the tile picks the table, the bottom half is the next tile
+      address = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4) | ((row & 0x08) << 1);
+    else
+      address = (ctrl & ctrlSpriteTable ? 0x1000 : 0x0000) | (tile << 4);
+
+    address += row & 0x07;
+
+    const u8 *pixels = tiles.Row(chrPages, address, (attributes & 0x40) != 0); // Horizontal flip
+    u8        tag    = ((attributes & 0x03) << 2) | (attributes & 0x20 ? spriteBehind : 0) | (sprite == 0 ? spriteZero : 0);
+
+    for (u32 column = 0; column < 8 && left + column < width; ++column)
+    {
+      if (pixels[column] && !(sprites[left + column] & 0x03))
+        sprites[left + column] = pixels[column] | tag;
+    }
+  }
+}
+
+// Picks between background and sprite, background is its pixel value in bits 0-1 and its
+// palette in bits 2-3. Also where sprite 0 hits.
+FORCEINLINE u16 Ppu::Pixel(u32 pixelX, u8 background)
+{
+  u8 sprite = sprites[pixelX];
+
+  if (!(mask & maskBackground) || (pixelX < 8 && !(mask & maskLeftBackground)))
+    background = 0;
+  if (!(mask & maskSprites) || (pixelX < 8 && !(mask & maskLeftSprites)))
+    sprite = 0;
+
+  u8 index = background & 0x03 ? background : 0;
+
+  if (sprite & 0x03)
+  {
+    if ((sprite & spriteZero) && (background & 0x03) && pixelX != 255)
+      status |= statusSpriteZero;
+
+    if (!(sprite & spriteBehind) || !(background & 0x03))
+      index = 0x10 | (sprite & spriteColor);
+  }
+
+  return (palette[index] & (mask & maskGreyscale ? 0x30 : 0x3F)) | ((mask & 0xE0) << 1);
+}
+
+/* Timing */
+template<Ppu::Renderer renderer>
+void Ppu::Run(u32 dots)
+{
+  if (renderer == Renderer::Dot)
+    RunDots(dots);
+  else
+    RunScanlines(dots);
+}
+
+template void Ppu::Run<Ppu::Renderer::Scanline>(u32 dots);
+template void Ppu::Run<Ppu::Renderer::Dot>     (u32 dots);
+
+void Ppu::Run(u32 dots)
+{
+  if (defaultRenderer == Renderer::Dot)
+    RunDots(dots);
+  else
+    RunScanlines(dots);
+}
+
+FORCEINLINE void Ppu::Timing()
+{
+  if (dot != 1)
+    return;
+
+  if (scanline == vblankLine)
+  {
+    status |= statusVblank;
+    frameCount++;
+  }
+  else if (scanline == preRender)
+    status &= ~(statusVblank | statusSpriteZero | statusOverflow);
+}
+
+FORCEINLINE void Ppu::ClockScanline()
+{
+  if (scanlineHandler)
+    scanlineHandler(scanlineContext);
+}
+
+FORCEINLINE void Ppu::NextDot()
+{
+  dot++;
+
+  // Odd frames skip the last dot of the pre-render line when rendering
+  if (dot == dotsPerScanline - 1 && scanline == preRender && oddFrame && Rendering())
+    dot = dotsPerScanline;
+
+  if (dot < dotsPerScanline)
+    return;
+
+  dot = 0;
+
+  if (++scanline == scanlinesPerFrame)
+  {
+    scanline = 0;
+    oddFrame = !oddFrame;
+  }
+}
+
+/* Scanline renderer */
+void Ppu::RunScanlines(u32 dots)
+{
+  while (dots > 0)
+  {
+    // Dots with work, 339 decides the odd frame skip and 340 ends the line
+    u16 next = dot <= 1   ? 1   :
+               dot <= 256 ? 256 :
+               dot <= 257 ? 257 :
+               dot <= 260 ? 260 :
+               dot <= 280 ? 280 :
+               dot <= 339 ? 339 : 340;
+
+    u32 idle = (u32)(next - dot) < dots ? next - dot : dots;
+
+    dot  += idle;
+    dots -= idle;
+
+    if (dots == 0)
+      break;
+
+    ScanlineEvent();
+    NextDot();
+    dots--;
+  }
+}
+
+void Ppu::ScanlineEvent()
+{
+  Timing();
+
+  if (scanline >= height && scanline != preRender)
+    return;
+
+  switch (dot)
+  {
+    case 256:
+      if (scanline < height)
+        RenderLine();
+      if (Rendering())
+        IncrementY();
+      break;
+
+    case 257:
+      if (Rendering())
+        CopyX();
+
+      EvaluateSprites(scanline == preRender ? -1 : scanline);
+      break;
+
+    case 260:
+      if (Rendering())
+        ClockScanline();
+      break;
+
+    case 280: // The hardware copies on every dot from 280 to 304, once is the same without writes in between
+      if (scanline == preRender && Rendering())
+        CopyY();
+      break;
+  }
+}
+
+// Fetches the 33 tiles the line touches from v, as the pipeline would have, and drops the
+// first x pixels
+void Ppu::RenderLine()
+{
+  u16 *out = FrameLine(scanline);
+  u8   line[width + 8];
+
+  // With rendering off every pixel is the backdrop, Pixel would pick it 256 times over
+  if (!Rendering())
+  {
+    u16 backdrop = Pixel(0, 0);
+
+    for (u32 pixelX = 0; pixelX < width; ++pixelX)
+      out[pixelX] = backdrop;
+
+    return;
+  }
+
+  if (mask & maskBackground)
+  {
+    u16 address = v;
+    u16 table   = ctrl & ctrlBackgroundTable ? 0x1000 : 0x0000;
+
+    for (u32 tile = 0; tile < 33; ++tile)
+    {
+      u16       pattern = table | (Read(TileAddress(address)) << 4) | ((address >> 12) & 0x07);
+      u8        colors  = AttributeBits(address) << 2;
+      const u8 *pixels  = tiles.Row(chrPages, pattern, false);
+
+      for (u32 column = 0; column < 8; ++column)
+        line[tile * 8 + column] = pixels[column] ? pixels[column] | colors : 0;
+
+      if ((address & 0x001F) == 31)
+        address = (address & ~0x001F) ^ 0x0400;
+      else
+        address++;
+    }
+  }
+  else
+    memset(line, 0, sizeof(line));
+
+  for (u32 pixelX = 0; pixelX < width; ++pixelX)
+    out[pixelX] = Pixel(pixelX, line[pixelX + x]);
+}
+
+/* Dot renderer */
+void Ppu::RunDots(u32 dots)
+{
+  for (; dots > 0; --dots)
+  {
+    StepDot();
+    NextDot();
+  }
+}
+
+FORCEINLINE void Ppu::LoadShifters()
+{
+  patternLow    = (patternLow    & 0xFF00) | nextLow;
+  patternHigh   = (patternHigh   & 0xFF00) | nextHigh;
+  attributeLow  = (attributeLow  & 0xFF00) | (nextAttribute & 0x01 ? 0xFF : 0x00);
+  attributeHigh = (attributeHigh & 0xFF00) | (nextAttribute & 0x02 ? 0xFF : 0x00);
+}
+
+FORCEINLINE void Ppu::UpdateShifters()
+{
+  patternLow    <<= 1;
+  patternHigh   <<= 1;
+  attributeLow  <<= 1;
+  attributeHigh <<= 1;
+}
+
+// Tiles are fetched over eight dots, nametable, attribute, low and high pattern, and go
+// into the shifters eight dots later. Dots 321-336 prefetch the first two tiles of the next line.
+FORCEINLINE void Ppu::StepDot()
+{
+  Timing();
+
+  if (scanline >= height && scanline != preRender)
+    return;
+
+  if (Rendering())
+  {
+    if ((dot >= 2 && dot < 258) || (dot >= 321 && dot < 338))
+    {
+      UpdateShifters();
+
+      switch ((dot - 1) & 0x07)
+      {
+        case 0:
+          LoadShifters();
+          nextTile = Read(TileAddress(v));
+          break;
+        case 2:
+          nextAttribute = AttributeBits(v);
+          break;
+        case 4:
+          nextLow  = Read((ctrl & ctrlBackgroundTable ? 0x1000 : 0x0000) | (nextTile << 4) | ((v >> 12) & 0x07));
+          break;
+        case 6:
+          nextHigh = Read((ctrl & ctrlBackgroundTable ? 0x1000 : 0x0000) | (nextTile << 4) | ((v >> 12) & 0x07) | 0x08);
+          break;
+        case 7:
+          IncrementX();
+          break;
+      }
+    }
+
+    if (dot == 256)
+      IncrementY();
+    else if (dot == 257)
+      CopyX();
+    else if (dot == 260)
+      ClockScanline();
+    else if (scanline == preRender && dot >= 280 && dot <= 304)
+      CopyY();
+  }
+
+  if (scanline < height && dot >= 1 && dot <= 256)
+  {
+    u8 background = 0;
+
+    if (mask & maskBackground)
+    {
+      u16 bit   = 0x8000 >> x;
+      u8  pixel = (patternLow   & bit ? 0x01 : 0) | (patternHigh   & bit ? 0x02 : 0);
+      u8  color = (attributeLow & bit ? 0x04 : 0) | (attributeHigh & bit ? 0x08 : 0);
+
+      background = pixel ? pixel | color : 0;
+    }
+
+    FrameLine(scanline)[dot - 1] = Pixel(dot - 1, background);
+  }
+
+  if (dot == 257)
+    EvaluateSprites(scanline == preRender ? -1 : scanline);
+}
@@ -0,0 +1,248 @@
+#ifndef __PPU_H__
+#define __PPU_H__
+
+#pragma once
+
+#include <memory>
+#include "pages.hpp"
+#include "rom.hpp"
+#include "tiles.hpp"
+#include "types.hpp"
+
+/* Picture processing unit. Owns the nametable VRAM, OAM and palette RAM, reads the pattern
+   tables from CHR ROM or its own CHR RAM, and draws into an indexed framebuffer. Runs in
+   batches of dots: three per CPU cycle, 341 per scanline and 262 scanlines per frame.
+
+   Two renderers share the registers, the sprite evaluation and the pixel composition:
+     Scanline  Draws a whole line at dot 256 and only stops at the dots where something
+               happens. Register writes take effect on the next line.
+     Dot       Runs the background fetch pipeline dot by dot, so writes between dots
+               (split scrolling, palette changes) show up where they happen. */
+class Ppu {
+public:
+  static const u32 width             = 256;
+  static const u32 height            = 240;
+  static const u32 dotsPerScanline   = 341;
+  static const u32 scanlinesPerFrame = 262;
+  static const u16 vblankLine        = 241; // The vblank flag is set at its dot 1
+  static const u16 preRender         = 261;
+
+  enum class Renderer : u8 {
+    Scanline,
+    Dot
+  };
+
+  static const Renderer defaultRenderer; // Dot when built with NESEMU_PPU_DOT
+
+  // Called at dot 260 of the rendered lines while rendering, where the PPU fetches the
+  // sprite patterns. Cartridges count scanlines there.
+  typedef void (*ScanlineHandler)(void *context);
+
+  Ppu();
+  Ppu(const Ppu &other);
+
+  Ppu &operator=(const Ppu &other);
+
+  // Same as operator=, sharing the pages of VRAM and CHR RAM with other instead of copying
+  // them. Either copies a page before writing to it.
+  void Share           (Ppu &other);
+
+  void LoadRom         (const std::shared_ptr<const Rom> &newRom); // Null leaves 8KB of CHR RAM and horizontal mirroring
+  void Reset           ();
+
+  /* Cartridge banks, LoadRom maps the first 8KB of CHR and the mirroring of the header */
+  void MapChr          (u32 page, u32 offset); // 1KB page of the pattern tables to offset in CHR ROM, or CHR RAM without it
+  void MapNametable    (u32 page, u32 bank);   // Nametable page to the 1KB bank of VRAM
+
+  // Not copied, whoever owns the copy sets its own
+  void SetScanlineHandler(ScanlineHandler handler, void *context);
+
+  /* Save state section: memory, banks, registers, timing and the background pipeline. The
+     ROM and the frame aren't in it, the frame is drawn again from the state. */
+  struct Snapshot {
+    u8   vram   [0x1000];
+    u8   chrRam [0x2000];
+    u8   palette[0x20];
+    u8   oam    [0x100];
+    u8   sprites[width];
+    u32  chrBanks[8];
+    u8   nametableBanks[4];
+    u32  frameCount;
+    u16  v;
+    u16  t;
+    u16  scanline;
+    u16  dot;
+    u16  patternLow;
+    u16  patternHigh;
+    u16  attributeLow;
+    u16  attributeHigh;
+    u8   ctrl;
+    u8   mask;
+    u8   status;
+    u8   oamAddress;
+    u8   readBuffer;
+    u8   latch;
+    u8   x;
+    bool w;
+    bool oddFrame;
+    u8   nextTile;
+    u8   nextAttribute;
+    u8   nextLow;
+    u8   nextHigh;
+  };
+
+  void Save            (Snapshot &snapshot) const;
+  void Restore         (const Snapshot &snapshot);
+
+  void Run             (u32 dots); // With defaultRenderer
+  template<Renderer renderer> void Run(u32 dots);
+
+  /* CPU side, $2000-$2007 mirrored up to $3FFF */
+  u8   ReadRegister    (u16 address);
+  void WriteRegister   (u16 address, u8 value);
+
+  // Bus handlers, context is the Ppu
+  static u8   ReadIo   (void *context, u16 address);
+  static void WriteIo  (void *context, u16 address, u8 value);
+
+  /* Output. A pixel is a palette index in bits 0-5 and the emphasis bits of PPUMASK in bits 6-8 */
+  const u16 *GetFrame      () const; // width * height pixels, rows top to bottom. Null until a line is drawn
+  u32        GetFrameCount () const; // Frames finished, bumped when vblank starts
+  bool       GetNmi        () const; // NMI line: in vblank with NMI enabled in PPUCTRL
+  u16        GetScanline   () const; // 0-239 visible, 241-260 vblank, 261 pre-render
+  u16        GetDot        () const;
+
+  // Dots Run needs to have run (line, lineDot), from 1 to a frame. Counts the dot the odd
+  // frame skips when rendering, as it stands now.
+  u32        GetDotsUntil  (u16 line, u16 lineDot) const;
+
+  // Dots Run needs to have run for the scanline handler to be called count times, as things
+  // stand now. 0 when that's more than a frame away or rendering is off.
+  u32        GetDotsUntilScanlines(u32 count) const;
+
+  /* PPU address space, for debuggers and tests */
+  u8   ReadMemory      (u16 address) const;
+  void WriteMemory     (u16 address, u8 value);
+  u8   ReadOam         (u8 address) const;
+  void WriteOam        (u8 address, u8 value);
+
+private:
+  /* PPUCTRL, PPUMASK and PPUSTATUS bits */
+  static const u8 ctrlIncrement       = 0x04; // VRAM address steps 32 instead of 1
+  static const u8 ctrlSpriteTable     = 0x08; // 8x8 sprites at 0x1000
+  static const u8 ctrlBackgroundTable = 0x10; // Background at 0x1000
+  static const u8 ctrlTallSprites     = 0x20; // 8x16 sprites
+  static const u8 ctrlNmi             = 0x80;
+  static const u8 maskGreyscale       = 0x01;
+  static const u8 maskLeftBackground  = 0x02; // Background in the leftmost 8 pixels
+  static const u8 maskLeftSprites     = 0x04;
+  static const u8 maskBackground      = 0x08;
+  static const u8 maskSprites         = 0x10;
+  static const u8 maskRendering       = maskBackground | maskSprites;
+  static const u8 statusOverflow      = 0x20;
+  static const u8 statusSpriteZero    = 0x40;
+  static const u8 statusVblank        = 0x80;
+
+  static const u32 frameDots = dotsPerScanline * scanlinesPerFrame;
+
+  /* Sprite pixels of the next line, see EvaluateSprites */
+  static const u8 spriteColor  = 0x0F; // Pixel value in bits 0-1, palette in bits 2-3. 0 is transparent
+  static const u8 spriteBehind = 0x20; // Behind opaque background
+  static const u8 spriteZero   = 0x40; // Comes from sprite 0
+
+  /* Memory */
+  PagedMemory<0x400, 4>      vram;            // Nametables, 2KB on the board, 4KB with four screen cartridges
+  PagedMemory<0x400, 8>      chrRam;          // Pattern tables when the cartridge has no CHR ROM
+  u8                         palette[0x20];
+  u8                         oam    [0x100];
+  std::shared_ptr<const Rom> rom;
+
+  // 1KB pages of the PPU address space, the same scheme as Bus on the CPU side. The pointers
+  // are made from the banks, which is what gets copied.
+  u32       chrBanks           [8]; // Offsets into CHR ROM, or chrRam
+  u8        nametableBanks     [4]; // 1KB banks of vram
+  const u8 *chrPages           [8]; // Pattern tables
+  u8       *chrWritePages      [8]; // Null for CHR ROM, and CHR RAM shared with a fork
+  const u8 *nametablePages     [4]; // 0x2000, 0x2400, 0x2800 and 0x2C00, mirrored up to 0x3EFF
+  u8       *nametableWritePages[4]; // Null while shared with a fork
+
+  ScanlineHandler scanlineHandler;
+  void           *scanlineContext;
+
+  /* Registers */
+  u8   ctrl;
+  u8   mask;
+  u8   status;
+  u8   oamAddress;
+  u8   readBuffer; // PPUDATA reads below the palette return the previous read
+  u8   latch;      // Last value written or read, returned by write only registers
+
+  // Scrolling: current and temporary VRAM address (yyy NN YYYYY XXXXX), fine X and the
+  // write toggle shared by PPUSCROLL and PPUADDR
+  u16  v;
+  u16  t;
+  u8   x;
+  bool w;
+
+  /* Timing */
+  u16  scanline;
+  u16  dot;      // Next dot to run
+  bool oddFrame; // Odd frames skip a dot when rendering
+  u32  frameCount;
+
+  /* Background pipeline of the dot renderer: 16 bit shifters, the next tile loads into the low byte */
+  u16  patternLow;
+  u16  patternHigh;
+  u16  attributeLow;
+  u16  attributeHigh;
+  u8   nextTile;
+  u8   nextAttribute;
+  u8   nextLow;
+  u8   nextHigh;
+
+  u8                     sprites[width]; // Sprite pixels of the line being drawn
+  TileCache              tiles;          // Decoded chrPages for the scanline renderer and sprites
+  std::unique_ptr<u16[]> frame;          // Output, not state: allocated when the first line is drawn and never copied
+
+  void MapMemory       ();
+  void MapPages        ();          // Pointers from the banks, the decoded tiles stay
+  void CopyState       (const Ppu &other); // All but the memory
+  void WriteShared     (u16 address, u8 value); // First write to a shared page
+  void MapDefaultBanks ();          // The layout without a mapper
+  FORCEINLINE void MapChrPage(u32 page);
+  FORCEINLINE void ClockScanline();
+
+  FORCEINLINE u8 Read  (u16 address) const;
+  FORCEINLINE void Write(u16 address, u8 value);
+  FORCEINLINE static u8 PaletteIndex(u16 address);
+
+  FORCEINLINE bool Rendering() const;
+  FORCEINLINE u16 *FrameLine(u32 line);
+
+  /* Loopy scrolling, the increments and copies the hardware makes while rendering */
+  FORCEINLINE void IncrementX();
+  FORCEINLINE void IncrementY();
+  FORCEINLINE void CopyX     ();
+  FORCEINLINE void CopyY     ();
+
+  FORCEINLINE u16 TileAddress     (u16 address) const;
+  FORCEINLINE u16 AttributeAddress(u16 address) const;
+  FORCEINLINE u8  AttributeBits   (u16 address) const; // Palette of the tile at address
+
+  void EvaluateSprites (s32 line); // Fills sprites for line + 1
+  FORCEINLINE u16 Pixel(u32 pixelX, u8 background);
+
+  /* Renderers */
+  void RenderLine      ();          // Scanline: the whole current line from v and x
+  void RunScanlines    (u32 dots);
+  void ScanlineEvent   ();          // Work of the scanline renderer at the current dot
+  void RunDots         (u32 dots);
+  FORCEINLINE void StepDot();       // One dot of the dot renderer
+  FORCEINLINE void LoadShifters  ();
+  FORCEINLINE void UpdateShifters();
+
+  FORCEINLINE void Timing();        // Vblank and flag updates shared by both renderers
+  FORCEINLINE void NextDot();
+};
+
+#endif //__PPU_H__
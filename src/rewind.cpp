@@ -0,0 +1,280 @@
+#include "rewind.hpp"
+#include <cstddef>
+#include <cstring>
+#include "cpu.hpp"
+
+namespace
+{
+  const size_t ramOffset    = offsetof(SaveState, cpu) + offsetof(Cpu::Snapshot, ram);
+  const size_t prgRamOffset = offsetof(SaveState, cpu) + offsetof(Cpu::Snapshot, prgRam);
+  const u32    ramPages     = sizeof(Cpu::Snapshot::ram) / Bus::pageSize;
+
+  static_assert(prgRamOffset >= ramOffset + sizeof(Cpu::Snapshot::ram), "deltas walk the pages in order");
+
+  // Where page n of the Cpu snapshot RAM is in a state, as numbered by SaveChanges
+  size_t PageOffset(u32 page)
+  {
+    return page < ramPages ? ramOffset + page * Bus::pageSize : prgRamOffset + (page - ramPages) * Bus::pageSize;
+  }
+
+  u8 *WriteVarint(u8 *out, size_t value)
+  {
+    for (; value >= 0x80; value >>= 7)
+      *out++ = (u8)value | 0x80;
+
+    *out++ = (u8)value;
+
+    return out;
+  }
+
+  const u8 *ReadVarint(const u8 *in, size_t &value)
+  {
+    value = 0;
+
+    for (u32 shift = 0; ; shift += 7)
+    {
+      value |= (size_t)(*in & 0x7F) << shift;
+
+      if (!(*in++ & 0x80))
+        return in;
+    }
+  }
+
+  FORCEINLINE u64 Load64(const u8 *bytes)
+  {
+    u64 value;
+
+    memcpy(&value, bytes, sizeof(value));
+
+    return value;
+  }
+
+  /* A delta is a list of (zero run, literal count, literals), varints then bytes: skip the
+     run, XOR the literals in. A literal run ends at 4 unchanged bytes, shorter gaps cost less
+     inside it than a new pair. */
+  struct DeltaWriter {
+    u8     *out;
+    size_t  zeros; // Unchanged bytes not written yet
+
+    // Unchanged without looking
+    void Skip(size_t size)
+    {
+      zeros += size;
+    }
+
+    // Encodes the XOR of size bytes of target and source, and copies source over target
+    void Xor(u8 *target, const u8 *source, size_t size)
+    {
+      size_t i = 0;
+
+      while (i < size)
+      {
+        size_t start = i;
+
+        while (i + 8 <= size && Load64(target + i) == Load64(source + i))
+          i += 8;
+        while (i < size && target[i] == source[i])
+          ++i;
+
+        zeros += i - start;
+
+        if (i == size)
+          return;
+
+        size_t end = i + 1;
+
+        for (size_t j = end; j < size && j - end < 4; ++j)
+          if (target[j] != source[j])
+            end = j + 1;
+
+        out = WriteVarint(out, zeros);
+        out = WriteVarint(out, end - i);
+
+        for (; i < end; ++i)
+        {
+          *out++    = target[i] ^ source[i];
+          target[i] = source[i];
+        }
+
+        zeros = 0;
+      }
+    }
+  };
+}
+
+Rewind::Rewind(size_t capacity, u32 maxPoints)
+{
+  // Every byte a literal, in runs of one between gaps of 4: a pair of 3 byte varints every 5
+  const size_t maxDelta = sizeof(SaveState) * 3;
+
+  ring   .resize(capacity);
+  entries.resize(maxPoints > 1 ? maxPoints - 1 : 1);
+  encoded.resize(maxDelta);
+
+  newest.reset(new SaveState());
+  saved .reset(new SaveState());
+
+  Clear();
+}
+
+void Rewind::Push(Cpu &cpu)
+{
+  // The first point is whole, SaveChanges needs a full copy to start from
+  if (!hasNewest)
+  {
+    cpu.Save(*saved);
+    cpu.SaveChanges(*saved);
+
+    memcpy(newest.get(), saved.get(), sizeof(SaveState));
+    hasNewest = true;
+
+    return;
+  }
+
+  Store(Encode(cpu.SaveChanges(*saved)));
+}
+
+bool Rewind::Pop(Cpu &cpu)
+{
+  if (!hasNewest || !cpu.Restore(*newest))
+    return false;
+
+  if (deltas == 0)
+  {
+    hasNewest = false;
+    return true;
+  }
+
+  const Entry &entry = entries[(first + deltas - 1) % entries.size()];
+
+  Apply(&ring[entry.offset], entry.size);
+
+  used -= entry.size;
+  --deltas;
+
+  return true;
+}
+
+void Rewind::Clear()
+{
+  first     = 0;
+  deltas    = 0;
+  used      = 0;
+  hasNewest = false;
+}
+
+u32 Rewind::GetCount() const
+{
+  return deltas + (hasNewest ? 1 : 0);
+}
+
+size_t Rewind::GetUsed() const
+{
+  return used;
+}
+
+size_t Rewind::GetCapacity() const
+{
+  return ring.size();
+}
+
+// Clean RAM pages are equal in both states and skipped, everything else is compared
+size_t Rewind::Encode(u64 changed)
+{
+  u8          *target = (u8 *)newest.get();
+  const u8    *source = (const u8 *)saved.get();
+  DeltaWriter  writer = { encoded.data(), 0 };
+  size_t       offset = 0;
+
+  for (u32 page = 0; page < Cpu::snapshotPages; ++page)
+  {
+    size_t pageOffset = PageOffset(page);
+
+    writer.Xor(target + offset, source + offset, pageOffset - offset);
+
+    if (changed & (1ULL << page))
+      writer.Xor(target + pageOffset, source + pageOffset, Bus::pageSize);
+    else
+      writer.Skip(Bus::pageSize);
+
+    offset = pageOffset + Bus::pageSize;
+  }
+
+  writer.Xor(target + offset, source + offset, sizeof(SaveState) - offset);
+
+  return writer.out - encoded.data();
+}
+
+void Rewind::Apply(const u8 *delta, size_t size)
+{
+  u8       *target = (u8 *)newest.get();
+  const u8 *end    = delta + size;
+  size_t    offset = 0;
+
+  while (delta < end)
+  {
+    size_t zeros;
+    size_t count;
+
+    delta = ReadVarint(delta, zeros);
+    delta = ReadVarint(delta, count);
+
+    offset += zeros;
+
+    for (size_t i = 0; i < count; ++i)
+      target[offset + i] ^= delta[i];
+
+    offset += count;
+    delta  += count;
+  }
+}
+
+// Deltas follow each other around the ring, the free space runs from the end of the newest
+// to the start of the oldest
+void Rewind::Store(size_t size)
+{
+  if (size > ring.size())
+  {
+    deltas = 0; // Only the newest point is left to go back to
+    used   = 0;
+    return;
+  }
+
+  if (deltas == entries.size())
+    DropOldest();
+
+  size_t offset = 0;
+
+  if (deltas > 0)
+  {
+    const Entry &last = entries[(first + deltas - 1) % entries.size()];
+
+    offset = last.offset + last.size;
+  }
+
+  // Past the end, start over at the beginning: what's left at the end is the oldest
+  if (offset + size > ring.size())
+  {
+    while (deltas > 0 && entries[first].offset >= offset)
+      DropOldest();
+
+    offset = 0;
+  }
+
+  while (deltas > 0 && entries[first].offset < offset + size && offset < entries[first].offset + entries[first].size)
+    DropOldest();
+
+  memcpy(&ring[offset], encoded.data(), size);
+
+  entries[(first + deltas) % entries.size()] = { (u32)offset, (u32)size };
+
+  ++deltas;
+  used += size;
+}
+
+void Rewind::DropOldest()
+{
+  used  -= entries[first].size;
+  first  = (first + 1) % entries.size();
+  --deltas;
+}
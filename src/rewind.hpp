@@ -0,0 +1,61 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "savestate.hpp"
+#include "types.hpp"
+
+class Cpu;
+
+/* Rewind buffer. Every point is kept as a delta against the one before it: the save state
+   XORed with the previous one, so what didn't change is zero, run length encoded as zero runs
+   and literal bytes. RAM pages the bus saw no write to are skipped without being compared.
+   The deltas go into a ring of fixed size that drops the oldest points when it's full;
+   nothing is allocated after construction, so a push costs the same on every frame.
+
+   An XOR delta goes both ways. The buffer keeps the newest point whole, and Pop steps it back
+   to the one before by applying the newest delta. */
+class Rewind {
+public:
+  static const size_t defaultCapacity = 32 << 20;    // Bytes of deltas
+  static const u32    defaultPoints   = 60 * 60 * 10; // 10 minutes at one point per frame
+
+  explicit Rewind(size_t capacity = defaultCapacity, u32 maxPoints = defaultPoints);
+
+  Rewind(const Rewind &) = delete;
+  Rewind &operator=(const Rewind &) = delete;
+
+  void   Push       (Cpu &cpu); // Records the machine as the newest point
+  bool   Pop        (Cpu &cpu); // Restores the machine to the newest point and drops it. False when there's none
+  void   Clear      ();
+
+  u32    GetCount   () const; // Points that can be popped
+  size_t GetUsed    () const; // Bytes of deltas in the ring
+  size_t GetCapacity() const;
+
+private:
+  struct Entry {
+    u32 offset; // Into ring
+    u32 size;
+  };
+
+  std::vector<u8>            ring;
+  std::vector<Entry>         entries;  // Circular, oldest at first
+  std::vector<u8>            encoded;  // The delta being pushed, sized for the worst case
+  std::unique_ptr<SaveState> newest;   // The newest point
+  std::unique_ptr<SaveState> saved;    // Written by SaveChanges only, its clean pages are the machine's
+  u32                        first;
+  u32                        deltas;   // Entries in use
+  size_t                     used;
+  bool                       hasNewest;
+
+  size_t Encode     (u64 changed);                  // XOR of saved and newest into encoded, newest becomes saved
+  void   Apply      (const u8 *delta, size_t size); // XORs a delta into newest
+  void   Store      (size_t size);                  // encoded into the ring, dropping the oldest deltas it overlaps
+  void   DropOldest ();
+};
+
+#endif //__REWIND_H__
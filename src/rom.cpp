@@ -0,0 +1,284 @@
+#include "rom.hpp"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Rom::Rom()
+{
+  data = nullptr;
+  size = 0;
+#ifdef _WIN32
+  file    = INVALID_HANDLE_VALUE;
+  mapping = nullptr;
+#endif
+
+  Close();
+}
+
+Rom::~Rom()
+{
+  Close();
+}
+
+bool Rom::Load(const std::string &romFile)
+{
+  Close();
+
+  if (!Map(romFile) || !ParseHeader())
+  {
+    std::string message = error;
+
+    Close();
+    error = message;
+
+    return false;
+  }
+
+  return true;
+}
+
+void Rom::Close()
+{
+#ifdef _WIN32
+  if (data)
+    UnmapViewOfFile(data);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+
+  file    = INVALID_HANDLE_VALUE;
+  mapping = nullptr;
+#else
+  if (data)
+    munmap(const_cast<u8 *>(data), size);
+#endif
+
+  data       = nullptr;
+  size       = 0;
+  format     = Format::INes;
+  mapper     = 0;
+  submapper  = 0;
+  mirroring  = Mirroring::Horizontal;
+  battery    = false;
+  trainer    = nullptr;
+  prgRom     = nullptr;
+  prgRomSize = 0;
+  chrRom     = nullptr;
+  chrRomSize = 0;
+  prgRamSize = 0;
+  chrRamSize = 0;
+
+  error.clear();
+}
+
+bool Rom::Map(const std::string &romFile)
+{
+#ifdef _WIN32
+  file = CreateFileA(romFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+  if (file == INVALID_HANDLE_VALUE)
+    return Fail("Can't open the file");
+
+  LARGE_INTEGER fileSize;
+
+  if (!GetFileSizeEx(file, &fileSize))
+    return Fail("Can't get the size of the file");
+
+  if (fileSize.QuadPart < headerSize)
+    return Fail("The file is too small to be a rom");
+
+  size    = (size_t)fileSize.QuadPart;
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+  if (!mapping)
+    return Fail("Can't map the file");
+
+  data = (const u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+  if (!data)
+    return Fail("Can't map the file");
+#else
+  int fd = open(romFile.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return Fail("Can't open the file");
+
+  struct stat status;
+
+  if (fstat(fd, &status) != 0 || status.st_size < (off_t)headerSize)
+  {
+    close(fd);
+    return Fail("The file is too small to be a rom");
+  }
+
+  void *view = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd); // The mapping keeps the file alive
+
+  if (view == MAP_FAILED)
+    return Fail("Can't map the file");
+
+  data = (const u8 *)view;
+  size = status.st_size;
+#endif
+
+  return true;
+}
+
+// Header layout: https://www.nesdev.org/wiki/INES and https://www.nesdev.org/wiki/NES_2.0
+bool Rom::ParseHeader()
+{
+  const u8 *header = data;
+
+  if (memcmp(header, "NES\x1A", 4) != 0)
+    return Fail("Not an iNES rom, the header magic is missing");
+
+  format    = (header[7] & 0x0C) == 0x08 ? Format::Nes20 : Format::INes;
+  mirroring = (header[6] & 0x08) ? Mirroring::FourScreen : ((header[6] & 0x01) ? Mirroring::Vertical : Mirroring::Horizontal);
+  battery   = (header[6] & 0x02) != 0;
+  mapper    = (header[6] >> 4) | (header[7] & 0xF0);
+
+  u64 prgSize;
+  u64 chrSize;
+
+  if (format == Format::Nes20)
+  {
+    mapper   |= (header[8] & 0x0F) << 8;
+    submapper = header[8] >> 4;
+
+    // A size MSB nibble of 0xF switches the LSB to exponent-multiplier notation: 2^E * (MM * 2 + 1)
+    u8 prgMsb = header[9] & 0x0F;
+    u8 chrMsb = header[9] >> 4;
+
+    prgSize = prgMsb == 0x0F ? ((u64)1 << (header[4] >> 2)) * ((header[4] & 0x03) * 2 + 1) : ((prgMsb << 8) | header[4]) * (u64)0x4000;
+    chrSize = chrMsb == 0x0F ? ((u64)1 << (header[5] >> 2)) * ((header[5] & 0x03) * 2 + 1) : ((chrMsb << 8) | header[5]) * (u64)0x2000;
+
+    // RAM sizes are shift counts, 64 << n bytes, 0 means none
+    u8 prgRamShift   = header[10] & 0x0F;
+    u8 prgNvramShift = header[10] >> 4;
+    u8 chrRamShift   = header[11] & 0x0F;
+
+    prgRamSize = (prgRamShift   ? 64 << prgRamShift   : 0) + (prgNvramShift ? 64 << prgNvramShift : 0);
+    chrRamSize =  chrRamShift   ? 64 << chrRamShift   : 0;
+  }
+  else
+  {
+    // Old dumping tools wrote their name in bytes 7-15, the upper mapper nibble is garbage then
+    if (header[12] || header[13] || header[14] || header[15])
+      mapper &= 0x0F;
+
+    prgSize    = header[4] * (u64)0x4000;
+    chrSize    = header[5] * (u64)0x2000;
+    prgRamSize = (header[8] ? header[8] : 1) * 0x2000; // 0 means 8KB for compatibility
+    chrRamSize = chrSize == 0 ? 0x2000 : 0;
+  }
+
+  if (prgSize < 0x100)
+    return Fail("The rom has no PRG ROM");
+
+  // The PPU maps CHR in 1KB pages, NES 2.0 sizes can go below one
+  if (chrSize != 0 && chrSize < 0x400)
+    return Fail("The rom's CHR ROM is smaller than a 1KB bank");
+
+  if (prgSize > size || chrSize > size)
+    return Fail("The rom is truncated, the header asks for more PRG/CHR data than the file holds");
+
+  u64 offset = headerSize;
+
+  if (header[6] & 0x04)
+  {
+    trainer = data + offset;
+    offset += trainerSize;
+  }
+
+  if (offset + prgSize + chrSize > size)
+    return Fail("The rom is truncated, the header asks for more PRG/CHR data than the file holds");
+
+  prgRom     = data + offset;
+  prgRomSize = (u32)prgSize;
+  chrRom     = chrSize ? data + offset + prgSize : nullptr;
+  chrRomSize = (u32)chrSize;
+
+  return true;
+}
+
+bool Rom::Fail(const std::string &message)
+{
+  error = message;
+
+  return false;
+}
+
+const std::string &Rom::GetError() const
+{
+  return error;
+}
+
+Rom::Format Rom::GetFormat() const
+{
+  return format;
+}
+
+u16 Rom::GetMapper() const
+{
+  return mapper;
+}
+
+u8 Rom::GetSubmapper() const
+{
+  return submapper;
+}
+
+Rom::Mirroring Rom::GetMirroring() const
+{
+  return mirroring;
+}
+
+bool Rom::HasBattery() const
+{
+  return battery;
+}
+
+const u8 *Rom::GetTrainer() const
+{
+  return trainer;
+}
+
+const u8 *Rom::GetPrgRom() const
+{
+  return prgRom;
+}
+
+u32 Rom::GetPrgRomSize() const
+{
+  return prgRomSize;
+}
+
+const u8 *Rom::GetChrRom() const
+{
+  return chrRom;
+}
+
+u32 Rom::GetChrRomSize() const
+{
+  return chrRomSize;
+}
+
+u32 Rom::GetPrgRamSize() const
+{
+  return prgRamSize;
+}
+
+u32 Rom::GetChrRamSize() const
+{
+  return chrRamSize;
+}
@@ -0,0 +1,85 @@
+#ifndef __ROM_H__
+#define __ROM_H__
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "types.hpp"
+
+/* iNES / NES 2.0 cartridge image. The file is memory mapped read only and the PRG and CHR
+   banks point straight into the mapping, nothing is copied. Instances that share a Rom
+   share its pages, the OS loads them on first access. */
+class Rom {
+public:
+  enum class Format : u8 {
+    INes,
+    Nes20
+  };
+
+  enum class Mirroring : u8 {
+    Horizontal,
+    Vertical,
+    FourScreen
+  };
+
+  Rom();
+  ~Rom();
+
+  Rom(const Rom &) = delete;
+  Rom &operator=(const Rom &) = delete;
+
+  // Maps and validates romFile. Returns false and sets GetError() when it can't be used.
+  bool Load                  (const std::string &romFile);
+  void Close                 ();
+
+  const std::string &GetError() const;
+
+  Format    GetFormat        () const;
+  u16       GetMapper        () const;
+  u8        GetSubmapper     () const;
+  Mirroring GetMirroring     () const;
+  bool      HasBattery       () const;
+
+  const u8 *GetTrainer       () const; // 512 bytes loaded at 0x7000, null when there is none
+  const u8 *GetPrgRom        () const;
+  u32       GetPrgRomSize    () const;
+  const u8 *GetChrRom        () const; // Null when the board uses CHR RAM
+  u32       GetChrRomSize    () const;
+  u32       GetPrgRamSize    () const; // Work RAM plus battery backed RAM
+  u32       GetChrRamSize    () const;
+
+private:
+  static const u32 headerSize  = 16;
+  static const u32 trainerSize = 512;
+
+  /* Mapping */
+  const u8 *data;
+  size_t    size;
+#ifdef _WIN32
+  void     *file;    // HANDLE
+  void     *mapping; // HANDLE
+#endif
+
+  /* Header */
+  Format    format;
+  u16       mapper;
+  u8        submapper;
+  Mirroring mirroring;
+  bool      battery;
+  const u8 *trainer;
+  const u8 *prgRom;
+  u32       prgRomSize;
+  const u8 *chrRom;
+  u32       chrRomSize;
+  u32       prgRamSize;
+  u32       chrRamSize;
+
+  std::string error;
+
+  bool Map                   (const std::string &romFile);
+  bool ParseHeader           ();
+  bool Fail                  (const std::string &message);
+};
+
+#endif //__ROM_H__
@@ -0,0 +1,191 @@
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Copied with memcpy and read from a mapping, so plain data only
+static_assert(std::is_trivially_copyable<SaveState>::value, "save states are copied as bytes");
+static_assert(std::is_standard_layout<SaveState>::value, "save state sections are found with offsetof");
+
+/* SaveState */
+namespace
+{
+  // Every state carries the table. A section that changes size or moves makes older states
+  // fail Check even when the version wasn't bumped.
+  const SaveState::Section sections[(u32)SaveState::SectionId::Count] = {
+    { SaveState::SectionId::Cpu   , offsetof(SaveState, cpu   ), sizeof(Cpu::Snapshot)    },
+    { SaveState::SectionId::Ppu   , offsetof(SaveState, ppu   ), sizeof(Ppu::Snapshot)    },
+    { SaveState::SectionId::Apu   , offsetof(SaveState, apu   ), sizeof(Apu::Snapshot)    },
+    { SaveState::SectionId::Mapper, offsetof(SaveState, mapper), sizeof(Mapper::Snapshot) }
+  };
+}
+
+void SaveState::Stamp(const Rom *rom)
+{
+  header.magic    = magic;
+  header.version  = version;
+  header.size     = sizeof(SaveState);
+  header.mapper   = rom ? rom->GetMapper() : noMapper;
+  header.reserved = 0;
+  header.prgSize  = rom ? rom->GetPrgRomSize() : 0;
+  header.chrSize  = rom && rom->GetChrRom() ? rom->GetChrRomSize() : 0;
+
+  memcpy(header.sections, sections, sizeof(sections));
+}
+
+const char *SaveState::Check(const Rom *rom) const
+{
+  if (header.magic != magic)
+    return "not a save state";
+
+  if (header.version != version || header.size != sizeof(SaveState) || memcmp(header.sections, sections, sizeof(sections)) != 0)
+    return "saved by another version";
+
+  if (header.mapper  != (rom ? rom->GetMapper() : noMapper) ||
+      header.prgSize != (rom ? rom->GetPrgRomSize() : 0) ||
+      header.chrSize != (rom && rom->GetChrRom() ? rom->GetChrRomSize() : 0))
+    return "saved with another cartridge";
+
+  return nullptr;
+}
+
+/* StateFile */
+StateFile::StateFile()
+{
+  data = nullptr;
+  size = 0;
+#ifdef _WIN32
+  file    = INVALID_HANDLE_VALUE;
+  mapping = nullptr;
+#endif
+
+  Close();
+}
+
+StateFile::~StateFile()
+{
+  Close();
+}
+
+bool StateFile::Load(const std::string &stateFile)
+{
+  Close();
+
+#ifdef _WIN32
+  file = CreateFileA(stateFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+  if (file == INVALID_HANDLE_VALUE)
+    return Fail("Can't open the file");
+
+  LARGE_INTEGER fileSize;
+
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart != sizeof(SaveState))
+    return Fail("The file isn't a save state of this version");
+
+  size    = (size_t)fileSize.QuadPart;
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+  if (!mapping)
+    return Fail("Can't map the file");
+
+  data = (const u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+  if (!data)
+    return Fail("Can't map the file");
+#else
+  int fd = open(stateFile.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return Fail("Can't open the file");
+
+  struct stat status;
+
+  if (fstat(fd, &status) != 0 || status.st_size != (off_t)sizeof(SaveState))
+  {
+    close(fd);
+    return Fail("The file isn't a save state of this version");
+  }
+
+  void *view = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd); // The mapping keeps the file alive
+
+  if (view == MAP_FAILED)
+    return Fail("Can't map the file");
+
+  data = (const u8 *)view;
+  size = status.st_size;
+#endif
+
+  // Any cartridge will do here, Cpu::Restore checks it's the loaded one
+  const SaveState *state = Get();
+
+  if (state->header.magic != SaveState::magic || state->header.version != SaveState::version)
+    return Fail("The file isn't a save state of this version");
+
+  return true;
+}
+
+void StateFile::Close()
+{
+#ifdef _WIN32
+  if (data)
+    UnmapViewOfFile(data);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+
+  file    = INVALID_HANDLE_VALUE;
+  mapping = nullptr;
+#else
+  if (data)
+    munmap(const_cast<u8 *>(data), size);
+#endif
+
+  data = nullptr;
+  size = 0;
+
+  error.clear();
+}
+
+bool StateFile::Save(const std::string &stateFile, const SaveState &state)
+{
+  FILE *file = fopen(stateFile.c_str(), "wb");
+
+  if (!file)
+    return false;
+
+  bool written = fwrite(&state, 1, sizeof(state), file) == sizeof(state);
+
+  return fclose(file) == 0 && written;
+}
+
+const SaveState *StateFile::Get() const
+{
+  return (const SaveState *)data;
+}
+
+const std::string &StateFile::GetError() const
+{
+  return error;
+}
+
+bool StateFile::Fail(const std::string &message)
+{
+  Close();
+  error = message;
+
+  return false;
+}
@@ -0,0 +1,93 @@
+#ifndef __SAVESTATE_H__
+#define __SAVESTATE_H__
+
+#pragma once
+
+#include <string>
+#include "apu.hpp"
+#include "cpu.hpp"
+#include "mapper.hpp"
+#include "ppu.hpp"
+#include "rom.hpp"
+#include "types.hpp"
+
+/* Snapshot of a whole machine in a fixed binary layout. The file is the struct as it is in
+   memory: a header with a table of sections, then the sections of the Cpu, the PPU, the APU
+   and the mapper, each a plain copy of the component's state in host byte order. Loading
+   maps the file, checks the header and copies every section back, nothing is parsed.
+
+   A section that changes changes the size of the struct, which has to come with a new
+   version: states of other versions are refused. */
+struct SaveState {
+  static const u32 magic    = 0x5353454E; // "NESS"
+  static const u32 version  = 2;
+  static const u16 noMapper = 0xFFFF;     // Saved without a cartridge
+
+  enum class SectionId : u32 {
+    Cpu,
+    Ppu,
+    Apu,
+    Mapper,
+    Count
+  };
+
+  struct Section {
+    SectionId id;
+    u32       offset; // From the start of the state
+    u32       size;
+  };
+
+  struct Header {
+    u32     magic;
+    u32     version;
+    u32     size;     // Of the whole state
+    u16     mapper;   // The cartridge a state fits, noMapper without one
+    u16     reserved;
+    u32     prgSize;
+    u32     chrSize;  // 0 for CHR RAM
+    Section sections[(u32)SectionId::Count];
+  };
+
+  Header           header;
+  Cpu::Snapshot    cpu;
+  Ppu::Snapshot    ppu;
+  Apu::Snapshot    apu;
+  Mapper::Snapshot mapper;
+
+  void        Stamp(const Rom *rom);       // Fills the header for a state of rom, null without a cartridge
+  const char *Check(const Rom *rom) const; // Null when the state fits rom, why it doesn't otherwise
+};
+
+/* Save state file, mapped read only. Restoring from Get copies the sections straight out of
+   the mapping. */
+class StateFile {
+public:
+  StateFile();
+  ~StateFile();
+
+  StateFile(const StateFile &) = delete;
+  StateFile &operator=(const StateFile &) = delete;
+
+  // Maps stateFile and checks its header. Returns false and sets GetError() when it isn't a state of this version.
+  bool Load                  (const std::string &stateFile);
+  void Close                 ();
+
+  static bool Save           (const std::string &stateFile, const SaveState &state);
+
+  const SaveState   *Get     () const; // Null until Load succeeds
+  const std::string &GetError() const;
+
+private:
+  const u8 *data;
+  size_t    size;
+#ifdef _WIN32
+  void     *file;    // HANDLE
+  void     *mapping; // HANDLE
+#endif
+
+  std::string error;
+
+  bool Fail                  (const std::string &message);
+};
+
+#endif //__SAVESTATE_H__
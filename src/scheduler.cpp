@@ -0,0 +1,132 @@
+#include "scheduler.hpp"
+
+Scheduler::Scheduler()
+{
+  Clear();
+}
+
+void Scheduler::Schedule(Event event, s64 time)
+{
+  u8 position = positions[(u32)event];
+
+  if (position == none)
+  {
+    Place(size, { time, event });
+    SiftUp(size++);
+    return;
+  }
+
+  s64 previous = heap[position].time;
+
+  heap[position].time = time;
+
+  if (time < previous)
+    SiftUp(position);
+  else
+    SiftDown(position);
+}
+
+void Scheduler::Cancel(Event event)
+{
+  u8 position = positions[(u32)event];
+
+  if (position != none)
+    Remove(position);
+}
+
+void Scheduler::Clear()
+{
+  size = 0;
+
+  for (u32 i = 0; i < count; ++i)
+    positions[i] = none;
+}
+
+bool Scheduler::IsPending(Event event) const
+{
+  return positions[(u32)event] != none;
+}
+
+s64 Scheduler::GetTime(Event event) const
+{
+  u8 position = positions[(u32)event];
+
+  return position != none ? heap[position].time : never;
+}
+
+bool Scheduler::Pop(s64 now, Event &event)
+{
+  if (size == 0 || heap[0].time > now)
+    return false;
+
+  event = heap[0].event;
+  Remove(0);
+
+  return true;
+}
+
+void Scheduler::Place(u32 index, const Entry &entry)
+{
+  heap[index]                 = entry;
+  positions[(u32)entry.event] = (u8)index;
+}
+
+void Scheduler::SiftUp(u32 index)
+{
+  Entry entry = heap[index];
+
+  while (index > 0)
+  {
+    u32 parent = (index - 1) / 2;
+
+    if (heap[parent].time <= entry.time)
+      break;
+
+    Place(index, heap[parent]);
+    index = parent;
+  }
+
+  Place(index, entry);
+}
+
+void Scheduler::SiftDown(u32 index)
+{
+  Entry entry = heap[index];
+
+  for (;;)
+  {
+    u32 child = index * 2 + 1;
+
+    if (child >= size)
+      break;
+
+    if (child + 1 < size && heap[child + 1].time < heap[child].time)
+      child++;
+
+    if (entry.time <= heap[child].time)
+      break;
+
+    Place(index, heap[child]);
+    index = child;
+  }
+
+  Place(index, entry);
+}
+
+// The last entry fills the hole and moves whichever way its time says
+void Scheduler::Remove(u32 index)
+{
+  positions[(u32)heap[index].event] = none;
+
+  if (--size == index)
+    return;
+
+  s64 time = heap[index].time;
+
+  Place(index, heap[size]);
+
+  if (heap[index].time < time)
+    SiftUp(index);
+  else
+    SiftDown(index);
+}
@@ -0,0 +1,64 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#pragma once
+
+#include "types.hpp"
+
+/* Pending events on the master clock, the CPU cycle count. Every kind is pending at most once,
+   scheduling it again moves it. A binary min-heap on the time keeps the next one at the top:
+   the CPU runs uninterrupted up to it, the components it concerns catch up there and the CPU
+   looks at its interrupt lines. Between events nothing is polled. */
+class Scheduler {
+public:
+  enum class Event : u8 {
+    Vblank,     // The PPU sets the vblank flag, raising NMI when PPUCTRL enables it
+    SpriteZero, // The PPU reaches the line where sprite 0 can hit
+    FrameIrq,   // The APU frame counter raises its interrupt
+    DmcIrq,     // The APU DMC fetches the last byte of a sample
+    MapperIrq,  // The cartridge counter raises its interrupt
+    Dma,        // OAM DMA, the CPU stops while 256 bytes are copied
+    Count
+  };
+
+  static const s64 never = INT64_MAX; // Time of an event that isn't pending
+
+  Scheduler();
+
+  void Schedule   (Event event, s64 time); // Replaces the pending one of the same kind
+  void Cancel     (Event event);
+  void Clear      ();
+
+  bool IsPending  (Event event) const;
+  s64  GetTime    (Event event) const;     // never when it isn't pending
+
+  FORCEINLINE s64 GetNextTime() const;     // never when nothing is pending
+
+  // Takes the earliest event due at now or before, false when there is none
+  bool Pop        (s64 now, Event &event);
+
+private:
+  static const u32 count = (u32)Event::Count;
+  static const u8  none  = 0xFF;
+
+  struct Entry {
+    s64   time;
+    Event event;
+  };
+
+  Entry heap     [count];
+  u8    positions[count]; // Heap index of each kind, none when it isn't pending
+  u32   size;
+
+  void Place   (u32 index, const Entry &entry);
+  void SiftUp  (u32 index);
+  void SiftDown(u32 index);
+  void Remove  (u32 index);
+};
+
+FORCEINLINE s64 Scheduler::GetNextTime() const
+{
+  return size ? heap[0].time : never;
+}
+
+#endif //__SCHEDULER_H__
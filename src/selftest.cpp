@@ -0,0 +1,3007 @@
+#include "selftest.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+#include "apu.hpp"
+#include "audio.hpp"
+#include "batch.hpp"
+#include "cpu.hpp"
+#include "jit.hpp"
+#include "lockstep.hpp"
+#include "movie.hpp"
+#include "opcodes.hpp"
+#include "palette.hpp"
+#include "ppu.hpp"
+#include "rewind.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+#include "tiles.hpp"
+#include "tracer.hpp"
+
+namespace
+{
+  const u8 flagC = 0x01;
+  const u8 flagZ = 0x02;
+  const u8 flagB = 0x10;
+  const u8 flagU = 0x20;
+  const u8 flagV = 0x40;
+  const u8 flagN = 0x80;
+
+  const u16 programStart = 0x0200;
+  const u8  zeroPage     = 0x10;
+  const u8  branchOffset = 0x10;
+
+  struct Expected {
+    u8 A;
+    u8 X;
+    u8 Y;
+    u8 P;
+    u8 M;
+  };
+
+  /* Eager reference model, flags are computed right away the way the Cpu used to */
+  void SetFlag(Expected &e, u8 flag, bool value)
+  {
+    e.P = value ? (e.P | flag) : (e.P & ~flag);
+  }
+
+  void SetZN(Expected &e, u8 value)
+  {
+    SetFlag(e, flagZ, value == 0);
+    SetFlag(e, flagN, (value & 0x80) == 0x80);
+  }
+
+  void AddWithCarry(Expected &e, u8 value)
+  {
+    bool carry     = (e.P & flagC) == flagC;
+    s32  signedSum = (s8)e.A + (s8)value + carry;
+    u32  sum       = e.A + value + carry;
+
+    SetFlag(e, flagV, signedSum < -128 || signedSum > 127);
+    SetFlag(e, flagC, sum > 0xFF);
+    e.A = (u8)sum;
+    SetZN(e, e.A);
+  }
+
+  void Compare(Expected &e, u8 reg, u8 value)
+  {
+    SetFlag(e, flagC, reg >= value);
+    SetZN(e, (u8)(reg - value));
+  }
+
+  // Every instruction starts with A = X = Y = a and M = m as its operand, the byte
+  // in zero page or the byte on top of the stack.
+  Expected Reference(u8 opcode, u8 a, u8 m, u8 p)
+  {
+    Expected e = { a, a, a, p, m };
+    bool     carry = (p & flagC) == flagC;
+
+    switch (opcode)
+    {
+    case 0x69: AddWithCarry(e, m);  break;              // ADC #
+    case 0xE9: AddWithCarry(e, ~m); break;              // SBC #
+    case 0xC9: Compare(e, e.A, m); break;               // CMP #
+    case 0xE0: Compare(e, e.X, m); break;               // CPX #
+    case 0xC0: Compare(e, e.Y, m); break;               // CPY #
+    case 0x29: e.A &= m; SetZN(e, e.A); break;          // AND #
+    case 0x09: e.A |= m; SetZN(e, e.A); break;          // ORA #
+    case 0x49: e.A ^= m; SetZN(e, e.A); break;          // EOR #
+    case 0xA9: e.A  = m; SetZN(e, e.A); break;          // LDA #
+    case 0xA2: e.X  = m; SetZN(e, e.X); break;          // LDX #
+    case 0xA0: e.Y  = m; SetZN(e, e.Y); break;          // LDY #
+    case 0x24:                                          // BIT zp
+      SetFlag(e, flagZ, (e.A & m) == 0);
+      SetFlag(e, flagV, (m & flagV) == flagV);
+      SetFlag(e, flagN, (m & flagN) == flagN);
+      break;
+    case 0x0A:                                          // ASL A
+      SetFlag(e, flagC, (a & 0x80) == 0x80);
+      e.A = a << 1;
+      SetZN(e, e.A);
+      break;
+    case 0x4A:                                          // LSR A
+      SetFlag(e, flagC, (a & 0x01) == 0x01);
+      e.A = a >> 1;
+      SetZN(e, e.A);
+      break;
+    case 0x2A:                                          // ROL A
+      SetFlag(e, flagC, (a & 0x80) == 0x80);
+      e.A = (a << 1) | (carry ? 0x01 : 0x00);
+      SetZN(e, e.A);
+      break;
+    case 0x6A:                                          // ROR A
+      SetFlag(e, flagC, (a & 0x01) == 0x01);
+      e.A = (a >> 1) | (carry ? 0x80 : 0x00);
+      SetZN(e, e.A);
+      break;
+    case 0xE6: e.M++; SetZN(e, e.M); break;             // INC zp
+    case 0xC6: e.M--; SetZN(e, e.M); break;             // DEC zp
+    case 0xE8: e.X++; SetZN(e, e.X); break;             // INX
+    case 0xC8: e.Y++; SetZN(e, e.Y); break;             // INY
+    case 0xCA: e.X--; SetZN(e, e.X); break;             // DEX
+    case 0x88: e.Y--; SetZN(e, e.Y); break;             // DEY
+    case 0xAA: e.X = e.A; SetZN(e, e.X); break;         // TAX
+    case 0xA8: e.Y = e.A; SetZN(e, e.Y); break;         // TAY
+    case 0x8A: e.A = e.X; SetZN(e, e.A); break;         // TXA
+    case 0x98: e.A = e.Y; SetZN(e, e.A); break;         // TYA
+    case 0x18: SetFlag(e, flagC, false); break;         // CLC
+    case 0x38: SetFlag(e, flagC, true);  break;         // SEC
+    case 0xB8: SetFlag(e, flagV, false); break;         // CLV
+    case 0x68: e.A = m; SetZN(e, e.A); break;           // PLA
+    case 0x28: e.P = (m & ~flagB) | flagU; break;       // PLP
+    }
+
+    return e;
+  }
+
+  enum class Operand : u8 { None, Immediate, ZeroPage };
+
+  const struct { u8 opcode; Operand operand; } instructions[] = {
+    { 0x69, Operand::Immediate }, { 0xE9, Operand::Immediate }, { 0xC9, Operand::Immediate },
+    { 0xE0, Operand::Immediate }, { 0xC0, Operand::Immediate }, { 0x29, Operand::Immediate },
+    { 0x09, Operand::Immediate }, { 0x49, Operand::Immediate }, { 0xA9, Operand::Immediate },
+    { 0xA2, Operand::Immediate }, { 0xA0, Operand::Immediate }, { 0x24, Operand::ZeroPage  },
+    { 0x0A, Operand::None      }, { 0x4A, Operand::None      }, { 0x2A, Operand::None      },
+    { 0x6A, Operand::None      }, { 0xE6, Operand::ZeroPage  }, { 0xC6, Operand::ZeroPage  },
+    { 0xE8, Operand::None      }, { 0xC8, Operand::None      }, { 0xCA, Operand::None      },
+    { 0x88, Operand::None      }, { 0xAA, Operand::None      }, { 0xA8, Operand::None      },
+    { 0x8A, Operand::None      }, { 0x98, Operand::None      }, { 0x18, Operand::None      },
+    { 0x38, Operand::None      }, { 0xB8, Operand::None      }, { 0x68, Operand::None      },
+    { 0x28, Operand::None      },
+  };
+
+  /* Branch opcodes and the flag they test, the branch is taken when the flag equals set */
+  const struct { u8 opcode; u8 flag; bool set; } branches[] = {
+    { 0x10, flagN, false }, { 0x30, flagN, true }, // BPL, BMI
+    { 0x50, flagV, false }, { 0x70, flagV, true }, // BVC, BVS
+    { 0x90, flagC, false }, { 0xB0, flagC, true }, // BCC, BCS
+    { 0xD0, flagZ, false }, { 0xF0, flagZ, true }, // BNE, BEQ
+  };
+
+  // Runs every flag producing instruction over all accumulator/operand pairs and a
+  // set of incoming status bytes. Flags are read back both through the packed status
+  // and through the eight conditional branches, the two ways the Cpu consumes them.
+  int FlagsSelfTest()
+  {
+    const u8 statuses[] = { 0x24, 0x25, 0xE6, 0xE7 }; // I and U set, C/Z/V/N clear or set
+
+    Cpu *cpu      = new Cpu();
+    u32  checks   = 0;
+    u32  failures = 0;
+
+    for (const auto &instruction : instructions)
+    {
+      u8  opcode = instruction.opcode;
+      u16 branch = programStart + (instruction.operand == Operand::None ? 1 : 2);
+
+      cpu->WriteMemory(programStart,     opcode);
+      cpu->WriteMemory(programStart + 1, zeroPage);
+      cpu->WriteMemory(branch + 1,       branchOffset);
+
+      for (u32 pair = 0; pair < 0x10000; ++pair)
+      {
+        u8 a = pair >> 8;
+        u8 m = pair & 0xFF;
+
+        if (instruction.operand == Operand::Immediate)
+          cpu->WriteMemory(programStart + 1, m);
+
+        for (u8 p : statuses)
+        {
+          Expected e = Reference(opcode, a, m, p);
+
+          for (const auto &b : branches)
+          {
+            bool taken  = ((e.P & b.flag) == b.flag) == b.set;
+            u16  target = branch + 2 + (taken ? branchOffset : 0);
+
+            cpu->WriteMemory(zeroPage, m);
+            cpu->WriteMemory(0x01FE,   m);
+            cpu->WriteMemory(branch,   b.opcode);
+            cpu->SetState({ programStart, 0xFD, a, a, a, p, 0 });
+            cpu->RunInstructions(1);
+
+            Cpu::State s = cpu->GetState();
+
+            ++checks;
+            if (s.A != e.A || s.X != e.X || s.Y != e.Y || s.P != e.P || cpu->ReadMemory(zeroPage) != e.M)
+            {
+              if (failures++ < 16)
+                printf("%02X A:%02X M:%02X P:%02X -> A:%02X X:%02X Y:%02X P:%02X, expected A:%02X X:%02X Y:%02X P:%02X\n",
+                       opcode, a, m, p, s.A, s.X, s.Y, s.P, e.A, e.X, e.Y, e.P);
+              break;
+            }
+
+            cpu->RunInstructions(1);
+
+            ++checks;
+            if (cpu->GetPC() != target)
+            {
+              if (failures++ < 16)
+                printf("%02X A:%02X M:%02X P:%02X then branch %02X -> PC:%04X, expected PC:%04X\n",
+                       opcode, a, m, p, b.opcode, cpu->GetPC(), target);
+            }
+          }
+        }
+      }
+    }
+
+    printf("flags: %u checks, %u failures\n", checks, failures);
+
+    delete cpu;
+
+    return failures == 0 ? 0 : 1;
+  }
+
+  /* nestest automation mode */
+  const u16 nestestStart        = 0xC000;
+  const u16 nestestEnd          = 0xC66E; // Final RTS, reached after nestestInstructions
+  const u32 nestestInstructions = 8990;
+  const u32 contextBefore       = 8;      // Matching lines shown before a divergence
+  const u32 contextAfter        = 3;      // Reference lines shown after it
+
+  /* One line of nestest.log:
+     C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7 */
+  struct LogEntry {
+    u16  PC;
+    u8   A;
+    u8   X;
+    u8   Y;
+    u8   P;
+    u8   SP;
+    s32  cycleCount;
+    bool hasCycles; // Older logs count PPU dots in CYC, only the ones with a PPU field count CPU cycles
+  };
+
+  bool ParseLogLine(const char *line, LogEntry &entry)
+  {
+    unsigned pc, a, x, y, p, sp;
+    int      cycles;
+
+    const char *registers = strstr(line, " A:");
+
+    if (sscanf(line, "%4x", &pc) != 1 || !registers ||
+        sscanf(registers, " A:%x X:%x Y:%x P:%x SP:%x", &a, &x, &y, &p, &sp) != 5)
+      return false;
+
+    const char *cycleField = strstr(registers, "CYC:");
+
+    entry.PC         = pc;
+    entry.A          = a;
+    entry.X          = x;
+    entry.Y          = y;
+    entry.P          = p;
+    entry.SP         = sp;
+    entry.hasCycles  = cycleField && strstr(registers, "PPU:") && sscanf(cycleField, "CYC:%d", &cycles) == 1;
+    entry.cycleCount = entry.hasCycles ? cycles : 0;
+
+    return true;
+  }
+
+  TraceRecord RecordState(const Cpu &cpu)
+  {
+    Cpu::State  state  = cpu.GetState();
+    TraceRecord record = {};
+    u8          bytes  = opcodeInfo[cpu.ReadMemory(state.PC)].bytes;
+
+    record.cycleCount  = state.cycleCount;
+    record.PC          = state.PC;
+    record.opcode      = cpu.ReadMemory(state.PC);
+    record.operands[0] = bytes > 1 ? cpu.ReadMemory(state.PC + 1) : 0;
+    record.operands[1] = bytes > 2 ? cpu.ReadMemory(state.PC + 2) : 0;
+    record.A           = state.A;
+    record.X           = state.X;
+    record.Y           = state.Y;
+    record.P           = state.P;
+    record.SP          = state.SP;
+
+    return record;
+  }
+
+  // Returns false when any field differs, print lists them
+  bool CompareEntry(const LogEntry &expected, const TraceRecord &actual, bool print)
+  {
+    bool same = true;
+
+    auto check = [&same, print](const char *name, int expectedValue, int actualValue, const char *format) {
+      if (expectedValue == actualValue)
+        return;
+
+      same = false;
+
+      if (!print)
+        return;
+
+      printf("  %-3s expected ", name);
+      printf(format, expectedValue);
+      printf(", emulated ");
+      printf(format, actualValue);
+      printf("\n");
+    };
+
+    check("PC" , expected.PC, actual.PC, "%04X");
+    check("A"  , expected.A , actual.A , "%02X");
+    check("X"  , expected.X , actual.X , "%02X");
+    check("Y"  , expected.Y , actual.Y , "%02X");
+    check("P"  , expected.P , actual.P , "%02X");
+    check("SP" , expected.SP, actual.SP, "%02X");
+
+    if (expected.hasCycles)
+      check("CYC", expected.cycleCount, (int)actual.cycleCount, "%d");
+
+    return same;
+  }
+
+  // Every test leaves an error code in 0x02 (official opcodes) and 0x03 (unofficial opcodes)
+  int CheckNestestResult(const Cpu &cpu)
+  {
+    u8 official   = cpu.ReadMemory(0x02);
+    u8 unofficial = cpu.ReadMemory(0x03);
+
+    printf("nestest: result $02=%02X $03=%02X\n", official, unofficial);
+
+    return official == 0 && unofficial == 0 ? 0 : 1;
+  }
+
+  // Runs nestest in automation mode. With a reference log every instruction is compared
+  // against its line as the log is read, stopping at the first divergence. Without one
+  // only the end point and the result codes are checked.
+  int NestestSelfTest(const std::string &romFile, const std::string &reference)
+  {
+    Cpu *cpu = new Cpu();
+
+    if (!LoadNestest(*cpu, romFile))
+    {
+      delete cpu;
+      return 1;
+    }
+
+    if (reference.empty())
+    {
+      cpu->RunInstructions(nestestInstructions);
+
+      int result = CheckNestestResult(*cpu);
+
+      if (cpu->GetPC() != nestestEnd)
+      {
+        printf("nestest: ended at %04X instead of %04X\n", cpu->GetPC(), nestestEnd);
+        result = 1;
+      }
+
+      delete cpu;
+
+      return result;
+    }
+
+    FILE *log = fopen(reference.c_str(), "r");
+
+    if (!log)
+    {
+      printf("Can't open %s\n", reference.c_str());
+      delete cpu;
+      return 1;
+    }
+
+    std::deque<std::string> context;
+    char                    line[256];
+    char                    text[128];
+    u32                     lineNumber = 0;
+    u32                     compared   = 0;
+    int                     result     = 0;
+
+    while (fgets(line, sizeof(line), log))
+    {
+      LogEntry expected;
+
+      ++lineNumber;
+
+      if (!ParseLogLine(line, expected))
+        continue;
+
+      TraceRecord actual = RecordState(*cpu);
+
+      if (!CompareEntry(expected, actual, false))
+      {
+        printf("nestest: diverged at instruction %u, %s line %u\n", compared + 1, reference.c_str(), lineNumber);
+
+        CompareEntry(expected, actual, true);
+
+        for (const std::string &previous : context)
+          printf("   %s", previous.c_str());
+
+        Tracer::Format(actual, text, sizeof(text));
+        printf("-  %s", line);
+        printf("+  %s", text);
+
+        for (u32 i = 0; i < contextAfter && fgets(line, sizeof(line), log); ++i)
+          printf("   %s", line);
+
+        result = 1;
+        break;
+      }
+
+      context.push_back(line);
+
+      if (context.size() > contextBefore)
+        context.pop_front();
+
+      cpu->RunInstructions(1);
+      ++compared;
+    }
+
+    fclose(log);
+
+    if (result == 0)
+    {
+      printf("nestest: %u instructions match %s\n", compared, reference.c_str());
+      result = CheckNestestResult(*cpu);
+    }
+
+    delete cpu;
+
+    return result;
+  }
+
+  /* Block cache */
+  const s32 blockRunCycles = 26500; // About one nestest run
+  const u32 blockPasses    = 600;
+  const u32 jitRuns        = 40;    // Blocks are compiled after nativeThreshold runs that fit a slice
+
+  bool SameState(const Cpu::State &a, const Cpu::State &b)
+  {
+    return a.PC == b.PC && a.SP == b.SP && a.A == b.A && a.X == b.X && a.Y == b.Y && a.P == b.P && a.cycleCount == b.cycleCount;
+  }
+
+  // Runs nestest through Cpu::Run with dispatch and with the switch loop, in slices of 1 to
+  // 113 cycles, comparing the registers after every slice. Every run after the first starts
+  // over with the blocks of the previous ones.
+  int CompareWithSwitch(const char *name, const std::string &romFile, Cpu::Dispatch dispatch, u32 runs, Cpu *&cpu)
+  {
+    Cpu *reference = new Cpu();
+    u32  slices    = 0;
+    int  result    = 0;
+
+    cpu = new Cpu();
+
+    if (!LoadNestest(*cpu, romFile) || !LoadNestest(*reference, romFile))
+      result = 1;
+
+    Cpu::State start = cpu->GetState();
+
+    for (u32 run = 0; run < runs && result == 0; ++run)
+    {
+      cpu->SetState(start);
+      reference->SetState(start);
+
+      for (s32 slice = 1; reference->GetCycleCount() < blockRunCycles; slice = slice % 113 + 1, ++slices)
+      {
+        s32 overshoot          = cpu->Run(slice, dispatch);
+        s32 referenceOvershoot = reference->Run(slice, Cpu::Dispatch::Switch);
+
+        Cpu::State state    = cpu->GetState();
+        Cpu::State expected = reference->GetState();
+
+        if (overshoot != referenceOvershoot || !SameState(state, expected))
+        {
+          printf("%s: run %u diverged after %u slices, PC:%04X CYC:%lld, expected PC:%04X CYC:%lld\n",
+                 name, run + 1, slices, state.PC, (long long)state.cycleCount, expected.PC, (long long)expected.cycleCount);
+          result = 1;
+          break;
+        }
+      }
+    }
+
+    for (u32 address = 0; address < 0x8000 && result == 0; ++address)
+    {
+      if (cpu->ReadMemory(address) != reference->ReadMemory(address))
+      {
+        printf("%s: memory at %04X differs from the switch loop\n", name, address);
+        result = 1;
+      }
+    }
+
+    if (result == 0)
+      printf("%s: nestest matches the switch loop over %u slices\n", name, slices);
+
+    delete reference;
+
+    return result;
+  }
+
+  // Runs a loop that rewrites its own code through a mirror of RAM on every pass
+  int SelfModifyingTest(const char *name, Cpu::Dispatch dispatch)
+  {
+    int result = 0;
+
+    // 0300: INC $0B04 ; 0x0B04 mirrors the operand of the LDX below
+    // 0303: LDX #$00
+    // 0305: JMP $0300
+    const u8 program[] = { 0xEE, 0x04, 0x0B, 0xA2, 0x00, 0x4C, 0x00, 0x03 };
+
+    Cpu *cpu = new Cpu();
+
+    for (u32 i = 0; i < sizeof(program); ++i)
+      cpu->WriteMemory(0x0300 + i, program[i]);
+
+    cpu->SetState({ 0x0300, 0xFD, 0, 0, 0, 0x24, 0 });
+
+    for (u32 pass = 1; pass <= blockPasses; ++pass)
+    {
+      // The first passes are interpreted until the block is decoded, the next ones
+      // check the write drops the block it runs in. Every pass takes 11 cycles.
+      if (pass % 2)
+        cpu->RunInstructions(3, dispatch);
+      else
+        cpu->Run(11, dispatch);
+
+      Cpu::State state = cpu->GetState();
+
+      if (state.PC != 0x0300 || state.X != (u8)pass)
+      {
+        printf("%s: self-modifying pass %u ended at PC:%04X with X:%02X, expected PC:0300 X:%02X\n",
+               name, pass, state.PC, state.X, (u8)pass);
+        result = 1;
+        break;
+      }
+    }
+
+    if (result == 0)
+      printf("%s: self-modifying code ran %u passes\n", name, blockPasses);
+
+    delete cpu;
+
+    return result;
+  }
+
+  int BlocksSelfTest(const std::string &romFile)
+  {
+    Cpu *blocks = nullptr;
+    int  result = CompareWithSwitch("blocks", romFile, Cpu::Dispatch::Block, 2, blocks);
+
+    delete blocks;
+
+    if (result != 0)
+      return result;
+
+    return SelfModifyingTest("blocks", Cpu::Dispatch::Block);
+  }
+
+  // Same as the blocks test with enough nestest runs for its loops to be compiled. Code in
+  // RAM is never compiled, the self-modifying loop checks it still runs from decoded ops.
+  int JitSelfTest(const std::string &romFile)
+  {
+    Cpu *jit      = nullptr;
+    int  result   = CompareWithSwitch("jit", romFile, Cpu::Dispatch::Jit, jitRuns, jit);
+    u32  compiled = jit->GetNativeBlockCount();
+
+    delete jit;
+
+    if (result != 0)
+      return result;
+
+#ifdef NESEMU_JIT_X64
+    if (compiled == 0)
+    {
+      printf("jit: no block was compiled\n");
+      return 1;
+    }
+#endif
+
+    printf("jit: %u native blocks\n", compiled);
+
+    return SelfModifyingTest("jit", Cpu::Dispatch::Jit);
+  }
+
+  // Same as the blocks test on the routines nestest was recompiled into ahead of time. Code in
+  // RAM is never translated, the self-modifying loop runs on the interpreter.
+  int AotSelfTest(const std::string &romFile)
+  {
+    Cpu *aot    = nullptr;
+    int  result = CompareWithSwitch("aot", romFile, Cpu::Dispatch::Static, 2, aot);
+    bool linked = aot->HasStaticProgram();
+
+    delete aot;
+
+    if (result != 0)
+      return result;
+
+    if (!linked)
+    {
+      printf("aot: %s wasn't recompiled into this build\n", romFile.c_str());
+      return 1;
+    }
+
+    return SelfModifyingTest("aot", Cpu::Dispatch::Static);
+  }
+
+  /* PPU */
+  const u32 ppuFrames = 4;
+  const u32 ppuDots   = ppuFrames * Ppu::dotsPerScanline * Ppu::scanlinesPerFrame + 242 * Ppu::dotsPerScanline; // Ends in vblank
+
+  void SetPpuAddress(Ppu &ppu, u16 address)
+  {
+    ppu.ReadRegister(0x2002); // Resets the write toggle
+    ppu.WriteRegister(0x2006, address >> 8);
+    ppu.WriteRegister(0x2006, address & 0xFF);
+  }
+
+  // PPUDATA buffering, palette mirrors and the vblank flag
+  int PpuRegisterTest()
+  {
+    Ppu *ppu    = new Ppu();
+    int  result = 0;
+
+    SetPpuAddress(*ppu, 0x2400);
+    ppu->WriteRegister(0x2007, 0x12);
+    ppu->WriteRegister(0x2007, 0x34);
+    SetPpuAddress(*ppu, 0x3F00);
+    ppu->WriteRegister(0x2007, 0x2A);
+
+    SetPpuAddress(*ppu, 0x2400);
+    ppu->ReadRegister(0x2007); // Fills the buffer
+
+    u8 first  = ppu->ReadRegister(0x2007);
+    u8 second = ppu->ReadRegister(0x2007);
+
+    SetPpuAddress(*ppu, 0x3F10);
+
+    u8 mirror = ppu->ReadRegister(0x200F) & 0x3F; // 0x200F mirrors 0x2007
+
+    if (first != 0x12 || second != 0x34 || mirror != 0x2A)
+    {
+      printf("ppu: PPUDATA read %02X %02X %02X, expected 12 34 2A\n", first, second, mirror);
+      result = 1;
+    }
+
+    // Vblank starts on dot 1 of line 241 and reading PPUSTATUS clears it
+    ppu->Reset();
+    ppu->Run(241 * Ppu::dotsPerScanline + 1);
+
+    u8 before = ppu->ReadRegister(0x2002);
+
+    ppu->Run(1);
+
+    u8 during = ppu->ReadRegister(0x2002);
+    u8 after  = ppu->ReadRegister(0x2002);
+
+    if ((before & 0x80) || !(during & 0x80) || (after & 0x80) || ppu->GetFrameCount() != 1)
+    {
+      printf("ppu: PPUSTATUS read %02X %02X %02X around vblank\n", before, during, after);
+      result = 1;
+    }
+
+    delete ppu;
+
+    return result;
+  }
+
+  // Draws the same scene with both renderers and compares the frames and the flags
+  int PpuSelfTest(const std::string &romFile)
+  {
+    int result = PpuRegisterTest();
+
+    for (u32 tall = 0; tall < 2 && result == 0; ++tall)
+    {
+      Ppu *scanline = new Ppu();
+
+      if (!LoadPpuScene(*scanline, romFile, tall != 0))
+      {
+        delete scanline;
+        return 1;
+      }
+
+      Ppu *dot = new Ppu(*scanline);
+
+      scanline->Run<Ppu::Renderer::Scanline>(ppuDots);
+      dot     ->Run<Ppu::Renderer::Dot>     (ppuDots);
+
+      u8 status         = scanline->ReadRegister(0x2002);
+      u8 expectedStatus = dot     ->ReadRegister(0x2002);
+      u32 pixels        = Ppu::width * Ppu::height;
+      u32 differ        = 0;
+      u32 backdrop      = 0;
+
+      for (u32 i = 0; i < pixels; ++i)
+      {
+        differ   += scanline->GetFrame()[i] != dot->GetFrame()[i];
+        backdrop += scanline->GetFrame()[i] == scanline->ReadMemory(0x3F00);
+      }
+
+      const char *sprites = tall ? "8x16" : "8x8";
+
+      if (differ != 0 || status != expectedStatus || scanline->GetFrameCount() != dot->GetFrameCount() ||
+          scanline->GetScanline() != dot->GetScanline() || scanline->GetDot() != dot->GetDot())
+      {
+        printf("ppu: %s renderers differ on %u pixels, status %02X and %02X, at %u,%u and %u,%u\n", sprites, differ,
+               status, expectedStatus, scanline->GetScanline(), scanline->GetDot(), dot->GetScanline(), dot->GetDot());
+        result = 1;
+      }
+      else if (backdrop == pixels || (status & 0xC0) != 0xC0 || scanline->GetFrameCount() != ppuFrames + 1)
+      {
+        printf("ppu: %s scene drew %u backdrop pixels, status %02X after %u frames\n", sprites, backdrop, status,
+               scanline->GetFrameCount());
+        result = 1;
+      }
+      else
+        printf("ppu: %s sprites, both renderers drew the same %u frames\n", sprites, ppuFrames + 1);
+
+      delete scanline;
+      delete dot;
+    }
+
+    return result;
+  }
+
+  /* Tile cache */
+  int TileKernelTest()
+  {
+    const u32 count = TileCache::tileCount;
+
+    std::vector<u8> chr(count * 16);
+    std::vector<u8> expected(count * 64), expectedFlipped(count * 64);
+    std::vector<u8> pixels  (count * 64), flipped        (count * 64);
+
+    u32 seed = 1;
+
+    for (u8 &byte : chr)
+    {
+      seed = seed * 1103515245 + 12345;
+      byte = (u8)(seed >> 16);
+    }
+
+    // Low plane 0x55 and high plane 0x33 make the first row of tile 0 go through every pixel value twice
+    chr[0] = 0x55;
+    chr[8] = 0x33;
+
+    TileCache::Decode(TileCache::Kernel::Scalar, chr.data(), count, expected.data(), expectedFlipped.data());
+
+    const u8 row[8] = { 0, 1, 2, 3, 0, 1, 2, 3 };
+
+    if (memcmp(expected.data(), row, sizeof(row)) != 0 || expectedFlipped[7] != row[0] || expectedFlipped[6] != row[1])
+    {
+      printf("tiles: scalar decoder is wrong on the first row\n");
+      return 1;
+    }
+
+    int result = 0;
+
+    for (TileCache::Kernel kernel : { TileCache::Kernel::Sse2, TileCache::Kernel::Avx2, TileCache::Kernel::Neon })
+    {
+      const char *name = TileCache::GetKernelName(kernel);
+
+      if (!TileCache::IsSupported(kernel))
+      {
+        printf("tiles: %s isn't supported here, skipped\n", name);
+        continue;
+      }
+
+      TileCache::Decode(kernel, chr.data(), count, pixels.data(), flipped.data());
+
+      if (pixels != expected || flipped != expectedFlipped)
+      {
+        printf("tiles: %s decodes differently from the scalar kernel\n", name);
+        result = 1;
+      }
+      else
+        printf("tiles: %s matches the scalar kernel on %u tiles\n", name, count);
+    }
+
+    return result;
+  }
+
+  // CHR RAM rewritten between frames: the scanline renderer draws from the cache and the dot
+  // renderer from memory, a stale tile shows up as a difference
+  int TileCacheSelfTest()
+  {
+    int result = TileKernelTest();
+
+    Ppu *scanline = new Ppu();
+
+    if (!LoadPpuScene(*scanline, "", false))
+    {
+      delete scanline;
+      return 1;
+    }
+
+    Ppu *dot = new Ppu(*scanline);
+
+    // The first line after power on differs, the dot renderer never prefetched its first tiles.
+    // Both then run from vblank to vblank, the rewrites go in between like a game would do them.
+    scanline->Run<Ppu::Renderer::Scanline>(ppuDots);
+    dot     ->Run<Ppu::Renderer::Dot>     (ppuDots);
+
+    for (u32 frame = 0; frame < ppuFrames && result == 0; ++frame)
+    {
+      // A different row of a different tile in each pattern table every frame, through PPUDATA
+      for (Ppu *ppu : { scanline, dot })
+      {
+        for (u16 table = 0; table < 0x2000; table += 0x1000)
+        {
+          for (u32 tile = 0; tile < 256; tile += 7)
+          {
+            SetPpuAddress(*ppu, table + tile * 16 + (frame + tile) % 16);
+            ppu->WriteRegister(0x2007, (u8)(tile * 37 + frame));
+          }
+        }
+
+        ppu->WriteRegister(0x2000, 0x00);
+        ppu->WriteRegister(0x2005, 0x5B);
+        ppu->WriteRegister(0x2005, 0x2D);
+      }
+
+      scanline->Run<Ppu::Renderer::Scanline>(Ppu::dotsPerScanline * Ppu::scanlinesPerFrame);
+      dot     ->Run<Ppu::Renderer::Dot>     (Ppu::dotsPerScanline * Ppu::scanlinesPerFrame);
+
+      if (memcmp(scanline->GetFrame(), dot->GetFrame(), Ppu::width * Ppu::height * sizeof(u16)) != 0)
+      {
+        printf("tiles: frame %u differs between the renderers\n", frame);
+        result = 1;
+      }
+    }
+
+    if (result == 0)
+      printf("tiles: both renderers drew the same %u frames with CHR RAM rewrites\n", ppuFrames);
+
+    delete scanline;
+    delete dot;
+
+    return result;
+  }
+
+  /* Palette */
+  bool WritePalette(const char *palFile, u32 colors)
+  {
+    FILE *file = fopen(palFile, "wb");
+
+    if (!file)
+    {
+      printf("palette: can't write %s\n", palFile);
+      return false;
+    }
+
+    for (u32 color = 0; color < colors; ++color)
+    {
+      u8 rgb[3] = { (u8)color, (u8)(color * 3), (u8)(255 - color) };
+
+      fwrite(rgb, 1, sizeof(rgb), file);
+    }
+
+    fclose(file);
+
+    return true;
+  }
+
+  // Built in colors, .pal files of 64 and 512 colors and the emphasis variants
+  int PaletteLoadTest()
+  {
+    const char *palFile = "palette-test.pal";
+
+    Palette palette;
+    int     result = 0;
+
+    // White, then white with red emphasis dims green and blue
+    if (palette.GetRgba(0x20) != 0xFFECEEEC || palette.GetRgb565(0x20) != 0xEF7D ||
+        palette.GetRgba(0x60) != 0xFFC1C2EC)
+    {
+      printf("palette: white is %08X %04X, %08X with red emphasis\n", palette.GetRgba(0x20), palette.GetRgb565(0x20),
+             palette.GetRgba(0x60));
+      result = 1;
+    }
+
+    if (!WritePalette(palFile, 64) || !palette.Load(palFile))
+    {
+      printf("palette: 64 colors: %s\n", palette.GetError().c_str());
+      return 1;
+    }
+
+    // Color 0x10 is 10 30 EF, blue emphasis dims the first two
+    if (palette.GetRgba(0x10) != 0xFFEF3010 || palette.GetRgba(0x110) != 0xFFEF270D)
+    {
+      printf("palette: 64 colors gave %08X and %08X\n", palette.GetRgba(0x10), palette.GetRgba(0x110));
+      result = 1;
+    }
+
+    if (!WritePalette(palFile, Palette::colorCount) || !palette.Load(palFile))
+    {
+      printf("palette: 512 colors: %s\n", palette.GetError().c_str());
+      return 1;
+    }
+
+    // Entry 0x110 is taken as it is
+    if (palette.GetRgba(0x110) != 0xFFEF3010)
+    {
+      printf("palette: 512 colors gave %08X\n", palette.GetRgba(0x110));
+      result = 1;
+    }
+
+    if (!WritePalette(palFile, 100) || palette.Load(palFile))
+    {
+      printf("palette: loaded a file of 100 colors\n");
+      result = 1;
+    }
+
+    remove(palFile);
+
+    return result;
+  }
+
+  // SIMD kernels against the scalar one. The first half of the frame has a single emphasis
+  // per line, the second changes it every pixel, and the count leaves a tail for every kernel.
+  int PaletteSelfTest()
+  {
+    int result = PaletteLoadTest();
+
+    Palette palette;
+    u32     count = Ppu::width * Ppu::height + 7;
+    u32     seed  = 1;
+
+    std::vector<u16> pixels(count);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+
+      u16 emphasis = i < count / 2 ? (i / Ppu::width) & 7 : (seed >> 24) & 7;
+
+      pixels[i] = ((seed >> 16) & 0x3F) | (emphasis << 6);
+    }
+
+    std::vector<u32> expected(count), rgba(count);
+    std::vector<u16> expected565(count), rgb565(count);
+
+    palette.Convert(Palette::Kernel::Scalar, pixels.data(), count, expected.data());
+    palette.Convert(Palette::Kernel::Scalar, pixels.data(), count, expected565.data());
+
+    for (Palette::Kernel kernel : { Palette::Kernel::Avx2, Palette::Kernel::Neon })
+    {
+      const char *name = Palette::GetKernelName(kernel);
+
+      if (!Palette::IsSupported(kernel))
+      {
+        printf("palette: %s isn't supported here, skipped\n", name);
+        continue;
+      }
+
+      palette.Convert(kernel, pixels.data(), count, rgba.data());
+      palette.Convert(kernel, pixels.data(), count, rgb565.data());
+
+      if (rgba != expected || rgb565 != expected565)
+      {
+        printf("palette: %s converts differently from the scalar kernel\n", name);
+        result = 1;
+      }
+      else
+        printf("palette: %s matches the scalar kernel on %u pixels\n", name, count);
+    }
+
+    return result;
+  }
+
+  /* APU */
+  const u32 apuFrameCycles = 29830; // 4 step frame counter sequence
+
+  u8 ReadDmcPattern(void *, u16 address)
+  {
+    return 0x55 + (address & 1); // Bits that keep moving the output up and down
+  }
+
+  // Length counters, the frame and DMC interrupts and $4015
+  int ApuRegisterTest()
+  {
+    Apu *apu    = new Apu();
+    int  result = 0;
+
+    apu->WriteRegister(0x4017, 0x40); // 4 step, no interrupt
+    apu->WriteRegister(0x4015, 0x01);
+    apu->WriteRegister(0x4003, 0x18); // Length 2, two half frames
+
+    u8 loaded = apu->ReadRegister(0x4015);
+
+    apu->Run(14913);
+
+    u8 halfway = apu->ReadRegister(0x4015);
+
+    apu->Run(apuFrameCycles - 14913);
+
+    u8 expired = apu->ReadRegister(0x4015);
+
+    if (loaded != 0x01 || halfway != 0x01 || expired != 0x00 || apu->GetIrq())
+    {
+      printf("apu: length counter status %02X %02X %02X\n", loaded, halfway, expired);
+      result = 1;
+    }
+
+    apu->Reset();
+    apu->WriteRegister(0x4017, 0x00);
+    apu->Run(apuFrameCycles - 2);
+
+    bool early = apu->GetIrq();
+
+    apu->Run(2);
+
+    bool raised  = apu->GetIrq();
+    u8   status  = apu->ReadRegister(0x4015);
+    bool cleared = !apu->GetIrq();
+
+    if (early || !raised || status != 0x40 || !cleared)
+    {
+      printf("apu: frame interrupt %d %d, status %02X, %s by the read\n", early, raised, status, cleared ? "cleared" : "kept");
+      result = 1;
+    }
+
+    // 17 bytes at 54 cycles a bit, the interrupt comes with the last fetch
+    apu->Reset();
+    apu->SetDmcReader(ReadDmcPattern, nullptr);
+    apu->WriteRegister(0x4017, 0x40);
+    apu->WriteRegister(0x4010, 0x8F);
+    apu->WriteRegister(0x4011, 0x40);
+    apu->WriteRegister(0x4013, 0x01);
+    apu->WriteRegister(0x4015, 0x10);
+
+    u8 playing = apu->ReadRegister(0x4015);
+
+    apu->Run(15 * 8 * 54);
+
+    bool busy = !apu->GetIrq();
+
+    apu->Run(2 * 8 * 54);
+
+    u8 done = apu->ReadRegister(0x4015);
+
+    if (playing != 0x10 || !busy || done != 0x80)
+    {
+      printf("apu: DMC status %02X then %02X, interrupt %s\n", playing, done, busy ? "on time" : "early");
+      result = 1;
+    }
+
+    delete apu;
+
+    return result;
+  }
+
+  // One second of a 440 Hz square on the first pulse, through the ring: the sample count,
+  // the zero crossings after the high-pass, and the amplitude of a full volume square
+  int ApuToneTest()
+  {
+    Apu          *apu    = new Apu();
+    SampleBuffer  out(17);
+    int           result = 0;
+
+    apu->SetOutput(&out);
+    apu->WriteRegister(0x4015, 0x01);
+    apu->WriteRegister(0x4000, 0xBF); // 50%, halted length, constant volume 15
+    apu->WriteRegister(0x4002, 0xFD); // 1789773 / (16 * 254) = 440.4 Hz
+    apu->WriteRegister(0x4003, 0x08);
+
+    for (u32 cycles = 0; cycles < Apu::clockRate; cycles += 29781)
+      apu->Run(cycles + 29781 <= Apu::clockRate ? 29781 : Apu::clockRate - cycles);
+
+    std::vector<s16> samples(out.GetSize());
+
+    out.Pop(samples.data(), (u32)samples.size());
+
+    u32 crossings = 0;
+    s32 peak      = 0;
+
+    // The first 100 ms let the high-pass settle
+    for (size_t i = Apu::defaultSampleRate / 10; i < samples.size(); ++i)
+    {
+      crossings += (samples[i - 1] < 0) != (samples[i] < 0);
+      peak       = std::max(peak, (s32)std::abs(samples[i]));
+    }
+
+    u32 expected = 2 * 440 * 9 / 10;
+
+    if (samples.size() < Apu::defaultSampleRate - 1 || samples.size() > Apu::defaultSampleRate + 1 ||
+        crossings < expected - 4 || crossings > expected + 4 || peak < 1500 || peak > 4500 || out.GetDropped() != 0)
+    {
+      printf("apu: %u samples, %u zero crossings (expected %u), peak %d\n", (u32)samples.size(), crossings, expected, peak);
+      result = 1;
+    }
+    else
+      printf("apu: 440 Hz square gave %u samples, %u zero crossings, peak %d\n", (u32)samples.size(), crossings, peak);
+
+    delete apu;
+
+    return result;
+  }
+
+  // A full ring drops instead of waiting, and a consumer thread sees every pushed sample in order
+  int SampleBufferTest()
+  {
+    SampleBuffer ring(10);
+    int          result = 0;
+
+    std::vector<s16> chunk(2000);
+
+    if (ring.Push(chunk.data(), 2000) != 1024 || ring.GetDropped() != 976 || ring.Pop(chunk.data(), 2000) != 1024)
+    {
+      printf("apu: a full ring kept %u samples, dropped %u\n", ring.GetSize(), (u32)ring.GetDropped());
+      result = 1;
+    }
+
+    const u32 total = 1000000;
+
+    u32 mismatches = 0;
+
+    std::thread consumer([&ring, &mismatches]() {
+      s16 samples[256];
+
+      for (u32 next = 0; next < total;)
+      {
+        u32 count = ring.Pop(samples, 256);
+
+        for (u32 i = 0; i < count; ++i, ++next)
+          mismatches += samples[i] != (s16)next;
+
+        if (count == 0)
+          std::this_thread::yield();
+      }
+    });
+
+    s16 samples[100];
+
+    for (u32 pushed = 0; pushed < total;)
+    {
+      u32 count = std::min(100u, total - pushed);
+
+      for (u32 i = 0; i < count; ++i)
+        samples[i] = (s16)(pushed + i);
+
+      // Only this test waits for room, the APU drops
+      for (u32 done = ring.Push(samples, count); done < count; done += ring.Push(samples + done, count - done))
+        std::this_thread::yield();
+
+      pushed += count;
+    }
+
+    consumer.join();
+
+    if (mismatches != 0)
+    {
+      printf("apu: %u samples came out of the ring wrong\n", mismatches);
+      result = 1;
+    }
+
+    return result;
+  }
+
+  int ApuSelfTest()
+  {
+    int result = ApuRegisterTest();
+
+    result |= ApuToneTest();
+    result |= SampleBufferTest();
+
+    return result;
+  }
+
+  /* Scheduler */
+  const u32 schedulerFrames = 10;
+  const s32 frameCycles     = 29781;    // 341 * 262 / 3 rounded up
+  const s32 vblankCycles    = 27395;    // Dot 1 of line 241 is run after 341 * 241 + 2 dots
+  const u16 interruptCount  = 0x0700;   // Bumped by the handlers below
+
+  // Against a heap that's reordered, moved and cancelled: events pop in time order
+  int SchedulerHeapTest()
+  {
+    typedef Scheduler::Event Event;
+
+    const u32 kinds  = (u32)Event::Count;
+    Scheduler scheduler;
+    u32       seed   = 1;
+    int       result = 0;
+
+    for (u32 round = 0; round < 1000 && result == 0; ++round)
+    {
+      s64 times[kinds];
+
+      for (u32 kind = 0; kind < kinds; ++kind)
+      {
+        seed        = seed * 1103515245 + 12345;
+        times[kind] = (seed >> 16) % 64 + ((s64)round << 32); // Past 32 bits and with ties
+        scheduler.Schedule((Event)kind, times[kind] + (kind & 1 ? 100 : -100)); // Then moved back or ahead
+        scheduler.Schedule((Event)kind, times[kind]);
+      }
+
+      Event cancelled = (Event)(round % kinds);
+      Event event;
+      s64   previous  = INT64_MIN;
+      u32   popped    = 0;
+
+      scheduler.Cancel(cancelled);
+
+      while (scheduler.Pop(scheduler.GetNextTime(), event))
+      {
+        s64 time = times[(u32)event];
+
+        if (event == cancelled || time < previous)
+          break;
+
+        previous = time;
+        popped++;
+      }
+
+      if (popped != kinds - 1 || scheduler.GetNextTime() != Scheduler::never)
+      {
+        printf("scheduler: round %u popped %u events out of order\n", round, popped);
+        result = 1;
+      }
+    }
+
+    scheduler.Schedule(Event::Vblank, 10);
+
+    Event event;
+
+    if (scheduler.Pop(9, event) || !scheduler.Pop(10, event) || event != Event::Vblank || scheduler.IsPending(Event::Vblank))
+    {
+      printf("scheduler: event due at 10 wasn't popped at 10 only\n");
+      result = 1;
+    }
+
+    return result;
+  }
+
+  // Without a cartridge every vector reads open bus, $FFFF. ISC $xxxx,X there takes its
+  // operand from $0000 and continues at $0002: the handler lives in RAM.
+  Cpu *LoadInterruptTest(const u8 *program, u32 size, const u8 *handler, u32 handlerSize, s64 cycleCount)
+  {
+    Cpu *cpu = new Cpu();
+
+    cpu->WriteMemory(0x0000, interruptCount & 0xFF);
+    cpu->WriteMemory(0x0001, interruptCount >> 8);
+
+    for (u32 i = 0; i < handlerSize; ++i)
+      cpu->WriteMemory(0x0002 + i, handler[i]);
+
+    for (u32 i = 0; i < size; ++i)
+      cpu->WriteMemory(0x0300 + i, program[i]);
+
+    cpu->SetState({ 0x0300, 0xFD, 0, 0, 0, 0x24, cycleCount });
+
+    return cpu;
+  }
+
+  // Vblank NMI, once per frame, on a clock that crosses 2^31 on the way
+  int NmiTest()
+  {
+    // 0300: LDA #$80
+    // 0302: STA $2000 ; NMI on vblank
+    // 0305: JMP $0305
+    const u8 program[] = { 0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x05, 0x03 };
+    const u8 handler[] = { 0x40 }; // RTI
+
+    s64  start  = INT32_MAX - 5 * frameCycles;
+    Cpu *cpu    = LoadInterruptTest(program, sizeof(program), handler, sizeof(handler), start);
+    int  result = 0;
+
+    s32 overshoot = cpu->Run(vblankCycles - 10, Cpu::Dispatch::Switch);
+    u8  before    = cpu->ReadMemory(interruptCount);
+
+    overshoot = cpu->Run(10 - overshoot + 3 + 7 + 7, Cpu::Dispatch::Switch); // JMP, the interrupt and ISC
+
+    u8 after = cpu->ReadMemory(interruptCount);
+    u8 P     = cpu->ReadMemory(0x01FB);
+
+    if (before != 0 || after != 1 || cpu->ReadMemory(0x01FD) != 0x03 || cpu->ReadMemory(0x01FC) != 0x05 || P != 0xA4)
+    {
+      printf("scheduler: NMI count %u then %u at vblank, pushed %02X%02X P:%02X\n",
+             before, after, cpu->ReadMemory(0x01FD), cpu->ReadMemory(0x01FC), P);
+      result = 1;
+    }
+
+    for (u32 frame = 1; frame < schedulerFrames; ++frame)
+      overshoot = cpu->Run(frameCycles - overshoot, Cpu::Dispatch::Switch);
+
+    u8  count  = cpu->ReadMemory(interruptCount);
+    u32 frames = cpu->GetPpu().GetFrameCount();
+
+    if (count != schedulerFrames || frames != schedulerFrames || cpu->GetCycleCount() <= INT32_MAX)
+    {
+      printf("scheduler: %u NMIs in %u frames, ended at cycle %lld\n", count, frames, (long long)cpu->GetCycleCount());
+      result = 1;
+    }
+
+    if (result == 0)
+      printf("scheduler: %u NMIs in %u frames up to cycle %lld\n", count, frames, (long long)cpu->GetCycleCount());
+
+    delete cpu;
+
+    return result;
+  }
+
+  // The frame IRQ waits for CLI, which stops the batch so it's taken right after
+  int IrqTest()
+  {
+    // 0300: LDA #$00
+    // 0302: STA $4017 ; 4 step, frame IRQ
+    // 0305: JMP $0305
+    // 0308: CLI
+    // 0309: NOP x 8
+    // 0311: JMP $0311
+    const u8 program[] = { 0xA9, 0x00, 0x8D, 0x17, 0x40, 0x4C, 0x05, 0x03,
+                           0x58, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0x4C, 0x11, 0x03 };
+    const u8 handler[] = { 0x4C, 0x02, 0x00 }; // JMP $0002, the interrupt stays asserted
+
+    Cpu *cpu    = LoadInterruptTest(program, sizeof(program), handler, sizeof(handler), 0);
+    int  result = 0;
+
+    cpu->Run(apuFrameCycles + 100, Cpu::Dispatch::Switch);
+
+    Cpu::State masked = cpu->GetState();
+
+    if (masked.PC != 0x0305 || !cpu->GetApu().GetIrq() || cpu->ReadMemory(interruptCount) != 0)
+    {
+      printf("scheduler: frame IRQ %s with I set, PC:%04X\n", cpu->GetApu().GetIrq() ? "taken" : "missing", masked.PC);
+      result = 1;
+    }
+
+    masked.PC = 0x0308;
+    cpu->SetState(masked);
+    cpu->Run(100, Cpu::Dispatch::Switch);
+
+    Cpu::State state  = cpu->GetState();
+    u16        pushed = cpu->ReadMemory(0x01FD) << 8 | cpu->ReadMemory(0x01FC);
+    u8         P      = cpu->ReadMemory(0x01FB);
+
+    if (state.PC != 0x0002 || pushed != 0x0309 || P != 0x22 || !(state.P & 0x04) || cpu->ReadMemory(interruptCount) != 1)
+    {
+      printf("scheduler: IRQ after CLI at PC:%04X, pushed %04X P:%02X, expected 0309 P:22\n", state.PC, pushed, P);
+      result = 1;
+    }
+
+    delete cpu;
+
+    return result;
+  }
+
+  // OAM DMA copies the page and stops the CPU 513 cycles, 514 from an odd one
+  int DmaTest()
+  {
+    // 0300: LDA #$02
+    // 0302: STA $4014
+    // 0305: JMP $0305
+    const u8 program[] = { 0xA9, 0x02, 0x8D, 0x14, 0x40, 0x4C, 0x05, 0x03 };
+
+    int result = 0;
+
+    for (s64 start = 0; start < 2; ++start)
+    {
+      Cpu *cpu = LoadInterruptTest(program, sizeof(program), nullptr, 0, start);
+
+      for (u32 i = 0; i < 0x100; ++i)
+        cpu->WriteMemory(0x0200 + i, (u8)(i * 7 + 3));
+
+      cpu->Run(3, Cpu::Dispatch::Switch); // LDA and STA
+
+      s64 expected = start + 2 + 4 + 513 + ((start + 6) & 1);
+      u32 copied   = 0;
+
+      while (copied < 0x100 && cpu->GetPpu().ReadOam((u8)copied) == (u8)(copied * 7 + 3))
+        copied++;
+
+      if (cpu->GetCycleCount() != expected || cpu->GetPC() != 0x0305 || copied != 0x100)
+      {
+        printf("scheduler: DMA from cycle %lld ended at %lld, expected %lld, %u bytes copied\n",
+               (long long)start, (long long)cpu->GetCycleCount(), (long long)expected, copied);
+        result = 1;
+      }
+
+      delete cpu;
+    }
+
+    return result;
+  }
+
+  // Sprite 0 hit is cleared on the pre-render line, which no event stops at: only reads of
+  // PPUSTATUS catching the PPU up see it go, once a frame
+  int CatchUpTest()
+  {
+    // 0300: BIT $2002
+    // 0303: BVC $0300 ; Until sprite 0 hits
+    // 0305: BIT $2002
+    // 0308: BVS $0305 ; Until the pre-render line clears it
+    // 030A: INC $0700
+    // 030D: JMP $0300
+    const u8 program[] = { 0x2C, 0x02, 0x20, 0x50, 0xFB, 0x2C, 0x02, 0x20, 0x70, 0xFB,
+                           0xEE, 0x00, 0x07, 0x4C, 0x00, 0x03 };
+
+    Cpu *cpu    = LoadInterruptTest(program, sizeof(program), nullptr, 0, 0);
+    int  result = 0;
+
+    // An opaque tile 0 everywhere, sprite 0 over it at line 100
+    cpu->WriteMemory(0x2006, 0x00);
+    cpu->WriteMemory(0x2006, 0x00);
+
+    for (u32 row = 0; row < 8; ++row)
+      cpu->WriteMemory(0x2007, 0xFF);
+
+    const u8 sprite[] = { 100, 0x00, 0x00, 100 };
+
+    cpu->WriteMemory(0x2003, 0x00);
+
+    for (u8 value : sprite)
+      cpu->WriteMemory(0x2004, value);
+
+    cpu->WriteMemory(0x2001, 0x1E);
+
+    s32 overshoot = 0;
+
+    for (u32 frame = 0; frame < schedulerFrames; ++frame)
+      overshoot = cpu->Run(frameCycles - overshoot, Cpu::Dispatch::Switch);
+
+    u8  count    = cpu->ReadMemory(interruptCount);
+    u32 catchUps = cpu->GetCatchUps();
+
+    if (count != schedulerFrames || catchUps == 0)
+    {
+      printf("scheduler: sprite 0 hit cleared %u times in %u frames, %u catch-ups a frame\n", count, schedulerFrames, catchUps);
+      result = 1;
+    }
+    else
+      printf("scheduler: PPUSTATUS polling caught the PPU up %u times a frame\n", catchUps);
+
+    delete cpu;
+
+    return result;
+  }
+
+  int SchedulerSelfTest()
+  {
+    int result = SchedulerHeapTest();
+
+    result |= NmiTest();
+    result |= IrqTest();
+    result |= DmaTest();
+    result |= CatchUpTest();
+
+    return result;
+  }
+
+  /* Mappers */
+  const char *mapperRomFile = "mapper-test.nes";
+  const u16   mapperProgram = 0xF000; // In the last 8KB bank, which every board here can put at 0xE000
+
+  // An iNES image whose 8KB PRG banks and 1KB CHR banks are filled with their index, so a read
+  // tells which bank is mapped. program goes at 0xF000 of the last bank, with reset and NMI
+  // pointing at it and IRQ at irqOffset into it. No CHR banks leaves CHR RAM.
+  bool WriteMapperRom(u8 mapper, u8 prg16, u8 chr8, bool vertical, const u8 *program, u32 size, u16 irqOffset)
+  {
+    FILE *file = fopen(mapperRomFile, "wb");
+
+    if (!file)
+      return false;
+
+    const u8 header[16] = { 'N', 'E', 'S', 0x1A, prg16, chr8, (u8)((mapper << 4) | (vertical ? 0x01 : 0x00)), (u8)(mapper & 0xF0) };
+
+    std::vector<u8> prg(prg16 * 0x4000);
+    std::vector<u8> chr(chr8  * 0x2000);
+
+    for (u32 i = 0; i < prg.size(); ++i)
+      prg[i] = (u8)(i / 0x2000);
+
+    for (u32 i = 0; i < chr.size(); ++i)
+      chr[i] = (u8)(i / 0x400);
+
+    u8 *last = &prg[prg.size() - 0x2000];
+    u16 irq  = mapperProgram + irqOffset;
+
+    memcpy(last + 0x1000, program, size);
+
+    const u8 vectors[6] = { mapperProgram & 0xFF, mapperProgram >> 8, mapperProgram & 0xFF, mapperProgram >> 8, (u8)(irq & 0xFF), (u8)(irq >> 8) };
+
+    memcpy(last + 0x1FFA, vectors, sizeof(vectors));
+
+    bool written = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                   fwrite(prg.data(), 1, prg.size(), file) == prg.size() &&
+                   fwrite(chr.data(), 1, chr.size(), file) == chr.size();
+
+    fclose(file);
+
+    return written;
+  }
+
+  Cpu *LoadMapperRom(u8 mapper, u8 prg16, u8 chr8, bool vertical, const u8 *program = nullptr, u32 size = 0, u16 irqOffset = 0)
+  {
+    const u8 loop[] = { 0x4C, mapperProgram & 0xFF, mapperProgram >> 8 }; // JMP $F000
+
+    Cpu *cpu = new Cpu();
+
+    if (!program)
+    {
+      program = loop;
+      size    = sizeof(loop);
+    }
+
+    if (!WriteMapperRom(mapper, prg16, chr8, vertical, program, size, irqOffset) || !cpu->LoadRom(mapperRomFile))
+    {
+      printf("mapper: can't load a mapper %u rom\n", mapper);
+      delete cpu;
+      return nullptr;
+    }
+
+    return cpu;
+  }
+
+  // PRG banks at 0x8000, 0xA000, 0xC000 and 0xE000, then the 1KB CHR banks
+  bool CheckBanks(const char *name, const Cpu &cpu, const u8 (&prg)[4], const u8 (&chr)[8])
+  {
+    bool matches = true;
+
+    for (u32 slot = 0; slot < 4; ++slot)
+      matches = matches && cpu.ReadMemory(0x8000 + slot * 0x2000) == prg[slot];
+
+    for (u32 page = 0; page < 8; ++page)
+      matches = matches && cpu.GetPpu().ReadMemory(page * 0x400) == chr[page];
+
+    if (!matches)
+    {
+      printf("mapper: %s: PRG", name);
+
+      for (u32 slot = 0; slot < 4; ++slot)
+        printf(" %u", cpu.ReadMemory(0x8000 + slot * 0x2000));
+
+      printf(", CHR");
+
+      for (u32 page = 0; page < 8; ++page)
+        printf(" %u", cpu.GetPpu().ReadMemory(page * 0x400));
+
+      printf("\n");
+    }
+
+    return matches;
+  }
+
+  // The four nametables, 0 to 3, land on these VRAM pages
+  bool CheckNametables(const char *name, Cpu &cpu, const u8 (&layout)[4])
+  {
+    Ppu &ppu     = cpu.GetPpu();
+    bool matches = true;
+
+    for (u32 table = 0; table < 4; ++table)
+      ppu.WriteMemory(0x2000 + table * 0x400, 0x00);
+
+    for (u32 table = 0; table < 4; ++table)
+    {
+      ppu.WriteMemory(0x2000 + table * 0x400, 0xA0 + table);
+
+      for (u32 other = 0; other < 4; ++other)
+        matches = matches && (ppu.ReadMemory(0x2000 + other * 0x400) == 0xA0 + table) == (layout[other] == layout[table]);
+    }
+
+    if (!matches)
+      printf("mapper: %s: nametables aren't mirrored as %u %u %u %u\n", name, layout[0], layout[1], layout[2], layout[3]);
+
+    return matches;
+  }
+
+  // MMC1 registers take five writes, bit 0 first
+  void WriteMmc1(Cpu &cpu, u16 address, u8 value)
+  {
+    for (u32 bit = 0; bit < 5; ++bit)
+      cpu.WriteMemory(address, (value >> bit) & 0x01);
+  }
+
+  int FixedBoardsTest()
+  {
+    const u8 horizontal[4] = { 0, 0, 1, 1 };
+    const u8 vertical  [4] = { 0, 1, 0, 1 };
+
+    int  result = 0;
+    Cpu *cpu    = LoadMapperRom(0, 1, 1, true); // NROM-128, the 16KB bank at both halves
+
+    if (!cpu)
+      return 1;
+
+    if (!CheckBanks("NROM-128", *cpu, { 0, 1, 0, 1 }, { 0, 1, 2, 3, 4, 5, 6, 7 }) || !CheckNametables("NROM-128", *cpu, vertical) ||
+        cpu->GetPC() != mapperProgram)
+      result = 1;
+
+    cpu->WriteMemory(0x8000, 0x55); // Dropped
+
+    if (cpu->ReadMemory(0x8000) != 0)
+    {
+      printf("mapper: NROM ROM was written\n");
+      result = 1;
+    }
+
+    delete cpu;
+
+    // UxROM, CHR RAM
+    if (!(cpu = LoadMapperRom(2, 8, 0, false)))
+      return 1;
+
+    cpu->WriteMemory(0x8000, 5);
+    cpu->GetPpu().WriteMemory(0x1FFF, 0x5A);
+
+    if (!CheckBanks("UxROM", *cpu, { 10, 11, 14, 15 }, { 0, 0, 0, 0, 0, 0, 0, 0 }) || !CheckNametables("UxROM", *cpu, horizontal) ||
+        cpu->GetPpu().ReadMemory(0x1FFF) != 0x5A)
+      result = 1;
+
+    delete cpu;
+
+    // CNROM
+    if (!(cpu = LoadMapperRom(3, 2, 4, false)))
+      return 1;
+
+    cpu->WriteMemory(0x8000, 2);
+
+    if (!CheckBanks("CNROM", *cpu, { 0, 1, 2, 3 }, { 16, 17, 18, 19, 20, 21, 22, 23 }))
+      result = 1;
+
+    cpu->WriteMemory(0x8000, 5); // Wraps around the 4 banks
+
+    if (!CheckBanks("CNROM", *cpu, { 0, 1, 2, 3 }, { 8, 9, 10, 11, 12, 13, 14, 15 }))
+      result = 1;
+
+    delete cpu;
+
+    return result;
+  }
+
+  int Mmc1Test()
+  {
+    const u8 lower   [4] = { 0, 0, 0, 0 };
+    const u8 upper   [4] = { 1, 1, 1, 1 };
+    const u8 vertical[4] = { 0, 1, 0, 1 };
+
+    int  result = 0;
+    Cpu *cpu    = LoadMapperRom(1, 8, 8, false);
+
+    if (!cpu)
+      return 1;
+
+    // Power on: the last bank fixed at 0xC000, 8KB of CHR
+    if (!CheckBanks("MMC1 power on", *cpu, { 0, 1, 14, 15 }, { 0, 1, 2, 3, 4, 5, 6, 7 }) || cpu->GetPC() != mapperProgram)
+      result = 1;
+
+    WriteMmc1(*cpu, 0xE000, 3);
+    WriteMmc1(*cpu, 0xA000, 3); // 8KB mode ignores bit 0
+
+    if (!CheckBanks("MMC1 PRG 3", *cpu, { 6, 7, 14, 15 }, { 8, 9, 10, 11, 12, 13, 14, 15 }))
+      result = 1;
+
+    // The first bank fixed at 0x8000, 4KB of CHR, vertical
+    WriteMmc1(*cpu, 0x8000, 0x1A);
+    WriteMmc1(*cpu, 0xA000, 5);
+    WriteMmc1(*cpu, 0xC000, 9);
+
+    if (!CheckBanks("MMC1 4KB", *cpu, { 0, 1, 6, 7 }, { 20, 21, 22, 23, 36, 37, 38, 39 }) || !CheckNametables("MMC1 vertical", *cpu, vertical))
+      result = 1;
+
+    // 32KB, single screen
+    WriteMmc1(*cpu, 0x8000, 0x00);
+
+    if (!CheckBanks("MMC1 32KB", *cpu, { 4, 5, 6, 7 }, { 16, 17, 18, 19, 20, 21, 22, 23 }) || !CheckNametables("MMC1 lower", *cpu, lower))
+      result = 1;
+
+    WriteMmc1(*cpu, 0x8000, 0x01);
+
+    if (!CheckNametables("MMC1 upper", *cpu, upper))
+      result = 1;
+
+    // Bit 7 drops the bits written so far and fixes the last bank again
+    cpu->WriteMemory(0x8000, 0x01);
+    cpu->WriteMemory(0x8000, 0x80);
+    WriteMmc1(*cpu, 0xE000, 2);
+
+    if (!CheckBanks("MMC1 reset", *cpu, { 4, 5, 14, 15 }, { 16, 17, 18, 19, 20, 21, 22, 23 }))
+      result = 1;
+
+    delete cpu;
+
+    return result;
+  }
+
+  void WriteMmc3(Cpu &cpu, u8 select, u8 value)
+  {
+    cpu.WriteMemory(0x8000, select);
+    cpu.WriteMemory(0x8001, value);
+  }
+
+  int Mmc3BankTest()
+  {
+    const u8 horizontal[4] = { 0, 0, 1, 1 };
+    const u8 vertical  [4] = { 0, 1, 0, 1 };
+
+    int  result = 0;
+    Cpu *cpu    = LoadMapperRom(4, 8, 16, true);
+
+    if (!cpu)
+      return 1;
+
+    const u8 values[8] = { 8, 13, 20, 21, 22, 23, 3, 4 };
+
+    for (u8 reg = 0; reg < 8; ++reg)
+      WriteMmc3(*cpu, reg, values[reg]);
+
+    // R0 and R1 are 2KB banks, the low bit is ignored
+    if (!CheckBanks("MMC3", *cpu, { 3, 4, 14, 15 }, { 8, 9, 12, 13, 20, 21, 22, 23 }) || !CheckNametables("MMC3 vertical", *cpu, vertical))
+      result = 1;
+
+    cpu->WriteMemory(0x8000, 0xC0); // Both halves swapped
+    cpu->WriteMemory(0xA000, 0x01);
+
+    if (!CheckBanks("MMC3 swapped", *cpu, { 14, 4, 3, 15 }, { 20, 21, 22, 23, 8, 9, 12, 13 }) || !CheckNametables("MMC3 horizontal", *cpu, horizontal))
+      result = 1;
+
+    delete cpu;
+
+    return result;
+  }
+
+  const u16 mmc3IrqHandler = mapperProgram + 0x19;
+
+  // The counter reloads with 99 on line 0 and reaches 0 every 100 rendered lines, at dot 260.
+  // The handler counts, acknowledges and enables again.
+  Cpu *LoadMmc3IrqProgram()
+  {
+    // F000: LDA #$40
+    // F002: STA $4017 ; No frame IRQ
+    // F005: LDA #99
+    // F007: STA $C000 ; Latch
+    // F00A: STA $C001 ; Reload
+    // F00D: STA $E001 ; Enable
+    // F010: LDA #$18
+    // F012: STA $2001 ; Rendering
+    // F015: CLI
+    // F016: JMP $F016
+    // F019: INC $0700 ; IRQ
+    // F01C: STA $E000 ; Acknowledge
+    // F01F: STA $E001
+    // F022: RTI
+    const u8 program[] = { 0xA9, 0x40, 0x8D, 0x17, 0x40,
+                           0xA9, 99, 0x8D, 0x00, 0xC0, 0x8D, 0x01, 0xC0, 0x8D, 0x01, 0xE0,
+                           0xA9, 0x18, 0x8D, 0x01, 0x20, 0x58, 0x4C, 0x16, 0xF0,
+                           0xEE, 0x00, 0x07, 0x8D, 0x00, 0xE0, 0x8D, 0x01, 0xE0, 0x40 };
+
+    return LoadMapperRom(4, 8, 16, false, program, sizeof(program), mmc3IrqHandler - mapperProgram);
+  }
+
+  int Mmc3IrqTest()
+  {
+    const u16 handler = mmc3IrqHandler;
+    const u32 frames  = 10;
+
+    int  result = 0;
+    Cpu *cpu    = LoadMmc3IrqProgram();
+
+    if (!cpu)
+      return 1;
+
+    // Taken after the instruction running at dot 260 of line 99, the JMP and 7 cycles later at most
+    while (cpu->GetPC() != handler && cpu->GetPpu().GetFrameCount() == 0)
+      cpu->Run(1, Cpu::Dispatch::Switch);
+
+    const Ppu &ppu = cpu->GetPpu();
+
+    if (cpu->GetPC() != handler || ppu.GetScanline() != 99 || ppu.GetDot() <= 260 || ppu.GetDot() > 260 + 3 * (3 + 7))
+    {
+      printf("mapper: MMC3 IRQ taken at line %u dot %u, expected line 99 dot 260\n", ppu.GetScanline(), ppu.GetDot());
+      result = 1;
+    }
+
+    // Up to vblank: 241 clocks a frame, 2409 in all and the last IRQ at the 2400th
+    while (ppu.GetFrameCount() < frames)
+      cpu->Run(100, Cpu::Dispatch::Switch);
+
+    Cpu copy(*cpu);
+    u8  count = cpu->ReadMemory(interruptCount);
+
+    for (u32 frame = 0; frame < frames; ++frame)
+    {
+      cpu->Run(frameCycles, Cpu::Dispatch::Jit);
+      copy.Run(frameCycles, Cpu::Dispatch::Block);
+    }
+
+    u8 total     = cpu->ReadMemory(interruptCount);
+    u8 copyTotal = copy.ReadMemory(interruptCount);
+
+    if (count != 24 || total != 48 || copyTotal != 48)
+    {
+      printf("mapper: %u MMC3 IRQs in %u frames, then %u and %u in a copy, expected 24 and 48\n", count, frames, total, copyTotal);
+      result = 1;
+    }
+    else
+      printf("mapper: %u MMC3 IRQs in %u frames, 1 per 100 scanlines\n", total, frames * 2);
+
+    delete cpu;
+
+    return result;
+  }
+
+  // NES 2.0 sizes go below a 16KB PRG bank and an 8KB CHR bank: 8KB of PRG shows at every
+  // slot and 2KB of CHR at every pair of pages, on every board. CHR below a 1KB bank can't load.
+  int SmallRomTest()
+  {
+    int result = 0;
+
+    for (u8 mapper = 0; mapper <= 4; ++mapper)
+    {
+      for (u32 chrSize : { 0x800u, 0x200u })
+      {
+        // Exponent-multiplier sizes: 2^13 and 2^11 or 2^9, times 1
+        const u8 header[16] = { 'N', 'E', 'S', 0x1A, 13 << 2, (u8)((chrSize == 0x800 ? 11 : 9) << 2), (u8)(mapper << 4), 0x08, 0x00, 0xFF };
+
+        std::vector<u8> prg(0x2000, 0x5A);
+        std::vector<u8> chr(chrSize);
+
+        for (u32 i = 0; i < chr.size(); ++i)
+          chr[i] = (u8)(i / 0x400);
+
+        const u8 loop   [3] = { 0x4C, mapperProgram & 0xFF, mapperProgram >> 8 }; // JMP $F000
+        const u8 vectors[6] = { mapperProgram & 0xFF, mapperProgram >> 8, mapperProgram & 0xFF, mapperProgram >> 8, mapperProgram & 0xFF, mapperProgram >> 8 };
+
+        memcpy(&prg[0x1000], loop, sizeof(loop));
+        memcpy(&prg[0x1FFA], vectors, sizeof(vectors));
+
+        FILE *file    = fopen(mapperRomFile, "wb");
+        bool  written = file && fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                        fwrite(prg.data(), 1, prg.size(), file) == prg.size() &&
+                        fwrite(chr.data(), 1, chr.size(), file) == chr.size();
+
+        if (file)
+          fclose(file);
+
+        std::unique_ptr<Cpu> cpu(new Cpu());
+
+        if (!written)
+        {
+          printf("mapper: can't write %s\n", mapperRomFile);
+          return 1;
+        }
+
+        bool loaded = cpu->LoadRom(mapperRomFile);
+
+        if (chrSize < 0x400)
+        {
+          if (loaded)
+          {
+            printf("mapper: mapper %u loaded %u bytes of CHR, less than a bank\n", mapper, chrSize);
+            result = 1;
+          }
+
+          continue;
+        }
+
+        if (!loaded)
+        {
+          printf("mapper: can't load mapper %u with 8KB of PRG\n", mapper);
+          result = 1;
+          continue;
+        }
+
+        cpu->Run(frameCycles * 2, Cpu::Dispatch::Switch);
+
+        bool mirrored = cpu->GetPC() >= mapperProgram && cpu->GetPC() < mapperProgram + sizeof(loop);
+
+        for (u32 slot = 0; slot < 4; ++slot)
+          mirrored = mirrored && cpu->ReadMemory(0x8000 + slot * 0x2000) == 0x5A;
+
+        for (u32 page = 0; page < 8; ++page)
+          mirrored = mirrored && cpu->GetPpu().ReadMemory(page * 0x400) < 2;
+
+        if (!mirrored)
+        {
+          printf("mapper: mapper %u doesn't mirror 8KB of PRG and 2KB of CHR\n", mapper);
+          result = 1;
+        }
+      }
+    }
+
+    if (result == 0)
+      printf("mapper: 8KB of PRG and 2KB of CHR run on every board, 512 bytes of CHR don't load\n");
+
+    return result;
+  }
+
+  int MapperSelfTest()
+  {
+    int result = FixedBoardsTest();
+
+    result |= Mmc1Test();
+    result |= Mmc3BankTest();
+    result |= Mmc3IrqTest();
+    result |= SmallRomTest();
+
+    remove(mapperRomFile);
+
+    return result;
+  }
+
+  /* Save states */
+  const char *stateFile   = "savestate-test.state";
+  const u32   stateFrames = 5;
+
+  // An MMC3 cartridge with rendering, a pulse channel and an IRQ switching PRG banks
+  //
+  // F000: LDA #$40
+  // F002: STA $4017 ; No frame IRQ
+  // F005: LDA #99
+  // F007: STA $C000
+  // F00A: STA $C001
+  // F00D: STA $E001 ; MMC3 IRQ every 100 lines
+  // F010: LDA #$01
+  // F012: STA $4015
+  // F015: LDA #$BF
+  // F017: STA $4000
+  // F01A: LDA #$08
+  // F01C: STA $4003 ; Pulse 1 on
+  // F01F: LDA #$18
+  // F021: STA $2001 ; Rendering
+  // F024: CLI
+  // F025: INC $0701
+  // F028: LDX $0701
+  // F02B: STX $4002 ; Pulse period
+  // F02E: JMP $F025
+  // F031: INC $0700 ; IRQ
+  // F034: STA $E000
+  // F037: STA $E001
+  // F03A: LDA #$06
+  // F03C: STA $8000
+  // F03F: LDA $0700
+  // F042: STA $8001 ; PRG bank at 0x8000
+  // F045: RTI
+  Cpu *LoadStateProgram()
+  {
+    const u8 program[] = { 0xA9, 0x40, 0x8D, 0x17, 0x40, 0xA9, 99, 0x8D, 0x00, 0xC0, 0x8D, 0x01, 0xC0, 0x8D, 0x01, 0xE0,
+                           0xA9, 0x01, 0x8D, 0x15, 0x40, 0xA9, 0xBF, 0x8D, 0x00, 0x40, 0xA9, 0x08, 0x8D, 0x03, 0x40,
+                           0xA9, 0x18, 0x8D, 0x01, 0x20, 0x58,
+                           0xEE, 0x01, 0x07, 0xAE, 0x01, 0x07, 0x8E, 0x02, 0x40, 0x4C, 0x25, 0xF0,
+                           0xEE, 0x00, 0x07, 0x8D, 0x00, 0xE0, 0x8D, 0x01, 0xE0, 0xA9, 0x06, 0x8D, 0x00, 0x80,
+                           0xAD, 0x00, 0x07, 0x8D, 0x01, 0x80, 0x40 };
+
+    return LoadMapperRom(4, 8, 16, false, program, sizeof(program), 0x31);
+  }
+
+  // Hash of what a run leaves behind: registers, RAM, the frame, OAM, the APU clock and IRQ,
+  // and the PRG bank at 0x8000
+  u64 Fingerprint(const Cpu &cpu)
+  {
+    Cpu::State state = cpu.GetState();
+    u64        hash  = 14695981039346656037ULL;
+
+    auto add = [&hash](u64 value) { hash = (hash ^ value) * 1099511628211ULL; };
+
+    add(state.PC);
+    add(state.SP);
+    add(state.A);
+    add(state.X);
+    add(state.Y);
+    add(state.P);
+    add((u64)state.cycleCount);
+
+    for (u32 address = 0; address < 0x800; ++address)
+      add(cpu.ReadMemory(address));
+
+    for (u32 address = 0x6000; address < 0x8000; ++address)
+      add(cpu.ReadMemory(address));
+
+    const u16 *frame = cpu.GetPpu().GetFrame();
+
+    for (u32 pixel = 0; frame && pixel < Ppu::width * Ppu::height; ++pixel)
+      add(frame[pixel]);
+
+    for (u32 address = 0; address < 0x100; ++address)
+      add(cpu.GetPpu().ReadOam((u8)address));
+
+    add(cpu.GetApu().GetCycleCount());
+    add(cpu.GetApu().GetIrq());
+    add(cpu.ReadMemory(0x8000));
+
+    return hash;
+  }
+
+  u64 RunFingerprint(Cpu &cpu, Cpu::Dispatch dispatch)
+  {
+    s32 overshoot = 0;
+
+    for (u32 frame = 0; frame < stateFrames; ++frame)
+      overshoot = cpu.Run(frameCycles - overshoot, dispatch);
+
+    return Fingerprint(cpu);
+  }
+
+  // Restored into a new machine, over the one it was saved from and from a file, a state
+  // runs on exactly like the machine it was saved from
+  int SaveStateSelfTest()
+  {
+    int  result = 0;
+    Cpu *cpu    = LoadStateProgram();
+
+    if (!cpu)
+      return 1;
+
+    // Mid-frame, with IRQs taken and banks switched
+    s32 overshoot = 0;
+
+    for (u32 frame = 0; frame < 7; ++frame)
+      overshoot = cpu->Run(frameCycles - overshoot, Cpu::Dispatch::Switch);
+
+    cpu->Run(1234 - overshoot, Cpu::Dispatch::Switch);
+
+    std::unique_ptr<SaveState> state(new SaveState());
+
+    cpu->Save(*state);
+
+    u64 expected = RunFingerprint(*cpu, Cpu::Dispatch::Switch);
+
+    // A new machine with the same cartridge
+    Cpu *restored = new Cpu();
+
+    if (!restored->LoadRom(mapperRomFile) || !restored->Restore(*state) || RunFingerprint(*restored, Cpu::Dispatch::Switch) != expected)
+    {
+      printf("savestate: a new machine ran differently from the state\n");
+      result = 1;
+    }
+
+    delete restored;
+
+    // Back over the machine it was saved from, with blocks and native code decoded since
+    if (!cpu->Restore(*state) || RunFingerprint(*cpu, Cpu::Dispatch::Jit) != expected)
+    {
+      printf("savestate: rewinding the machine ran differently from the state\n");
+      result = 1;
+    }
+
+    // Through a file
+    StateFile file;
+
+    restored = new Cpu();
+
+    if (!StateFile::Save(stateFile, *state) || !file.Load(stateFile) || !restored->LoadRom(mapperRomFile) ||
+        !restored->Restore(*file.Get()) || RunFingerprint(*restored, Cpu::Dispatch::Block) != expected)
+    {
+      printf("savestate: the state from %s ran differently: %s\n", stateFile, file.GetError().c_str());
+      result = 1;
+    }
+
+    file.Close();
+
+    // Refused: another version, another cartridge, no state at all
+    state->header.version++;
+
+    if (restored->Restore(*state) || state->Check(nullptr) == nullptr)
+    {
+      printf("savestate: a state of another version was restored\n");
+      result = 1;
+    }
+
+    state->header.version--;
+    delete restored;
+
+    restored = LoadMapperRom(0, 2, 1, false);
+
+    if (!restored || restored->Restore(*state))
+    {
+      printf("savestate: a state was restored with another cartridge\n");
+      result = 1;
+    }
+
+    delete restored;
+
+    if (file.Load(mapperRomFile))
+    {
+      printf("savestate: %s loaded as a state\n", mapperRomFile);
+      result = 1;
+    }
+
+    if (result == 0)
+      printf("savestate: %u byte states restore to the same %u frames\n", (u32)sizeof(SaveState), stateFrames);
+
+    delete cpu;
+
+    remove(stateFile);
+    remove(mapperRomFile);
+
+    return result;
+  }
+
+  /* Rewind */
+  const u32 rewindFrames = 120;
+
+  // The first write to a page after TrackWrites flags it, mirrors apart
+  int DirtyPageTest()
+  {
+    u8  memory[0x800] = {};
+    Bus bus;
+
+    bus.MapMemory(0x0000, 0x2000, memory, sizeof(memory));
+    bus.TrackWrites();
+
+    bus.Write(0x0305, 0x12);
+    bus.Write(0x0306, 0x34); // Direct, the page is mapped back
+    bus.Write(0x0B07, 0x56); // Mirror of page 3
+
+    bool flagged = bus.IsDirty(0x0300) && bus.IsDirty(0x0B00) && !bus.IsDirty(0x0400) && !bus.IsDirty(0x0300 + 0x1000);
+    bool written = memory[0x305] == 0x12 && memory[0x306] == 0x34 && memory[0x307] == 0x56;
+    bool tracked = bus.IsWritable(0x0400) && bus.WatchWrites(0x0400, nullptr, nullptr);
+
+    if (!flagged || !written || !tracked)
+    {
+      printf("rewind: dirty pages flagged:%d written:%d, tracked pages watched:%d\n", flagged, written, tracked);
+      return 1;
+    }
+
+    return 0;
+  }
+
+  // Pops the points of saves back from last, each has to restore to the state saved at it
+  int PopSaves(Rewind &rewind, Cpu &cpu, const std::vector<SaveState> &saves, u32 last, u32 count, const char *what)
+  {
+    std::unique_ptr<SaveState> state(new SaveState());
+
+    for (u32 point = 0; point < count; ++point)
+    {
+      if (!rewind.Pop(cpu))
+      {
+        printf("rewind: %s, no point left after %u\n", what, point);
+        return 1;
+      }
+
+      cpu.Save(*state);
+
+      if (memcmp(state.get(), &saves[last - point], sizeof(SaveState)) != 0)
+      {
+        printf("rewind: %s, point %u restored another state\n", what, last - point);
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  // Every frame pushed pops back to the same state, over dispatches, new pushes after pops,
+  // and a ring too small to hold them all
+  int RewindSelfTest()
+  {
+    int  result = DirtyPageTest();
+    Cpu *cpu    = LoadStateProgram();
+
+    if (!cpu)
+      return 1;
+
+    std::vector<SaveState> saves(rewindFrames);
+    Rewind                 rewind;
+
+    for (u32 frame = 0; frame < rewindFrames; ++frame)
+    {
+      cpu->Run(frameCycles, frame % 2 ? Cpu::Dispatch::Jit : Cpu::Dispatch::Switch);
+      rewind.Push(*cpu);
+      cpu->Save(saves[frame]);
+    }
+
+    size_t perPoint = rewind.GetUsed() / (rewindFrames - 1);
+
+    // Back half way, then on again from there
+    result |= PopSaves(rewind, *cpu, saves, rewindFrames - 1, rewindFrames / 2, "first pops");
+
+    for (u32 frame = rewindFrames / 2; frame < rewindFrames; ++frame)
+    {
+      cpu->Run(frameCycles, Cpu::Dispatch::Block);
+      rewind.Push(*cpu);
+      cpu->Save(saves[frame]);
+    }
+
+    result |= PopSaves(rewind, *cpu, saves, rewindFrames - 1, rewindFrames, "second pops");
+
+    if (rewind.Pop(*cpu) || rewind.GetCount() != 0)
+    {
+      printf("rewind: popped past the first point\n");
+      result = 1;
+    }
+
+    // A ring for a few deltas keeps the newest
+    Rewind small(perPoint * 10);
+
+    for (u32 frame = 0; frame < rewindFrames; ++frame)
+    {
+      cpu->Run(frameCycles, Cpu::Dispatch::Block);
+      small.Push(*cpu);
+      cpu->Save(saves[frame]);
+    }
+
+    u32 kept = small.GetCount();
+
+    if (kept < 2 || kept >= rewindFrames || small.GetUsed() > small.GetCapacity())
+    {
+      printf("rewind: a %u byte ring kept %u points in %u bytes\n", (u32)small.GetCapacity(), kept, (u32)small.GetUsed());
+      result = 1;
+    }
+    else
+      result |= PopSaves(small, *cpu, saves, rewindFrames - 1, kept, "small ring");
+
+    if (result == 0)
+      printf("rewind: %u frames pushed and popped, %u bytes per point\n", rewindFrames, (u32)perPoint);
+
+    delete cpu;
+
+    remove(mapperRomFile);
+
+    return result;
+  }
+
+  /* Forks */
+  const u32 forkFrames  = 4;
+  const u32 forkThreads = 8;
+
+  // NROM with CHR RAM, rendering off. Counts at $6100 and writes the count to PRG RAM, a
+  // nametable and CHR RAM, then calls a routine the test puts in PRG RAM
+  //
+  // F000: LDX $6100
+  // F003: INX
+  // F004: STX $6100
+  // F007: TXA
+  // F008: STA $6200,X
+  // F00B: LDA #$20
+  // F00D: STA $2006
+  // F010: STX $2006
+  // F013: STX $2007 ; Nametable at $20xx
+  // F016: LDA #$00
+  // F018: STA $2006
+  // F01B: STX $2006
+  // F01E: STX $2007 ; CHR RAM at $00xx
+  // F021: JSR $7000
+  // F024: JMP $F000
+  // 7000: INC $6300
+  // 7003: RTS
+  Cpu *LoadForkProgram()
+  {
+    const u8 program[] = { 0xAE, 0x00, 0x61, 0xE8, 0x8E, 0x00, 0x61, 0x8A, 0x9D, 0x00, 0x62,
+                           0xA9, 0x20, 0x8D, 0x06, 0x20, 0x8E, 0x06, 0x20, 0x8E, 0x07, 0x20,
+                           0xA9, 0x00, 0x8D, 0x06, 0x20, 0x8E, 0x06, 0x20, 0x8E, 0x07, 0x20,
+                           0x20, 0x00, 0x70, 0x4C, 0x00, 0xF0 };
+    const u8 routine[] = { 0xEE, 0x00, 0x63, 0x60 };
+
+    Cpu *cpu = LoadMapperRom(0, 2, 0, false, program, sizeof(program));
+
+    for (u32 i = 0; cpu && i < sizeof(routine); ++i)
+      cpu->WriteMemory(0x7000 + i, routine[i]);
+
+    return cpu;
+  }
+
+  void RunFrames(Cpu &cpu, Cpu::Dispatch dispatch, u32 frames = forkFrames)
+  {
+    for (u32 frame = 0; frame < frames; ++frame)
+      cpu.Run(frameCycles, dispatch);
+  }
+
+  bool SameState(const Cpu &cpu, const Cpu &expected)
+  {
+    std::unique_ptr<SaveState> state   (new SaveState());
+    std::unique_ptr<SaveState> reference(new SaveState());
+
+    cpu     .Save(*state);
+    expected.Save(*reference);
+
+    return memcmp(state.get(), reference.get(), sizeof(SaveState)) == 0;
+  }
+
+  // A fork runs like a copy and neither side sees the other's writes, over PRG RAM code
+  // decoded before the fork changed it, forks of forks outliving their parent, and forks
+  // writing the same pages on threads
+  int ForkSelfTest()
+  {
+    int  result = 0;
+    Cpu *cpu    = LoadForkProgram();
+
+    if (!cpu)
+      return 1;
+
+    RunFrames(*cpu, Cpu::Dispatch::Switch);
+
+    Cpu                  copy(*cpu);
+    std::unique_ptr<Cpu> child  (cpu->Fork());
+    std::unique_ptr<Cpu> sibling(cpu->Fork());
+
+    // The routine decoded from the shared page, then changed to count at $6304
+    Cpu childCopy(copy);
+
+    RunFrames(*child, Cpu::Dispatch::Block, 1);
+    RunFrames(childCopy, Cpu::Dispatch::Switch, 1);
+
+    child    ->WriteMemory(0x6100, 0x80);
+    child    ->WriteMemory(0x7001, 0x04);
+    child    ->GetPpu().WriteMemory(0x1234, 0x5A);
+    childCopy.WriteMemory(0x6100, 0x80);
+    childCopy.WriteMemory(0x7001, 0x04);
+    childCopy.GetPpu().WriteMemory(0x1234, 0x5A);
+
+    RunFrames(*child, Cpu::Dispatch::Block);
+    RunFrames(childCopy, Cpu::Dispatch::Switch);
+
+    if (!SameState(*child, childCopy) || child->ReadMemory(0x6304) == 0)
+    {
+      printf("fork: a fork ran differently from a copy\n");
+      result = 1;
+    }
+
+    if (!SameState(*cpu, copy) || !SameState(*sibling, copy) || cpu->ReadMemory(0x7001) != 0x00)
+    {
+      printf("fork: the writes of a fork showed in its parent\n");
+      result = 1;
+    }
+
+    // The parent writing pages its forks still hold
+    RunFrames(*cpu, Cpu::Dispatch::Jit);
+    RunFrames(copy, Cpu::Dispatch::Switch);
+    RunFrames(*sibling, Cpu::Dispatch::Block);
+
+    if (!SameState(*cpu, copy) || !SameState(*sibling, copy))
+    {
+      printf("fork: a parent writing after the fork ran differently from a copy\n");
+      result = 1;
+    }
+
+    // A fork of a fork, on its own after both are gone
+    std::unique_ptr<Cpu> grandchild(child->Fork());
+
+    child.reset();
+    sibling.reset();
+    delete cpu;
+
+    RunFrames(*grandchild, Cpu::Dispatch::Jit);
+    RunFrames(childCopy, Cpu::Dispatch::Switch);
+
+    if (!SameState(*grandchild, childCopy))
+    {
+      printf("fork: a fork of a fork ran differently from a copy\n");
+      result = 1;
+    }
+
+    // Forks of one machine writing their copies of the same pages at once
+    std::vector<std::unique_ptr<Cpu>> forks;
+    std::vector<std::unique_ptr<Cpu>> copies;
+    std::vector<std::thread>          threads;
+
+    for (u32 i = 0; i < forkThreads; ++i)
+    {
+      forks .emplace_back(grandchild->Fork());
+      copies.emplace_back(new Cpu(*grandchild));
+
+      forks [i]->WriteMemory(0x6100, (u8)(i * 32));
+      copies[i]->WriteMemory(0x6100, (u8)(i * 32));
+    }
+
+    for (u32 i = 0; i < forkThreads; ++i)
+      threads.emplace_back([&forks, i]() { RunFrames(*forks[i], Cpu::Dispatch::Jit); });
+
+    for (u32 i = 0; i < forkThreads; ++i)
+    {
+      threads[i].join();
+      RunFrames(*copies[i], Cpu::Dispatch::Switch);
+
+      if (!SameState(*forks[i], *copies[i]))
+      {
+        printf("fork: fork %u on a thread ran differently from a copy\n", i);
+        result = 1;
+      }
+    }
+
+    if (result == 0)
+      printf("fork: %u forks ran like copies, %u of them on threads\n", forkThreads + 4, forkThreads);
+
+    remove(mapperRomFile);
+
+    return result;
+  }
+
+  /* Batch runs */
+  const char *batchManifest = "batch-test.txt";
+  const u32   batchFrames   = 30;
+  const u32   batchRepeats  = 4; // Of every job, so workers take several and steal
+
+  // Strobes, reads the 8 buttons of port 0 into $0700 and adds them up in $0701
+  //
+  // F000: LDA #$01
+  // F002: STA $4016
+  // F005: LDA #$00
+  // F007: STA $4016
+  // F00A: LDX #$08
+  // F00C: LDA $4016
+  // F00F: LSR A
+  // F010: ROR $0700
+  // F013: DEX
+  // F014: BNE $F00C
+  // F016: LDA $0700
+  // F019: CLC
+  // F01A: ADC $0701
+  // F01D: STA $0701
+  // F020: JMP $F000
+  bool WriteControllerRom()
+  {
+    const u8 program[] = { 0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00, 0x8D, 0x16, 0x40, 0xA2, 0x08,
+                           0xAD, 0x16, 0x40, 0x4A, 0x6E, 0x00, 0x07, 0xCA, 0xD0, 0xF6,
+                           0xAD, 0x00, 0x07, 0x18, 0x6D, 0x01, 0x07, 0x8D, 0x01, 0x07, 0x4C, 0x00, 0xF0 };
+
+    return WriteMapperRom(0, 2, 1, false, program, sizeof(program), 0);
+  }
+
+  // Frame n holds buttons n * step on port 0 and their complement on port 1
+  bool WriteMovie(const char *movieFile, u32 frames, u32 step, bool resets)
+  {
+    FILE *file = fopen(movieFile, "w");
+
+    if (!file)
+      return false;
+
+    fprintf(file, "version 3\nemuVersion 22020\nrerecordCount 0\npalFlag 0\nromFilename %s\nport0 1\nport1 1\nport2 0\n", mapperRomFile);
+
+    for (u32 frame = 0; frame < frames; ++frame)
+    {
+      char pads[2][9] = {};
+
+      for (u32 i = 0; i < 8; ++i)
+      {
+        pads[0][i] = (frame * step) & (0x80 >> i) ? "RLDUTSBA"[i] : '.';
+        pads[1][i] = (frame * step) & (0x80 >> i) ? ' ' : 'x';
+      }
+
+      fprintf(file, "|%u|%s|%s||\n", resets && frame == frames / 2 ? 1 : 0, pads[0], pads[1]);
+    }
+
+    return fclose(file) == 0;
+  }
+
+  // Shifted out A first, then 1s, and the A button over and over while the strobe is high
+  int ControllerTest()
+  {
+    Cpu *cpu = LoadMapperRom(0, 1, 1, false);
+
+    if (!cpu)
+      return 1;
+
+    const u8 held = Cpu::buttonA | Cpu::buttonStart | Cpu::buttonRight;
+
+    cpu->SetButtons(0, held);
+    cpu->WriteMemory(0x4016, 1);
+    cpu->SetButtons(0, held | Cpu::buttonB); // Latched at the falling edge
+    cpu->WriteMemory(0x4016, 0);
+    cpu->SetButtons(0, 0);
+
+    u32 port0 = 0;
+    u32 port1 = 0;
+
+    for (u32 bit = 0; bit < 10; ++bit)
+    {
+      port0 |= (cpu->ReadMemory(0x4016) & 0x01) << bit;
+      port1 |= (cpu->ReadMemory(0x4017) & 0x01) << bit;
+    }
+
+    cpu->SetButtons(0, Cpu::buttonA);
+    cpu->WriteMemory(0x4016, 1);
+
+    bool strobed = (cpu->ReadMemory(0x4016) & 0x01) && (cpu->ReadMemory(0x4016) & 0x01);
+
+    delete cpu;
+
+    if (port0 != (0x300u | held | Cpu::buttonB) || port1 != 0x300 || !strobed)
+    {
+      printf("batch: controllers read %03X and %03X, expected %03X and 300\n", port0, port1, 0x300u | held | Cpu::buttonB);
+      return 1;
+    }
+
+    return 0;
+  }
+
+  int MovieTest()
+  {
+    Movie movie;
+    int   result = 0;
+
+    if (!WriteMovie("batch-a.fm2", batchFrames, 37, false) || !movie.Load("batch-a.fm2") || movie.GetFrameCount() != batchFrames)
+    {
+      printf("batch: a %u frame movie loaded with %u frames: %s\n", batchFrames, movie.GetFrameCount(), movie.GetError().c_str());
+      return 1;
+    }
+
+    for (u32 frame = 0; frame < batchFrames; ++frame)
+      if (movie.GetButtons(frame, 0) != (u8)(frame * 37) || movie.GetButtons(frame, 1) != (u8)~(frame * 37))
+        result = 1;
+
+    if (result || movie.GetButtons(batchFrames, 0) != 0)
+    {
+      printf("batch: the movie buttons were read wrong\n");
+      result = 1;
+    }
+
+    if (!WriteMovie("batch-reset.fm2", batchFrames, 1, true) || movie.Load("batch-reset.fm2") || movie.Load(mapperRomFile))
+    {
+      printf("batch: a movie with a reset, or a rom, loaded as a movie\n");
+      result = 1;
+    }
+
+    remove("batch-reset.fm2");
+
+    return result;
+  }
+
+  // Frame by frame on a new Cpu, the way Batch runs a job
+  u64 RunMovie(const Movie *movie, u32 frames)
+  {
+    Cpu cpu;
+    s32 overshoot = 0;
+
+    if (!cpu.LoadRom(mapperRomFile))
+      return 0;
+
+    for (u32 frame = 0; frame < frames; ++frame)
+    {
+      cpu.SetButtons(0, movie ? movie->GetButtons(frame, 0) : 0);
+      cpu.SetButtons(1, movie ? movie->GetButtons(frame, 1) : 0);
+
+      overshoot = cpu.Run(frameCycles - overshoot);
+    }
+
+    return Batch::GetHash(cpu);
+  }
+
+  // A manifest of movies, no movie, a missing rom and a wrong hash runs on one thread and on
+  // several to the hashes of runs on new machines, the two failures failing alone
+  int BatchSelfTest()
+  {
+    int result = ControllerTest();
+
+    if (!WriteControllerRom())
+      return 1;
+
+    result |= MovieTest();
+
+    Movie movies[2];
+
+    if (!WriteMovie("batch-b.fm2", batchFrames, 101, false) || !movies[0].Load("batch-a.fm2") || !movies[1].Load("batch-b.fm2"))
+      return 1;
+
+    const u64 expected[3] = { RunMovie(&movies[0], batchFrames), RunMovie(&movies[1], batchFrames), RunMovie(nullptr, batchFrames) };
+
+    if (expected[0] == expected[1] || expected[0] == expected[2] || expected[1] == expected[2])
+    {
+      printf("batch: the movies ran to the same hash\n");
+      result = 1;
+    }
+
+    FILE *file = fopen(batchManifest, "w");
+
+    if (!file)
+      return 1;
+
+    fprintf(file, "# rom movie frames outputs\n");
+
+    for (u32 repeat = 0; repeat < batchRepeats; ++repeat)
+    {
+      fprintf(file, "%s batch-a.fm2 0 state=batch-a.state hash=%016llx\n", mapperRomFile, (unsigned long long)expected[0]);
+      fprintf(file, "%s batch-b.fm2 %u\n", mapperRomFile, batchFrames);
+      fprintf(file, "%s - %u frame=batch.rgba   # No input\n", mapperRomFile, batchFrames);
+    }
+
+    fprintf(file, "missing.nes - 10\n");
+    fprintf(file, "%s batch-a.fm2 0 hash=%016llx\n", mapperRomFile, (unsigned long long)~expected[0]);
+    fclose(file);
+
+    const u32 jobCount = batchRepeats * 3 + 2;
+
+    for (u32 threads : { 1, 4 })
+    {
+      Batch batch;
+
+      if (!batch.Load(batchManifest) || batch.GetJobs().size() != jobCount)
+      {
+        printf("batch: the manifest loaded %u jobs of %u: %s\n", (u32)batch.GetJobs().size(), jobCount, batch.GetError().c_str());
+        result = 1;
+        break;
+      }
+
+      bool                            ok      = batch.Run(threads);
+      const std::vector<BatchResult> &results = batch.GetResults();
+      bool                            same    = true;
+
+      for (u32 job = 0; job < jobCount - 2; ++job)
+        same = same && results[job].ok && results[job].frames == batchFrames && results[job].hash == expected[job % 3];
+
+      if (ok || !same || results[jobCount - 2].ok || results[jobCount - 1].ok || batch.GetFrames() != (jobCount - 1) * batchFrames)
+      {
+        printf("batch: %u threads ran the jobs to other results\n", threads);
+        result = 1;
+      }
+
+      if (threads > 1)
+        printf("batch: %u jobs on %u threads: %s, %s\n", jobCount, threads, results[jobCount - 2].error.c_str(), results[jobCount - 1].error.c_str());
+    }
+
+    // The state the job saved
+    StateFile state;
+    Cpu       cpu;
+
+    if (!state.Load("batch-a.state") || !cpu.LoadRom(mapperRomFile) || !cpu.Restore(*state.Get()) ||
+        cpu.ReadMemory(0x0700) != movies[0].GetButtons(batchFrames - 1, 0))
+    {
+      printf("batch: the saved state isn't the end of the job\n");
+      result = 1;
+    }
+
+    state.Close();
+
+    // Broken manifests
+    const char *broken[] = { "rom.nes movie.fm2\n", "rom.nes - 0\n", "rom.nes - 10 hash=xyz\n", "rom.nes - 10 sound=a.wav\n" };
+
+    for (const char *line : broken)
+    {
+      Batch batch;
+
+      file = fopen(batchManifest, "w");
+      fputs(line, file);
+      fclose(file);
+
+      if (batch.Load(batchManifest) || batch.GetError().empty())
+      {
+        printf("batch: loaded the manifest %s", line);
+        result = 1;
+      }
+    }
+
+    remove(batchManifest);
+    remove("batch-a.fm2");
+    remove("batch-b.fm2");
+    remove("batch-a.state");
+    remove("batch.rgba");
+    remove(mapperRomFile);
+
+    return result;
+  }
+
+  /* Lockstep */
+  const u32 lockstepRuns = 3;
+
+  // Forks of cpu in every lane, set up by setup(lane cpu, lane), have to end up as a fork
+  // running alone on Cpu::RunInstructions does, with every kernel. The vector kernels have to
+  // run at least lanesPerStep lanes per step on average.
+  template<typename Setup>
+  int CompareLockstep(const char *what, Cpu &cpu, u32 count, double lanesPerStep, Setup setup)
+  {
+    std::vector<std::unique_ptr<Cpu>> expected;
+
+    for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+    {
+      expected.push_back(cpu.Fork());
+      setup(*expected[lane], lane);
+
+      for (u32 run = 0; run < lockstepRuns; ++run)
+        expected[lane]->RunInstructions(count, Cpu::Dispatch::Switch);
+    }
+
+    int result = 0;
+
+    for (Lockstep::Kernel kernel : { Lockstep::Kernel::Scalar, Lockstep::Kernel::Vector, Lockstep::Kernel::Avx2, Lockstep::Kernel::Avx512 })
+    {
+      const char *name = Lockstep::GetKernelName(kernel);
+
+      if (!Lockstep::IsSupported(kernel))
+      {
+        printf("lockstep: %s isn't supported here, skipped\n", name);
+        continue;
+      }
+
+      std::vector<std::unique_ptr<Cpu>> lanes;
+      Lockstep                          lockstep;
+      u64                               steps  = 0;
+      u64                               vector = 0;
+      u64                               scalar = 0;
+
+      for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+      {
+        lanes.push_back(cpu.Fork());
+        setup(*lanes[lane], lane);
+        lockstep.Add(*lanes[lane]);
+      }
+
+      for (u32 run = 0; run < lockstepRuns; ++run)
+      {
+        lockstep.RunInstructions(kernel, count);
+
+        steps  += lockstep.GetSteps();
+        vector += lockstep.GetVectorInstructions();
+        scalar += lockstep.GetScalarInstructions();
+      }
+
+      u32    lane    = 0;
+      double perStep = steps ? (double)vector / steps : 0;
+
+      while (lane < Lockstep::maxLanes && SameState(*lanes[lane], *expected[lane]))
+        ++lane;
+
+      if (lane < Lockstep::maxLanes)
+      {
+        printf("lockstep: lane %u of %s runs differently with %s\n", lane, what, name);
+        result = 1;
+      }
+      else if (vector + scalar != (u64)Lockstep::maxLanes * lockstepRuns * count)
+      {
+        printf("lockstep: %s ran %llu instructions with %s\n", what, (unsigned long long)(vector + scalar), name);
+        result = 1;
+      }
+      else if (kernel != Lockstep::Kernel::Scalar && perStep < lanesPerStep)
+      {
+        printf("lockstep: %s ran %.1f lanes per step with %s\n", what, perStep, name);
+        result = 1;
+      }
+      else
+        printf("lockstep: %s matches with %s, %.1f lanes per step, %.0f%% of the instructions in vectors\n",
+               what, name, perStep, 100.0 * vector / (vector + scalar));
+    }
+
+    return result;
+  }
+
+  // The same with events: forks of cpu set up by setup(lane cpu, lane) run frames with Lockstep::Run
+  // and have to end up as a fork running them alone on Cpu::Run, with the same overshoots
+  template<typename Setup>
+  int CompareLockstepFrames(const char *what, Cpu &cpu, u32 frames, Setup setup)
+  {
+    std::vector<std::unique_ptr<Cpu>> expected;
+    s32                               overshoots[Lockstep::maxLanes] = {};
+
+    for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+    {
+      expected.push_back(cpu.Fork());
+      setup(*expected[lane], lane);
+
+      for (u32 frame = 0; frame < frames; ++frame)
+        overshoots[lane] = expected[lane]->Run(frameCycles - overshoots[lane], Cpu::Dispatch::Switch);
+    }
+
+    int result = 0;
+
+    for (Lockstep::Kernel kernel : { Lockstep::Kernel::Scalar, Lockstep::Kernel::Vector, Lockstep::Kernel::Avx2, Lockstep::Kernel::Avx512 })
+    {
+      const char *name = Lockstep::GetKernelName(kernel);
+
+      if (!Lockstep::IsSupported(kernel))
+        continue;
+
+      std::vector<std::unique_ptr<Cpu>> lanes;
+      Lockstep                          lockstep;
+      u64                               vector = 0;
+
+      for (u32 lane = 0; lane < Lockstep::maxLanes; ++lane)
+      {
+        lanes.push_back(cpu.Fork());
+        setup(*lanes[lane], lane);
+        lockstep.Add(*lanes[lane]);
+      }
+
+      for (u32 frame = 0; frame < frames; ++frame)
+      {
+        lockstep.Run(kernel, frameCycles);
+        vector += lockstep.GetVectorInstructions();
+      }
+
+      u32 lane = 0;
+
+      while (lane < Lockstep::maxLanes && SameState(*lanes[lane], *expected[lane]) && lockstep.GetOvershoot(lane) == overshoots[lane])
+        ++lane;
+
+      if (lane < Lockstep::maxLanes)
+      {
+        printf("lockstep: lane %u of %s runs frames differently with %s\n", lane, what, name);
+        result = 1;
+      }
+      else if (kernel != Lockstep::Kernel::Scalar && vector == 0)
+      {
+        printf("lockstep: %s ran no frame instructions in vectors with %s\n", what, name);
+        result = 1;
+      }
+      else
+        printf("lockstep: %s frames match with %s\n", what, name);
+    }
+
+    return result;
+  }
+
+  // UxROM, the 16KB banks at 0x8000 hold the byte 2n then 2n + 1: a run of one instruction
+  // repeated, the same instruction in each 8KB, that ends at 0xC000. The fixed bank's does the
+  // same down to 0xF000. Each lane has its bank at $00, the lanes of bank 3 skip the branch
+  // and the others take it across a page.
+  //
+  // F000: LDA $00
+  // F002: STA $8000
+  // F005: INC $01
+  // F007: JMP $F0F9
+  // F0F9: LDA $00
+  // F0FB: CMP #$03
+  // F0FD: BNE $F102
+  // F0FF: JMP $8000
+  // F102: JMP $8000
+  int LockstepBankTest()
+  {
+    const u8 branch[] = { 0xA5, 0x00, 0xC9, 0x03, 0xD0, 0x03, 0x4C, 0x00, 0x80, 0x4C, 0x00, 0x80 };
+
+    u8 program[0xF9 + sizeof(branch)] = { 0xA5, 0x00, 0x8D, 0x00, 0x80, 0xE6, 0x01, 0x4C, 0xF9, 0xF0 };
+
+    memcpy(program + 0xF9, branch, sizeof(branch));
+
+    Cpu *cpu = LoadMapperRom(2, 8, 0, false, program, sizeof(program));
+
+    if (!cpu)
+      return 1;
+
+    // NOP zero page and ORA zero page, ASL zero page and SLO, PHP and ORA immediate, ASL A and ANC
+    int result = CompareLockstep("banks", *cpu, 10000, 3.0, [](Cpu &lane, u32 index) { lane.WriteMemory(0x0000, 2 + (index & 3)); });
+
+    delete cpu;
+
+    remove(mapperRomFile);
+
+    return result;
+  }
+
+  // Lanes in step on nestest, apart by a few hundred instructions, over PPU and PRG RAM code
+  // they run differently, through banks they switch differently, and over frames of IRQs
+  int LockstepSelfTest(const std::string &romFile)
+  {
+    std::unique_ptr<Cpu> cpu(new Cpu());
+
+    if (!LoadNestest(*cpu, romFile))
+    {
+      printf("Can't load %s\n", romFile.c_str());
+      return 1;
+    }
+
+    // Four groups of four
+    int result = CompareLockstep("nestest", *cpu, 2000, 2.0, [](Cpu &lane, u32 index) {
+      lane.RunInstructions((index & 3) * 500, Cpu::Dispatch::Switch);
+    });
+
+    // Every lane counts from its own start, odd ones decrement the count in PRG RAM
+    cpu.reset(LoadForkProgram());
+
+    if (!cpu)
+      return 1;
+
+    result |= CompareLockstep("fork program", *cpu, 2000, 4.0, [](Cpu &lane, u32 index) {
+      lane.WriteMemory(0x6100, (u8)(index * 16));
+
+      if (index & 1)
+        lane.WriteMemory(0x7000, 0xCE); // DEC $6300
+    });
+
+    // Frames of IRQs, the lanes apart by up to a few hundred cycles
+    cpu.reset(LoadMmc3IrqProgram());
+
+    if (!cpu)
+      return 1;
+
+    result |= CompareLockstepFrames("MMC3 IRQs", *cpu, 3, [](Cpu &lane, u32 index) {
+      lane.Run((s32)(index & 7) * 50, Cpu::Dispatch::Switch);
+    });
+
+    remove(mapperRomFile);
+
+    return result | LockstepBankTest();
+  }
+}
+
+int RunSelfTest(const std::string &name, const std::string &romFile, const std::string &reference)
+{
+  if (name == "flags")
+    return FlagsSelfTest();
+  if (name == "nestest")
+    return NestestSelfTest(romFile, reference);
+  if (name == "blocks")
+    return BlocksSelfTest(romFile);
+  if (name == "jit")
+    return JitSelfTest(romFile);
+  if (name == "aot")
+    return AotSelfTest(romFile);
+  if (name == "ppu")
+    return PpuSelfTest(romFile);
+  if (name == "tiles")
+    return TileCacheSelfTest();
+  if (name == "palette")
+    return PaletteSelfTest();
+  if (name == "apu")
+    return ApuSelfTest();
+  if (name == "scheduler")
+    return SchedulerSelfTest();
+  if (name == "mapper")
+    return MapperSelfTest();
+  if (name == "savestate")
+    return SaveStateSelfTest();
+  if (name == "rewind")
+    return RewindSelfTest();
+  if (name == "fork")
+    return ForkSelfTest();
+  if (name == "batch")
+    return BatchSelfTest();
+  if (name == "lockstep")
+    return LockstepSelfTest(romFile);
+
+  printf("Unknown self test: %s\n", name.c_str());
+  printf("Available: flags, nestest, blocks, jit, aot, ppu, tiles, palette, apu, scheduler, mapper, savestate, rewind, fork, batch, lockstep\n");
+
+  return 1;
+}
+
+bool LoadNestest(Cpu &cpu, const std::string &romFile)
+{
+  if (!cpu.LoadRom(romFile))
+    return false;
+
+  Cpu::State state = cpu.GetState();
+
+  state.PC = nestestStart;
+  cpu.SetState(state);
+
+  return true;
+}
+
+bool LoadPpuScene(Ppu &ppu, const std::string &romFile, bool tallSprites)
+{
+  u32  seed   = 1;
+  auto random = [&seed]() { seed = seed * 1103515245 + 12345; return seed >> 16; };
+
+  if (romFile.empty())
+  {
+    ppu.LoadRom(nullptr);
+
+    for (u16 address = 0; address < 0x2000; ++address)
+      ppu.WriteMemory(address, (u8)random());
+  }
+  else
+  {
+    std::shared_ptr<Rom> rom = std::make_shared<Rom>();
+
+    if (!rom->Load(romFile))
+    {
+      printf("Can't load %s: %s\n", romFile.c_str(), rom->GetError().c_str());
+      return false;
+    }
+
+    ppu.LoadRom(rom);
+  }
+
+  std::vector<u8> tiles; // Tiles of the first pattern table that aren't blank
+
+  for (u32 tile = 0; tile < 256; ++tile)
+  {
+    for (u32 row = 0; row < 16; ++row)
+    {
+      if (ppu.ReadMemory(tile * 16 + row))
+      {
+        tiles.push_back(tile);
+        break;
+      }
+    }
+  }
+
+  if (tiles.empty())
+  {
+    printf("%s has no tiles to draw\n", romFile.empty() ? "CHR RAM" : romFile.c_str());
+    return false;
+  }
+
+  // Every nametable, attribute table and palette entry, then 64 sprites with sprite 0 over the background
+  for (u16 address = 0x2000; address < 0x3000; ++address)
+    ppu.WriteMemory(address, (address & 0x3FF) >= 0x3C0 ? (u8)random() : tiles[random() % tiles.size()]);
+
+  for (u16 address = 0x3F00; address < 0x3F20; ++address)
+    ppu.WriteMemory(address, (u8)random());
+
+  for (u32 sprite = 0; sprite < 64; ++sprite)
+  {
+    ppu.WriteOam(sprite * 4 + 0, sprite == 0 ? 100 : random() % 232);
+    ppu.WriteOam(sprite * 4 + 1, tiles[random() % tiles.size()] & (tallSprites ? 0xFE : 0xFF));
+    ppu.WriteOam(sprite * 4 + 2, sprite == 0 ? 0 : random() & 0xE3);
+    ppu.WriteOam(sprite * 4 + 3, sprite == 0 ? 100 : (u8)random());
+  }
+
+  ppu.WriteRegister(0x2000, tallSprites ? 0x20 : 0x00);
+  ppu.WriteRegister(0x2005, 0x5B); // Scrolled in both directions, with fine X
+  ppu.WriteRegister(0x2005, 0x2D);
+  ppu.WriteRegister(0x2001, 0x1E); // Both layers, left columns included
+
+  return true;
+}
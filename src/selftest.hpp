@@ -0,0 +1,25 @@
+#ifndef __SELFTEST_H__
+#define __SELFTEST_H__
+
+#pragma once
+
+#include <string>
+
+class Cpu;
+class Ppu;
+
+// Runs the named self test and prints the results. reference is an optional input file,
+// the nestest.log to compare against for the nestest test.
+// Returns the process exit code, 0 when the test passes.
+int RunSelfTest(const std::string &name, const std::string &romFile, const std::string &reference);
+
+// Loads nestest and starts it in automation mode: PC = 0xC000 instead of the reset vector,
+// which runs every test without a PPU. Returns false when the rom can't be loaded.
+bool LoadNestest(Cpu &cpu, const std::string &romFile);
+
+// Loads the CHR of romFile and fills VRAM, palettes and OAM with a busy scene that scrolls
+// and shows both layers, for the PPU test and benchmark. An empty romFile fills CHR RAM
+// with random tiles instead.
+bool LoadPpuScene(Ppu &ppu, const std::string &romFile, bool tallSprites);
+
+#endif //__SELFTEST_H__
@@ -0,0 +1,304 @@
+#include "tiles.hpp"
+#include <cstring>
+
+#if defined(NESEMU_TILES_X64)
+#include <immintrin.h>
+#elif defined(NESEMU_TILES_NEON)
+#include <arm_neon.h>
+#endif
+
+// AVX2 is compiled for its own functions and picked at run time. MSVC only has it when the
+// whole build targets it.
+#if defined(NESEMU_TILES_X64) && (defined(__GNUC__) || defined(__clang__))
+#define NESEMU_TILES_AVX2
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#elif defined(NESEMU_TILES_X64) && defined(__AVX2__)
+#define NESEMU_TILES_AVX2
+#define AVX2_FUNCTION
+#endif
+
+TileCache::TileCache()
+{
+  InvalidateAll();
+}
+
+TileCache::TileCache(const TileCache &)
+{
+  InvalidateAll();
+}
+
+TileCache &TileCache::operator=(const TileCache &)
+{
+  InvalidateAll();
+
+  return *this;
+}
+
+void TileCache::Invalidate(u16 address)
+{
+  u32 tile = (address >> 4) & (tileCount - 1);
+
+  valid[tile >> 6] &= ~(1ull << (tile & 63));
+}
+
+void TileCache::InvalidatePage(u32 page)
+{
+  valid[page & 7] = 0;
+}
+
+void TileCache::InvalidateAll()
+{
+  memset(valid, 0, sizeof(valid));
+}
+
+// A 1KB page holds 64 whole tiles
+void TileCache::Load(const u8 *const pages[8], u32 tile)
+{
+  Decode(GetKernel(), pages[tile >> 6] + (tile & 63) * 16, 1, pixels[tile][0], pixels[tile][1]);
+
+  valid[tile >> 6] |= 1ull << (tile & 63);
+}
+
+/* Decoders. Pixel x of a row is bit 7 - x of the low plane plus bit 7 - x of the high plane
+   times two. The SIMD kernels copy each plane byte across the 8 lanes of its row, keep one
+   bit per lane with a mask that goes 0x80 to 0x01 (0x01 to 0x80 flipped) and turn the lanes
+   where the bit is set into 1 or 2. */
+namespace
+{
+  void DecodeScalar(const u8 *chr, u32 count, u8 *pixels, u8 *flipped)
+  {
+    for (u32 tile = 0; tile < count; ++tile, chr += 16, pixels += 64)
+    {
+      for (u32 row = 0; row < 8; ++row)
+      {
+        u8 low  = chr[row];
+        u8 high = chr[row + 8];
+
+        for (u32 column = 0; column < 8; ++column)
+        {
+          u8 pixel = ((low >> (7 - column)) & 0x01) | (((high >> (7 - column)) & 0x01) << 1);
+
+          pixels[row * 8 + column] = pixel;
+
+          if (flipped)
+            flipped[row * 8 + 7 - column] = pixel;
+        }
+      }
+
+      if (flipped)
+        flipped += 64;
+    }
+  }
+
+#ifdef NESEMU_TILES_X64
+  // Two rows of 8 pixels, low and high hold each plane byte 8 times
+  FORCEINLINE __m128i ExpandSse2(__m128i low, __m128i high, __m128i bits)
+  {
+    __m128i lowBits  = _mm_cmpeq_epi8(_mm_and_si128(low , bits), bits);
+    __m128i highBits = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+
+    return _mm_sub_epi8(_mm_setzero_si128(), _mm_add_epi8(lowBits, _mm_add_epi8(highBits, highBits)));
+  }
+
+  // Unpacking a register with itself doubles every byte, three times make 8 copies
+  void DecodeSse2(const u8 *chr, u32 count, u8 *pixels, u8 *flipped)
+  {
+    const __m128i bits    = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i reverse = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+
+    for (u32 tile = 0; tile < count; ++tile, chr += 16, pixels += 64)
+    {
+      __m128i planes = _mm_loadu_si128((const __m128i *)chr);
+      __m128i low2   = _mm_unpacklo_epi8(planes, planes);
+      __m128i high2  = _mm_unpackhi_epi8(planes, planes);
+      __m128i low4[2]  = { _mm_unpacklo_epi16(low2 , low2 ), _mm_unpackhi_epi16(low2 , low2 ) };
+      __m128i high4[2] = { _mm_unpacklo_epi16(high2, high2), _mm_unpackhi_epi16(high2, high2) };
+
+      for (u32 half = 0; half < 2; ++half)
+      {
+        __m128i low8 [2] = { _mm_unpacklo_epi32(low4 [half], low4 [half]), _mm_unpackhi_epi32(low4 [half], low4 [half]) };
+        __m128i high8[2] = { _mm_unpacklo_epi32(high4[half], high4[half]), _mm_unpackhi_epi32(high4[half], high4[half]) };
+
+        for (u32 pair = 0; pair < 2; ++pair)
+        {
+          u32 offset = (half * 2 + pair) * 16;
+
+          _mm_storeu_si128((__m128i *)(pixels + offset), ExpandSse2(low8[pair], high8[pair], bits));
+
+          if (flipped)
+            _mm_storeu_si128((__m128i *)(flipped + offset), ExpandSse2(low8[pair], high8[pair], reverse));
+        }
+      }
+
+      if (flipped)
+        flipped += 64;
+    }
+  }
+#endif
+
+#ifdef NESEMU_TILES_AVX2
+  AVX2_FUNCTION FORCEINLINE __m256i ExpandAvx2(__m256i low, __m256i high, __m256i bits)
+  {
+    __m256i lowBits  = _mm256_cmpeq_epi8(_mm256_and_si256(low , bits), bits);
+    __m256i highBits = _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+
+    return _mm256_sub_epi8(_mm256_setzero_si256(), _mm256_add_epi8(lowBits, _mm256_add_epi8(highBits, highBits)));
+  }
+
+  // Both planes are broadcast to every 64 bit lane, a byte shuffle then copies four rows at once
+  AVX2_FUNCTION void DecodeAvx2(const u8 *chr, u32 count, u8 *pixels, u8 *flipped)
+  {
+    const __m256i rows[2] = {
+      _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3),
+      _mm256_setr_epi8(4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7)
+    };
+    const __m256i bits    = _mm256_set1_epi64x(0x0102040810204080ll);
+    const __m256i reverse = _mm256_set1_epi64x((long long)0x8040201008040201ull);
+
+    for (u32 tile = 0; tile < count; ++tile, chr += 16, pixels += 64)
+    {
+      u64 planes[2];
+
+      memcpy(planes, chr, sizeof(planes));
+
+      __m256i low  = _mm256_set1_epi64x((long long)planes[0]);
+      __m256i high = _mm256_set1_epi64x((long long)planes[1]);
+
+      for (u32 half = 0; half < 2; ++half)
+      {
+        __m256i low8  = _mm256_shuffle_epi8(low , rows[half]);
+        __m256i high8 = _mm256_shuffle_epi8(high, rows[half]);
+
+        _mm256_storeu_si256((__m256i *)(pixels + half * 32), ExpandAvx2(low8, high8, bits));
+
+        if (flipped)
+          _mm256_storeu_si256((__m256i *)(flipped + half * 32), ExpandAvx2(low8, high8, reverse));
+      }
+
+      if (flipped)
+        flipped += 64;
+    }
+  }
+#endif
+
+#ifdef NESEMU_TILES_NEON
+  FORCEINLINE uint8x16_t ExpandNeon(uint8x16_t low, uint8x16_t high, uint8x16_t bits)
+  {
+    uint8x16_t lowBits  = vandq_u8(vtstq_u8(low , bits), vdupq_n_u8(1));
+    uint8x16_t highBits = vandq_u8(vtstq_u8(high, bits), vdupq_n_u8(2));
+
+    return vorrq_u8(lowBits, highBits);
+  }
+
+  void DecodeNeon(const u8 *chr, u32 count, u8 *pixels, u8 *flipped)
+  {
+    static const u8 order  [16] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    static const u8 reverse[16] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+
+    const uint8x16_t bits        = vld1q_u8(order);
+    const uint8x16_t reverseBits = vld1q_u8(reverse);
+
+    for (u32 tile = 0; tile < count; ++tile, chr += 16, pixels += 64)
+    {
+      for (u32 pair = 0; pair < 4; ++pair)
+      {
+        uint8x16_t low  = vcombine_u8(vdup_n_u8(chr[pair * 2    ]), vdup_n_u8(chr[pair * 2 + 1]));
+        uint8x16_t high = vcombine_u8(vdup_n_u8(chr[pair * 2 + 8]), vdup_n_u8(chr[pair * 2 + 9]));
+
+        vst1q_u8(pixels + pair * 16, ExpandNeon(low, high, bits));
+
+        if (flipped)
+          vst1q_u8(flipped + pair * 16, ExpandNeon(low, high, reverseBits));
+      }
+
+      if (flipped)
+        flipped += 64;
+    }
+  }
+#endif
+}
+
+TileCache::Kernel TileCache::GetKernel()
+{
+  static const Kernel kernel = IsSupported(Kernel::Avx2) ? Kernel::Avx2 :
+                               IsSupported(Kernel::Sse2) ? Kernel::Sse2 :
+                               IsSupported(Kernel::Neon) ? Kernel::Neon : Kernel::Scalar;
+
+  return kernel;
+}
+
+bool TileCache::IsSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return true;
+
+#ifdef NESEMU_TILES_X64
+    case Kernel::Sse2: // Part of x86-64
+      return true;
+#endif
+
+#ifdef NESEMU_TILES_AVX2
+    case Kernel::Avx2:
+#if defined(__GNUC__) || defined(__clang__)
+      return __builtin_cpu_supports("avx2");
+#else
+      return true;
+#endif
+#endif
+
+#ifdef NESEMU_TILES_NEON
+    case Kernel::Neon: // Part of AArch64
+      return true;
+#endif
+
+    default:
+      return false;
+  }
+}
+
+const char *TileCache::GetKernelName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar: return "scalar";
+    case Kernel::Sse2:   return "sse2";
+    case Kernel::Avx2:   return "avx2";
+    case Kernel::Neon:   return "neon";
+  }
+
+  return "unknown";
+}
+
+// Kernels the host doesn't run fall back to the scalar one
+void TileCache::Decode(Kernel kernel, const u8 *chr, u32 count, u8 *pixels, u8 *flipped)
+{
+  if (!IsSupported(kernel))
+    kernel = Kernel::Scalar;
+
+  switch (kernel)
+  {
+#ifdef NESEMU_TILES_X64
+    case Kernel::Sse2:
+      DecodeSse2(chr, count, pixels, flipped);
+      return;
+#endif
+
+#ifdef NESEMU_TILES_AVX2
+    case Kernel::Avx2:
+      DecodeAvx2(chr, count, pixels, flipped);
+      return;
+#endif
+
+#ifdef NESEMU_TILES_NEON
+    case Kernel::Neon:
+      DecodeNeon(chr, count, pixels, flipped);
+      return;
+#endif
+
+    default:
+      DecodeScalar(chr, count, pixels, flipped);
+      return;
+  }
+}
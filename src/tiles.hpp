@@ -0,0 +1,68 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+
+#pragma once
+
+#include "types.hpp"
+
+// SIMD tile decoders for the host, the scalar one is always there
+#if defined(__x86_64__) || defined(_M_X64)
+#define NESEMU_TILES_X64
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NESEMU_TILES_NEON
+#endif
+
+/* Decoded pattern tables. A CHR tile is two 8 byte bit planes, the low bits of its 8 rows then
+   the high bits; TileCache expands each of the 512 tiles the PPU sees into 64 pixel values
+   (0-3), once as stored and once flipped horizontally for sprites. Tiles are decoded the first
+   time a row is asked for and stay until invalidated: one tile on a CHR RAM write, a 1KB page
+   of 64 tiles when the page is mapped somewhere else. */
+class TileCache {
+public:
+  static const u32 tileCount = 512; // 8KB of pattern tables
+
+  enum class Kernel : u8 {
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon
+  };
+
+  TileCache();
+
+  // Not copied, a copy starts empty and decodes from its own pages
+  TileCache(const TileCache &other);
+  TileCache &operator=(const TileCache &other);
+
+  // Pixels of row (address & 7) of the tile at address, from the 1KB pages of the pattern tables
+  FORCEINLINE const u8 *Row(const u8 *const pages[8], u16 address, bool flipped);
+
+  void Invalidate    (u16 address); // The tile holding address
+  void InvalidatePage(u32 page);
+  void InvalidateAll ();
+
+  /* Decoders. Decode expands count tiles of chr into pixels and, unless it is null, flipped,
+     64 bytes per tile, rows top to bottom. */
+  static Kernel      GetKernel    (); // Fastest one the host runs, picked on first use
+  static bool        IsSupported  (Kernel kernel);
+  static const char *GetKernelName(Kernel kernel);
+  static void        Decode       (Kernel kernel, const u8 *chr, u32 count, u8 *pixels, u8 *flipped);
+
+private:
+  u8  pixels[tileCount][2][64]; // As stored, flipped
+  u64 valid [tileCount / 64];   // One bit per tile, a word per page
+
+  void Load(const u8 *const pages[8], u32 tile);
+};
+
+FORCEINLINE const u8 *TileCache::Row(const u8 *const pages[8], u16 address, bool flipped)
+{
+  u32 tile = (address >> 4) & (tileCount - 1);
+
+  if (!(valid[tile >> 6] & (1ull << (tile & 63))))
+    Load(pages, tile);
+
+  return &pixels[tile][flipped ? 1 : 0][(address & 7) * 8];
+}
+
+#endif //__TILES_H__
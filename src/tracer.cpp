@@ -0,0 +1,130 @@
+#include "tracer.hpp"
+#include <chrono>
+#include "opcodes.hpp"
+
+TraceBuffer::TraceBuffer(u32 capacityLog2)
+  : records((size_t)1 << capacityLog2), mask(((u64)1 << capacityLog2) - 1), head(0), tail(0)
+{
+
+}
+
+bool TraceBuffer::Pop(TraceRecord &record)
+{
+  u64 position = tail.load(std::memory_order_relaxed);
+
+  if (position == head.load(std::memory_order_acquire))
+    return false;
+
+  record = records[position & mask];
+  tail.store(position + 1, std::memory_order_release);
+
+  return true;
+}
+
+Tracer::Tracer()
+  : running(false), out(nullptr)
+{
+
+}
+
+Tracer::~Tracer()
+{
+  Stop();
+}
+
+bool Tracer::Start(const std::string &file)
+{
+  Stop();
+
+  out = file == "-" ? stdout : fopen(file.c_str(), "w");
+
+  if (!out)
+  {
+    printf("Can't open trace file %s\n", file.c_str());
+    return false;
+  }
+
+  running = true;
+  thread  = std::thread([this]() { Drain(); });
+
+  return true;
+}
+
+void Tracer::Stop()
+{
+  if (!thread.joinable())
+    return;
+
+  running = false;
+  thread.join();
+
+  if (out != stdout)
+    fclose(out);
+  else
+    fflush(out);
+
+  out = nullptr;
+}
+
+void Tracer::Drain()
+{
+  TraceRecord record;
+  char        text[128];
+
+  for (;;)
+  {
+    // Read running before emptying the buffer, records pushed before Stop are never lost
+    bool stopping = !running;
+
+    while (buffer.Pop(record))
+    {
+      Format(record, text, sizeof(text));
+      fputs(text, out);
+    }
+
+    if (stopping)
+      break;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void Tracer::Format(const TraceRecord &record, char *text, size_t size)
+{
+  const OpInfo &info = opcodeInfo[record.opcode];
+
+  u8  lo = record.operands[0];
+  u16 word = record.operands[0] | (record.operands[1] << 8);
+
+  char bytes[12];
+  char operand[16];
+
+  switch (info.bytes)
+  {
+    case 1:  snprintf(bytes, sizeof(bytes), "%02X"          , record.opcode); break;
+    case 2:  snprintf(bytes, sizeof(bytes), "%02X %02X"     , record.opcode, lo); break;
+    default: snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record.opcode, lo, record.operands[1]); break;
+  }
+
+  switch (info.mode)
+  {
+    case AddressingMode::Implied:     operand[0] = '\0'; break;
+    case AddressingMode::Accumulator: snprintf(operand, sizeof(operand), "A"); break;
+    case AddressingMode::Immediate:   snprintf(operand, sizeof(operand), "#$%02X"   , lo); break;
+    case AddressingMode::ZeroPage:    snprintf(operand, sizeof(operand), "$%02X"    , lo); break;
+    case AddressingMode::ZeroPageX:   snprintf(operand, sizeof(operand), "$%02X,X"  , lo); break;
+    case AddressingMode::ZeroPageY:   snprintf(operand, sizeof(operand), "$%02X,Y"  , lo); break;
+    case AddressingMode::Absolute:    snprintf(operand, sizeof(operand), "$%04X"    , word); break;
+    case AddressingMode::AbsoluteX:   snprintf(operand, sizeof(operand), "$%04X,X"  , word); break;
+    case AddressingMode::AbsoluteY:   snprintf(operand, sizeof(operand), "$%04X,Y"  , word); break;
+    case AddressingMode::Indirect:    snprintf(operand, sizeof(operand), "($%04X)"  , word); break;
+    case AddressingMode::IndirectX:   snprintf(operand, sizeof(operand), "($%02X,X)", lo); break;
+    case AddressingMode::IndirectY:   snprintf(operand, sizeof(operand), "($%02X),Y", lo); break;
+    case AddressingMode::Relative:    snprintf(operand, sizeof(operand), "$%04X"    , (u16)(record.PC + 2 + (s8)lo)); break;
+  }
+
+  // Unofficial opcodes are marked with a star, the way nestest.log does
+  snprintf(text, size, "%04X  %-8s %c%s %-26s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lld\n",
+           record.PC, bytes, info.official ? ' ' : '*', info.mnemonic, operand,
+           record.A, record.X, record.Y, record.P, record.SP, (long long)record.cycleCount);
+}
@@ -0,0 +1,88 @@
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "types.hpp"
+
+/* Fixed size trace record, the state before one instruction executes */
+struct TraceRecord {
+  s64 cycleCount;
+  u16 PC;
+  u8  opcode;
+  u8  operands[2]; // Only the first bytes - 1 are meaningful, see opcodeInfo
+  u8  A;
+  u8  X;
+  u8  Y;
+  u8  P;
+  u8  SP;
+  u8  padding[6];
+};
+
+/* Single producer, single consumer lock-free ring of trace records. The emulation thread
+   pushes and the formatting thread pops, the only shared state are the two indexes. */
+class TraceBuffer {
+public:
+  explicit TraceBuffer(u32 capacityLog2 = 16);
+
+  bool Push(const TraceRecord &record); // False when the ring is full
+  bool Pop (TraceRecord &record);       // False when the ring is empty
+
+private:
+  std::vector<TraceRecord> records;
+  u64                      mask;
+
+  // Each index is written by one side only, on its own cache line so they don't false share
+  alignas(64) std::atomic<u64> head; // Next record to write
+  alignas(64) std::atomic<u64> tail; // Next record to read
+};
+
+/* Formats trace records as text on a background thread, one line per instruction:
+   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7 */
+class Tracer {
+public:
+  Tracer();
+  ~Tracer();
+
+  bool Start(const std::string &file); // "-" writes to stdout
+  void Stop ();                        // Formats what is left in the buffer and closes the file
+
+  // Waits for room when the formatter falls behind, so traces are never missing records
+  void Write(const TraceRecord &record);
+
+  static void Format(const TraceRecord &record, char *text, size_t size);
+
+private:
+  TraceBuffer       buffer;
+  std::thread       thread;
+  std::atomic<bool> running;
+  FILE             *out;
+
+  void Drain();
+};
+
+inline bool TraceBuffer::Push(const TraceRecord &record)
+{
+  u64 position = head.load(std::memory_order_relaxed);
+
+  if (position - tail.load(std::memory_order_acquire) > mask)
+    return false;
+
+  records[position & mask] = record;
+  head.store(position + 1, std::memory_order_release);
+
+  return true;
+}
+
+inline void Tracer::Write(const TraceRecord &record)
+{
+  while (!buffer.Push(record))
+    std::this_thread::yield();
+}
+
+#endif //__TRACER_H__
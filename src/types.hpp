@@ -14,4 +14,12 @@ typedef int16_t  s16;
 typedef int32_t  s32;
 typedef int64_t  s64;
 
+// Hot paths (memory access, instruction handlers) are forced inline so the interpreter loops
+// become a single function
+#if defined(_MSC_VER)
+#define FORCEINLINE __forceinline
+#else
+#define FORCEINLINE inline __attribute__((always_inline))
+#endif
+
 #endif //__TYPES_H__
\ No newline at end of file